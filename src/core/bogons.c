@@ -37,6 +37,7 @@
 #include "settings.h"
 
 #include "lib/ascii.h"
+#include "lib/epoch.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
 #include "lib/host_addr.h"
@@ -56,9 +57,39 @@
 static const char bogons_file[] = "bogons.txt";
 static const char bogons_what[] = "Bogus IP addresses";
 
-static struct iprange_db *bogons_db; /**< The database of bogus CIDR ranges */
+/**
+ * The database of bogus CIDR ranges.
+ *
+ * It is never modified once published, so that it can be looked up from
+ * any thread without locking: a reload builds a new database, replacing
+ * the old one which is freed once no reader can still be using it.
+ */
+static struct iprange_db *bogons_db;
 static time_t bogons_mtime;			 /**< Modification time of loaded file */
 
+/**
+ * Free database retired from the readers.
+ */
+static void
+bogons_db_free(void *p)
+{
+	struct iprange_db *idb = p;
+
+	iprange_free(&idb);
+}
+
+/**
+ * Publish new database, retiring the old one.
+ */
+static void
+bogons_publish(struct iprange_db *idb)
+{
+	struct iprange_db *old = bogons_db;
+
+	EPOCH_PUBLISH(bogons_db, idb);
+	epoch_retire(old, bogons_db_free);
+}
+
 /**
  * Load bogons data from the supplied FILE.
  *
@@ -73,8 +104,10 @@ bogons_load(FILE *f)
 	int bits;
 	iprange_err_t error;
 	filestat_t buf;
+	struct iprange_db *idb;
+	int count;
 
-	bogons_db = iprange_new();
+	idb = iprange_new();
 	if (-1 == fstat(fileno(f), &buf)) {
 		g_warning("cannot stat %s: %m", bogons_file);
 	} else {
@@ -104,7 +137,7 @@ bogons_load(FILE *f)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(bogons_db, ip, bits, 1);
+		error = iprange_add_cidr(idb, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -118,15 +151,17 @@ bogons_load(FILE *f)
 		}
 	}
 
-	iprange_sync(bogons_db);
+	iprange_sync(idb);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u bogus IP ranges (%u hosts)",
-			iprange_get_item_count(bogons_db),
-			iprange_get_host_count4(bogons_db));
+			iprange_get_item_count(idb), iprange_get_host_count4(idb));
 	}
 
-	return iprange_get_item_count(bogons_db);
+	count = iprange_get_item_count(idb);
+	bogons_publish(idb);
+
+	return count;
 }
 
 /**
@@ -146,7 +181,6 @@ bogons_changed(const char *filename, void *unused_udata)
 	if (f == NULL)
 		return;
 
-	bogons_close();
 	count = bogons_load(f);
 	fclose(f);
 
@@ -220,7 +254,8 @@ bogons_init(void)
 void
 bogons_close(void)
 {
-	iprange_free(&bogons_db);
+	bogons_publish(NULL);
+	epoch_synchronize();
 }
 
 /**
@@ -231,6 +266,9 @@ bogons_close(void)
 bool
 bogons_check(const host_addr_t ha)
 {
+	struct iprange_db *idb;
+	bool bogus;
+
 	if G_UNLIKELY(NULL == bogons_db)
 		return FALSE;
 
@@ -244,7 +282,12 @@ bogons_check(const host_addr_t ha)
 	if (delta_time(tm_time(), bogons_mtime) > 15552000)	/* ~6 months */
 		return !host_addr_is_routable(ha);
 
-	return 0 != iprange_get_addr(bogons_db, ha);
+	epoch_enter();
+	idb = EPOCH_READ(bogons_db);
+	bogus = idb != NULL && 0 != iprange_get_addr(idb, ha);
+	epoch_leave();
+
+	return bogus;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
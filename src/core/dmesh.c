@@ -58,10 +58,12 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/halloc.h"
@@ -71,7 +73,9 @@
 #include "lib/hikset.h"
 #include "lib/htable.h"
 #include "lib/parse.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
+#include "lib/random.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
 #include "lib/strtok.h"
@@ -81,6 +85,7 @@
 #include "lib/url.h"
 #include "lib/urn.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
@@ -93,15 +98,40 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  */
 static hikset_t *mesh = NULL;
 
+/**
+ * Mesh buckets holding entries are also indexed by the time at which their
+ * oldest entry will expire, so that stale entries can be periodically
+ * expired without scanning the whole mesh.
+ */
+static erbtree_t dmesh_aging;
+static cperiodic_t *dmesh_aging_ev;
+
 struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
+	erbtree_t entries;		/**< The download mesh entries, sorted by stamp */
 	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
 	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
+	struct dmesh_alt *alts;	/**< Compact IPv4 locations requestable by hash */
+	uint alts_count;		/**< Amount of locations in ``alts'' */
+	uint alts_size;			/**< Allocated length of ``alts'' */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
+	time_t deadline;		/**< Expiration of oldest entry, 0 if not indexed */
+	rbnode_t aging;			/**< Embedded node in the aging index */
 	const sha1_t *sha1;		/**< The SHA1 of this mesh */
 };
 
+/**
+ * Compact description of an IPv4 location that can be requested by hash,
+ * which are the only ones that dmesh_fill_alternate() can return.
+ */
+struct dmesh_alt {
+	uint32 ip;				/**< IPv4 address */
+	uint16 port;			/**< Port */
+	uint8 good;				/**< Whether entry was marked as good */
+	uint8 bad;				/**< Whether entry got negative feedback */
+};
+
 struct dmesh_entry {
+	rbnode_t node;			/**< Embedded node in the bucket entries */
 	time_t inserted;		/**< When entry was inserted in mesh */
 	time_t stamp;			/**< When entry was last seen */
 	union {
@@ -119,12 +149,28 @@ struct dmesh_entry {
 
 #define MIN_BAD_REPORT	3			/**< Don't ban before that many X-Nalt */
 #define DMESH_CALLOUT	5000		/**< Callout heartbeat every 5 seconds */
+#define DMESH_AGING		60			/**< Expire stale buckets every minute */
 #define DMESH_BAN_VETO	300			/**< 5 minutes, to keep banned entry */
 #define EXPIRE_DELAY	600			/**< 10 minutes after last update */
 
 #define FW_MAX_PROXIES	4			/**< At most 4 push-proxies */
 
+#define DMESH_STORE_VERSION	1		/**< Serialization version of stored meshes */
+#define DMESH_STORE_NAMELEN	1024	/**< Max length of stored URL names */
+#define DMESH_STORE_PROXIES	32		/**< Max amount of stored push-proxies */
+#define DMESH_STORE_MAXLEN	2048	/**< Max length of stored records */
+
+/*
+ * Record types in the stored download mesh.
+ */
+#define DMESH_STORE_SHA1	'S'		/**< SHA1 of the following entries */
+#define DMESH_STORE_URL		'U'		/**< URL entry */
+#define DMESH_STORE_FW		'F'		/**< Firewalled entry */
+
+#define DMESH_BAN_F_SHA1	(1U << 0)	/**< Banned entry has a known SHA1 */
+
 static const char dmesh_file[] = "dmesh";
+static const char dmesh_store_magic[] = "GTKG-DMESH";
 static cqueue_t *dmesh_cq;			/**< Download mesh callout queue */
 
 /**
@@ -161,11 +207,14 @@ static htable_t *ban_mesh_by_sha1 = NULL;
 #define BAN_LIFETIME	7200		/**< 2 hours */
 
 static const char dmesh_ban_file[] = "dmesh_ban";
+static const char dmesh_ban_store_magic[] = "GTKG-DMESH-BAN";
 
 static void dmesh_retrieve(void);
 static void dmesh_ban_retrieve(void);
 static char *dmesh_urlinfo_to_string(const dmesh_urlinfo_t *info);
 static char *dmesh_fwinfo_to_string(const dmesh_fwinfo_t *info);
+static int dm_deadline_cmp(const void *a, const void *b);
+static bool dmesh_aging_timer(void *unused_udata);
 
 /**
  * Hash a URL info.
@@ -209,7 +258,10 @@ dmesh_init(void)
 	ban_mesh = hikset_create_any(offsetof(struct dmesh_banned, info),
 		urlinfo_hash, urlinfo_eq);
 	ban_mesh_by_sha1 = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
+	erbtree_init(&dmesh_aging, dm_deadline_cmp, offsetof(struct dmesh, aging));
 	dmesh_cq = cq_main_submake("dmesh", DMESH_CALLOUT);
+	dmesh_aging_ev = cq_periodic_add(dmesh_cq, DMESH_AGING * 1000,
+		dmesh_aging_timer, NULL);
 	dmesh_retrieve();
 	dmesh_ban_retrieve();
 }
@@ -577,6 +629,32 @@ dmesh_url_parse(const char *url, dmesh_urlinfo_t *info)
 	return TRUE;
 }
 
+/**
+ * Compare two mesh entries by stamp, for sorting the entries of a bucket.
+ */
+static int
+dm_entry_stamp_cmp(const void *a, const void *b)
+{
+	const struct dmesh_entry *ea = a, *eb = b;
+	int c;
+
+	c = CMP(ea->stamp, eb->stamp);
+	return 0 == c ? ptr_cmp(ea, eb) : c;
+}
+
+/**
+ * Compare two mesh buckets by expiration deadline, for the aging index.
+ */
+static int
+dm_deadline_cmp(const void *a, const void *b)
+{
+	const struct dmesh *da = a, *db = b;
+	int c;
+
+	c = CMP(da->deadline, db->deadline);
+	return 0 == c ? ptr_cmp(da, db) : c;
+}
+
 /**
  * Allocate a new download mesh structure (there is one per SHA1).
  */
@@ -585,9 +663,9 @@ dm_alloc(const struct sha1 *sha1)
 {
 	struct dmesh *dm;
 
-	WALLOC(dm);
-	dm->last_update = 0;
-	dm->entries = list_new();
+	WALLOC0(dm);
+	erbtree_init(&dm->entries, dm_entry_stamp_cmp,
+		offsetof(struct dmesh_entry, node));
 	dm->sha1 = atom_sha1_get(sha1);
 	dm->by_host = htable_create_any(packed_host_hash_func,
 		packed_host_hash_func2, packed_host_eq_func);
@@ -602,8 +680,11 @@ dm_alloc(const struct sha1 *sha1)
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
+	if (0 != dm->deadline)
+		erbtree_remove(&dmesh_aging, &dm->aging);
+
+	erbtree_discard(&dm->entries, cast_to_free_fn(dmesh_entry_free));
+	XFREE_NULL(dm->alts);
 
 	/*
 	 * Values in the dme->by_host table were the dmesh_entry structures
@@ -620,6 +701,92 @@ dm_free(struct dmesh *dm)
 	WFREE(dm);
 }
 
+/**
+ * Locate the compact location for addr:port in the mesh bucket.
+ *
+ * @return the compact location, NULL if not found.
+ */
+static struct dmesh_alt *
+dm_alt_find(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	uint32 ip;
+	uint i;
+
+	if (!host_addr_is_ipv4(addr))
+		return NULL;
+
+	ip = host_addr_ipv4(addr);
+
+	for (i = 0; i < dm->alts_count; i++) {
+		struct dmesh_alt *alt = &dm->alts[i];
+
+		if (alt->ip == ip && alt->port == port)
+			return alt;
+	}
+
+	return NULL;
+}
+
+/**
+ * Synchronize the compact location of a mesh entry with the entry,
+ * creating it if the entry can now be requested by hash.
+ */
+static void
+dm_alt_sync(struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	struct dmesh_alt *alt;
+
+	if (dme->fw_entry || !host_addr_is_ipv4(dme->e.url.addr))
+		return;
+
+	alt = dm_alt_find(dm, dme->e.url.addr, dme->e.url.port);
+
+	if (NULL == alt) {
+		if (dme->e.url.idx != URN_INDEX)
+			return;
+
+		if (dm->alts_count == dm->alts_size) {
+			dm->alts_size = MAX(8, 2 * dm->alts_size);
+			XREALLOC_ARRAY(dm->alts, dm->alts_size);
+		}
+
+		alt = &dm->alts[dm->alts_count++];
+		alt->ip = host_addr_ipv4(dme->e.url.addr);
+		alt->port = dme->e.url.port;
+	}
+
+	alt->good = booleanize(dme->good);
+	alt->bad = booleanize(dme->bad != NULL);
+}
+
+/**
+ * Remove the compact location of a mesh entry, if any.
+ */
+static void
+dm_alt_remove(struct dmesh *dm, const struct dmesh_entry *dme)
+{
+	struct dmesh_alt *alt;
+
+	if (dme->fw_entry)
+		return;
+
+	alt = dm_alt_find(dm, dme->e.url.addr, dme->e.url.port);
+
+	if (alt != NULL)
+		*alt = dm->alts[--dm->alts_count];	/* Order does not matter */
+}
+
+/**
+ * Change the stamp of a mesh entry, keeping the bucket entries sorted.
+ */
+static void
+dm_entry_restamp(struct dmesh *dm, struct dmesh_entry *dme, time_t stamp)
+{
+	erbtree_remove(&dm->entries, &dme->node);
+	dme->stamp = stamp;
+	erbtree_insert(&dm->entries, &dme->node);
+}
+
 /**
  * Remove specified entry from mesh bucket and reclaim it.
  */
@@ -632,7 +799,7 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 	bool found;
 
 	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(erbtree_count(&dm->entries) > 0);
 
 	if (GNET_PROPERTY(dmesh_debug) > 1) {
 		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
@@ -654,9 +821,8 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 	g_assert(found);
 	g_assert(value == (void *) dme);
 
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
-
-	g_assert(found);
+	erbtree_remove(&dm->entries, &dme->node);	/* Remove from entries... */
+	dm_alt_remove(dm, dme);
 
 	/* ...and from the proper hash table */
 
@@ -696,11 +862,11 @@ dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
 	}
 
 	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
-
-	g_assert(found);
 	g_assert(!dme->fw_entry);
 
+	erbtree_remove(&dm->entries, &dme->node);	/* Remove from entries */
+	dm_alt_remove(dm, dme);
+
 	htable_remove(dm->by_host, &packed);	/* And from hash table */
 	wfree_packed_host(deconstify_pointer(key), NULL);
 
@@ -739,27 +905,48 @@ dm_lifetime(const struct dmesh *dm)
 	return sha1_of_finished_file(dm->sha1) ? MAX_LIBLIFETIME : MAX_LIFETIME;
 }
 
+/**
+ * Update the position of the mesh bucket in the aging index, based on the
+ * expiration time of its oldest entry.
+ */
+static void
+dm_reindex(struct dmesh *dm)
+{
+	const struct dmesh_entry *oldest = erbtree_head(&dm->entries);
+	time_t deadline;
+
+	deadline = NULL == oldest ? 0 :
+		time_advance(oldest->stamp, dm_lifetime(dm));
+
+	if (deadline == dm->deadline)
+		return;
+
+	if (0 != dm->deadline)
+		erbtree_remove(&dmesh_aging, &dm->aging);
+
+	dm->deadline = deadline;
+
+	if (0 != deadline)
+		erbtree_insert(&dmesh_aging, &dm->aging);
+}
+
 /**
  * Expire entries deemed too old in a given mesh bucket `dm'.
+ *
+ * Since entries are sorted by stamp, we only need to look at the oldest ones.
  */
 static void
 dm_expire(struct dmesh *dm)
 {
-	pslist_t *expired = NULL;
-	pslist_t *sl;
+	struct dmesh_entry *dme;
 	time_t now = tm_time();
 	long agemax;
-	list_iter_t *iter;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-
+	while (NULL != (dme = erbtree_head(&dm->entries))) {
 		if (delta_time(now, dme->stamp) <= agemax)
-			continue;
+			break;
 
 		/*
 		 * Remove the entry.
@@ -776,19 +963,10 @@ dm_expire(struct dmesh *dm)
 					dmesh_urlinfo_to_string(&dme->e.url),
 				(unsigned) delta_time(now, dme->stamp));
 
-		expired = pslist_prepend(expired, dme);
-	}
-
-	list_iter_free(&iter);
-
-	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
-
 		dm_remove_entry(dm, dme);
 	}
 
-	pslist_free(expired);
-
+	dm_reindex(dm);
 	dm->last_update = tm_time();
 }
 
@@ -806,7 +984,7 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(erbtree_count(&dm->entries) == 0);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
@@ -814,6 +992,38 @@ dmesh_dispose(const struct sha1 *sha1)
 	entropy_harvest_single(PTRLEN(sha1));
 }
 
+/**
+ * Callout queue periodic event to expire the mesh buckets whose oldest entry
+ * became stale, without having to scan the whole mesh.
+ */
+static bool
+dmesh_aging_timer(void *unused_udata)
+{
+	struct dmesh *dm;
+	time_t now = tm_time();
+
+	(void) unused_udata;
+
+	while (NULL != (dm = erbtree_head(&dmesh_aging))) {
+		if (delta_time(dm->deadline, now) >= 0)
+			break;
+
+		/*
+		 * After expiration, the oldest remaining entry necessarily expires
+		 * in the future, so the bucket moves out of the way.
+		 */
+
+		dm_expire(dm);
+
+		if (0 == erbtree_count(&dm->entries)) {
+			struct sha1 sha1 = *dm->sha1;	/* Freed with bucket */
+			dmesh_dispose(&sha1);
+		}
+	}
+
+	return TRUE;		/* Keep calling */
+}
+
 /**
  * Remove entry from mesh due to a failed download attempt.
  */
@@ -847,8 +1057,10 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (erbtree_count(&dm->entries) == 0)
 		dmesh_dispose(sha1);
+	else
+		dm_reindex(dm);
 
     return TRUE;
 }
@@ -876,13 +1088,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (erbtree_count(&dm->entries) == 0) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? erbtree_count(&dm->entries) : 0;
 }
 
 /**
@@ -1016,10 +1228,11 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		if (dme->e.url.idx != idx && idx == URN_INDEX) {
 			dme->e.url.idx = idx;
 			atom_str_change(&dme->e.url.name, name);
+			dm_alt_sync(dm, dme);
 		}
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
-			dme->stamp = stamp;
+			dm_entry_restamp(dm, dme, stamp);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry reused for urn:sha1:%s at %s",
@@ -1049,21 +1262,24 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by host.
+		 * We insert new entries in the entries sorted by stamp, and record
+		 * them into the hash table indexed by host.
 		 */
 
-		list_append(dm->entries, dme);
+		erbtree_insert(&dm->entries, &dme->node);
 		dm->last_update = now;
 
 		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
+		dm_alt_sync(dm, dme);
 
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
+		if (erbtree_count(&dm->entries) == MAX_ENTRIES) {
+			struct dmesh_entry *oldest = erbtree_head(&dm->entries);
 			dm_remove_entry(dm, oldest);
 		}
 	}
 
+	dm_reindex(dm);
+
 	/*
 	 * We got a new entry that could be used for swarming if we are
 	 * downloading that file.
@@ -1143,7 +1359,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		g_assert(guid_eq(dme->e.fwh.guid, info->guid));
 
 		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
-			dme->stamp = stamp;
+			dm_entry_restamp(dm, dme, stamp);
 
 		/*
 		 * If we have new proxies, the new list supersedes the old one.
@@ -1183,21 +1399,23 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 				sha1_base32(sha1), guid_hex_str(info->guid));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by GUID.
+		 * We insert new entries in the entries sorted by stamp, and record
+		 * them into the hash table indexed by GUID.
 		 */
 
-		list_append(dm->entries, dme);
+		erbtree_insert(&dm->entries, &dme->node);
 		dm->last_update = now;
 
 		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
 
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
+		if (erbtree_count(&dm->entries) == MAX_ENTRIES) {
+			struct dmesh_entry *oldest = erbtree_head(&dm->entries);
 			dm_remove_entry(dm, oldest);
 		}
 	}
 
+	dm_reindex(dm);
+
 	/*
 	 * We got a new entry that could be used for swarming if we are
 	 * downloading that file.
@@ -1350,6 +1568,7 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 
 	if (hash_list_length(dme->bad) + 1 < MIN_BAD_REPORT) {
 		hash_list_append(dme->bad, WCOPY(&net));
+		dm_alt_sync(dm, dme);
 	} else {
 		/* Add entry to the banned mesh if not a firewalled source */
 
@@ -1357,6 +1576,11 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 			dmesh_ban_add(sha1, &dme->e.url, 0);
 
 		dm_remove_entry(dm, dme);
+
+		if (0 == erbtree_count(&dm->entries))
+			dmesh_dispose(sha1);
+		else
+			dm_reindex(dm);
 	}
 }
 
@@ -1429,10 +1653,12 @@ retry:
 
 		if (!dme->good)
 			dme->inserted = now;	/* First time flagged as good */
-		dme->stamp = now;			/* We know it's still alive */
+		dm_entry_restamp(dm, dme, now);	/* We know it's still alive */
+		dm_reindex(dm);
 	}
 
 	dme->good = good;
+	dm_alt_sync(dm, dme);
 }
 
 /**
@@ -1481,10 +1707,12 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 
 		if (!dme->good)
 			dme->inserted = now;	/* First time flagged as good */
-		dme->stamp = now;			/* We know it's still alive */
+		dm_entry_restamp(dm, dme, now);	/* We know it's still alive */
+		dm_reindex(dm);
 	}
 
 	dme->good = good;
+	dm_alt_sync(dm, dme);
 }
 
 /**
@@ -1670,109 +1898,6 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 	return rw < size ? rw : (size_t) -1;
 }
 
-/**
- * Format dmesh_entry in the provided buffer, as an URL with an appended
- * timestamp in ISO format, GMT time.
- *
- * @return length of formatted entry, -1 if the URL would be larger than
- * the buffer.
- */
-static size_t
-dmesh_entry_url_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
-{
-	size_t rw;
-	bool quoting;
-
-	g_assert(!dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the URL info first.
-	 */
-
-	rw = dmesh_urlinfo_to_string_buf(&dme->e.url, buf, size, &quoting);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * If quoting is required, we need to surround the already formatted
-	 * string into "quotes".
-	 */
-
-	if (quoting) {
-		if (rw + 2 >= size)		/* Not enough room for 2 quotes */
-			return (size_t) -1;
-
-		g_memmove(buf + 1, buf, rw);
-		buf[0] = '"';
-		buf[++rw] = '"';
-		buf[++rw] = '\0';
-	}
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			" ", timestamp_utc_to_string(dme->stamp), (void *) 0);
-
-	return rw < size ? rw : (size_t) -1;
-}
-
-/**
- * Format dmesh_entry in the provided buffer, as a firewalled location
- * with an appended timestamp in ISO format, GMT time.
- *
- * @return length of formatted entry, -1 if the entry would be larger than
- * the buffer.
- */
-static size_t
-dmesh_entry_fw_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
-{
-	size_t rw;
-
-	g_assert(dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the firewalled host info first.
-	 */
-
-	rw = dmesh_fwinfo_to_string_buf(&dme->e.fwh, buf, size);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			";", timestamp_utc_to_string(dme->stamp), (void *) 0);
-
-	return rw < size ? rw : (size_t) -1;
-}
-
-/**
- * Format the `dme' mesh entry as "URL timestamp" or as FW host info.
- *
- * @return pointer to static string.
- */
-static const char *
-dmesh_entry_to_string(const struct dmesh_entry *dme)
-{
-	static char str[1024];
-
-	if (dme->fw_entry) {
-		dmesh_entry_fw_stamp(dme, str, sizeof str);
-	} else {
-		dmesh_entry_url_stamp(dme, str, sizeof str);
-	}
-
-	return str;
-}
-
 /**
  * Fill supplied vector `hvec' whose size is `hcnt' with some alternate
  * locations for a given SHA1 key, that can be requested by hash directly.
@@ -1783,34 +1908,39 @@ int
 dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 {
 	struct dmesh *dm;
-	struct dmesh_entry *selected[MAX_ENTRIES];
-	int nselected;
-	int i;
-	int j;
 	bool complete_file;
-	list_iter_t *iter;
+	uint i, n;
+	int j;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
 	 */
 
 	dm = hikset_lookup(mesh, sha1);
-	if (dm == NULL)						/* SHA1 unknown */
+	if (dm == NULL || 0 == dm->alts_count)	/* SHA1 unknown or no location */
 		return 0;
 
 	/*
-	 * First pass: identify good entries that can be requested by hash only.
+	 * Choose at most `hcnt' good entries at random.
+	 *
+	 * The compact locations only list entries that can be requested by hash,
+	 * and their order is irrelevant, so we perform an in-place partial
+	 * shuffle, stopping as soon as we have filled the vector.
 	 */
 
-	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
+	n = dm->alts_count;
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (i = j = 0; i < n && j < hcnt; i++) {
+		struct dmesh_alt *alt, tmp;
+		host_addr_t addr;
+		uint r;
 
-		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
-			continue;
+		r = i + random_value(n - i - 1);
+		tmp = dm->alts[r];
+		dm->alts[r] = dm->alts[i];
+		dm->alts[i] = tmp;
+		alt = &dm->alts[i];
 
 		/*
 		 * When downloading (i.e. when the file is not complete), we have the
@@ -1819,48 +1949,22 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 		 */
 
 		if (complete_file) {
-			if (dme->bad)		/* Skip entries with negative feedback */
+			if (alt->bad)		/* Skip entries with negative feedback */
 				continue;
 		} else {
-			if (!dme->good)
+			if (!alt->good)
 				continue;		/* Only propagate good alt locs */
 		}
 
-		if (!host_addr_is_ipv4(dme->e.url.addr))
-			continue;
+		addr = host_addr_get_ipv4(alt->ip);
 
-		if (g2_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if (g2_cache_lookup(addr, alt->port))
 			continue;			/* Don't pollute with G2-only entries */
 
-		if (local_addr_cache_lookup(dme->e.url.addr, dme->e.url.port))
+		if (local_addr_cache_lookup(addr, alt->port))
 			continue;			/* Don't pollute with our recent addresses */
 
-		g_assert(i < MAX_ENTRIES);
-		selected[i++] = dme;
-	}
-
-	nselected = i;
-	list_iter_free(&iter);
-
-	if (nselected == 0)
-		return 0;
-
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
-
-	/*
-	 * Second pass: choose at most `hcnt' entries at random.
-	 *
-	 * We do this by randomly shuffling the whole array and then selecting
-	 * the first `hcnt' entries.
-	 */
-
-	shuffle(selected, nselected, sizeof selected[0]);
-
-	for (i = j = 0; i < nselected && j < hcnt; i++, j++) {
-		struct dmesh_entry *dme;
-
-		dme = selected[i];
-		gnet_host_set(&hvec[j], dme->e.url.addr, dme->e.url.port);
+		gnet_host_set(&hvec[j++], addr, alt->port);
 	}
 
 	return j;		/* Amount we filled in vector */
@@ -1974,7 +2078,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	rbnode_t *rn;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2140,7 +2244,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (erbtree_count(&dm->entries) == 0) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2159,11 +2263,10 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	ERBTREE_FOREACH(&dm->entries, rn) {
+		struct dmesh_entry *dme = erbtree_data(&dm->entries, rn);
 
 		if (dme->fw_entry)
 			continue;
@@ -2206,12 +2309,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= erbtree_count(&dm->entries));
 
 	/*
 	 * Second pass.
@@ -2293,10 +2395,8 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	ERBTREE_FOREACH(&dm->entries, rn) {
+		struct dmesh_entry *dme = erbtree_data(&dm->entries, rn);
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2368,8 +2468,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2949,7 +3047,7 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	rbnode_t *rn;
 	int i;
 
 	g_assert(sha1);
@@ -2961,10 +3059,13 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (
+		rn = erbtree_first(&dm->entries);
+		rn != NULL && i < count;
+		rn = erbtree_next(rn)
+	) {
+		struct dmesh_entry *dme = erbtree_data(&dm->entries, rn);
 		dmesh_urlinfo_t *from;
 
 		if (dme->fw_entry)
@@ -2976,8 +3077,6 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		buf[i++] = *from;
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3264,73 +3363,341 @@ dmesh_multiple_downloads(const struct sha1 *sha1,
 }
 
 /**
- * Store key/value pair in file.
+ * Context for storing hash table items.
+ */
+struct dmesh_store_ctx {
+	FILE *out;				/**< File where records are written */
+	pmsg_t *mb;				/**< Buffer where record is serialized */
+};
+
+/**
+ * Write the record serialized in the context buffer, prefixed by its length.
  */
 static void
-dmesh_store_kv(void *value, void *udata)
+dmesh_store_record(struct dmesh_store_ctx *ctx)
 {
-	const struct dmesh *dm = value;
-	FILE *out = udata;
-	list_iter_t *iter;
+	char len[2];
+
+	poke_be16(len, pmsg_written_size(ctx->mb));
+	fwrite(len, sizeof len, 1, ctx->out);
+	fwrite(pmsg_start(ctx->mb), pmsg_written_size(ctx->mb), 1, ctx->out);
+	pmsg_reset(ctx->mb);
+}
+
+/**
+ * Store mesh entry as a record:
+ *
+ *   URL entry:        'U', stamp, ip, port (be16), idx (ule64), [name]
+ *   firewalled entry: 'F', stamp, GUID, count (u8), count * (ip, port (be16))
+ *
+ * The name is only present when the index is not URN_INDEX, since it is
+ * otherwise the urn:sha1 of the bucket.
+ */
+static void
+dmesh_store_entry(struct dmesh_store_ctx *ctx, const struct dmesh_entry *dme)
+{
+	pmsg_t *mb = ctx->mb;
+
+	if (dme->fw_entry) {
+		const dmesh_fwinfo_t *info = &dme->e.fwh;
+		size_t n = 0;
+
+		pmsg_write_u8(mb, DMESH_STORE_FW);
+		pmsg_write_time(mb, dme->stamp);
+		pmsg_write(mb, info->guid, GUID_RAW_SIZE);
+
+		if (info->proxies != NULL)
+			n = MIN(hash_list_length(info->proxies), DMESH_STORE_PROXIES);
+
+		pmsg_write_u8(mb, n);
 
-	fprintf(out, "%s\n", sha1_base32(dm->sha1));
+		if (n != 0) {
+			hash_list_iter_t *iter = hash_list_iterator(info->proxies);
 
-	iter = list_iter_before_head(dm->entries);
+			while (hash_list_iter_has_next(iter) && n-- != 0) {
+				const gnet_host_t *host = hash_list_iter_next(iter);
 
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
-		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
+				pmsg_write_ipv4_or_ipv6_addr(mb, gnet_host_get_addr(host));
+				pmsg_write_be16(mb, gnet_host_get_port(host));
+			}
+
+			hash_list_iter_release(&iter);
+		}
+	} else {
+		const dmesh_urlinfo_t *info = &dme->e.url;
+
+		if (
+			info->idx != URN_INDEX &&
+			strlen(info->name) > DMESH_STORE_NAMELEN
+		)
+			return;		/* Cannot be persisted */
+
+		pmsg_write_u8(mb, DMESH_STORE_URL);
+		pmsg_write_time(mb, dme->stamp);
+		pmsg_write_ipv4_or_ipv6_addr(mb, info->addr);
+		pmsg_write_be16(mb, info->port);
+		pmsg_write_ule64(mb, info->idx);
+
+		if (info->idx != URN_INDEX)
+			pmsg_write_string(mb, info->name, (size_t) -1);
 	}
 
-	list_iter_free(&iter);
+	dmesh_store_record(ctx);
+}
 
-	fputs("\n", out);
+/**
+ * Store key/value pair in file.
+ *
+ * A 'S' record holding the SHA1 is followed by the records of its entries.
+ */
+static void
+dmesh_store_kv(void *value, void *udata)
+{
+	const struct dmesh *dm = value;
+	struct dmesh_store_ctx *ctx = udata;
+	rbnode_t *rn;
+
+	pmsg_write_u8(ctx->mb, DMESH_STORE_SHA1);
+	pmsg_write(ctx->mb, dm->sha1, SHA1_RAW_SIZE);
+	dmesh_store_record(ctx);
+
+	ERBTREE_FOREACH(&dm->entries, rn) {
+		dmesh_store_entry(ctx, erbtree_data(&dm->entries, rn));
+	}
 }
 
 /* XXX add dmesh_store_if_dirty() and export that only */
 
-typedef void (*header_func_t)(FILE *out);
-
 /**
  * Store hash table `hash' into `file'.
- * The file header is emitted by `header_cb'.
- * The storing callback for each item is `store_cb'.
+ * The file starts with `magic' followed by the serialization version.
+ * The storing callback for each item is `store_cb', which is given a
+ * pointer to a struct dmesh_store_ctx.
  */
 static void
 dmesh_store_hikset(const char *what, hikset_t *hash, const char *file,
-	header_func_t header_cb, data_fn_t store_cb)
+	const char *magic, data_fn_t store_cb)
 {
-	FILE *out;
+	struct dmesh_store_ctx ctx;
 	file_path_t fp;
+	uint8 version = DMESH_STORE_VERSION;
 
 	file_path_set(&fp, settings_config_dir(), file);
-	out = file_config_open_write(what, &fp);
+	ctx.out = file_config_open_write(what, &fp);
 
-	if (!out)
+	if (!ctx.out)
 		return;
 
-	header_cb(out);
-	hikset_foreach(hash, store_cb, out);
+	fwrite(magic, strlen(magic), 1, ctx.out);
+	fwrite(&version, sizeof version, 1, ctx.out);
 
-	file_config_close(out, &fp);
+	ctx.mb = pmsg_new(PMSG_P_DATA, NULL, DMESH_STORE_MAXLEN);
+	hikset_foreach(hash, store_cb, &ctx);
+	pmsg_free(ctx.mb);
+
+	file_config_close(ctx.out, &fp);
 }
 
 /**
- * Prints header to dmesh store file.
+ * Open file and check whether it starts with the given magic, followed
+ * by a supported serialization version.
+ *
+ * @param what		what is being read, for logging
+ * @param file		the name of the file in the configuration directory
+ * @param magic		the magic string starting binary files
+ * @param binary	written with whether file is in binary form
+ *
+ * @return the opened file, positionned after the magic and the version for
+ * binary files, at the start of the file otherwise, NULL if not readable.
  */
-static void
-dmesh_header_print(FILE *out)
+static FILE *
+dmesh_retrieve_open(const char *what, const char *file,
+	const char *magic, bool *binary)
 {
-	file_config_preamble(out, "Download mesh");
+	FILE *f;
+	file_path_t fp[1];
+	char buf[32];
+	size_t len = strlen(magic);
+	uint8 version;
 
-	fputs(	"#\n# Format is:\n"
-			"#   SHA1\n"
-			"#   URL1 timestamp1\n"
-			"#   URL2 timestamp2\n"
-			"#   FWALT timestamp\n"
-			"#   <blank line>\n"
-			"#\n\n",
-			out);
+	g_assert(len < sizeof buf);
+
+	file_path_set(fp, settings_config_dir(), file);
+	f = file_config_open_read(what, fp, G_N_ELEMENTS(fp));
+	if (!f)
+		return NULL;
+
+	if (1 != fread(buf, len, 1, f) || 0 != memcmp(buf, magic, len)) {
+		*binary = FALSE;
+		rewind(f);
+		return f;
+	}
+
+	if (1 != fread(&version, sizeof version, 1, f)) {
+		fclose(f);
+		return NULL;
+	}
+
+	if (version > DMESH_STORE_VERSION) {
+		g_warning("%s(): unknown %s format version %u",
+			G_STRFUNC, what, version);
+		fclose(f);
+		return NULL;
+	}
+
+	*binary = TRUE;
+	return f;
+}
+
+/**
+ * Read the next length-prefixed record from a binary file.
+ *
+ * @return the binary stream to parse the record, NULL on EOF or error.
+ */
+static bstr_t *
+dmesh_retrieve_record(FILE *f, char *buf, size_t size, const char *what)
+{
+	char len[2];
+	size_t reclen;
+
+	if (1 != fread(len, sizeof len, 1, f))
+		return NULL;
+
+	reclen = peek_be16(len);
+
+	if (0 == reclen || reclen > size || 1 != fread(buf, reclen, 1, f)) {
+		g_warning("%s(): truncated or damaged %s, stopping", G_STRFUNC, what);
+		return NULL;
+	}
+
+	return bstr_open(buf, reclen, BSTR_F_ERROR);
+}
+
+/**
+ * Parse firewalled entry record from the binary stream, after the type.
+ *
+ * @return TRUE if the entry was parsed correctly.
+ */
+static bool
+dmesh_retrieve_fw(bstr_t *bs, const struct sha1 *sha1)
+{
+	dmesh_fwinfo_t info;
+	struct guid guid;
+	time_t stamp;
+	uint8 n;
+
+	bstr_read_time(bs, &stamp);
+	bstr_read(bs, &guid, sizeof guid);
+	bstr_read_u8(bs, &n);
+
+	if (bstr_has_error(bs))
+		return FALSE;
+
+	info.guid = &guid;
+	info.proxies = NULL;
+
+	while (n-- != 0) {
+		host_addr_t addr;
+		uint16 port;
+		gnet_host_t host;
+
+		bstr_read_packed_ipv4_or_ipv6_addr(bs, &addr);
+		if (!bstr_read_be16(bs, &port))
+			break;
+
+		if (is_private_addr(addr) || !host_is_valid(addr, port))
+			continue;
+
+		if (info.proxies == NULL)
+			info.proxies = hash_list_new(gnet_host_hash, gnet_host_equal);
+
+		gnet_host_set(&host, addr, port);
+		if (!hash_list_contains(info.proxies, &host))
+			hash_list_append(info.proxies, gnet_host_dup(&host));
+	}
+
+	if (bstr_has_error(bs) || !dmesh_raw_fw_add(sha1, &info, stamp, TRUE))
+		hash_list_free_all(&info.proxies, gnet_host_free);
+
+	return !bstr_has_error(bs);
+}
+
+/**
+ * Parse URL entry record from the binary stream, after the type.
+ *
+ * @return TRUE if the entry was parsed correctly.
+ */
+static bool
+dmesh_retrieve_url(bstr_t *bs, const struct sha1 *sha1)
+{
+	dmesh_urlinfo_t info;
+	char name[DMESH_STORE_NAMELEN + 1];
+	host_addr_t addr;
+	time_t stamp;
+	uint16 port;
+	uint64 idx;
+
+	bstr_read_time(bs, &stamp);
+	bstr_read_packed_ipv4_or_ipv6_addr(bs, &addr);
+	bstr_read_be16(bs, &port);
+	bstr_read_ule64(bs, &idx);
+
+	if (bstr_has_error(bs) || idx > MAX_INT_VAL(uint32))
+		return FALSE;
+
+	if (URN_INDEX == idx) {
+		dmesh_fill_info(&info, sha1, addr, port, URN_INDEX, NULL);
+	} else {
+		size_t len;
+
+		if (!bstr_read_fixed_string(bs, &len, name, sizeof name))
+			return FALSE;
+
+		dmesh_fill_info(&info, NULL, addr, port, idx, name);
+	}
+
+	dmesh_raw_add(sha1, &info, stamp, TRUE);
+	return TRUE;
+}
+
+/**
+ * Retrieve download mesh stored in binary form.
+ */
+static G_GNUC_COLD void
+dmesh_retrieve_binary(FILE *f)
+{
+	char buf[DMESH_STORE_MAXLEN];
+	struct sha1 sha1;
+	bool has_sha1 = FALSE;
+	uint n = 0;
+	bstr_t *bs;
+
+	while (NULL != (bs = dmesh_retrieve_record(f, buf, sizeof buf, "mesh"))) {
+		uint8 type = 0;
+		bool ok = FALSE;
+
+		n++;
+		bstr_read_u8(bs, &type);
+
+		switch (type) {
+		case DMESH_STORE_SHA1:
+			ok = has_sha1 = bstr_read(bs, &sha1, sizeof sha1);
+			break;
+		case DMESH_STORE_URL:
+			ok = has_sha1 && dmesh_retrieve_url(bs, &sha1);
+			break;
+		case DMESH_STORE_FW:
+			ok = has_sha1 && dmesh_retrieve_fw(bs, &sha1);
+			break;
+		}
+
+		if (!ok && GNET_PROPERTY(dmesh_debug)) {
+			g_warning("%s(): ignoring damaged record #%u (type %u): %s",
+				G_STRFUNC, n, type, bstr_error(bs));
+		}
+
+		bstr_free(&bs);
+	}
 }
 
 /**
@@ -3341,28 +3708,20 @@ void
 dmesh_store(void)
 {
 	dmesh_store_hikset("download mesh",
-		mesh, dmesh_file, dmesh_header_print, dmesh_store_kv);
+		mesh, dmesh_file, dmesh_store_magic, dmesh_store_kv);
 }
 
 /**
- * Retrieve download mesh and add entries that have not expired yet.
- * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ * Retrieve download mesh stored in the former text format.
  */
 static G_GNUC_COLD void
-dmesh_retrieve(void)
+dmesh_retrieve_text(FILE *f)
 {
-	FILE *f;
 	char tmp[4096];
 	struct sha1 sha1;
 	bool has_sha1 = FALSE;
 	bool skip = FALSE, truncated = FALSE;
 	int line = 0;
-	file_path_t fp[1];
-
-	file_path_set(fp, settings_config_dir(), dmesh_file);
-	f = file_config_open_read("download mesh", fp, G_N_ELEMENTS(fp));
-	if (!f)
-		return;
 
 	/*
 	 * Retrieval algorithm:
@@ -3418,35 +3777,61 @@ dmesh_retrieve(void)
 				has_sha1 = TRUE;
 		}
 	}
+}
+
+/**
+ * Retrieve download mesh and add entries that have not expired yet.
+ * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ *
+ * The mesh is stored in binary form, but the former text format is still
+ * understood.
+ */
+static G_GNUC_COLD void
+dmesh_retrieve(void)
+{
+	FILE *f;
+	bool binary;
+
+	f = dmesh_retrieve_open("download mesh", dmesh_file,
+			dmesh_store_magic, &binary);
+	if (!f)
+		return;
+
+	if (binary)
+		dmesh_retrieve_binary(f);
+	else
+		dmesh_retrieve_text(f);
 
 	fclose(f);
 	dmesh_store();			/* Persist what we have retrieved */
 }
 
 /**
- * Store key/value pair in file.
+ * Store key/value pair in file, as a record:
+ *
+ *   flags (u8), created, ip, port (be16), idx (ule64), name, [SHA1]
  */
 static void
 dmesh_ban_store_kv(void *value, void *udata)
 {
 	const struct dmesh_banned *dmb = value;
-	FILE *out = udata;
+	struct dmesh_store_ctx *ctx = udata;
+	const dmesh_urlinfo_t *info = dmb->info;
 
-	fprintf(out, "%lu %s\n",
-		(ulong) dmb->created, dmesh_urlinfo_to_string(dmb->info));
-}
+	if (strlen(info->name) > DMESH_STORE_NAMELEN)
+		return;		/* Cannot be persisted */
 
-/**
- * Prints header to banned mesh store file.
- */
-static void
-dmesh_ban_header_print(FILE *out)
-{
-	file_config_preamble(out, "Banned mesh");
+	pmsg_write_u8(ctx->mb, NULL == dmb->sha1 ? 0 : DMESH_BAN_F_SHA1);
+	pmsg_write_time(ctx->mb, dmb->created);
+	pmsg_write_ipv4_or_ipv6_addr(ctx->mb, info->addr);
+	pmsg_write_be16(ctx->mb, info->port);
+	pmsg_write_ule64(ctx->mb, info->idx);
+	pmsg_write_string(ctx->mb, info->name, (size_t) -1);
 
-	fputs(	"#\n# Format is:\n"
-			"#  timestamp URL\n"
-			"#\n\n", out);
+	if (dmb->sha1 != NULL)
+		pmsg_write(ctx->mb, dmb->sha1, SHA1_RAW_SIZE);
+
+	dmesh_store_record(ctx);
 }
 
 /**
@@ -3457,30 +3842,65 @@ void
 dmesh_ban_store(void)
 {
 	dmesh_store_hikset("banned mesh",
-		ban_mesh, dmesh_ban_file, dmesh_ban_header_print, dmesh_ban_store_kv);
+		ban_mesh, dmesh_ban_file, dmesh_ban_store_magic, dmesh_ban_store_kv);
 }
 
 /**
- * Retrieve banned mesh and add entries that have not expired yet.
- * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh_ban.
+ * Retrieve banned mesh stored in binary form.
  */
 static G_GNUC_COLD void
-dmesh_ban_retrieve(void)
+dmesh_ban_retrieve_binary(FILE *in)
+{
+	char buf[DMESH_STORE_MAXLEN];
+	char name[DMESH_STORE_NAMELEN + 1];
+	uint n = 0;
+	bstr_t *bs;
+
+	while (NULL != (bs = dmesh_retrieve_record(in, buf, sizeof buf, "ban"))) {
+		dmesh_urlinfo_t info;
+		struct sha1 sha1;
+		time_t stamp;
+		uint64 idx;
+		uint8 flags;
+		size_t len;
+
+		n++;
+		bstr_read_u8(bs, &flags);
+		bstr_read_time(bs, &stamp);
+		bstr_read_packed_ipv4_or_ipv6_addr(bs, &info.addr);
+		bstr_read_be16(bs, &info.port);
+		bstr_read_ule64(bs, &idx);
+		bstr_read_fixed_string(bs, &len, name, sizeof name);
+
+		if (flags & DMESH_BAN_F_SHA1)
+			bstr_read(bs, &sha1, sizeof sha1);
+
+		if (bstr_has_error(bs) || idx > MAX_INT_VAL(uint32)) {
+			g_warning("%s(): ignoring damaged banned entry #%u: %s",
+				G_STRFUNC, n, bstr_error(bs));
+		} else {
+			info.idx = idx;
+			info.name = name;
+			dmesh_ban_add((flags & DMESH_BAN_F_SHA1) ? &sha1 : NULL,
+				&info, stamp);
+		}
+
+		bstr_free(&bs);
+	}
+}
+
+/**
+ * Retrieve banned mesh stored in the former text format.
+ */
+static G_GNUC_COLD void
+dmesh_ban_retrieve_text(FILE *in)
 {
-	FILE *in;
 	char tmp[1024];
 	unsigned line = 0;
 	time_t stamp;
 	const char *p;
 	int error;
 	dmesh_urlinfo_t info;
-	file_path_t fp;
-
-	file_path_set(&fp, settings_config_dir(), dmesh_ban_file);
-	in = file_config_open_read("banned mesh", &fp, 1);
-
-	if (!in)
-		return;
 
 	/*
 	 * Retrieval algorithm:
@@ -3513,10 +3933,30 @@ dmesh_ban_retrieve(void)
 			continue;
 		}
 
-		/* FIXME: Save SHA1 for banning */
 		dmesh_ban_add(NULL, &info, stamp);
 		atom_str_free(info.name);
 	}
+}
+
+/**
+ * Retrieve banned mesh and add entries that have not expired yet.
+ * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh_ban.
+ */
+static G_GNUC_COLD void
+dmesh_ban_retrieve(void)
+{
+	FILE *in;
+	bool binary;
+
+	in = dmesh_retrieve_open("banned mesh", dmesh_ban_file,
+			dmesh_ban_store_magic, &binary);
+	if (!in)
+		return;
+
+	if (binary)
+		dmesh_ban_retrieve_binary(in);
+	else
+		dmesh_ban_retrieve_text(in);
 
 	fclose(in);
 	dmesh_ban_store();			/* Persist what we have retrieved */
@@ -3558,6 +3998,7 @@ dmesh_close(void)
 	dmesh_store();
 	dmesh_ban_store();
 
+	cq_periodic_remove(&dmesh_aging_ev);
 	hikset_foreach(mesh, dmesh_free_kv, NULL);
 	hikset_free_null(&mesh);
 
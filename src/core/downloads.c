@@ -156,6 +156,7 @@
 #define DOWNLOAD_FS_SPACE		16384	/**< Min filesystem free space */
 #define DOWNLOAD_PUSH_FREQ		30		/**< Each 30 secs, we allow sending... */
 #define DOWNLOAD_PUSH_MAX		4		/**< ...4 PUSHes max to a server */
+#define DOWNLOAD_AIO_MAX		4		/**< Max pending async writes per file */
 
 #define IO_AVG_RATE		5		/**< Compute global recv rate every 5 secs */
 
@@ -198,6 +199,8 @@ static void download_queue_hold(struct download *d, uint32 hold,
 static void download_force_stop(struct download *d, const char * reason, ...);
 static void download_reparent(struct download *d, struct dl_server *new_server);
 static void download_silent_flush(struct download *d);
+static void download_write_request(void *data, int source,
+	inputevt_cond_t cond);
 static void change_server_addr(struct dl_server *server,
 	const host_addr_t new_addr, const uint16 new_port);
 static struct download *download_pick_another(const struct download *d);
@@ -588,15 +591,130 @@ download_pipeline_free_null(struct dl_pipeline **dp_ptr)
 	}
 }
 
+/**
+ * Free all the pipelined requests of a download.
+ */
+static void
+download_pipeline_free_all(struct download *d)
+{
+	download_check(d);
+
+	while (d->pipeline != NULL) {
+		struct dl_pipeline *dp = d->pipeline;
+
+		d->pipeline = dp->next;
+		download_pipeline_free_null(&dp);
+	}
+}
+
+/**
+ * @return the last pipelined request sent (or being sent), NULL if none.
+ */
+static struct dl_pipeline *
+download_pipeline_tail(const struct download *d)
+{
+	struct dl_pipeline *dp = d->pipeline;
+
+	if (dp != NULL) {
+		while (dp->next != NULL)
+			dp = dp->next;
+	}
+
+	return dp;
+}
+
+/**
+ * @return the pipelined request being sent, NULL if none.
+ */
+static struct dl_pipeline *
+download_pipeline_sending(const struct download *d)
+{
+	struct dl_pipeline *dp = download_pipeline_tail(d);
+
+	if (dp != NULL && GTA_DL_PIPE_SENDING == dp->status)
+		return dp;
+
+	return NULL;
+}
+
+/**
+ * Append a new pipelined request to the download.
+ *
+ * @return the new request, in the GTA_DL_PIPE_SELECTED state.
+ */
+static struct dl_pipeline *
+download_pipeline_append(struct download *d)
+{
+	struct dl_pipeline *dp, *tail;
+
+	download_check(d);
+
+	dp = download_pipeline_alloc();
+	tail = download_pipeline_tail(d);
+
+	if (NULL == tail) {
+		d->pipeline = dp;
+	} else {
+		g_assert(GTA_DL_PIPE_SENT == tail->status);
+		tail->next = dp;
+	}
+
+	return dp;
+}
+
+/**
+ * Remove the last pipelined request of the download, which was never sent.
+ */
+static void
+download_pipeline_drop_tail(struct download *d)
+{
+	struct dl_pipeline **dp_ptr;
+
+	download_check(d);
+	g_assert(d->pipeline != NULL);
+
+	for (dp_ptr = &d->pipeline; (*dp_ptr)->next != NULL; /* empty */)
+		dp_ptr = &(*dp_ptr)->next;
+
+	g_assert(GTA_DL_PIPE_SELECTED == (*dp_ptr)->status);
+
+	download_pipeline_free_null(dp_ptr);
+}
+
+/**
+ * @return the amount of pipelined requests for the download.
+ */
+unsigned
+download_pipeline_depth(const struct download *d)
+{
+	const struct dl_pipeline *dp;
+	unsigned n = 0;
+
+	download_check(d);
+
+	for (dp = d->pipeline; dp != NULL; dp = dp->next)
+		n++;
+
+	return n;
+}
+
 /**
  * Can we issue a pipelined request for a given download?
+ *
+ * The first pipelined request is issued when we are close to the end of the
+ * current one.  Further requests are issued only when the data already
+ * requested would be fully received before the server can see a new
+ * request, i.e. when it takes less than the measured round-trip time
+ * to receive it at the measured source throughput.  The pipelining depth
+ * therefore adapts to each source, within the configured maximum.
  */
 static bool
 download_pipeline_can_initiate(const struct download *d)
 {
 	fileinfo_t *fi;
-	unsigned avg_bps, s;
-	unsigned threshold;
+	const struct dl_pipeline *dp;
+	unsigned avg_bps, depth = 0, max_depth;
+	unsigned latency, threshold;
 	filesize_t downloaded, remain;
 
 	download_check(d);
@@ -606,8 +724,22 @@ download_pipeline_can_initiate(const struct download *d)
 	fi = d->file_info;
 	file_info_check(fi);
 
-	if (download_pipelining(d))
-		return FALSE;				/* Only one pipelined request at a time */
+	for (dp = d->pipeline; dp != NULL; dp = dp->next) {
+		if (dp->status != GTA_DL_PIPE_SENT)
+			return FALSE;			/* Previous request not fully sent */
+		depth++;
+	}
+
+	/*
+	 * Until the server has proven it can handle a pipelined request, do not
+	 * send it more than one at a time.
+	 */
+
+	max_depth = (d->server->attrs & DLS_A_PIPELINING) ?
+		GNET_PROPERTY(dl_pipeline_depth) : 1;
+
+	if (depth >= max_depth)
+		return FALSE;
 
 	if (!fi->file_size_known)
 		return FALSE;				/* Must know upper boundary */
@@ -668,19 +800,22 @@ download_pipeline_can_initiate(const struct download *d)
 		remain = d->chunk.size + d->chunk.overlap;
 	}
 
+	for (dp = d->pipeline; dp != NULL; dp = dp->next) {
+		remain += dp->chunk.size + dp->chunk.overlap;
+	}
+
 	avg_bps = download_speed_avg(d);
-	s = remain / (avg_bps ? avg_bps : 1);
 
 	g_assert(dl_server_valid(d->server));
 
-	threshold = MAX(DOWNLOAD_PIPELINE_MSECS, GNET_PROPERTY(dl_http_latency));
-	threshold = MAX(threshold, d->server->latency);
+	latency = MAX(GNET_PROPERTY(dl_http_latency), d->server->latency);
+	threshold = 0 == depth ? MAX(DOWNLOAD_PIPELINE_MSECS, latency) : latency;
 
-	return uint_saturate_mult(s, 1000) <= threshold;
+	return remain * 1000 / MAX(avg_bps, 1) <= threshold;
 }
 
 /**
- * Take ownership of pipelined chunk after cloning.
+ * Take ownership of pipelined chunks after cloning.
  */
 static void
 download_pipeline_update_chunk(const struct download *d)
@@ -688,17 +823,19 @@ download_pipeline_update_chunk(const struct download *d)
 	struct dl_pipeline *dp;
 
 	download_check(d);
-	dp = d->pipeline;
-	dl_pipeline_check(dp);
-	g_assert(dp->status != GTA_DL_PIPE_SELECTED);
 
-	/*
-	 * With aggressive swarming, the pipelined chunk could be completed,
-	 * in which case we shall ignore data later on when detecting we're
-	 * bumping into a DONE chunk.
-	 */
+	for (dp = d->pipeline; dp != NULL; dp = dp->next) {
+		dl_pipeline_check(dp);
+		g_assert(dp->status != GTA_DL_PIPE_SELECTED);
 
-	file_info_new_chunk_owner(d, dp->chunk.start, dp->chunk.end);
+		/*
+		 * With aggressive swarming, the pipelined chunk could be completed,
+		 * in which case we shall ignore data later on when detecting we're
+		 * bumping into a DONE chunk.
+		 */
+
+		file_info_new_chunk_owner(d, dp->chunk.start, dp->chunk.end);
+	}
 }
 
 /**
@@ -3944,6 +4081,18 @@ download_clone(struct download *d)
 		d->bio = NULL;		/* I/O source kept as well */
 		d->out_file = NULL;	/* Keep file opened when pipelining */
 		rx_change_owner(cd->rx, cd);
+
+		/*
+		 * If a later pipelined request is still being flushed, the I/O
+		 * callback must now be invoked on the cloned download.
+		 */
+
+		if (download_pipeline_sending(cd) != NULL) {
+			g_assert(s != NULL);
+			socket_evt_clear(s);
+			socket_evt_set(s, INPUT_EVENT_WX, download_write_request, cd);
+		}
+
 		switch (cd->pipeline->status) {
 		case GTA_DL_PIPE_SENDING:
 			download_set_status(cd, GTA_DL_REQ_SENDING);
@@ -4761,7 +4910,7 @@ download_stop_v(struct download *d, download_status_t new_status,
 	}
 
 	file_info_clear_download(d, FALSE);
-	download_pipeline_free_null(&d->pipeline);
+	download_pipeline_free_all(d);
 	file_info_changed(d->file_info);
 	d->flags &= ~(DL_F_CHUNK_CHOSEN | DL_F_SWITCHED | DL_F_REPLIED |
 		DL_F_FROM_PLAIN | DL_F_FROM_ERROR | DL_F_NO_PIPELINE);
@@ -5288,7 +5437,7 @@ download_info_reget(struct download *d)
 		return;
 
 	file_info_clear_download(d, TRUE);			/* `d' might be running */
-	download_pipeline_free_null(&d->pipeline);
+	download_pipeline_free_all(d);
 	file_size_known = fi->file_size_known;		/* This should not change */
 
 	if (d->file_info->sha1 != NULL)
@@ -9168,6 +9317,136 @@ out:
 	return success;
 }
 
+/**
+ * Handle disk write errors, freezing the download queue if the error is
+ * one that will not go away by itself.
+ */
+static void
+download_write_error(int error)
+{
+	switch (error) {
+	case ENOSPC:	/* No space left */
+		queue_frozen_on_write_error = TRUE;
+		/* FALL THROUGH */
+	case EDQUOT:	/* quota exceeded */
+	case EROFS:		/* read-only filesystem */
+	case EIO:		/* I/O error */
+		if (!download_queue_is_frozen()) {
+			download_freeze_queue();
+			g_warning("freezing download queue due to write error: %s",
+				g_strerror(error));
+		}
+		break;
+	}
+}
+
+/**
+ * An asynchronous write of download data.
+ *
+ * The range is accounted as done in the fileinfo as soon as the write is
+ * issued, and it is marked as empty again should the write fail.  Since the
+ * download can be gone by the time the write completes, we only keep the
+ * identity of the fileinfo.
+ */
+struct download_write {
+	const struct guid *fi_guid;		/**< GUID of the fileinfo (atom) */
+	slist_t *list;					/**< The data buffers being written */
+	filesize_t from;				/**< First byte being written */
+	filesize_t to;					/**< First byte not written */
+};
+
+/**
+ * Completion callback for asynchronous writes of download data.
+ */
+static void
+download_write_done(ssize_t written, int error, void *arg)
+{
+	struct download_write *dw = arg;
+	filesize_t size = dw->to - dw->from;
+
+	if G_UNLIKELY((ssize_t) -1 == written || (filesize_t) written != size) {
+		fileinfo_t *fi = file_info_by_guid(dw->fi_guid);
+		filesize_t done = MAX(0, written);
+
+		if ((ssize_t) -1 == written) {
+			download_write_error(error);
+			g_warning("write of %s bytes to file \"%s\" failed: %s",
+				filesize_to_string(size),
+				NULL == fi ? "<gone>" : filepath_basename(fi->pathname),
+				g_strerror(error));
+		} else {
+			g_warning("partial write (written=%s, expected=%s) to file \"%s\"",
+				filesize_to_string(done), filesize_to_string2(size),
+				NULL == fi ? "<gone>" : filepath_basename(fi->pathname));
+		}
+
+		/*
+		 * Since the range was already accounted as done, we need to flag the
+		 * part that did not make it to the disk as empty again, so that it
+		 * can be downloaded anew.  If the file is now complete, it will fail
+		 * the SHA1 verification and the bad parts will be fetched again.
+		 */
+
+		if (fi != NULL && !FILE_INFO_COMPLETE(fi))
+			file_info_unwritten(fi, dw->from + done, dw->to);
+	}
+
+	atom_guid_free_null(&dw->fi_guid);
+	pmsg_slist_free_all(&dw->list);
+	WFREE(dw);
+}
+
+/**
+ * Flush buffered data to disk asynchronously.
+ *
+ * The buffers are handed over to the disk writer and replaced with fresh
+ * ones, so that reception can proceed whilst the data are written.
+ *
+ * @param d			the download to flush
+ */
+static void
+download_flush_async(struct download *d)
+{
+	struct dl_buffers *b;
+	struct download_write *dw;
+	iovec_t *iov;
+	fileinfo_t *fi;
+	int n;
+
+	download_check(d);
+	b = d->buffers;
+	fi = d->file_info;
+
+	buffers_check_held(d);
+
+	iov = buffers_to_iovec(d, &n);
+
+	WALLOC(dw);
+	dw->fi_guid = atom_guid_get(fi->guid);
+	dw->list = b->list;
+	dw->from = d->pos;
+	dw->to = d->pos + b->held;
+
+	file_object_pwritev_async(d->out_file, iov, n, d->pos,
+		download_write_done, dw);
+	HFREE_NULL(iov);
+
+	file_info_update(d, dw->from, dw->to, DL_CHUNK_DONE);
+	gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+		GNET_PROPERTY(dl_byte_count) + b->held);
+
+	d->pos = dw->to;
+
+	if (fi->buffered >= b->held)
+		fi->buffered -= b->held;
+	else
+		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
+
+	b->list = slist_new();
+	b->held = 0;
+	b->mode = DL_BUF_READING;
+}
+
 /**
  * Flush buffered data to disk.
  *
@@ -9238,6 +9517,20 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 
 	entropy_harvest_small(VARLEN(d), VARLEN(old_held), VARLEN(old_pos), NULL);
 
+	/*
+	 * Unless we are stopping, or the disk is not keeping up with the
+	 * incoming data, let the disk writer handle the buffers: we do not
+	 * need to wait for the data to reach the disk before receiving more.
+	 */
+
+	if (
+		may_stop &&
+		file_object_aio_pending(d->out_file) < DOWNLOAD_AIO_MAX
+	) {
+		download_flush_async(d);
+		return TRUE;
+	}
+
 	do {
 		iovec_t *iov;
 		ssize_t ret;
@@ -9278,21 +9571,10 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 
 	if ((ssize_t) -1 == written) {
 		const char *error;
+		int saved_errno = errno;
 
-		switch (errno) {
-		case ENOSPC:	/* No space left */
-			queue_frozen_on_write_error = TRUE;
-			/* FALL THROUGH */
-		case EDQUOT:	/* quota exceeded */
-		case EROFS:		/* read-only filesystem */
-		case EIO:		/* I/O error */
-			if (!download_queue_is_frozen()) {
-				download_freeze_queue();
-				g_warning("freezing download queue due to write error: %m");
-			}
-			break;
-		}
-	
+		download_write_error(saved_errno);
+		errno = saved_errno;
 	   	error = g_strerror(errno);
 		g_warning("write of %lu bytes to file \"%s\" failed: %m",
 			(ulong) b->held, download_basename(d));
@@ -12951,14 +13233,28 @@ download_request_sent(struct download *d)
 	tm_now(&d->header_sent);
 
 	if (download_pipelining(d)) {
-		g_assert(DOWNLOAD_IS_ACTIVE(d));
-		dl_pipeline_check(d->pipeline);
-		d->pipeline->status = GTA_DL_PIPE_SENT;
-		return;		/* We're still processing reception of previous request */
-	} else {
-		download_set_status(d, GTA_DL_REQ_SENT);
+		struct dl_pipeline *dp = download_pipeline_sending(d);
+
+		if (dp != NULL) {
+			dp->status = GTA_DL_PIPE_SENT;
+
+			if (GTA_DL_REQ_SENDING != d->status) {
+				g_assert(DOWNLOAD_IS_ACTIVE(d));
+				return;		/* Still processing reception of previous request */
+			}
+
+			/*
+			 * We were waiting for this request to be flushed before
+			 * parsing the reply to an earlier pipelined request: resume
+			 * reception, which was suspended meanwhile.
+			 */
+
+			rx_enable(d->rx);
+		}
 	}
 
+	download_set_status(d, GTA_DL_REQ_SENT);
+
 	/*
 	 * Now prepare to read the status line and the headers.
 	 * XXX separate this to swallow 100 continuations?
@@ -12980,6 +13276,7 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 {
 	struct download *d = data;
 	struct gnutella_socket *s;
+	struct dl_pipeline *dp;
 	http_buffer_t *r;
 	ssize_t sent;
 	int rw;
@@ -12989,12 +13286,13 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 	download_check(d);
 
 	s = d->socket;
-	r = download_pipelining(d) ? d->pipeline->req : d->req;
+	dp = download_pipeline_sending(d);
+	r = dp != NULL ? dp->req : d->req;
 
 	g_assert(s->gdk_tag);		/* I/O callback still registered */
 	http_buffer_check(r);
-	g_assert(d->pipeline != NULL || GTA_DL_REQ_SENDING == d->status);
-	g_assert(NULL == d->pipeline || GTA_DL_PIPE_SENDING == d->pipeline->status);
+	g_assert(dp != NULL || GTA_DL_REQ_SENDING == d->status);
+	g_assert(dp != NULL || !download_pipelining(d));
 
 	if (cond & INPUT_EVENT_EXCEPTION) {
 		const char *msg = _("Could not send whole HTTP request");
@@ -13040,7 +13338,7 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 		return;
 	} else if (GNET_PROPERTY(download_trace) & SOCK_TRACE_OUT) {
 		g_debug("----Sent Request (%s%s) completely to %s (%u bytes):",
-			download_pipelining(d) ? "pipelined " : "",
+			dp != NULL ? "pipelined " : "",
 			d->keep_alive ? "follow-up" : "initial",
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			http_buffer_length(r));
@@ -13053,7 +13351,7 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 
 	if (GNET_PROPERTY(download_debug)) {
 		g_debug("flushed partially written %sHTTP request to %s (%u bytes)",
-			download_pipelining(d) ? "pipelined " : "",
+			dp != NULL ? "pipelined " : "",
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			http_buffer_length(r));
     }
@@ -13061,8 +13359,8 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 	socket_evt_clear(s);
 
 	http_buffer_free(r);
-	if (download_pipelining(d)) {
-		d->pipeline->req = NULL;
+	if (dp != NULL) {
+		dp->req = NULL;
 	} else {
 		d->req = NULL;
 	}
@@ -13089,6 +13387,7 @@ download_send_request(struct download *d)
 	ssize_t sent;
 	size_t maxsize = sizeof request_buf - 3;
 	struct dl_chunk *req = NULL;
+	struct dl_pipeline *sending = NULL;
 
 	download_check(d);
 
@@ -13122,24 +13421,38 @@ download_send_request(struct download *d)
 	 *
 	 * The second time we're called with a pipelined request we have to
 	 * populate the download structure with the HTTP request information.
+	 *
+	 * When several requests are pipelined, only the last one can be new.
+	 * Otherwise, we process the oldest one, whose reply comes next, and the
+	 * others remain pipelined.
 	 */
 
 	if (download_pipelining(d)) {
-		struct dl_pipeline *dp = d->pipeline;
+		struct dl_pipeline *dp = download_pipeline_tail(d);
 		dl_pipeline_status_t status;
 
 		dl_pipeline_check(dp);
 
-		status = dp->status;
-
-		switch (status) {
-		case GTA_DL_PIPE_SELECTED:	/* Sending new pipelined request */
+		if (GTA_DL_PIPE_SELECTED == dp->status) {
+			/* Sending new pipelined request */
+			sending = dp;
 			req = &dp->chunk;
 			d->flags |= DL_F_PIPELINED;	/* Suppress HTTP latency computation */
 			goto picked;
+		}
+
+		dp = d->pipeline;
+		dl_pipeline_check(dp);
+
+		status = dp->status;
+
+		switch (status) {
+		case GTA_DL_PIPE_SELECTED:
+			break;
 		case GTA_DL_PIPE_SENDING:	/* Partially sent already */
 			g_assert(dp->req != NULL);	/* Buffered request to flush */
 			g_assert(NULL == d->req);	/* Was processing previous request */
+			g_assert(NULL == dp->next);	/* Last pipelined request */
 			g_assert(s->gdk_tag != 0);	/* Event: download_write_request() */
 			/* FALL THROUGH */
 		case GTA_DL_PIPE_SENT:		/* Fully sent already */
@@ -13170,16 +13483,29 @@ download_send_request(struct download *d)
 			 * the remote server after it completed the sending of the previous
 			 * chunk.
 			 *
-			 * A NULL pipeline structure will signal download_request_sent()
-			 * that it can parse the HTTP reply.
+			 * Once no pipelined request remains being sent, the reply can
+			 * be parsed by download_request_sent().
 			 */
 
 			download_pipeline_read(d);
-			download_pipeline_free_null(&d->pipeline);
+			d->pipeline = dp->next;
+			download_pipeline_free_null(&dp);
 			if (GTA_DL_PIPE_SENDING == status)
 				return;
-			else
-				goto fully_sent;
+
+			/*
+			 * If a later pipelined request is still being sent, we cannot
+			 * parse the reply before it is flushed since the socket I/O
+			 * callback is busy.  Suspend reception meanwhile so that the
+			 * reply remains in the socket until we are ready to read it.
+			 */
+
+			if (download_pipeline_sending(d) != NULL) {
+				rx_disable(d->rx);
+				download_set_status(d, GTA_DL_REQ_SENDING);
+				return;
+			}
+			goto fully_sent;
 		}
 
 		g_error("%s(): impossible state %d of HTTP pipelined "
@@ -13272,9 +13598,9 @@ picked:
 
 	d->last_update = tm_time();
 
-	if (download_pipelining(d)) {
+	if (sending != NULL) {
 		g_assert(DOWNLOAD_IS_ACTIVE(d));
-		d->pipeline->status = GTA_DL_PIPE_SENDING;
+		sending->status = GTA_DL_PIPE_SENDING;
 		fi_src_status_changed(d);
 	} else {
 		download_set_status(d, GTA_DL_REQ_SENDING);
@@ -13608,9 +13934,9 @@ picked:
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			(uint) sent, (uint) rw);
 
-		if (download_pipelining(d)) {
-			g_assert(NULL == d->pipeline->req);
-			d->pipeline->req = http_buffer_alloc(request_buf, rw, sent);
+		if (sending != NULL) {
+			g_assert(NULL == sending->req);
+			sending->req = http_buffer_alloc(request_buf, rw, sent);
 		} else {
 			g_assert(NULL == d->req);
 			d->req = http_buffer_alloc(request_buf, rw, sent);
@@ -15543,6 +15869,29 @@ download_tigertree_sweep(struct download *d,
 	HFREE_NULL(nodes);
 }
 
+/**
+ * Called when the TTH of the completed download is known to be good.
+ */
+static void
+download_verify_tigertree_good(struct download *d)
+{
+	download_set_status(d, GTA_DL_VERIFIED);
+
+	if (!has_good_sha1(d)) {
+		/*
+		 * FIXME:
+		 * This is far from perfect: if we come here, the SHA1 checking
+		 * was a mismatch, yet the TTH was good. We ought to flag this
+		 * bitprint (combination of SHA1 and TTH) as invalid before retrying.
+		 * But currently, what we do is move the download to the "bad" dir
+		 * and we leave it there, stopping the download.
+		 *		--RAM, 2007-08-25
+		 */
+		fi_mark_bad_bitprint(d->file_info);
+	}
+	download_verifying_done(d);
+}
+
 /**
  * Called when download verification is finished and digest is known.
  */
@@ -15568,8 +15917,6 @@ download_verify_tigertree_done(struct download *d,
 	if (tth_eq(tth, fi->tth)) {
 		g_message("TTH matches (file=\"%s\")", download_basename(d));
 
-		download_set_status(d, GTA_DL_VERIFIED);
-
 		if (
 			GNET_PROPERTY(tigertree_debug) > 1 &&
 			fi->tigertree.num_leaves > 0
@@ -15578,19 +15925,7 @@ download_verify_tigertree_done(struct download *d,
 			download_tigertree_sweep(d, leaves, num_leaves); 
 		}
 
-		if (!has_good_sha1(d)) {
-			/*
-			 * FIXME:
-			 * This is far from perfect: if we come here, the SHA1 checking
-			 * was a mismatch, yet the TTH was good. We ought to flag this
-			 * bitprint (combination of SHA1 and TTH) as invalid before retrying.
-			 * But currently, what we do is move the download to the "bad" dir
-			 * and we leave it there, stopping the download.
-			 *		--RAM, 2007-08-25
-			 */
-			fi_mark_bad_bitprint(fi);
-		}
-		download_verifying_done(d);
+		download_verify_tigertree_good(d);
 	} else {
 		download_set_status(d, GTA_DL_COMPLETED);
 
@@ -15685,6 +16020,21 @@ download_verify_tigertree(struct download *d)
 
 	entropy_harvest_single(VARLEN(d));
 
+	/*
+	 * When all the slices were verified against the tigertree whilst they
+	 * were downloaded, there is no need to hash the whole file again.
+	 */
+
+	if (file_info_tigertree_verified(fi)) {
+		g_message("TTH matches (file=\"%s\"): all %zu slices verified",
+			download_basename(d), fi->tigertree.num_leaves);
+
+		fi->tth_check = TRUE;
+		fi->vrfy_hashed = fi->size;
+		download_verify_tigertree_good(d);
+		return;
+	}
+
 	/*
 	 * Even if download was aborted or in error, we have a complete file
 	 * anyway, so start verifying its TTH.
@@ -15870,6 +16220,8 @@ download_close(void)
 {
 	gcu_download_gui_updates_freeze();
 
+	file_object_aio_sync_all();	/* Wait for pending writes to complete */
+
 	download_store();			/* Save latest copy */
 	download_freeze_queue();
 	file_info_store();			/* Must do BEFORE we remove downloads */
@@ -16202,6 +16554,7 @@ download_thex_done(struct download *d)
 		goto finish;
 	}
 	file_info_got_tigertree(fi, leaves, num_leaves, TRUE);
+	file_info_tigertree_verify(fi);		/* Check what we already have */
 	cancel_all = TRUE;
 
 finish:
@@ -16862,14 +17215,16 @@ download_timer(time_t now)
 				GNET_PROPERTY(enable_http_pipelining) &&
 				download_pipeline_can_initiate(d)
 			) {
-				g_assert(!download_pipelining(d));
+				struct dl_pipeline *dp;
+				bool picked = TRUE;
+
 				g_assert(DOWNLOAD_IS_ACTIVE(d));
 
-				d->pipeline = download_pipeline_alloc();
+				dp = download_pipeline_append(d);
 
 				if (
 					NULL == d->ranges ||
-					!download_pick_available(d, &d->pipeline->chunk)
+					!download_pick_available(d, &dp->chunk)
 				) {
 					/*
 					 * File info code may determine that a download file is
@@ -16889,14 +17244,15 @@ download_timer(time_t now)
 					 * we'll get an updated range list from the server.
 					 */
 
-					if (!download_pick_chunk(d, &d->pipeline->chunk, FALSE)) {
+					if (!download_pick_chunk(d, &dp->chunk, FALSE)) {
 						d->flags |= DL_F_NO_PIPELINE;
-						download_pipeline_free_null(&d->pipeline);
+						download_pipeline_drop_tail(d);
+						picked = FALSE;
 					}
 				}
 
 				if (DOWNLOAD_IS_ACTIVE(d)) {
-					if (download_pipelining(d)) {
+					if (picked) {
 						download_send_request(d);
 					}
 				} else {
@@ -16905,7 +17261,8 @@ download_timer(time_t now)
 				}
 
 				g_assert(!download_pipelining(d) ||
-					d->pipeline->status != GTA_DL_PIPE_SELECTED);
+					download_pipeline_tail(d)->status !=
+						GTA_DL_PIPE_SELECTED);
 			}
 
 			/* FALL THROUGH */
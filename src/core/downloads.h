@@ -133,6 +133,7 @@ void download_maybe_finished(struct download *d);
 
 bool download_handle_http(const char *url);
 bool download_is_stalled(const struct download *);
+unsigned download_pipeline_depth(const struct download *d);
 bool download_is_alive(const struct download *);
 bool download_is_active(const struct download *);
 bool download_is_completed_filename(const char *name);
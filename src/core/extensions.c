@@ -39,6 +39,7 @@
 #include "extensions.h"
 #include "ggep.h"
 
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/halloc.h"
@@ -566,7 +567,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 * OK, at this point we have validated the GGEP header.
 		 */
 
-		WALLOC(d);
+		ARENA_WALLOC(d);
 
 		d->ext_phys_payload = p;
 		d->ext_phys_paylen = data_length;
@@ -628,7 +629,7 @@ abort:
 
 	while (count--) {
 		exv--;
-		wfree(exv->opaque, sizeof(extdesc_t));
+		arena_wfree(exv->opaque, sizeof(extdesc_t));
 		exv->opaque = NULL;
 	}
 
@@ -655,7 +656,7 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	ARENA_WALLOC(d);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -782,7 +783,7 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 found:
 	g_assert(payload_start);
 
-	WALLOC(d);
+	ARENA_WALLOC(d);
 
 	d->ext_phys_payload = payload_start;
 	d->ext_phys_paylen = data_length;
@@ -831,7 +832,7 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * We don't analyze the XML, encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	ARENA_WALLOC(d);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -911,7 +912,7 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	ARENA_WALLOC(d);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -970,7 +971,7 @@ ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	ARENA_WALLOC(d);
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -1044,7 +1045,7 @@ ext_merge_adjacent(extvec_t *exv, extvec_t *next)
 	g_assert(
 		nd->ext_payload == NULL || nd->ext_payload == nd->ext_phys_payload);
 
-	WFREE(nd);
+	ARENA_WFREE(nd);
 	next->opaque = NULL;
 }
 
@@ -2229,7 +2230,7 @@ ext_reset(extvec_t *exv, int exvcnt)
 			d->ext_payload = NULL;
 		}
 
-		WFREE(d);
+		ARENA_WFREE(d);
 		e->opaque = NULL;
 	}
 }
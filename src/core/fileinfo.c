@@ -61,15 +61,18 @@
 #include "share.h"
 #include "sockets.h"
 #include "uploads.h"
+#include "verify_tth.h"
 
 #include "lib/array_util.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/chtable.h"
 #include "lib/concat.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
@@ -87,7 +90,6 @@
 #include "lib/path.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
-#include "lib/rbtree.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/tigertree.h"
@@ -107,6 +109,8 @@
 #include "lib/override.h"			/* Must be the last header included */
 
 #define FI_MIN_CHUNK_SPLIT	512		/**< Smallest chunk we can split */
+#define FI_CHUNK_RTT_FACTOR	8		/**< Request lasts at least that many RTTs */
+#define FI_CHUNK_ENDGAME	4		/**< Duration divisor during endgame */
 /**< Max field length we accept to save */
 #define FI_MAX_FIELD_LEN	(TTH_RAW_SIZE * TTH_MAX_LEAVES)
 #define FI_DHT_PERIOD		1200		/**< Requery period for DHT: 20 min */
@@ -130,7 +134,8 @@ enum dl_file_chunk_magic { DL_FILE_CHUNK_MAGIC = 0x563b483d };
  *
  * These are linked to form the chunklist, the list of all the chunks defined
  * for the file and which are either completed, reserved, or empty (not yet
- * downloaded).
+ * downloaded).  They are also indexed by range in the chunktree, to quickly
+ * locate the chunk holding a given offset.
  */
 struct dl_file_chunk {
 	enum dl_file_chunk_magic magic;
@@ -139,6 +144,7 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded red-black node */
 };
 
 static inline void
@@ -155,13 +161,16 @@ enum dl_avail_chunk_magic { DL_AVAIL_CHUNK_MAGIC = 0x3e69cf33 };
  *
  * For each chunk of the file, we compute the amount of sources that can
  * serve the chunk, allowing us to pick the rarest chunk when downloading.
+ * The map is updated incrementally as sources come and go or advertise
+ * new ranges, and is indexed both by range and by rarity.
  */
 struct dl_avail_chunk {
 	enum dl_avail_chunk_magic magic;
 	filesize_t from;				/**< Range offset start (byte included) */
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	size_t sources;					/**< Amount of sources offering chunk */
-	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node, ordered by range */
+	rbnode_t rnode;					/**< Embedded node, rarest first */
 };
 
 static inline void
@@ -199,7 +208,7 @@ dl_avail_chunk_check(const struct dl_avail_chunk * const ac)
  */
 
 static hikset_t *fi_by_sha1;
-static htable_t *fi_by_namesize;
+static chtable_t *fi_by_namesize;
 static hikset_t *fi_by_outname;
 static hikset_t *fi_by_guid;
 
@@ -211,6 +220,7 @@ static bool can_publish_partial_sha1;
 
 #define	FILE_INFO_MAGIC32 0xD1BB1ED0U
 #define	FILE_INFO_MAGIC64 0X91E63640U
+#define	FILE_INFO_MAGICJ  0X6A91E9D5U	/**< Journal appended to trailer */
 
 typedef uint32 fi_magic_t;
 
@@ -233,6 +243,10 @@ enum dl_file_info_field {
 
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
+#define FI_TAIL_LEN			(FI_TRAILER_INT * sizeof(uint32))
+#define FI_JOURNAL_RECLEN	(7 * sizeof(uint32))	/**< Journaled CHUNK field */
+#define FI_JOURNAL_MIN		1024	/**< Journal always allowed up to that size */
+#define FI_JOURNAL_MAX		64		/**< Max pending chunk changes */
 
 /**
  * The swarming trailer is built within a memory buffer first, to avoid having
@@ -510,11 +524,17 @@ struct trailer {
 	uint32 length;			/**< Total trailer length */
 	uint32 checksum;		/**< Trailer checksum */
 	fi_magic_t magic;		/**< Magic number */
+	uint32 journal;			/**< Length of appended journal, 0 if none */
+	uint32 jgeneration;		/**< Generation number at end of journal */
+	uint32 jchecksum;		/**< Journal checksum */
 };
 
 static fileinfo_t *file_info_retrieve_binary(const char *pathname);
 static void fi_free(fileinfo_t *fi);
 static void fi_update_seen_on_network(gnet_src_t srcid);
+static void fi_avail_update_source(fileinfo_t *fi, download_t *d);
+static void fi_avail_remove_source(fileinfo_t *fi, download_t *d);
+static void fi_avail_rebuild(fileinfo_t *fi);
 static const char *file_info_new_outname(const char *dir, const char *name);
 static bool looks_like_urn(const char *filename);
 
@@ -578,9 +598,11 @@ trailer_is_64bit(const struct trailer *tb)
 }
 
 /**
- * Write trailer buffer at current position on `fd', whose name is `name'.
+ * Write trailer buffer at given offset in file object `fo'.
+ *
+ * @return TRUE if the whole buffer was written.
  */
-static void
+static bool
 tbuf_write(const file_object_t *fo, filesize_t offset)
 {
 	size_t size = TBUF_WRITTEN_LEN();
@@ -597,7 +619,10 @@ tbuf_write(const file_object_t *fo, filesize_t offset)
 		error = (ssize_t) -1 == ret ? g_strerror(errno) : "Unknown error";
 		g_warning("error while flushing trailer info for \"%s\": %s",
 			file_object_pathname(fo), error);
+		return FALSE;
 	}
+
+	return TRUE;
 }
 
 /**
@@ -641,6 +666,138 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two chunk ranges so that two ranges are equal when they overlap.
+ */
+static int
+fi_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Append chunk at the tail of the chunklist.
+ *
+ * When the chunk overlaps with an existing one, it is not indexed and the
+ * chunklist becomes inconsistent, which file_info_check_chunklist() reports.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	erbtree_insert(&fi->chunktree, &fc->node);
+}
+
+/**
+ * Insert chunk `nfc' right after chunk `fc', which must no longer overlap.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	void *old;
+
+	g_assert(fc->to <= nfc->from);
+
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	old = erbtree_insert(&fi->chunktree, &nfc->node);
+
+	g_assert_log(NULL == old,
+		"%s(): inserted [%s, %s[ overlaps with existing chunk in \"%s\"",
+		G_STRFUNC, filesize_to_string(nfc->from),
+		filesize_to_string2(nfc->to), fi->pathname);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *nfc;
+
+	nfc = eslist_remove_after(&fi->chunklist, fc);
+	dl_file_chunk_check(nfc);
+	erbtree_remove(&fi->chunktree, &nfc->node);
+
+	return nfc;
+}
+
+/**
+ * Find the chunk holding the byte at offset `pos'.
+ *
+ * @return the chunk found, NULL if offset lies beyond the last chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&fi->chunktree, &key);
+}
+
+/**
+ * @return the chunk preceding `fc' in the file, NULL if none.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	rbnode_t *prev;
+
+	if (NULL == fc)
+		return NULL;
+
+	prev = erbtree_prev(&fc->node);
+
+	return NULL == prev ? NULL : erbtree_data(&fi->chunktree, prev);
+}
+
+/**
+ * @return the chunk following `fc' in the file, NULL if none.
+ */
+static inline struct dl_file_chunk *
+fi_chunk_next(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return eslist_next_data(&fi->chunklist, fc);
+}
+
+/**
+ * Find the first empty chunk intersecting with the [from, to[ range.
+ *
+ * @return the chunk found, NULL if the whole range is busy or done.
+ */
+static struct dl_file_chunk *
+fi_chunk_find_empty(const fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc;
+
+	for (
+		fc = fi_chunk_lookup(fi, from);
+		fc != NULL && fc->from < to;
+		fc = fi_chunk_next(fi, fc)
+	) {
+		dl_file_chunk_check(fc);
+
+		if (DL_CHUNK_EMPTY == fc->status)
+			return fc;
+	}
+
+	return NULL;
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -675,6 +832,37 @@ dl_avail_chunk_free(void *p)
 	WFREE(ac);
 }
 
+/**
+ * Compares two available ranges so that two ranges are equal when they
+ * overlap.
+ */
+static int
+fi_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_avail_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping ranges are equal */
+}
+
+/**
+ * Compares two available ranges on the amount of sources that provide them.
+ */
+static int
+fi_avail_source_cmp(const void *a, const void *b)
+{
+	const struct dl_avail_chunk *ca = a, *cb = b;
+	int c;
+
+	c = CMP(ca->sources, cb->sources);
+	return 0 == c ? CMP(ca->from, cb->from) : c;
+}
+
 /**
  * Given a fileinfo GUID, return the fileinfo_t associated with it, or NULL
  * if it does not exist.
@@ -699,6 +887,13 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 	const struct dl_file_chunk *fc;
 	filesize_t last = 0;
 
+	/*
+	 * Chunks overlapping with each other cannot be all indexed.
+	 */
+
+	if (eslist_count(&fi->chunklist) != erbtree_count(&fi->chunktree))
+		return FALSE;
+
 	/*
 	 * This routine ends up being a CPU hog when all the asserts using it
 	 * are run.  Do that only when debugging.
@@ -725,6 +920,108 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 	return TRUE;
 }
 
+/**
+ * Serialize chunk range and status into a CHUNK field payload.
+ */
+static void
+fi_chunk_encode(uint32 chunk[5],
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
+{
+	uint32 from_hi = (uint64) from >> 32;
+	uint32 to_hi = (uint64) to >> 32;
+
+	chunk[0] = htonl(from_hi);
+	chunk[1] = htonl((uint32) from);
+	chunk[2] = htonl(to_hi);
+	chunk[3] = htonl((uint32) to);
+	chunk[4] = htonl(status);
+}
+
+/**
+ * Pending chunk changes, to be appended to the trailer as a journal.
+ *
+ * Between two full trailer writes (checkpoints), we only record the ranges
+ * whose status changed, and flushing simply appends these to the end of
+ * the file, after the last checkpoint, followed by a journal tail.
+ */
+struct fi_journal {
+	uint count;					/**< Amount of entries used */
+	struct fi_journal_entry {
+		filesize_t from;		/**< First byte of range */
+		filesize_t to;			/**< First byte off range */
+		enum dl_chunk_status status;
+	} entry[FI_JOURNAL_MAX];
+};
+
+/**
+ * Discard pending chunk changes.
+ */
+static void
+fi_journal_free(fileinfo_t *fi)
+{
+	WFREE_NULL(fi->journal, sizeof *fi->journal);
+}
+
+/**
+ * Record that range [from, to[ was given the new status.
+ *
+ * When journaling is not possible, the fileinfo is marked dirty instead,
+ * which will cause a full trailer checkpoint at the next flush.
+ */
+static void
+fi_journal_record(fileinfo_t *fi,
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
+{
+	struct fi_journal *fj;
+	uint i;
+
+	g_assert(from < to);
+	g_assert(DL_CHUNK_DONE == status || DL_CHUNK_EMPTY == status);
+
+	if (fi->dirty || 0 == fi->trailer_len)
+		goto checkpoint;
+
+	if (NULL == fi->journal)
+		WALLOC0(fi->journal);
+
+	fj = fi->journal;
+
+	/*
+	 * Downloads mostly extend the ranges they previously completed, so try
+	 * to coalesce with an adjacent entry bearing the same status.  We can
+	 * only look back across entries with that status, or we would reorder
+	 * changes applying to the same range.
+	 */
+
+	for (i = fj->count; i != 0; i--) {
+		struct fi_journal_entry *fe = &fj->entry[i - 1];
+
+		if (fe->status != status)
+			break;
+
+		if (fe->to == from) {
+			fe->to = to;
+			return;
+		} else if (fe->from == to) {
+			fe->from = from;
+			return;
+		}
+	}
+
+	if (fj->count >= G_N_ELEMENTS(fj->entry))
+		goto checkpoint;
+
+	fj->entry[fj->count].from = from;
+	fj->entry[fj->count].to = to;
+	fj->entry[fj->count].status = status;
+	fj->count++;
+	return;
+
+checkpoint:
+	fi_journal_free(fi);
+	fi->dirty = TRUE;
+}
+
 /**
  * Store a binary record of the file metainformation at the end of the
  * supplied file descriptor, opened for writing.
@@ -789,18 +1086,10 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 
 	ESLIST_FOREACH(&fi->chunklist, cl) {
 		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
-		uint32 from_hi, to_hi;
 		uint32 chunk[5];
 
 		dl_file_chunk_check(fc);
-		from_hi = (uint64) fc->from >> 32;
-		to_hi = (uint64) fc->to >> 32;
-
-		chunk[0] = htonl(from_hi),
-		chunk[1] = htonl((uint32) fc->from),
-		chunk[2] = htonl(to_hi),
-		chunk[3] = htonl((uint32) fc->to),
-		chunk[4] = htonl(fc->status);
+		fi_chunk_encode(chunk, fc->from, fc->to, fc->status);
 		FIELD_ADD(FILE_INFO_FIELD_CHUNK, sizeof chunk, chunk, &checksum);
 	}
 
@@ -820,19 +1109,117 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	WRITE_UINT32(FILE_INFO_MAGIC64, &checksum);
 
 	/* Flush buffer at current position */
-	tbuf_write(fo, fi->size);
+	if (!tbuf_write(fo, fi->size))
+		length = 0;				/* Next flush will be a checkpoint again */
 
 	if (0 != file_object_ftruncate(fo, fi->size + length)) {
 		g_warning("%s(): truncate() failed for \"%s\": %m",
 			G_STRFUNC, file_info_readable_filename(fi));
+		length = 0;
 	}
 
+	fi->checkpoint = fi->generation;
+	fi->trailer_len = length;
+	fi->journal_len = 0;
+	fi->journal_sum = 0;
+	fi_journal_free(fi);
+
 	fi->dirty = FALSE;
 	fileinfo_dirty = TRUE;
 
 	entropy_harvest_time();
 }
 
+/**
+ * Append pending chunk changes to the journal following the last trailer
+ * checkpoint at the end of the file.
+ *
+ * The previous journal tail, if any, is overwritten by the new records and
+ * a new tail is written after them, referencing the whole journal.  The
+ * fileinfo database is not marked dirty: the trailer bears a more recent
+ * generation number and will be preferred at retrieval time.
+ *
+ * @return TRUE if the journal was appended, FALSE if a full trailer needs
+ * to be written instead.
+ */
+static bool
+file_info_fd_append_journal(fileinfo_t *fi, const file_object_t *fo)
+{
+	const struct fi_journal *fj = fi->journal;
+	filestat_t buf;
+	filesize_t end, offset;
+	uint32 checksum, sum, length;
+	uint i;
+
+	g_assert(fo);
+	g_assert(fj != NULL);
+
+	if (0 == fi->trailer_len)
+		return FALSE;
+
+	/*
+	 * Make sure the file still ends where we think it does, in case it
+	 * was modified behind our back.
+	 */
+
+	end = fi->size + fi->trailer_len + fi->journal_len;
+
+	if (0 != file_object_fstat(fo, &buf) || (filesize_t) buf.st_size != end)
+		return FALSE;
+
+	/*
+	 * Once the journal grows larger than the trailer itself, it is cheaper
+	 * to checkpoint the whole trailer again.
+	 */
+
+	length = MAX(fi->journal_len, FI_TAIL_LEN) + fj->count * FI_JOURNAL_RECLEN;
+
+	if (length > MAX(fi->trailer_len, FI_JOURNAL_MIN))
+		return FALSE;
+
+	offset = 0 == fi->journal_len ? end : end - FI_TAIL_LEN;
+
+	TBUF_INIT_WRITE();
+	checksum = fi->journal_sum;
+
+	for (i = 0; i < fj->count; i++) {
+		const struct fi_journal_entry *fe = &fj->entry[i];
+		uint32 chunk[5];
+
+		fi_chunk_encode(chunk, fe->from, fe->to, fe->status);
+		FIELD_ADD(FILE_INFO_FIELD_CHUNK, sizeof chunk, chunk, &checksum);
+	}
+
+	sum = checksum;			/* Running checksum of records only */
+
+	WRITE_UINT32((uint64) fi->size >> 32, &checksum);
+	WRITE_UINT32(fi->size, &checksum);
+	WRITE_UINT32(fi->generation + 1, &checksum);
+	WRITE_UINT32(length, &checksum);
+	WRITE_UINT32(checksum, &checksum);
+	WRITE_UINT32(FILE_INFO_MAGICJ, &checksum);
+
+	g_assert(offset + TBUF_WRITTEN_LEN() == fi->size + fi->trailer_len + length);
+
+	if (!tbuf_write(fo, offset)) {
+		fi->trailer_len = 0;	/* Trailer now unknown, force checkpoint */
+		return FALSE;
+	}
+
+	fi->generation++;
+	fi->journal_len = length;
+	fi->journal_sum = sum;
+	fi_journal_free(fi);
+
+	if (GNET_PROPERTY(fileinfo_debug) > 3) {
+		g_debug("FILEINFO: appended %u journal entr%s (%u bytes) to \"%s\"",
+			i, plural_y(i), length, file_info_readable_filename(fi));
+	}
+
+	entropy_harvest_time();
+	return TRUE;
+}
+
 /**
  * Store a binary record of the file metainformation at the end of the
  * output file, if it exists.
@@ -873,8 +1260,17 @@ file_info_store_binary(fileinfo_t *fi, bool force)
 
 	fo = file_object_open(fi->pathname, O_WRONLY);
 
+	/*
+	 * Unless forced, when only chunks changed since the last checkpoint, we
+	 * just need to append these changes to the trailer.
+	 */
+
 	if (fo != NULL) {
-		file_info_fd_store_binary(fi, fo);
+		if (
+			force || fi->dirty || NULL == fi->journal ||
+			!file_info_fd_append_journal(fi, fo)
+		)
+			file_info_fd_store_binary(fi, fo);
 		file_object_release(&fo);
 	}
 }
@@ -897,6 +1293,9 @@ fi_tigertree_free(fileinfo_t *fi)
 
 	if (fi->tigertree.leaves) {
 		WFREE_ARRAY(fi->tigertree.leaves, fi->tigertree.num_leaves);
+		WFREE_ARRAY_NULL(fi->tigertree.verified, fi->tigertree.num_leaves);
+		WFREE_ARRAY_NULL(fi->tigertree.generation, fi->tigertree.num_leaves);
+		fi->tigertree.good = 0;
 		fi->tigertree.slice_size = 0;
 		fi->tigertree.num_leaves = 0;
 		fi->tigertree.leaves = NULL;
@@ -919,6 +1318,8 @@ file_info_got_tigertree(fileinfo_t *fi,
 	fi_tigertree_free(fi);
 	fi->tigertree.leaves = WCOPY_ARRAY(leaves, num_leaves);
 	fi->tigertree.num_leaves = num_leaves;
+	WALLOC0_ARRAY(fi->tigertree.verified, num_leaves);
+	WALLOC0_ARRAY(fi->tigertree.generation, num_leaves);
 
 	fi->tigertree.slice_size = TTH_BLOCKSIZE;
 	num_blocks = tt_block_count(fi->size);
@@ -930,6 +1331,240 @@ file_info_got_tigertree(fileinfo_t *fi,
 		fi->dirty = TRUE;
 }
 
+/**
+ * @return whether all the bytes within [from, to[ are downloaded.
+ */
+static bool
+fi_range_is_done(const fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	const struct dl_file_chunk *fc;
+	filesize_t pos = from;
+
+	for (
+		fc = fi_chunk_lookup(fi, from);
+		fc != NULL && pos < to;
+		fc = fi_chunk_next(fi, fc)
+	) {
+		if (DL_CHUNK_DONE != fc->status)
+			return FALSE;
+		pos = fc->to;
+	}
+
+	return pos >= to;
+}
+
+/**
+ * Verification state of the tigertree slices.
+ */
+enum fi_slice_state {
+	FI_SLICE_UNKNOWN = 0,		/**< Not verified yet */
+	FI_SLICE_PENDING,			/**< Verification in progress */
+	FI_SLICE_GOOD				/**< Slice matched its tigertree leaf */
+};
+
+/**
+ * A pending slice verification.
+ */
+struct fi_slice_job {
+	const struct guid *guid;	/**< Fileinfo GUID (atom) */
+	struct tth expected;		/**< The tigertree leaf for the slice */
+	filesize_t from;			/**< First byte of slice */
+	filesize_t to;				/**< First byte off slice */
+	size_t index;				/**< Slice index */
+	uint8 generation;			/**< Slice generation at launch time */
+};
+
+/**
+ * Callback invoked when the slice digest has been computed.
+ */
+static void
+fi_tigertree_slice_done(const struct tth *digest, void *arg)
+{
+	struct fi_slice_job *job = arg;
+	fileinfo_t *fi;
+	size_t i = job->index;
+
+	fi = file_info_by_guid(job->guid);
+
+	/*
+	 * The fileinfo may have been removed, its tigertree replaced, or the
+	 * slice data discarded whilst we were computing the digest.
+	 */
+
+	if (
+		NULL == fi || NULL == fi->tigertree.verified ||
+		i >= fi->tigertree.num_leaves ||
+		!tth_eq(&job->expected, &fi->tigertree.leaves[i]) ||
+		job->generation != fi->tigertree.generation[i] ||
+		FI_SLICE_PENDING != fi->tigertree.verified[i]
+	)
+		goto done;
+
+	if (NULL == digest) {
+		fi->tigertree.verified[i] = FI_SLICE_UNKNOWN;	/* Will retry */
+	} else if (tth_eq(digest, &job->expected)) {
+		fi->tigertree.verified[i] = FI_SLICE_GOOD;
+		fi->tigertree.good++;
+
+		if (GNET_PROPERTY(tigertree_debug) > 1) {
+			g_debug("TTH slice #%zu [%s, %s[ of \"%s\" is good (%zu/%zu)",
+				i, filesize_to_string(job->from),
+				filesize_to_string2(job->to), file_info_readable_filename(fi),
+				fi->tigertree.good, fi->tigertree.num_leaves);
+		}
+	} else {
+		fi->tigertree.verified[i] = FI_SLICE_UNKNOWN;
+
+		/*
+		 * Once the file is complete, the final verification will deal
+		 * with the corruption.  Otherwise, mark the slice as empty so that
+		 * it can be requested again immediately.
+		 */
+
+		if (FILE_INFO_COMPLETE(fi) || !fi_range_is_done(fi, job->from, job->to))
+			goto done;
+
+		g_warning("TTH slice #%zu [%s, %s[ of \"%s\" is corrupted, "
+			"will download it again",
+			i, filesize_to_string(job->from), filesize_to_string2(job->to),
+			file_info_readable_filename(fi));
+
+		file_info_unwritten(fi, job->from, job->to);
+	}
+
+done:
+	atom_guid_free_null(&job->guid);
+	WFREE(job);
+}
+
+/**
+ * Launch verification of the tigertree slice at given index.
+ */
+static void
+fi_tigertree_verify_slice(fileinfo_t *fi, size_t i)
+{
+	struct fi_slice_job *job;
+
+	g_assert(i < fi->tigertree.num_leaves);
+	g_assert(FI_SLICE_UNKNOWN == fi->tigertree.verified[i]);
+
+	WALLOC(job);
+	job->guid = atom_guid_get(fi->guid);
+	job->expected = fi->tigertree.leaves[i];
+	job->from = i * fi->tigertree.slice_size;
+	job->to = MIN(job->from + fi->tigertree.slice_size, fi->size);
+	job->index = i;
+	job->generation = fi->tigertree.generation[i];
+
+	fi->tigertree.verified[i] = FI_SLICE_PENDING;
+	verify_tth_slice(fi->pathname, job->from, job->to - job->from,
+		fi_tigertree_slice_done, job);
+}
+
+/**
+ * Launch verification of the tigertree slices intersecting with [from, to[
+ * which are now completely downloaded.
+ */
+static void
+fi_tigertree_check_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	filesize_t slice = fi->tigertree.slice_size;
+	size_t i, last;
+
+	g_assert(from < to);
+
+	if (NULL == fi->tigertree.verified || 0 == slice)
+		return;
+
+	last = MIN((to - 1) / slice, fi->tigertree.num_leaves - 1);
+
+	for (i = from / slice; i <= last; i++) {
+		filesize_t start = i * slice;
+		filesize_t end = MIN(start + slice, fi->size);
+
+		if (FI_SLICE_UNKNOWN != fi->tigertree.verified[i])
+			continue;
+
+		if (fi_range_is_done(fi, start, end))
+			fi_tigertree_verify_slice(fi, i);
+	}
+}
+
+/**
+ * Forget about the verification of the tigertree slices whose index lies
+ * within [first, last], since their data are no longer downloaded.
+ *
+ * Bumping the slice generation makes sure any verification still pending
+ * for these slices will be ignored.
+ */
+static void
+fi_tigertree_forget(fileinfo_t *fi, size_t first, size_t last)
+{
+	size_t i;
+
+	g_assert(last < fi->tigertree.num_leaves);
+
+	for (i = first; i <= last; i++) {
+		if (FI_SLICE_GOOD == fi->tigertree.verified[i]) {
+			g_assert(fi->tigertree.good != 0);
+			fi->tigertree.good--;
+		}
+		fi->tigertree.verified[i] = FI_SLICE_UNKNOWN;
+		fi->tigertree.generation[i]++;
+	}
+}
+
+/**
+ * Invalidate verification of the tigertree slices intersecting with
+ * [from, to[, which are no longer completely downloaded.
+ */
+static void
+fi_tigertree_invalidate_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	filesize_t slice = fi->tigertree.slice_size;
+	size_t first;
+
+	g_assert(from < to);
+
+	if (NULL == fi->tigertree.verified || 0 == slice)
+		return;
+
+	first = from / slice;
+	if (first >= fi->tigertree.num_leaves)
+		return;
+
+	fi_tigertree_forget(fi, first,
+		MIN((to - 1) / slice, fi->tigertree.num_leaves - 1));
+}
+
+/**
+ * Launch verification of all the tigertree slices already downloaded,
+ * typically right after the tigertree was retrieved.
+ */
+void
+file_info_tigertree_verify(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_VERIFYING))
+		return;
+
+	if (0 != fi->size && fi->file_size_known)
+		fi_tigertree_check_range(fi, 0, fi->size);
+}
+
+/**
+ * @return whether all the tigertree slices of the file were verified.
+ */
+bool
+file_info_tigertree_verified(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	return fi->tigertree.verified != NULL &&
+		fi->tigertree.good == fi->tigertree.num_leaves;
+}
+
 /**
  * Record that the fileinfo trailer has been stripped.
  */
@@ -949,6 +1584,8 @@ file_info_strip_trailer(fileinfo_t *fi, const char *pathname)
 	g_assert(!((FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED) & fi->flags));
 	
 	fi_tigertree_free(fi);
+	fi_journal_free(fi);
+	fi->trailer_len = fi->journal_len = 0;
 
 	if (-1 == truncate(pathname, fi->size)) {
 		if (ENOENT == errno) {
@@ -1022,13 +1659,12 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunktree);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
 /**
- * Frees the chunklist and all its elements of a fileinfo struct. Note that
- * the consistency of the list isn't checked to explicitely allow freeing
- * inconsistent chunklists.
+ * Frees the availability map of a fileinfo struct.
  *
  * @param fi the fileinfo struct.
  */
@@ -1037,7 +1673,8 @@ file_info_available_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
-	eslist_wfree(&fi->available, sizeof(struct dl_avail_chunk));
+	erbtree_clear(&fi->rarest);
+	erbtree_discard(&fi->available, dl_avail_chunk_free);
 }
 
 /**
@@ -1066,6 +1703,7 @@ fi_free(fileinfo_t *fi)
 
 	http_rangeset_free_null(&fi->seen_on_network);
 	fi_tigertree_free(fi);
+	fi_journal_free(fi);
 
 	atom_guid_free_null(&fi->guid);
 	atom_str_free_null(&fi->pathname);
@@ -1113,14 +1751,14 @@ file_info_hash_insert_name_size(fileinfo_t *fi)
 		pslist_t *slist;
 		
 		nsk.name = sl->data;
-		slist = htable_lookup(fi_by_namesize, &nsk);
+		slist = chtable_lookup(fi_by_namesize, &nsk);
 
 		if (NULL != slist) {
 			pslist_append(slist, fi);		/* Head not changing */
 		} else {
 			namesize_t *ns = namesize_make(nsk.name, nsk.size);
 			slist = pslist_append(NULL, fi);
-			htable_insert(fi_by_namesize, ns, slist);
+			chtable_insert(fi_by_namesize, ns, slist);
 		}
 	}
 
@@ -1148,7 +1786,7 @@ file_info_hash_remove_name_size(fileinfo_t *fi)
 
 		nsk.name = sl->data;
 
-		found = htable_lookup_extended(fi_by_namesize, &nsk, &key, &value);
+		found = chtable_lookup_extended(fi_by_namesize, &nsk, &key, &value);
 
 		ns = deconstify_pointer(key);
 		slist = value;
@@ -1160,10 +1798,10 @@ file_info_hash_remove_name_size(fileinfo_t *fi)
 		slist = pslist_remove(slist, fi);
 
 		if (NULL == slist) {
-			htable_remove(fi_by_namesize, ns);
+			chtable_remove(fi_by_namesize, ns);
 			namesize_free(ns);
 		} else if (head != slist) {
-			htable_insert(fi_by_namesize, ns, slist); /* Head changed */
+			chtable_insert(fi_by_namesize, ns, slist); /* Head changed */
 		}
 	}
 }
@@ -1182,7 +1820,8 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
+	fi->no_empty = FALSE;
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1246,7 +1885,7 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 	 */
 	
 	ns = namesize_make(name, fi->size);
-	list = htable_lookup(fi_by_namesize, ns);
+	list = chtable_lookup(fi_by_namesize, ns);
 	if (NULL != list && NULL != pslist_find(list, fi)) {
 		/* Alias already known */
 	} else if (looks_like_urn(name)) {
@@ -1263,7 +1902,7 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 				pslist_append(list, fi);
 			} else {
 				list = pslist_append(list, fi);
-				htable_insert(fi_by_namesize, ns, list);
+				chtable_insert(fi_by_namesize, ns, list);
 				ns = NULL; /* Prevent freeing */
 			}
 		}
@@ -1272,23 +1911,91 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 		namesize_free(ns);
 }
 
+/**
+ * Read the fixed-size trailer tail located at `offset' in file `name',
+ * already opened as `fd', filling the supplied trailer buffer `tb'.
+ *
+ * @returns TRUE if a known tail was read, FALSE otherwise.
+ */
+static bool
+file_info_read_tail(int fd, fileoffset_t offset, struct trailer *tb,
+	const char *name)
+{
+	ssize_t r;
+	fi_magic_t magic;
+	uint32 tr[FI_TRAILER_INT];
+	uint64 filesize_hi;
+	size_t i = 0;
+
+	STATIC_ASSERT(sizeof tr == FI_TAIL_LEN);
+
+	/* No wrapper because this is a native fileoffset_t value. */
+	if (offset != lseek(fd, offset, SEEK_SET)) {
+		g_warning("%s(): error seek()ing in file \"%s\": %m", G_STRFUNC, name);
+		return FALSE;
+	}
+
+	r = read(fd, tr, sizeof tr);
+	if ((ssize_t) -1 == r) {
+		g_warning("%s(): error reading trailer in \"%s\": %m", G_STRFUNC, name);
+		return FALSE;
+	}
+
+
+	/*
+	 * Don't continue if the number of bytes read is smaller than
+	 * the minimum number of bytes needed.
+	 *		-- JA 12/02/2004
+	 */
+	if (r < 0 || (size_t) r < sizeof tr)
+		return FALSE;
+
+	filesize_hi = 0;
+	magic = ntohl(tr[5]);
+	switch (magic) {
+	case FILE_INFO_MAGICJ:
+	case FILE_INFO_MAGIC64:
+		filesize_hi	= ((uint64) ((uint32) ntohl(tr[0]))) << 32;
+		/* FALLTHROUGH */
+	case FILE_INFO_MAGIC32:
+		tb->filesize = filesize_hi | ((uint32) ntohl(tr[1]));
+		i = 2;
+		break;
+	}
+	if (2 != i) {
+		return FALSE;
+	}
+
+	for (/* NOTHING */; i < G_N_ELEMENTS(tr); i++) {
+		uint32 v = ntohl(tr[i]);
+
+		switch (i) {
+		case 2: tb->generation	= v; break;
+		case 3: tb->length		= v; break;
+		case 4: tb->checksum	= v; break;
+		case 5: tb->magic 		= v; break;
+		default:
+			g_assert_not_reached();
+		}
+	}
+
+	return TRUE;
+}
+
 /**
  * Extract fixed trailer at the end of the file `name', already opened as `fd'.
  * The supplied trailer buffer `tb' is filled.
  *
+ * When the trailer is followed by a journal of chunk changes, `tb' describes
+ * the trailer checkpoint and its journal fields describe the journal.
+ *
  * @returns TRUE if the trailer is "validated", FALSE otherwise.
  */
 static bool
 file_info_get_trailer(int fd, struct trailer *tb, filestat_t *sb,
 	const char *name)
 {
-	ssize_t r;
-	fi_magic_t magic;
-	uint32 tr[FI_TRAILER_INT];
 	filestat_t buf;
-	fileoffset_t offset;
-	uint64 filesize_hi;
-	size_t i = 0;
 
 	g_assert(fd >= 0);
 	g_assert(tb);
@@ -1307,7 +2014,7 @@ file_info_get_trailer(int fd, struct trailer *tb, filestat_t *sb,
 		return FALSE;
 	}
 
-	if (buf.st_size < (fileoffset_t) sizeof tr)
+	if (buf.st_size < (fileoffset_t) FI_TAIL_LEN)
 		return FALSE;
 
 	/*
@@ -1317,55 +2024,37 @@ file_info_get_trailer(int fd, struct trailer *tb, filestat_t *sb,
 	 *		--RAM, 02/02/2003 after a bug report from Christian Biere
 	 */
 
-	offset = buf.st_size - sizeof tr;		/* Start of trailer */
-
-	/* No wrapper because this is a native fileoffset_t value. */
-	if (offset != lseek(fd, offset, SEEK_SET)) {
-		g_warning("%s(): error seek()ing in file \"%s\": %m", G_STRFUNC, name);
-		return FALSE;
-	}
-
-	r = read(fd, tr, sizeof tr);
-	if ((ssize_t) -1 == r) {
-		g_warning("%s(): error reading trailer in \"%s\": %m", G_STRFUNC, name);
+	if (!file_info_read_tail(fd, buf.st_size - FI_TAIL_LEN, tb, name))
 		return FALSE;
-	}
 
+	tb->journal = 0;
 
 	/*
-	 * Don't continue if the number of bytes read is smaller than
-	 * the minimum number of bytes needed.
-	 *		-- JA 12/02/2004
+	 * A journal tail records the length of the whole journal, which is
+	 * immediately preceded by the tail of the last trailer checkpoint.
 	 */
-	if (r < 0 || (size_t) r < sizeof tr)
-		return FALSE;
 
-	filesize_hi = 0;
-	magic = ntohl(tr[5]);
-	switch (magic) {
-	case FILE_INFO_MAGIC64:
-		filesize_hi	= ((uint64) ((uint32) ntohl(tr[0]))) << 32;
-		/* FALLTHROUGH */
-	case FILE_INFO_MAGIC32:
-		tb->filesize = filesize_hi | ((uint32) ntohl(tr[1]));
-		i = 2;
-		break;
-	}
-	if (2 != i) {
-		return FALSE;
-	}
+	if (FILE_INFO_MAGICJ == tb->magic) {
+		struct trailer jt = *tb;
 
-	for (/* NOTHING */; i < G_N_ELEMENTS(tr); i++) {
-		uint32 v = ntohl(tr[i]);
+		if (
+			jt.length < FI_TAIL_LEN ||
+			(uint64) buf.st_size < (uint64) jt.length + FI_TAIL_LEN
+		)
+			return FALSE;
 
-		switch (i) {
-		case 2: tb->generation	= v; break;
-		case 3: tb->length		= v; break;
-		case 4: tb->checksum	= v; break;
-		case 5: tb->magic 		= v; break;
-		default:
-			g_assert_not_reached();
-		}
+		if (
+			!file_info_read_tail(fd,
+				buf.st_size - jt.length - FI_TAIL_LEN, tb, name)
+		)
+			return FALSE;
+
+		if (FILE_INFO_MAGIC64 != tb->magic || tb->filesize != jt.filesize)
+			return FALSE;
+
+		tb->journal = jt.length;
+		tb->jgeneration = jt.generation;
+		tb->jchecksum = jt.checksum;
 	}
 
 	g_assert(FILE_INFO_MAGIC32 == tb->magic || FILE_INFO_MAGIC64 == tb->magic);
@@ -1374,7 +2063,7 @@ file_info_get_trailer(int fd, struct trailer *tb, filestat_t *sb,
 	 * Now, sanity checks...  We must make sure this is a valid trailer.
 	 */
 
-	if ((uint64) buf.st_size != tb->filesize + tb->length) {
+	if ((uint64) buf.st_size != tb->filesize + tb->length + tb->journal) {
 		return FALSE;
 	}
 
@@ -1480,7 +2169,7 @@ file_info_lookup(const char *name, filesize_t size, const struct sha1 *sha1)
 		nsk.name = deconstify_char(name);
 		nsk.size = size;
 
-		list = htable_lookup(fi_by_namesize, &nsk);
+		list = chtable_lookup(fi_by_namesize, &nsk);
 		g_assert(!fi_alias_list_is_looping(list));
 		g_assert(NULL == pslist_find(list, NULL));
 	}
@@ -1766,11 +2455,151 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
-	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
+	erbtree_init(&fi->chunktree, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
+	erbtree_init(&fi->available, fi_overlap_cmp,
+		offsetof(struct dl_avail_chunk, node));
+	erbtree_init(&fi->rarest, fi_avail_source_cmp,
+		offsetof(struct dl_avail_chunk, rnode));
 
 	return fi;
 }
 
+/**
+ * Decode and validate a journaled CHUNK field payload.
+ *
+ * @return TRUE if the chunk change is valid for the fileinfo.
+ */
+static bool
+fi_journal_decode(const fileinfo_t *fi, const uint32 chunk[5],
+	struct fi_journal_entry *fe)
+{
+	fe->from = ((uint64) ntohl(chunk[0]) << 32) | ntohl(chunk[1]);
+	fe->to = ((uint64) ntohl(chunk[2]) << 32) | ntohl(chunk[3]);
+	fe->status = ntohl(chunk[4]);
+
+	if (fe->from >= fe->to || fe->to > fi->size)
+		return FALSE;
+
+	return DL_CHUNK_DONE == fe->status || DL_CHUNK_EMPTY == fe->status;
+}
+
+/**
+ * Set the status of all the bytes within range [from, to[, splitting
+ * chunks as needed.  Adjacent chunks with the same status are left unmerged.
+ */
+static void
+fi_chunk_mark(fileinfo_t *fi,
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
+{
+	struct dl_file_chunk *fc;
+
+	for (
+		fc = fi_chunk_lookup(fi, from);
+		fc != NULL && fc->from < to;
+		fc = fi_chunk_next(fi, fc)
+	) {
+		struct dl_file_chunk *nfc;
+
+		dl_file_chunk_check(fc);
+
+		if (fc->from < from) {
+			nfc = dl_file_chunk_alloc();
+			nfc->from = from;
+			nfc->to = fc->to;
+			nfc->status = fc->status;
+			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
+			continue;		/* Will process `nfc' next */
+		}
+
+		if (fc->to > to) {
+			nfc = dl_file_chunk_alloc();
+			nfc->from = to;
+			nfc->to = fc->to;
+			nfc->status = fc->status;
+			fc->to = to;
+			fi_chunk_insert_after(fi, fc, nfc);
+		}
+
+		fc->status = status;
+	}
+}
+
+/**
+ * Replay the journal of chunk changes following the trailer checkpoint
+ * that was just read from `fd' into `fi'.
+ *
+ * The journal is applied only when it is entirely valid.
+ *
+ * @return TRUE if journal was applied, FALSE if it was corrupted.
+ */
+static bool
+file_info_retrieve_journal(fileinfo_t *fi, int fd, const struct trailer *tb)
+{
+	uint32 chunk[5];
+	uint32 checksum = 0, sum = 0, tmpuint;
+	struct fi_journal_entry fe;
+	size_t i, n;
+	int pass;
+
+	g_assert(tb->journal >= FI_TAIL_LEN);
+
+	if (0 != (tb->journal - FI_TAIL_LEN) % FI_JOURNAL_RECLEN)
+		return FALSE;
+
+	n = (tb->journal - FI_TAIL_LEN) / FI_JOURNAL_RECLEN;
+
+	if ((ssize_t) tb->journal != tbuf_read(fd, tb->journal))
+		return FALSE;
+
+	/*
+	 * First pass validates the records and the checksum, the second one
+	 * applies the chunk changes.
+	 */
+
+	for (pass = 0; pass < 2; pass++) {
+		TBUF_INIT_READ(tb->journal);
+
+		for (i = 0; i < n; i++) {
+			if (!READ_UINT32(&tmpuint, &checksum))
+				return FALSE;
+			if (FILE_INFO_FIELD_CHUNK != tmpuint)
+				return FALSE;
+			if (!READ_UINT32(&tmpuint, &checksum))
+				return FALSE;
+			if (sizeof chunk != tmpuint)
+				return FALSE;
+			if (!READ_STR((char *) chunk, sizeof chunk, &checksum))
+				return FALSE;
+			if (!fi_journal_decode(fi, chunk, &fe))
+				return FALSE;
+			if (1 == pass)
+				fi_chunk_mark(fi, fe.from, fe.to, fe.status);
+		}
+
+		if (1 == pass)
+			break;
+
+		sum = checksum;
+
+		/* file size (upper and lower bits), generation, length */
+		for (i = 0; i < 4; i++) {
+			if (!READ_UINT32(&tmpuint, &checksum))
+				return FALSE;
+		}
+
+		if (checksum != tb->jchecksum)
+			return FALSE;
+	}
+
+	fi->generation = tb->jgeneration;
+	fi->journal_len = tb->journal;
+	fi->journal_sum = sum;
+
+	return TRUE;
+}
+
 /**
  * Reads the file metainfo from the trailer of a file, if it exists.
  *
@@ -2027,7 +2856,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2086,6 +2915,21 @@ G_STMT_START {				\
 		/* NOT REACHED */
 	}
 
+	fi->checkpoint = trailer.generation;
+	fi->trailer_len = trailer.length;
+
+	/*
+	 * Replay the journal of chunk changes appended since that checkpoint.
+	 * Should it be corrupted, we fall back to the checkpoint and will
+	 * rewrite a full trailer on next flush.
+	 */
+
+	if (0 != trailer.journal && !file_info_retrieve_journal(fi, fd, &trailer)) {
+		g_warning("%s(): ignoring corrupted journal (%u bytes) in \"%s\"",
+			G_STRFUNC, trailer.journal, pathname);
+		fi->trailer_len = 0;
+	}
+
 	fd_forget_and_close(&fd);
 
 	fi_tigertree_check(fi);
@@ -2128,7 +2972,7 @@ file_info_store_one(FILE *f, fileinfo_t *fi)
 	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
 		return;
 
-	if (fi->use_swarming && fi->dirty) {
+	if (fi->use_swarming && (fi->dirty || fi->journal != NULL)) {
 		file_info_store_binary(fi, FALSE);
 	}
 
@@ -2442,7 +3286,7 @@ file_info_close(void)
 	 */
 
 	hikset_foreach(fi_by_sha1, file_info_free_sha1_kv, NULL);
-	htable_foreach(fi_by_namesize, file_info_free_namesize_kv, NULL);
+	chtable_foreach(fi_by_namesize, file_info_free_namesize_kv, NULL);
 	hikset_foreach(fi_by_guid, file_info_free_guid_kv, NULL);
 	hikset_foreach(fi_by_outname, file_info_free_outname_kv, NULL);
 
@@ -2466,7 +3310,7 @@ file_info_close(void)
 		event_destroy(fi_events[i]);
 	}
 	hikset_free_null(&fi_by_sha1);
-	htable_free_null(&fi_by_namesize);
+	chtable_free_null(&fi_by_namesize);
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
 
@@ -2940,9 +3784,10 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
+	fi->no_empty = FALSE;
 	fi->generation = 0;		/* Restarting from scratch... */
 	fi->done = 0;
 	atom_sha1_free_null(&fi->cha1);
@@ -2969,7 +3814,7 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		fi_chunk_append(fi, WCOPY(fc));
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
@@ -3218,6 +4063,25 @@ file_info_retrieve(void)
 						goto reset;
 					}
 				}
+			} else if (
+				dfi->generation > fi->generation &&
+				dfi->checkpoint <= fi->generation
+			) {
+				/*
+				 * Only the journaled chunk changes are more recent, the
+				 * other fields in the database are up-to-date.
+				 */
+
+				file_info_chunklist_free(fi);
+				atom_sha1_free_null(&fi->cha1);
+				fi_copy_chunks(fi, dfi);
+				fi->generation = dfi->generation;
+				fi->checkpoint = dfi->checkpoint;
+				fi->trailer_len = dfi->trailer_len;
+				fi->journal_len = dfi->journal_len;
+				fi->journal_sum = dfi->journal_sum;
+				fi_free(dfi);
+				dfi = NULL;
 			} else if (dfi->generation > fi->generation) {
 				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
 				fi_free(fi);
@@ -3499,7 +4363,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3650,7 +4514,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4010,6 +4874,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 	slink_t *sl, *next;
 	struct dl_file_chunk *fc1, *fc2;
 	filesize_t done;
+	bool empty = FALSE;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4028,6 +4893,8 @@ file_info_merge_adjacent(fileinfo_t *fi)
 		if (DL_CHUNK_DONE == fc2->status) {
 			fc2->download = NULL;			/* Done, no longer reserved */
 			done += fc2->to - fc2->from;
+		} else if (DL_CHUNK_EMPTY == fc2->status) {
+			empty = TRUE;
 		}
 
 		if (NULL == fc1)
@@ -4044,7 +4911,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4058,9 +4925,56 @@ file_info_merge_adjacent(fileinfo_t *fi)
 	if (0 != eslist_count(&fi->chunklist))
 		fi->done = done;
 
+	fi->no_empty = !empty;
+
 	g_assert(file_info_check_chunklist(fi, TRUE));
 }
 
+/**
+ * Merge adjacent chunks sharing the same status and download around the
+ * [from, to[ range, which was just updated.
+ *
+ * Contrary to file_info_merge_adjacent(), this only looks at the chunks
+ * surrounding the range and does not recompute fi->done, hence it cannot
+ * be used when completed chunks were modified.
+ */
+static void
+fi_merge_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc1, *fc2;
+
+	fc1 = fi_chunk_lookup(fi, 0 == from ? 0 : from - 1);
+
+	if (NULL == fc1)
+		return;
+
+	if (DL_CHUNK_DONE == fc1->status)
+		fc1->download = NULL;			/* Done, no longer reserved */
+
+	while (fc1->to <= to && NULL != (fc2 = fi_chunk_next(fi, fc1))) {
+		dl_file_chunk_check(fc2);
+		g_assert(fc1->to == fc2->from);
+
+		if (DL_CHUNK_DONE == fc2->status)
+			fc2->download = NULL;
+
+		/*
+		 * Never merge adjacent busy chunks, see file_info_merge_adjacent().
+		 */
+
+		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
+			void *removed;
+
+			fc1->to = fc2->to;
+			removed = fi_chunk_remove_after(fi, fc1);
+			g_assert(removed == fc2);
+			dl_file_chunk_free(&fc2);
+		} else {
+			fc1 = fc2;
+		}
+	}
+}
+
 /**
  * Signals that the file size became suddenly unknown.
  *
@@ -4080,6 +4994,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	}
 
 	fi->file_size_known = FALSE;
+	fi_avail_rebuild(fi);		/* Discards the availability map */
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 
 }
@@ -4115,7 +5030,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4126,7 +5041,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4145,7 +5060,7 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4160,6 +5075,7 @@ file_info_size_known(struct download *d, filesize_t size)
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
+	fi_avail_rebuild(fi);		/* Sources now offer a known range */
 	file_info_changed(fi);
 }
 
@@ -4170,23 +5086,21 @@ file_info_size_known(struct download *d, filesize_t size)
  * When not marking the chunk as EMPTY, the range is linked to
  * the supplied download `d' so we know who "owns" it currently.
  */
-void
-file_info_update(const struct download *d, filesize_t from, filesize_t to,
-		enum dl_chunk_status status)
+static void
+file_info_update_chunks(fileinfo_t *fi, const struct download *d,
+	filesize_t from, filesize_t to, enum dl_chunk_status status)
 {
 	struct dl_file_chunk *fc, *nfc, *prevfc;
-	slink_t *sl;
-	fileinfo_t *fi;
 	bool found = FALSE;
-	int n, againcount = 0;
-	bool need_merging;
+	int againcount = 0;
+	bool need_merging, need_recount = FALSE;
+	bool emptied = FALSE, filled = FALSE;
 	const struct download *newval;
+	filesize_t start = from;
 
-	download_check(d);
-	fi = d->file_info;
 	file_info_check(fi);
-	g_assert(fi->refcount > 0);
 	g_assert(from < to);
+	g_assert(d != NULL || DL_CHUNK_EMPTY == status);
 
 	switch (status) {
 	case DL_CHUNK_DONE:
@@ -4229,7 +5143,7 @@ status_ok:
 
 	if (DL_CHUNK_DONE == status) {
 		fi->modified = fi->stamp;
-		fi->dirty = TRUE;
+		fi_journal_record(fi, from, to, status);
 	}
 
 again:
@@ -4238,7 +5152,7 @@ again:
 	if (++againcount > 10) {
 		g_error("%s(%s, %s, %d) is looping for \"%s\"! Man battle stations!",
 			G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
-			status, d->file_name);
+			status, fi->pathname);
 		return;
 	}
 
@@ -4252,17 +5166,22 @@ again:
 	 */
 
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
-		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
+		fc = fi_chunk_lookup(fi, from), prevfc = fi_chunk_prev(fi, fc);
+		fc != NULL;
+		prevfc = fc, fc = fi_chunk_next(fi, fc)
 	) {
-		fc = eslist_data(&fi->chunklist, sl);
-
 		dl_file_chunk_check(fc);
 
 		if (fc->to <= from) continue;
 		if (fc->from >= to) break;
 
+		/*
+		 * Updating a completed chunk requires fi->done to be recomputed.
+		 */
+
+		if (DL_CHUNK_DONE == fc->status)
+			need_recount = TRUE;
+
 		if (fc->from == from && fc->to == to) {
 
 			if (prevfc && prevfc->status == status)
@@ -4272,6 +5191,8 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
+			if (DL_CHUNK_EMPTY == fc->status)
+				filled = TRUE;
 			fc->status = status;
 			fc->download = newval;
 			found = TRUE;
@@ -4287,6 +5208,8 @@ again:
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
+			if (DL_CHUNK_EMPTY == fc->status)
+				filled = TRUE;
 			fc->status = status;
 			fc->download = newval;
 			from = fc->to;
@@ -4320,7 +5243,7 @@ again:
 				fc->to = to;
 				fc->status = status;
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4345,7 +5268,8 @@ again:
 				nfc->to = fc->to;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fc->to = from;
+				fi_chunk_insert_after(fi, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4356,6 +5280,7 @@ again:
 					 */
 					nfc->status = DL_CHUNK_EMPTY;
 					nfc->download = NULL;
+					emptied = TRUE;
 				}
 			}
 
@@ -4364,9 +5289,8 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
 			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4387,11 +5311,11 @@ again:
 			nfc->to = fc->to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
 
 			tmp = fc->to;
 			fc->to = from;
 			from = tmp;
+			fi_chunk_insert_after(fi, fc, nfc);
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
 		}
@@ -4406,18 +5330,38 @@ again:
 			fi->file_size_known ? "" : "unknown size, currently ",
 			filesize_to_string3(fi->size));
 
-		ESLIST_FOREACH(&fi->chunklist, sl) {
-			fc = eslist_data(&fi->chunklist, sl);
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 			g_warning("... %s %s %u", filesize_to_string(fc->from),
 				filesize_to_string2(fc->to), fc->status);
 		}
 	}
 
-	if (need_merging)
+	if (need_recount) {
 		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+	} else {
+		if (need_merging)
+			fi_merge_range(fi, start, to);
+
+		/*
+		 * Keep track of whether EMPTY chunks remain: the whole list only
+		 * needs to be scanned when a range fully covered an EMPTY chunk.
+		 */
+
+		if (DL_CHUNK_EMPTY == status || emptied)
+			fi->no_empty = FALSE;
+		else if (filled && !fi->no_empty)
+			fi->no_empty = NULL == fi_chunk_find_empty(fi, 0, fi->size);
+	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
+	/*
+	 * Slices whose data go back to EMPTY can no longer be deemed verified.
+	 */
+
+	if (DL_CHUNK_EMPTY == status)
+		fi_tigertree_invalidate_range(fi, start, to);
+
 	/*
 	 * When status is DL_CHUNK_DONE, we're coming from an "active" download,
 	 * i.e. we are writing to it, therefore we can reuse its file descriptor.
@@ -4426,14 +5370,55 @@ again:
 	if (fi->flags & FI_F_TRANSIENT)
 		goto done;
 
-	if (fi->dirty) {
-		file_info_store_binary(d->file_info, FALSE);
+	/*
+	 * Verify the tigertree slices we just completed, so that corrupted
+	 * data can be requested again without waiting for the whole file.
+	 */
+
+	if (DL_CHUNK_DONE == status)
+		fi_tigertree_check_range(fi, start, to);
+
+	if (fi->dirty || fi->journal != NULL) {
+		file_info_store_binary(fi, FALSE);
 	}
 
 done:
 	file_info_changed(fi);
 }
 
+/**
+ * Marks a chunk of the file with given status, on behalf of download `d'.
+ * The bytes range from `from' (included) to `to' (excluded).
+ *
+ * When not marking the chunk as EMPTY, the range is linked to
+ * the supplied download `d' so we know who "owns" it currently.
+ */
+void
+file_info_update(const struct download *d, filesize_t from, filesize_t to,
+		enum dl_chunk_status status)
+{
+	download_check(d);
+	g_assert(d->file_info->refcount > 0);
+
+	file_info_update_chunks(d->file_info, d, from, to, status);
+}
+
+/**
+ * Marks a chunk of the file as empty again, because the data that were
+ * previously reported as written could not be committed to disk.
+ * The bytes range from `from' (included) to `to' (excluded).
+ */
+void
+file_info_unwritten(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	file_info_check(fi);
+
+	if (fi->file_size_known && !(fi->flags & FI_F_TRANSIENT))
+		fi_journal_record(fi, from, to, DL_CHUNK_EMPTY);
+
+	file_info_update_chunks(fi, NULL, from, to, DL_CHUNK_EMPTY);
+}
+
 /**
  * Go through all chunks that belong to the download,
  * and unmark them as busy.
@@ -4526,6 +5511,12 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
+	fi_journal_free(fi);
+
+	if (fi->tigertree.verified != NULL)
+		fi_tigertree_forget(fi, 0, fi->tigertree.num_leaves - 1);
+
+	fi->dirty = TRUE;			/* Trailer must no longer list done chunks */
 	fileinfo_dirty = TRUE;
 }
 
@@ -4542,11 +5533,11 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_lookup(fi, from);
 
-		if (from >= fc->from && to <= fc->to)
-			return fc->status;
+	if (fc != NULL && to <= fc->to) {
+		dl_file_chunk_check(fc);
+		return fc->status;
 	}
 
 	/*
@@ -4617,6 +5608,7 @@ file_info_new_chunk_owner(const struct download *d,
 			if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
 				fc->status = DL_CHUNK_EMPTY;
 				fc->download = NULL;
+				fi->no_empty = FALSE;
 			}
 		}
 	}
@@ -4634,10 +5626,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -4700,33 +5693,16 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 		if (fc->download != NULL) {
 			download_check(d);
 			if (fc->download == d && DL_CHUNK_BUSY == fc->status) {
-				count++;
-				if (download_pipelining(d))
-					pipelined++;
-			}
-		}
-	}
-
-	g_assert(fi->lifecount >= (count - pipelined));
-
-	return count;
-}
-
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
+				count++;
+				if (download_pipelining(d))
+					pipelined++;
+			}
+		}
+	}
 
-	if (cb->to <= ca->from)
-		return +1;
+	g_assert(fi->lifecount >= (count - pipelined));
 
-	return 0;		/* Overlapping chunks are equal */
+	return count;
 }
 
 /**
@@ -4748,12 +5724,12 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
 	uint32 rarest_count = 0;
-	const struct dl_avail_chunk *rarest = NULL, *fa;
+	const struct dl_avail_chunk *rarest = NULL;
+	rbnode_t *rn;
 
 	file_info_check(fi);
 	g_assert(0 != eslist_count(&fi->chunklist));
@@ -4786,33 +5762,21 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
-	 * empty and need to be downloaded.
-	 *
 	 * The `offered' set contains the HTTP ranges offered by the source,
 	 * if any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
 	offered = NULL == d ? NULL : d->ranges;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
-	 * rarest available chunk: the fi->available list is sorted by increasing
+	 * rarest available chunk: the fi->rarest tree is sorted by increasing
 	 * source count.
 	 */
 
-	ESLIST_FOREACH_DATA(&fi->available, fa) {
+	ERBTREE_FOREACH(&fi->rarest, rn) {
+		const struct dl_avail_chunk *fa = erbtree_data(&fi->rarest, rn);
 		struct dl_file_chunk *dfc;
-		struct dl_file_chunk crange;
 
 		dl_avail_chunk_check(fa);
 
@@ -4830,10 +5794,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		)
 			continue;		/* Range not offered */
 
-		crange.from = fa->from;
-		crange.to = fa->to;
-
-		dfc = rbtree_lookup(missing, &crange);
+		dfc = fi_chunk_find_empty(fi, fa->from, fa->to);
 
 		if (dfc != NULL) {
 			/* Rare range overlaps with missing range */
@@ -4945,7 +5906,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -4967,8 +5928,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
@@ -4994,14 +5953,12 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0;
-	slink_t *sl;
+	struct dl_file_chunk *fc;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
-
 		/*
 		 * Check whether first chunk is at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
@@ -5018,7 +5975,6 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
@@ -5031,15 +5987,16 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		for (
+			fc = fi_chunk_lookup(fi, last_chunk_offset);
+			fc != NULL;
+			fc = fi_chunk_next(fi, fc)
+		) {
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_DONE == fc->status)
 				continue;
 
-			if (fc->from < last_chunk_offset && fc->to <= last_chunk_offset)
-				continue;
-
 			offset = fc->from < last_chunk_offset
 				? last_chunk_offset
 				: fc->from;
@@ -5061,37 +6018,22 @@ fi_pick_chunk(fileinfo_t *fi)
 	 * Pick the first chunk whose start is after the offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	fc = fi_chunk_lookup(fi, offset);
+
+	if (fc != NULL) {
+		struct dl_file_chunk *nfc;
 
 		dl_file_chunk_check(fc);
 
-		if (fc->from >= offset)
+		if (fc->from == offset)
 			return fc;
 
 		/*
-		 * If offset lies within a free chunk, it will get split below.
-		 * So exit without selecting anything yet.
+		 * If the offset lies within a big free chunk, be smarter and
+		 * break-up the chunk into two at the selected offset.
 		 */
 
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset)
-			break;
-	}
-
-	/*
-	 * If we have not picked anything, it means we have encountered a big chunk
-	 * and the selected offset lies within that chunk.
-	 * Be smarter and break-up any free chunk into two at the selected offset.
-	 */
-
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
 		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
-			struct dl_file_chunk *nfc;
-
 			g_assert(fc->from < offset);	/* Or we'd have cloned above */
 			g_assert(fc->download == NULL);	/* Chunk is empty */
 
@@ -5106,9 +6048,14 @@ fi_pick_chunk(fileinfo_t *fi)
 			nfc->status = DL_CHUNK_EMPTY;
 			fc->to = nfc->from;
 
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 			return nfc;
 		}
+
+		nfc = fi_chunk_next(fi, fc);
+
+		if (nfc != NULL)
+			return nfc;
 	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -5121,7 +6068,8 @@ fi_pick_chunk(fileinfo_t *fi)
 }
 
 /**
- * Compute chunksize to be used for the current request.
+ * Compute chunksize to be used for the current request, when nothing is
+ * known yet about the throughput of the source.
  */
 static filesize_t
 fi_chunksize(fileinfo_t *fi)
@@ -5339,6 +6287,71 @@ fi_find_slowest(const fileinfo_t *fi, const struct download *d)
 	return slowest;
 }
 
+/**
+ * Is the file in its endgame, i.e. are all its missing parts already being
+ * downloaded by some source?
+ */
+static bool
+fi_in_endgame(const fileinfo_t *fi)
+{
+	return fi->file_size_known && fi->done < fi->size && fi->no_empty;
+}
+
+/**
+ * Compute chunksize to be used for the next request made to a given source.
+ *
+ * Once the throughput of the source is known, requests are sized so that
+ * they last about dl_chunk_duration seconds: fast sources get larger chunks
+ * and issue less requests, whilst slow sources get smaller chunks and do
+ * not keep large parts of the file reserved until they time out.  Requests
+ * must also last long enough compared to the HTTP latency of the source,
+ * or waiting for replies would waste most of the link time.
+ *
+ * In the endgame, requests are shortened so that the remaining parts can
+ * be spread among the active sources.
+ *
+ * The result stays within the dl_minchunksize and dl_maxchunksize bounds
+ * configured by the user.
+ */
+static filesize_t
+fi_source_chunksize(fileinfo_t *fi, const struct download *d)
+{
+	filesize_t chunksize, share;
+	uint64 msecs;
+	uint avg_bps;
+	int src_count;
+
+	file_info_check(fi);
+	download_check(d);
+
+	avg_bps = download_speed_avg(d);
+	if (0 == avg_bps)
+		return fi_chunksize(fi);		/* Nothing measured yet */
+
+	msecs = (uint64) GNET_PROPERTY(dl_chunk_duration) * 1000;
+	msecs = MAX(msecs, (uint64) FI_CHUNK_RTT_FACTOR * d->server->latency);
+
+	if (fi_in_endgame(fi))
+		msecs /= FI_CHUNK_ENDGAME;
+
+	chunksize = avg_bps * msecs / 1000;
+
+	/*
+	 * A source must not be given more than its share of what remains, so
+	 * that other sources can still find something to request.
+	 */
+
+	src_count = fi_alive_count(fi);
+	src_count = MAX(1, src_count);
+	share = (fi->size - fi->done) / src_count;
+
+	chunksize = MIN(chunksize, share);
+	chunksize = MAX(chunksize, GNET_PROPERTY(dl_minchunksize));
+	chunksize = MIN(chunksize, GNET_PROPERTY(dl_maxchunksize));
+
+	return chunksize;
+}
+
 /**
  * Find the spot we could download at the tail of an already active chunk
  * to be aggressively completing the file ASAP.
@@ -5362,6 +6375,7 @@ fi_find_aggressive_candidate(
 	int starving;
 	filesize_t minchunk;
 	bool can_be_aggressive = FALSE;
+	bool endgame = fi_in_endgame(fi);
 	double missing_coverage;
 
 	/*
@@ -5397,7 +6411,19 @@ fi_find_aggressive_candidate(
 
 	missing_coverage = fi_missing_coverage(d);
 
-	if (fc) {
+	/*
+	 * In the endgame, the last missing parts are all reserved: compete for
+	 * the largest one regardless of the relative speeds, so that a single
+	 * stalling source cannot hold up the completion of the file.
+	 */
+
+	if (fc != NULL && endgame) {
+		can_be_aggressive = TRUE;
+
+		if (GNET_PROPERTY(download_debug) > 1)
+			g_debug("endgame for \"%s\": competing with %s for largest chunk",
+				fi->pathname, download_host_info(fc->download));
+	} else if (fc) {
 		double longest_missing_coverage;
 
 		download_check(fc->download);
@@ -5530,7 +6556,7 @@ file_info_reserve(const struct download *d,
 	if (GNET_PROPERTY(fileinfo_debug) > 2) {
 		int new_busy = fi_busy_count(fi, d);
 		g_assert(busy + 1 == new_busy);
-		g_assert(new_busy <= 1 + (download_pipelining(d) ? 1 : 0));
+		g_assert((unsigned) new_busy <= 1 + download_pipeline_depth(d));
 		if (chunk != NULL) {
 			int updated_busy = fi_busy_count(fi, old_d);
 			g_assert(updated_busy <= old_busy);
@@ -5571,15 +6597,15 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 
 	/*
 	 * No reservation for `d' yet unless we're pipelining, in which
-	 * case we must have exactly 1 already (the current running request),
-	 * excepted in the case of aggressive swarming where parts of our chunk
-	 * could have been stolen and completed already (in which case we'll
-	 * have none)..
+	 * case we must have one for the current running request and one for
+	 * each pipelined request already sent, excepted in the case of
+	 * aggressive swarming where parts of our chunks could have been stolen
+	 * and completed already (in which case we'll have less)..
 	 */
 
 	reserved = fi_busy_count(fi, d);
 	g_assert(reserved >= 0);
-	g_assert(reserved <= (download_pipelining(d) ? 1 : 0));
+	g_assert((unsigned) reserved <= download_pipeline_depth(d));
 
 	/*
 	 * Ensure the file has not disappeared.
@@ -5614,7 +6640,7 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	 *		--RAM, 2005-10-27
 	 */
 
-	chunksize = fi_chunksize(fi);
+	chunksize = fi_source_chunksize(fi, d);
 
 	if (
 		GNET_PROPERTY(pfsp_server) && d->served_reqs == 0 &&
@@ -5648,7 +6674,7 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	 *		--RAM, 2012-12-01
 	 */
 
-	if (eslist_count(&fi->available) > 1) {
+	if (erbtree_count(&fi->available) > 1) {
 		chunk = fi_pick_rarest_chunk(fi, NULL, chunksize);
 	} else {
 		chunk = GNET_PROPERTY(pfsp_server) ?
@@ -5688,7 +6714,7 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	busy -= pipelined;
 	g_assert(fi->lifecount > (int32) busy); /* Or we'd found a chunk before */
 
-	if (GNET_PROPERTY(use_aggressive_swarming)) {
+	if (GNET_PROPERTY(use_aggressive_swarming) || fi_in_endgame(fi)) {
 		filesize_t start, end;
 
 		if (fi_find_aggressive_candidate(d, busy, &start, &end, &chunk)) {
@@ -5763,8 +6789,8 @@ file_info_find_available_hole(
 	 *		--RAM, 2012-12-01
 	 */
 
-	if (eslist_count(&fi->available) > 1) {
-		chunksize = fi_chunksize(fi);
+	if (erbtree_count(&fi->available) > 1) {
+		chunksize = fi_source_chunksize(fi, d);
 		chunk = fi_pick_rarest_chunk(fi, d, chunksize);
 	} else {
 		chunk = GNET_PROPERTY(pfsp_server) ?
@@ -5825,7 +6851,7 @@ file_info_find_available_hole(
 
 	busy -= pipelined;
 
-	if (GNET_PROPERTY(use_aggressive_swarming)) {
+	if (GNET_PROPERTY(use_aggressive_swarming) || fi_in_endgame(fi)) {
 		filesize_t start, end;
 
 		if (fi_find_aggressive_candidate(d, busy, &start, &end, &chunk)) {
@@ -5858,7 +6884,7 @@ file_info_find_available_hole(
 
 found:
 	if (0 == chunksize)
-		chunksize = fi_chunksize(fi);
+		chunksize = fi_source_chunksize(fi, d);
 
 	if ((*to - *from) > chunksize)
 		*to = *from + chunksize;
@@ -6381,6 +7407,7 @@ file_info_add_source(fileinfo_t *fi, struct download *d)
 	}
 
 	src_event_trigger(d, EV_SRC_ADDED);
+	fi_avail_update_source(fi, d);
 
 	/*
 	 * Source was added, but we do not need to call fi_update_seen_on_network().
@@ -6416,6 +7443,7 @@ file_info_remove_source(fileinfo_t *fi, struct download *d, bool discard)
 	 */
 
 	src_event_trigger(d, EV_SRC_REMOVED);
+	fi_avail_remove_source(fi, d);
 	fi->sources = pslist_remove(fi->sources, d);
 
 	idtable_free_id(src_handle_map, d->src_handle);
@@ -6475,6 +7503,14 @@ file_info_cloned_source(fileinfo_t *fi, download_t *d, download_t *cd)
 	fi->sources = pslist_prepend(fi->sources, cd);
 	src_event_trigger(cd, EV_SRC_ADDED);
 
+	/*
+	 * The clone takes over the ranges accounted for the original download
+	 * in the availability map.
+	 */
+
+	cd->avail_ranges = d->avail_ranges;
+	d->avail_ranges = NULL;
+
 	/*
 	 * Do not mark fileinfo dirty, we're just increasing counters.
 	 */
@@ -7151,437 +8187,274 @@ file_info_get_file_url(gnet_fi_t handle)
 }
 
 /**
- * Compares two available ranges.
- *
- * Our relative order is a lexicographic order on (start, length), and
- * two chunks are identical only when they start on the same position are
- * have the same length.
+ * Insert new available range in the availability map of the file.
  */
-static int
-fi_avail_cmp(const void *a, const void *b)
+static struct dl_avail_chunk *
+fi_avail_insert(fileinfo_t *fi, filesize_t from, filesize_t to, size_t sources)
 {
-	const struct dl_avail_chunk *ca = a, *cb = b;
-
-	if (ca->from == cb->from) {
-		size_t la = ca->to - ca->from;
-		size_t lb = cb->to - cb->from;
+	struct dl_avail_chunk *ac;
+	void *old;
 
-		return CMP(la, lb);
-	}
+	ac = dl_avail_chunk_new(from, to, sources);
+	old = erbtree_insert(&fi->available, &ac->node);
+	g_assert(NULL == old);
+	erbtree_insert(&fi->rarest, &ac->rnode);
 
-	return CMP(ca->from, cb->from);
+	return ac;
 }
 
 /**
- * Compares two available ranges so that two ranges are equal when they
- * overlap.
+ * Remove available range from the availability map of the file and free it.
  */
-static int
-fi_overlap_cmp(const void *a, const void *b)
+static void
+fi_avail_remove(fileinfo_t *fi, struct dl_avail_chunk *ac)
 {
-	const struct dl_avail_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
+	dl_avail_chunk_check(ac);
 
-	return 0;		/* Overlapping ranges are equal */
+	erbtree_remove(&fi->available, &ac->node);
+	erbtree_remove(&fi->rarest, &ac->rnode);
+	dl_avail_chunk_free(ac);
 }
 
 /**
- * Compares two available ranges on the amount of sources that provide them.
+ * @return the available range following `ac' in the file, NULL if none.
  */
-static int
-fi_avail_source_cmp(const void *a, const void *b)
+static inline struct dl_avail_chunk *
+fi_avail_next(const fileinfo_t *fi, const struct dl_avail_chunk *ac)
 {
-	const struct dl_avail_chunk *ca = a, *cb = b;
-	int c;
-
-	c = CMP(ca->sources, cb->sources);
-	return 0 == c ? CMP(ca->from, cb->from) : c;
+	return erbtree_data(&fi->available, erbtree_next(&ac->node));
 }
 
 /**
- * Count one more source offering chunk [from, to[.
- *
- * @param rbt		the red-black tree where we store available chunks
- * @param from		start of chunk
- * @param to		first byte beyond chunk
+ * Merge the available range ending at `pos' with the one starting there
+ * when they are offered by the same amount of sources.
  */
 static void
-fi_count_source(rbtree_t *rbt, filesize_t from, filesize_t to)
+fi_avail_coalesce(fileinfo_t *fi, filesize_t pos)
 {
-	struct dl_avail_chunk *ac;
-	struct dl_avail_chunk key;
+	struct dl_avail_chunk key, *ac, *next;
 
-	key.from = from;
-	key.to = to;
+	if (0 == pos)
+		return;
 
-	ac = rbtree_lookup(rbt, &key);
-	if (NULL == ac) {
-		ac = dl_avail_chunk_new(from, to, 1);
-		rbtree_insert(rbt, ac);
-	} else {
-		ac->sources++;
-	}
+	key.from = pos - 1;
+	key.to = pos;
+
+	ac = erbtree_lookup(&fi->available, &key);
+
+	if (NULL == ac || ac->to != pos)
+		return;
+
+	next = fi_avail_next(fi, ac);
+
+	if (NULL == next || next->from != pos || next->sources != ac->sources)
+		return;
+
+	ac->to = next->to;			/* Keys in the rarest tree are unchanged */
+	fi_avail_remove(fi, next);
 }
 
 /**
- * Spread offered chunk `ac' to the list of available chunks held in the
- * red-black tree, updating the amount of sources offering each range of
- * the file.
- *
- * This is an important step in our computation of the rarest chunks offered
- * on the network.
+ * Account for `delta' more (or less, when negative) sources offering the
+ * [from, to[ range of the file.
  *
- * @param arbt		red-black tree listing available chunks with source count
- * @param ac		the offered chunk we're adding to the existing set
+ * The availability map holds non-overlapping ranges along with the amount
+ * of sources offering them, ranges offered by no source being absent.
+ * Existing ranges are split at the boundaries of the updated range, so
+ * that only the ranges overlapping with it are visited.
  */
 static void
-fi_update_available_forward(rbtree_t *arbt, const struct dl_avail_chunk *ac)
+fi_avail_add(fileinfo_t *fi, filesize_t from, filesize_t to, int delta)
 {
-	filesize_t from;					/* Starting point of added chunk */
+	struct dl_avail_chunk key, *ac, *prev;
+	filesize_t pos;
 
-	dl_avail_chunk_check(ac);
+	g_assert(delta != 0);
+
+	to = MIN(to, fi->size);
 
-	from = ac->from;
+	if (from >= to)
+		return;
 
-	do {
-		struct dl_avail_chunk key;
-		struct dl_avail_chunk *avc;		/* Available chunk */
-		rbnode_t *node;					/* Tree node for faster iteration */
+	/*
+	 * Locate the first available range overlapping with [from, to[.
+	 */
 
-		key.from = from;
-		key.to = ac->to;
+	key.from = from;
+	key.to = to;
 
-		avc = rbtree_lookup_node(arbt, &key, &node);
+	ac = erbtree_lookup(&fi->available, &key);
 
-		if (NULL == avc) {
-			struct dl_avail_chunk *anew;
+	while (
+		ac != NULL &&
+		NULL != (prev = erbtree_data(&fi->available, erbtree_prev(&ac->node))) &&
+		prev->to > from
+	) {
+		ac = prev;
+	}
 
-			/* Chunk overlaps with nothing -> new entry and we're done */
+	for (pos = from; pos < to; /* empty */) {
+		struct dl_avail_chunk *next;
 
-			anew = dl_avail_chunk_new(from, ac->to, ac->sources);
-			rbtree_insert(arbt, anew);
+		if (NULL == ac || ac->from >= to) {
+			/* Nothing offered up to the end of the range */
+			g_assert(delta > 0);
+			fi_avail_insert(fi, pos, to, delta);
 			break;
 		}
 
-		/*
-		 * Chunk `avc' overlaps with `ac'.
-		 * There are six main configurations possible, with case #0 being
-		 * handled flexibly (i.e. it can start / end on the same boundaries):
-		 *
-		 *   #0:         [=avc=]
-		 *              [---ac--]
-		 *
-		 *   #1:           [====avc====]
-		 *              [---ac--]
-		 *
-		 *   #2:       [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #3:     [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #4:   [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #5: [====avc====]
-		 *             [---ac--]
-		 *
-		 * We want to find the first available chunk which overlaps with `ac'.
-		 */
-
-		 for (;;) {
-			struct dl_avail_chunk *prev;
-			rbnode_t *pnode = node;
-
-			prev = rbtree_prev_node(arbt, &pnode);
-			if (NULL == prev)
-				break;		/* No other available chunk before `avc' */
-
-			if (prev->to <= from)
-				break;		/* No overlap with `ac' */
-
-			avc = prev;
-			node = pnode;
+		if (ac->from > pos) {
+			/* Nothing offered until the next available range */
+			g_assert(delta > 0);
+			fi_avail_insert(fi, pos, ac->from, delta);
+			pos = ac->from;
+			continue;
 		}
 
 		/*
-		 * Handle cases #0 and #1 by creating a new available chunk at
-		 * the beginning, then handling the overlapping part.
+		 * Split `ac' so that it starts at `pos' and does not extend past `to'.
 		 */
 
-		if (from < avc->from) {
-			struct dl_avail_chunk *anew;
-
-			g_assert(avc->from < ac->to);	/* Overlaps with `ac' */
+		if (ac->from < pos) {
+			filesize_t end = ac->to;
 
-			anew = dl_avail_chunk_new(from, avc->from, ac->sources);
-			rbtree_insert(arbt, anew);
-			from = avc->from;
+			ac->to = pos;
+			ac = fi_avail_insert(fi, pos, end, ac->sources);
 		}
 
-		/*
-		 * Handle cases #2, #3, #4 and #5 by splitting the existing available
-		 * chunk up to the start of the offered chunk `ac', and anything
-		 * following the end of `ac'.
-		 */
-
-		if (avc->from <= from) {
-			struct dl_avail_chunk *anew;
-			filesize_t to = MIN(avc->to, ac->to);	/* Upper intersection */
-			filesize_t avc_to = avc->to;
-			size_t sources = avc->sources;
-
-			g_assert(avc->to > from);			/* Overlaps with `ac' */
-
-			if (avc->from == from) {
-				/* Case #2, or case #0 with matching start */
-				avc->sources += ac->sources;	/* For the common part */
-
-				if (avc->to > ac->to)			/* `avc' longer than `ac' */
-					avc->to = ac->to;			/* Extra part added below */
-			} else {
-				/* Not case #2 */
-				avc->to = from;					/* Truncates `avc' */
-
-				/*
-				 * Insert the common part with added source counts.
-				 */
+		if (ac->to > to) {
+			filesize_t end = ac->to;
 
-				anew = dl_avail_chunk_new(from, to, ac->sources + avc->sources);
-				rbtree_insert(arbt, anew);
+			ac->to = to;
+			fi_avail_insert(fi, to, end, ac->sources);
+		}
 
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);		/* The chunk we just inserted */
-			}
+		pos = ac->to;
+		next = fi_avail_next(fi, ac);
 
-			/* Handle rightmost part of cases #2 and #3 */
+		g_assert(delta > 0 || ac->sources >= (size_t) -delta);
 
-			if (avc_to > to) {
-				anew = dl_avail_chunk_new(to, avc_to, sources);
-				rbtree_insert(arbt, anew);
+		erbtree_remove(&fi->rarest, &ac->rnode);
+		ac->sources += delta;
 
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);	
+		if (0 == ac->sources) {
+			erbtree_remove(&fi->available, &ac->node);
+			dl_avail_chunk_free(ac);
+		} else {
+			erbtree_insert(&fi->rarest, &ac->rnode);
+		}
 
-				break;		/* We've consumed the whole `ac' */
-			}
+		ac = next;
+	}
 
-			from = to;
-		}
-	} while (from < ac->to);
+	fi_avail_coalesce(fi, from);
+	fi_avail_coalesce(fi, to);
 }
 
 /**
- * Recompute rarest chunk information based on all the available sources.
+ * Remove the ranges accounted for source `d' from the availability map.
  */
 static void
-fi_update_rarest_chunks(fileinfo_t *fi)
+fi_avail_remove_source(fileinfo_t *fi, download_t *d)
 {
-	pslist_t *sl;
-	rbtree_t *rbt, *arbt;
-	rbtree_iter_t *iter;
-	size_t sources;
-	const void *item;
+	const http_range_t *r;
 
-	if (!fi->file_size_known)
+	if (NULL == d->avail_ranges)
 		return;
 
-	if (GNET_PROPERTY(fileinfo_debug) > 5)
-		g_debug("%s(): updating available for %s", G_STRFUNC, fi->pathname);
-	
-	/*
-	 * The following comments highlight the important steps needed to compute
-	 * the list of chunks available for the file with, for each chunk, the
-	 * amount of source that can serve it.
-	 *
-	 * We have the following scenario, depicting the chunks offered:
-	 *
-	 * Source #1:    [-A--]   [---B--]       [--C---]
-	 * Source #2:    [-----------------D-----------------] (whole file)
-	 * Source #3:          [------E------]      [---F----]
-	 * Source #4:    [-----------------G-----------------] (whole file)
-	 *
-	 * We want to build:
-	 *
-	 * Available:    [=a==][b][==c===][d=][e][f][=g=][=h=]
-	 * # of sources:   3    3     4    3   2  3   4    3
-	 *
-	 * The rarest chunk is "e" (2 sources only provide that range) so this is
-	 * the part of the file that needs to be downloaded first.
-	 * 
-	 * To compute this, we loop over all the "alive" sources we know about
-	 * for a file and for which we have chunk availability information.
-	 *
-	 * Each of the chunks (A, B, C, D, etc..) is inserted into a red-black tree
-	 * whose ordering function is based on the chunk starting offset, then the
-	 * length of the chunk (smallest length is smaller).
-	 * When a chunk is already present, we increase its availability count:
-	 * for instance, chunks D and G are identical according to our ordering
-	 * function, hence when G is inserted, we simply increase the availability
-	 * from 1 to 2.
-	 */
-
-	rbt = rbtree_create(fi_avail_cmp);
-	sources = 0;
+	HTTP_RANGE_FOREACH(d->avail_ranges, r) {
+		fi_avail_add(fi, r->start, r->end + 1, -1);
+	}
 
-	PSLIST_FOREACH(fi->sources, sl) {
-		const download_t *d = sl->data;
+	http_rangeset_free_null(&d->avail_ranges);
+}
 
-		download_check(d);
-		g_assert(fi == d->file_info);
+/**
+ * Account for the ranges offered by source `d' in the availability map,
+ * replacing whatever was previously accounted for that source.
+ *
+ * Sources not known to be partial offer the whole file, whereas partial
+ * sources for which we do not know the ranges yet are ignored.
+ */
+static void
+fi_avail_update_source(fileinfo_t *fi, download_t *d)
+{
+	http_rangeset_t *hrs = NULL;
+	const http_range_t *r;
 
-		sources++;
+	download_check(d);
+	g_assert(fi == d->file_info);
 
+	if (fi->file_size_known && fi->size != 0) {
 		if (!fi->use_swarming || !(d->flags & DL_F_PARTIAL)) {
-			/* Whole range available */
-			fi_count_source(rbt, 0, fi->size);
-		} else if (NULL == d->ranges) {
-			/* Partial file with no known ranges, ignore */
-			continue;
-		} else {
-			const http_range_t *r;
-
-			HTTP_RANGE_FOREACH(d->ranges, r) {
-				fi_count_source(rbt, r->start, r->end + 1);
-			}
+			hrs = http_rangeset_create();
+			http_rangeset_insert(hrs, 0, fi->size - 1);
+		} else if (d->ranges != NULL) {
+			hrs = http_rangeset_create();
+			http_rangeset_merge(hrs, d->ranges);
 		}
 	}
 
-	if (GNET_PROPERTY(fileinfo_debug) > 5) {
-		g_debug("- collected %zu range%s out of %zu source%s:",
-			rbtree_count(rbt), plural(rbtree_count(rbt)),
-			sources, plural(sources));
-
-		iter = rbtree_iter_new(rbt);
-		while (rbtree_iter_next(iter, &item)) {
-			const struct dl_avail_chunk *ac = item;		/* Chunk offered */
-			g_debug("   [%s, %s] (%.2f%%) %zu source%s",
-				filesize_to_string(ac->from), filesize_to_string2(ac->to),
-				100.0 * (ac->to - ac->from) / (0 == fi->size ? 1 : fi->size),
-				ac->sources, plural(ac->sources));
-		}
-		rbtree_iter_release(&iter);
+	if (
+		hrs != NULL && d->avail_ranges != NULL &&
+		http_rangeset_equal(hrs, d->avail_ranges)
+	) {
+		http_rangeset_free_null(&hrs);
+		return;				/* Nothing changed for that source */
 	}
 
-	/*
-	 * All the unique chunks are in the red-black tree, we can iterate in order
-	 * (so our visiting order will be A, D, E, B, etc..) and create the list
-	 * of chunks representing the available regions and the amount of times they
-	 * are offered (list of chunks a, b, c, d etc...).
-	 *
-	 * In our example, starting with "A" we get:
-	 *
-	 *     [--A-]
-	 *     [====]
-	 *        1
-	 *
-	 * because chunk "A" is present once. Then we process "D" so the list now
-	 * becomes:
-	 *
-	 *     [----------------D------------------]
-	 *     [====][=============================]
-	 *        3                  2
-	 *
-	 * because "A" and "D" overlap so the "A" part is available twice but the
-	 * count associated to "D" was 2 (chunks "D" and "G" are equal).  Then we
-	 * process "E" and we further split the second chunk in our list:
-	 *
-	 *           [------E------]
-	 *     [====][=============][==============]
-	 *        3         3                2 
-	 *
-	 * Encountering "B"
-	 *
-	 *              [---B--]
-	 *     [====][=][======][==][==============]
-	 *       3    3    4     3          2 
-	 * 
-	 * we further split the chunk, counting one more occurrence for the region
-	 * covered by "B".
-	 *
-	 * This list is also held in a red-black tree during construction, to
-	 * optimize lookups, but here we have only non-overlapping chunks
-	 * so we use a different comparison function.  The red-black tree will
-	 * be linearized into an embedded list at the end.
-	 */
-
-	file_info_available_free(fi);		/* Discard previous computation */
+	fi_avail_remove_source(fi, d);
 
-	arbt = rbtree_create(fi_overlap_cmp);
-	iter = rbtree_iter_new(rbt);
-
-	while (rbtree_iter_next(iter, &item)) {
-		const struct dl_avail_chunk *ac = item;		/* Chunk offered */
+	if (NULL == hrs)
+		return;
 
-		fi_update_available_forward(arbt, ac);
+	HTTP_RANGE_FOREACH(hrs, r) {
+		fi_avail_add(fi, r->start, r->end + 1, +1);
 	}
 
-	rbtree_iter_release(&iter);
+	d->avail_ranges = hrs;
 
 	if (GNET_PROPERTY(fileinfo_debug) > 5) {
-		filesize_t available = 0;
-
-		iter = rbtree_iter_new(arbt);
-
-		g_debug("- identified %zu available range%s over file:",
-			rbtree_count(arbt), plural(rbtree_count(arbt)));
+		const struct dl_avail_chunk *ac;
+		rbnode_t *rn;
 
-		while (rbtree_iter_next(iter, &item)) {
-			const struct dl_avail_chunk *avc = item;
-
-			dl_avail_chunk_check(avc);
+		g_debug("%s(): %zu available range%s for %s after update from %s:",
+			G_STRFUNC, erbtree_count(&fi->available),
+			plural(erbtree_count(&fi->available)), fi->pathname,
+			download_host_info(d));
 
+		ERBTREE_FOREACH(&fi->available, rn) {
+			ac = erbtree_data(&fi->available, rn);
 			g_debug("   [%s, %s] %zu source%s",
-				filesize_to_string(avc->from), filesize_to_string2(avc->to),
-				avc->sources, plural(avc->sources));
-
-			available += avc->to - avc->from;	/* For logging */
+				filesize_to_string(ac->from), filesize_to_string2(ac->to),
+				ac->sources, plural(ac->sources));
 		}
-
-		g_soft_assert_log(available <= fi->size,
-			"available=%s, fi->size=%s",
-			filesize_to_string(available), filesize_to_string2(fi->size));
-
-		g_debug("=> %s out of %s bytes available (%.2f%%)",
-			filesize_to_string(available), filesize_to_string2(fi->size),
-			100.0 * available / fi->size);
-
-		rbtree_iter_release(&iter);
 	}
+}
 
-	/*
-	 * In the end, we can dispose of the red-black trees and need only to keep
-	 * the list of chunks available along with their availability count.
-	 */
-
-	rbtree_discard(rbt, dl_avail_chunk_free);
-	rbtree_free_null(&rbt);
-
-	iter = rbtree_iter_new(arbt);
+/**
+ * Recompute the whole availability map from all the known sources.
+ *
+ * This is needed when the file size changes, since sources offering the
+ * whole file then offer a different range.
+ */
+static void
+fi_avail_rebuild(fileinfo_t *fi)
+{
+	pslist_t *sl;
 
-	while (rbtree_iter_next(iter, &item)) {
-		struct dl_avail_chunk *avc = deconstify_pointer(item);
+	PSLIST_FOREACH(fi->sources, sl) {
+		download_t *d = sl->data;
 
-		dl_avail_chunk_check(avc);
-		eslist_append(&fi->available, avc);
+		download_check(d);
+		http_rangeset_free_null(&d->avail_ranges);
 	}
 
-	rbtree_iter_release(&iter);
-	rbtree_free_null(&arbt);	/* Its items are now listed in fi->available */
-
-	/*
-	 * Sort the list so that the rarest chunks come first.
-	 *
-	 * Note that when there are no partial sources, there is only one available
-	 * chunk in the list: the chunk representing the whole file.
-	 */
+	file_info_available_free(fi);
 
-	eslist_sort(&fi->available, fi_avail_source_cmp);
+	PSLIST_FOREACH(fi->sources, sl) {
+		fi_avail_update_source(fi, sl->data);
+	}
 }
 
 /**
@@ -7611,11 +8484,11 @@ fi_update_seen_on_network(gnet_src_t srcid)
 	file_info_check(fi);
 
 	/*
-	 * We have new range information probably, so we need to recompute
-	 * the rarest chunks.
+	 * We have new range information probably, so we need to update the
+	 * availability of the ranges offered by that source.
 	 */
 
-	fi_update_rarest_chunks(fi);
+	fi_avail_update_source(fi, d);
 
 	if (GNET_PROPERTY(fileinfo_debug) > 5)
 		g_debug("%s(): updating ranges for %s", G_STRFUNC, fi->pathname);
@@ -7904,7 +8777,7 @@ file_info_init(void)
 
 	fi_by_sha1     = hikset_create(offsetof(fileinfo_t, sha1),
 						HASH_KEY_FIXED, SHA1_RAW_SIZE);
-	fi_by_namesize = htable_create_any(namesize_hash, NULL, namesize_eq);
+	fi_by_namesize = chtable_create_any(namesize_hash, NULL, namesize_eq);
 	fi_by_guid     = hikset_create(offsetof(fileinfo_t, guid),
 						HASH_KEY_FIXED, GUID_RAW_SIZE);
 	fi_by_outname  = hikset_create(offsetof(fileinfo_t, pathname),
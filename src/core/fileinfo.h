@@ -78,10 +78,13 @@ bool file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1);
 void file_info_got_tth(fileinfo_t *fi, const struct tth *tth);
 void file_info_got_tigertree(fileinfo_t *fi,
 		const struct tth *leaves, size_t num_leaves, bool mark_dirty);
+void file_info_tigertree_verify(fileinfo_t *fi);
+bool file_info_tigertree_verified(const fileinfo_t *fi);
 void file_info_size_known(struct download *d, filesize_t size);
 void file_info_size_unknown(fileinfo_t *fi);
 void file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	enum dl_chunk_status status);
+void file_info_unwritten(fileinfo_t *fi, filesize_t from, filesize_t to);
 void file_info_new_chunk_owner(const struct download *d,
 	filesize_t from, filesize_t to);
 enum dl_chunk_status file_info_pos_status(fileinfo_t *fi,
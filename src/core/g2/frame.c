@@ -325,9 +325,13 @@ g2_frame_recursive_deserialize(struct frame_dctx *dctx)
 
 	/*
 	 * OK, create the node.  We don't know whether there will be a payload yet.
+	 *
+	 * When the payload is not copied, the tree cannot outlive the buffer
+	 * being parsed, hence it can be allocated from the thread arena.
 	 */
 
-	node = g2_tree_alloc_empty(name);
+	node = dctx->copy ?
+		g2_tree_alloc_empty(name) : g2_tree_alloc_transient(name);
 
 	/*
 	 * If it is a compound packet, deserialize its children.
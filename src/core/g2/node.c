@@ -64,6 +64,7 @@
 #include "if/core/guid.h"
 
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/halloc.h"
 #include "lib/host_addr.h"
@@ -1019,10 +1020,18 @@ g2_node_handle(gnutella_node_t *n)
 	g2_tree_t *t;
 	size_t plen;
 	enum g2_msg type;
+	arena_mark_t mark;
 
 	node_check(n);
 	g_assert(NODE_TALKS_G2(n));
 
+	/*
+	 * The tree only lives during the processing of the message, so we
+	 * can allocate it from the thread arena.
+	 */
+
+	arena_thread_enter(&mark);
+
 	t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
 	if (NULL == t) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
@@ -1031,7 +1040,7 @@ g2_node_handle(gnutella_node_t *n)
 		}
 		if (GNET_PROPERTY(log_bad_g2))
 			dump_hex(stderr, "G2 Packet", n->data, n->size);
-		return;
+		goto done;
 	} else if (plen != n->size) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
 			g_warning("%s(): consumed %zu bytes but /%s from %s had %u",
@@ -1083,6 +1092,7 @@ g2_node_handle(gnutella_node_t *n)
 
 done:
 	g2_tree_free_null(&t);
+	arena_thread_leave(&mark);
 }
 
 /**
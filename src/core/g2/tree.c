@@ -100,6 +100,7 @@
 
 #include "tree.h"
 
+#include "lib/arena.h"
 #include "lib/atoms.h"
 #include "lib/etree.h"
 #include "lib/halloc.h"
@@ -125,6 +126,7 @@ struct g2_tree {
 	size_t paylen;					/**< Payload length */
 	node_t node;					/**< Embedded tree node */
 	unsigned copied:1;				/**< Whether payload was copied */
+	unsigned transient:1;			/**< Allocated from the thread arena */
 };
 
 static inline void
@@ -436,6 +438,37 @@ g2_tree_alloc_empty(const char *name)
 	return n;
 }
 
+/**
+ * Create a node without any payload, for a tree that will not outlive the
+ * current arena scope of the thread, if any.
+ *
+ * This is meant for trees built when parsing incoming messages: within an
+ * arena scope, the node and its name are allocated from the thread arena and
+ * are reclaimed when the scope is left, making freeing the tree very cheap.
+ * Outside of any arena scope, this is the same as g2_tree_alloc_empty().
+ *
+ * @param name		name of the node
+ *
+ * @return a new node with no payload.
+ */
+g2_tree_t *
+g2_tree_alloc_transient(const char *name)
+{
+	arena_t *a;
+	g2_tree_t *n;
+
+	if (!arena_thread_active())
+		return g2_tree_alloc_empty(name);
+
+	a = arena_thread();
+	n = arena_alloc0(a, sizeof *n);
+	n->magic = G2_TREE_MAGIC;
+	n->name = arena_strdup(a, name);
+	n->transient = TRUE;
+
+	return n;
+}
+
 /**
  * Release memory used by node.
  */
@@ -449,9 +482,13 @@ g2_tree_free_node(void *data)
 	if (n->payload != NULL && n->copied)
 		hfree(n->payload);
 
-	atom_str_free_null(&n->name);
 	n->payload = NULL;
 	n->magic = 0;
+
+	if (n->transient)
+		return;			/* Memory will be reclaimed with the arena scope */
+
+	atom_str_free_null(&n->name);
 	WFREE(n);
 }
 
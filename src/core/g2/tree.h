@@ -52,6 +52,7 @@ g2_tree_t *g2_tree_first_child(const g2_tree_t *root);
 g2_tree_t *g2_tree_next_sibling(const g2_tree_t *child);
 g2_tree_t *g2_tree_next_twin(const g2_tree_t *child);
 g2_tree_t *g2_tree_alloc_empty(const char *name);
+g2_tree_t *g2_tree_alloc_transient(const char *name);
 g2_tree_t *g2_tree_alloc(const char *name, const void *payload, size_t paylen);
 g2_tree_t *g2_tree_alloc_copy(const char *name,
 	const void *payload, size_t paylen);
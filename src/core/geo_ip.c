@@ -37,6 +37,7 @@
 #include "settings.h"
 
 #include "lib/ascii.h"
+#include "lib/epoch.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
 #include "lib/host_addr.h"
@@ -61,15 +62,25 @@
 struct gip_source {
 	const char *file;		/**< Source file */
 	const char *what;		/**< English description of file */
+	char *path;				/**< Path of loaded file (halloc-ed) */
 	time_t mtime;			/**< Modification time of loaded file */
 };
 
 static struct gip_source gip_source[] = {
-	{ "geo-ip.txt",		"Geographic IPv4 mappings", 0 },
-	{ "geo-ipv6.txt",	"Geographic IPv6 mappings", 0 },
+	{ "geo-ip.txt",		"Geographic IPv4 mappings", NULL, 0 },
+	{ "geo-ipv6.txt",	"Geographic IPv6 mappings", NULL, 0 },
 };
 
-static struct iprange_db *geo_db;	/**< The database of bogus CIDR ranges */
+/**
+ * The database of geographic CIDR ranges.
+ *
+ * It is never modified once published, so that it can be looked up from
+ * any thread without locking: a reload builds a new database, replacing
+ * the old one which is freed once no reader can still be using it.
+ */
+static struct iprange_db *geo_db;
+
+static struct iprange_db *gip_loading;	/**< Database being built */
 
 /**
  * Context used during ip_range_split() calls.
@@ -99,7 +110,7 @@ gip_add_cidr(uint32 ip, uint bits, void *udata)
 			ip_to_string(ip), bits, ctx->line);
 
 	cc = ctx->country;
-	error = iprange_add_cidr(geo_db, ip, bits, cc);
+	error = iprange_add_cidr(gip_loading, ip, bits, cc);
 
 	switch (error) {
 	case IPR_ERR_OK:
@@ -282,7 +293,7 @@ gip_parse_ipv6(const char *line, int linenum)
 		return;
 	}
 
-	error = iprange_add_cidr6(geo_db, ip, bits, (code + 1) << 1);
+	error = iprange_add_cidr6(gip_loading, ip, bits, (code + 1) << 1);
 
 	if (IPR_ERR_OK != error) {
 		g_warning("%s, line %d: cannot insert %s/%u: %s",
@@ -292,7 +303,32 @@ gip_parse_ipv6(const char *line, int linenum)
 }
 
 /**
- * Load geographic IP data from the supplied FILE.
+ * Free database retired from the readers.
+ */
+static void
+gip_db_free(void *p)
+{
+	struct iprange_db *idb = p;
+
+	iprange_free(&idb);
+}
+
+/**
+ * Publish the database we loaded, retiring the old one.
+ */
+static void
+gip_publish(void)
+{
+	struct iprange_db *old = geo_db;
+
+	EPOCH_PUBLISH(geo_db, gip_loading);
+	gip_loading = NULL;
+	epoch_retire(old, gip_db_free);
+}
+
+/**
+ * Load geographic IP data from the supplied FILE into the database
+ * being built.
  *
  * @return The amount of entries loaded.
  */
@@ -306,17 +342,7 @@ gip_load(FILE *f, unsigned idx)
 	g_assert(f != NULL);
 	g_assert(uint_is_non_negative(idx));
 	g_assert(idx < G_N_ELEMENTS(gip_source));
-
-	switch (idx) {
-	case GIP_IPV4:
-		iprange_reset_ipv4(geo_db);
-		break;
-	case GIP_IPV6:
-		iprange_reset_ipv6(geo_db);
-		break;
-	default:
-		g_assert_not_reached();
-	}
+	g_assert(gip_loading != NULL);
 
 	if (-1 == fstat(fileno(f), &buf)) {
 		g_warning("cannot stat %s: %m", gip_source[idx].file);
@@ -348,26 +374,30 @@ gip_load(FILE *f, unsigned idx)
 
 	}
 
-	iprange_sync(geo_db);
+	iprange_sync(gip_loading);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		if (GIP_IPV4 == idx) {
 			g_debug("loaded %u geographical IPv4 ranges (%u hosts)",
-				iprange_get_item_count4(geo_db),
-				iprange_get_host_count4(geo_db));
+				iprange_get_item_count4(gip_loading),
+				iprange_get_host_count4(gip_loading));
 		} else {
 			g_debug("loaded %u geographical IPv6 ranges",
-				iprange_get_item_count6(geo_db));
+				iprange_get_item_count6(gip_loading));
 		}
 	}
 
 	return GIP_IPV4 == idx ?
-		iprange_get_item_count4(geo_db) : iprange_get_item_count6(geo_db);
+		iprange_get_item_count4(gip_loading) :
+		iprange_get_item_count6(gip_loading);
 }
 
 /**
  * Watcher callback, invoked when the file from which we read the
  * geographic IP mappings changed.
+ *
+ * Since the published database cannot be modified, a new one is built
+ * from both the changed file and the other loaded file.
  */
 static void
 gip_changed(const char *filename, void *idx_ptr)
@@ -375,15 +405,46 @@ gip_changed(const char *filename, void *idx_ptr)
 	FILE *f;
 	char buf[80];
 	uint count;
-	unsigned idx = pointer_to_uint(idx_ptr);
+	unsigned n, idx = pointer_to_uint(idx_ptr);
 
 	f = file_fopen(filename, "r");
 	if (f == NULL)
 		return;
 
+	gip_loading = iprange_new();
 	count = gip_load(f, idx);
 	fclose(f);
 
+	for (n = 0; n < G_N_ELEMENTS(gip_source); n++) {
+		if (n == idx || NULL == gip_source[n].path)
+			continue;
+
+		f = file_fopen(gip_source[n].path, "r");
+		if (f != NULL) {
+			gip_load(f, n);
+			fclose(f);
+			continue;
+		}
+
+		/*
+		 * Could not reopen the other file: keep the ranges we currently
+		 * have for that address family instead of silently dropping them.
+		 */
+
+		g_warning("%s(): cannot reload %s, keeping previous IPv%c ranges",
+			G_STRFUNC, gip_source[n].path, GIP_IPV4 == n ? '4' : '6');
+
+		if (geo_db != NULL) {
+			if (GIP_IPV4 == n)
+				iprange_copy_ipv4(gip_loading, geo_db);
+			else
+				iprange_copy_ipv6(gip_loading, geo_db);
+			iprange_sync(gip_loading);
+		}
+	}
+
+	gip_publish();
+
 	str_bprintf(buf, sizeof buf, "Reloaded %u geographic IPv%c ranges.",
 		count, GIP_IPV4 == idx ? '4' : '6');
 
@@ -434,7 +495,8 @@ gip_retrieve(unsigned n)
 
 	filename = make_pathname(fp[idx].dir, fp[idx].name);
 	watcher_register(filename, gip_changed, uint_to_pointer(n));
-	HFREE_NULL(filename);
+	HFREE_NULL(gip_source[n].path);
+	gip_source[n].path = filename;
 
 	gip_load(f, n);
 	fclose(f);
@@ -449,10 +511,12 @@ done:
 void
 gip_init(void)
 {
-	geo_db = iprange_new();
+	gip_loading = iprange_new();
 
 	gip_retrieve(GIP_IPV4);
 	gip_retrieve(GIP_IPV6);
+
+	gip_publish();
 }
 
 /**
@@ -461,7 +525,14 @@ gip_init(void)
 void
 gip_close(void)
 {
-	iprange_free(&geo_db);
+	unsigned n;
+
+	for (n = 0; n < G_N_ELEMENTS(gip_source); n++) {
+		HFREE_NULL(gip_source[n].path);
+	}
+
+	gip_publish();			/* Publishes NULL */
+	epoch_synchronize();
 }
 
 /**
@@ -474,12 +545,17 @@ gip_close(void)
 uint16
 gip_country(const host_addr_t ha)
 {
-	uint16 code;
+	struct iprange_db *idb;
+	uint16 code = 0;
 
 	if G_UNLIKELY(NULL == geo_db)
 		return ISO3166_INVALID;
-		
-	code = iprange_get_addr(geo_db, ha);
+
+	epoch_enter();
+	idb = EPOCH_READ(geo_db);
+	if (idb != NULL)
+		code = iprange_get_addr(idb, ha);
+	epoch_leave();
 
 	return 0 == code ? ISO3166_INVALID : (code >> 1) - 1;
 }
@@ -52,6 +52,7 @@
 #include "lib/dbmw.h"
 #include "lib/dbstore.h"
 #include "lib/entropy.h"
+#include "lib/epoch.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
@@ -264,15 +265,42 @@ hostiles_flags_to_string(const hostiles_flags_t flags)
 }
 
 /**
- * Frees all entries in the given hostiles.
+ * Free database retired from the readers.
  */
 static void
-hostiles_close_one(hostiles_t which)
+hostiles_db_free(void *p)
+{
+	struct iprange_db *idb = p;
+
+	iprange_free(&idb);
+}
+
+/**
+ * Publish new database for given hostiles, retiring the old one.
+ *
+ * Published databases are never modified, so that readers can look them
+ * up from any thread without locking.
+ */
+static void
+hostiles_publish(hostiles_t which, struct iprange_db *idb)
 {
 	uint i = which;
-	
+	struct iprange_db *old;
+
 	g_assert(i < NUM_HOSTILES);
-	iprange_free(&hostile_db[i]);
+
+	old = hostile_db[i];
+	EPOCH_PUBLISH(hostile_db[i], idb);
+	epoch_retire(old, hostiles_db_free);
+}
+
+/**
+ * Frees all entries in the given hostiles.
+ */
+static void
+hostiles_close_one(hostiles_t which)
+{
+	hostiles_publish(which, NULL);
 }
 
 /**
@@ -288,11 +316,12 @@ hostiles_load(FILE *f, hostiles_t which)
 	int linenum = 0;
 	int bits;
 	iprange_err_t error;
+	struct iprange_db *idb;
+	int count;
 
 	g_assert(UNSIGNED(which) < NUM_HOSTILES);
-	g_assert(NULL == hostile_db[which]);
 
-	hostile_db[which] = iprange_new();
+	idb = iprange_new();
 
 	while (fgets(line, sizeof line, f)) {
 		linenum++;
@@ -317,7 +346,7 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(hostile_db[which], ip, bits, 1);
+		error = iprange_add_cidr(idb, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -333,14 +362,18 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 	}
 
-	iprange_sync(hostile_db[which]);
+	iprange_sync(idb);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u addresses/netmasks from %s (%u hosts)",
-			iprange_get_item_count(hostile_db[which]), hostiles_what[which],
-			iprange_get_host_count4(hostile_db[which]));
+			iprange_get_item_count(idb), hostiles_what[which],
+			iprange_get_host_count4(idb));
 	}
-	return iprange_get_item_count(hostile_db[which]);
+
+	count = iprange_get_item_count(idb);
+	hostiles_publish(which, idb);
+
+	return count;
 }
 
 /**
@@ -362,7 +395,6 @@ hostiles_changed(const char *filename, void *udata)
 	if (f == NULL)
 		return;
 
-	hostiles_close_one(which);
 	count = hostiles_load(f, which);
 	fclose(f);
 
@@ -684,16 +716,28 @@ hostiles_dynamic_add_ipv6(const uint8 *ipv6, hostiles_flags_t flags)
 static hostiles_flags_t
 hostiles_static_check_ipv4(uint32 ipv4)
 {
+	hostiles_flags_t flags = HSTL_CLEAN;
 	int i;
 
+	epoch_enter();
+
 	for (i = 0; i < NUM_HOSTILES; i++) {
+		struct iprange_db *idb;
+
 		if (i == HOSTILE_GLOBAL && !GNET_PROPERTY(use_global_hostiles_txt))
 			continue;
 
-		if (NULL != hostile_db[i] && 0 != iprange_get(hostile_db[i], ipv4))
-			return HSTL_STATIC;
+		idb = EPOCH_READ(hostile_db[i]);
+
+		if (NULL != idb && 0 != iprange_get(idb, ipv4)) {
+			flags = HSTL_STATIC;
+			break;
+		}
 	}
-	return HSTL_CLEAN;
+
+	epoch_leave();
+
+	return flags;
 }
 
 static hostiles_flags_t
@@ -1200,6 +1244,7 @@ hostiles_close(void)
 	for (i = 0; i < NUM_HOSTILES; i++) {
 		hostiles_close_one(i);
 	}
+	epoch_synchronize();
 
 	gnet_prop_remove_prop_changed_listener(PROP_USE_GLOBAL_HOSTILES_TXT,
 		use_global_hostiles_txt_changed);
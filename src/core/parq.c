@@ -62,8 +62,11 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/bit_array.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
+#include "lib/endian.h"
+#include "lib/fenwick.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/getline.h"
@@ -74,6 +77,7 @@
 #include "lib/htable.h"
 #include "lib/parse.h"
 #include "lib/plist.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/stats.h"
 #include "lib/str.h"
@@ -82,6 +86,7 @@
 #include "lib/tm.h"
 #include "lib/tokenizer.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"			/* Must be the last header included */
 
@@ -107,6 +112,20 @@
 #define MIN_ALWAYS_QUEUE	5		/**< Try to actively queue first 5 slots */
 #define STAT_POINTS			150		/**< Amount of stat points to keep */
 #define STAT_MIN_POINTS		10		/**< Min points before analyzing data */
+#define PARQ_SLOTS_MIN		64		/**< Minimum size of the queue index */
+#define PARQ_ETA_REFRESH	60		/**< Refresh slot times every minute */
+
+#define PARQ_STORE_VERSION	1		/**< Serialization version of saved queues */
+#define PARQ_STORE_NAMELEN	1023	/**< Max length of saved filenames */
+#define PARQ_STORE_MAXLEN	(PARQ_STORE_NAMELEN + 256)	/**< Max record size */
+
+/*
+ * Flags for saved queue entries.
+ */
+#define PARQ_STORE_F_PARQ	(1U << 0)	/**< Entry supports PARQ */
+#define PARQ_STORE_F_QUEUE	(1U << 1)	/**< Entry was sent QUEUE messages */
+#define PARQ_STORE_F_SHA1	(1U << 2)	/**< SHA1 of file is known */
+#define PARQ_STORE_F_XNODE	(1U << 3)	/**< X-Node address is known */
 
 #define MEBI (1024 * 1024)
 /*
@@ -134,6 +153,7 @@ static uint parq_upload_active_size = 20;
 
 static uint parq_upload_ban_window = 600;
 static const char file_parq_file[] = "parq";
+static const char parq_store_magic[] = "GTKG-PARQ";
 
 static plist_t *ul_parqs;			/**< List of all queued uploads */
 static int ul_parqs_cnt;			/**< Amount of queues */
@@ -175,19 +195,25 @@ enum parq_ul_queue_magic {
  */
 struct parq_ul_queue {
 	enum parq_ul_queue_magic magic;
-	plist_t *by_position;		/**< Queued items sorted on position. Newest is
-								 added to the end. */
-	hash_list_t *by_rel_pos;	/**< Queued items sorted by relative position */
+	struct parq_ul_queued **by_slot;	/**< Queued items by arrival slot */
+	fenwick_t *slot_used;		/**< Occupied slots, for absolute positions */
+	fenwick_t *slot_rel;		/**< Listed slots, for relative positions */
+	fenwick_t *slot_eta;		/**< Estimated slot times, for ETAs */
+	uint slot_count;			/**< Amount of slots in the index */
+	uint slot_next;				/**< Next arrival slot to allocate */
 	hash_list_t *by_date_dead;	/**< Dead items sorted on last update */
 	statx_t *slot_stats;		/**< Slot kept-time statistics */
-	int by_position_length;	/**< Number of items in "by_position" */
+	int by_position_length;	/**< Number of queued items */
+	uint eta_base;			/**< Cached ETA of the first position */
+	time_t eta_computed;	/**< When ``eta_base'' was computed */
+	time_t eta_refreshed;	/**< Last refresh of all estimated slot times */
 
 	int num;				/**< Queue number */
 	int active_uploads;
 	int active_queued_cnt;	/**< Number of actively queued entries */
 	int alive;				/**< Amount of alive entries */
 	int frozen;				/**< Subset of alive entries that are frozen */
-	unsigned recompute:1;	/**< Flagged as requiring update of internal data */
+	unsigned eta_stale:1;	/**< Whether ``eta_base'' must be recomputed */
 	unsigned active:1;		/**< Set to false when the number of upload slots
 								 was decreased but the queue still contained
 								 queued items. This queue shall be removed when
@@ -224,11 +250,8 @@ enum parq_ul_magic {
 struct parq_ul_queued {
 	enum parq_ul_magic magic;			/**< Magic number */
 	uint32 flags;			/**< Operating flags */
-	uint position;			/**< Current position in the queue */
-	uint relative_position; /**< Relative position in the queue, if 'not alive'
-								  uploads are taken into account */
-	uint eta;				/**< Expected time in seconds till an upload slot is
-							     reached, this is a relative timestamp */
+	uint slot;				/**< Arrival slot in the queue index */
+	uint slot_time;			/**< Estimated slot time, as recorded in index */
 
 	time_t expire;			/**< Time when the queue position will be lost */
 	time_t retry;			/**< Time when the first retry-after is expected */
@@ -276,6 +299,7 @@ struct parq_ul_queued {
 	unsigned had_slot:1;		/**< Whether we granted a slot to that entry */
 	unsigned is_alive:1;		/**< Whether client is still requesting file */
 	unsigned supports_parq:1;	/**< Is downloader PARQ-aware? */
+	unsigned in_rel:1;			/**< Listed in the relative positions */
 };
 
 static inline void
@@ -1420,234 +1444,387 @@ parq_estimated_slot_time(const struct parq_ul_queued *puq)
 	return pd ? MIN(pd, d) : d;
 }
 
+/***
+ *** Queue index.
+ ***
+ *** Each queue entry is given an arrival slot when it enters the queue, and
+ *** slots are never reordered: the absolute position of an entry is its rank
+ *** among the occupied slots and its relative position is its rank among the
+ *** slots of entries listed in the relative position list (alive entries
+ *** not frozen and not holding a regular upload slot).
+ ***
+ *** Ranks are maintained by Fenwick trees over the slot space, so that
+ *** positions are computed on demand in O(log n) instead of renumbering
+ *** the whole queue each time an entry comes or goes.  A third tree holds
+ *** the estimated slot time of listed entries, making the ETA of an entry
+ *** a simple prefix sum.
+ ***
+ *** When the slot space is exhausted, the index is rebuilt, compacting the
+ *** slots of the remaining entries.
+ ***/
+
 /**
- * Updates the ETA of all queued items in the given queue.
+ * Rebuild the slot index of a queue, compacting the occupied slots.
+ *
+ * @param q		the queue whose index we rebuild
+ * @param count	new amount of slots in the index
  */
 static void
-parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
+parq_ul_index_rebuild(struct parq_ul_queue *q, uint count)
 {
-	plist_t *l;
-	uint eta = 0;
-	uint avg_bps;
-	time_delta_t running_time = delta_time(tm_time(), parq_start);
-	hash_list_iter_t *iter;
+	struct parq_ul_queued **by_slot;
+	uint i, n = 0;
 
-	avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
-	avg_bps = MAX(1024, avg_bps);		/* Assume at least 1 KiB/s */
-	if (GNET_PROPERTY(parq_optimistic))
-		avg_bps = MAX(avg_bps, GNET_PROPERTY(bw_http_out));
+	parq_ul_queue_check(q);
+	g_assert(count > UNSIGNED(q->by_position_length));
 
-	if (which_ul_queue->active_uploads) {
-		/*
-		 * Current queue has an upload slot. Use this one for a start ETA.
-		 * Locate the first active upload in this queue.
-		 */
+	XMALLOC0_ARRAY(by_slot, count + 1);
+	fenwick_free_null(&q->slot_used);
+	fenwick_free_null(&q->slot_rel);
+	fenwick_free_null(&q->slot_eta);
+	q->slot_used = fenwick_make(count);
+	q->slot_rel = fenwick_make(count);
+	q->slot_eta = fenwick_make(count);
 
-		PLIST_FOREACH(which_ul_queue->by_position, l) {
-			struct parq_ul_queued *puq = l->data;
+	for (i = 1; i < q->slot_next; i++) {
+		struct parq_ul_queued *puq = q->by_slot[i];
 
-			if (puq->has_slot) {		/* Recompute ETA */
-				eta += parq_estimated_slot_time(puq);
-				break;
-			}
-		}
+		if (NULL == puq)
+			continue;
+
+		puq->slot = ++n;
+		by_slot[n] = puq;
+		fenwick_add(q->slot_used, n, 1);
+		if (puq->in_rel)
+			fenwick_add(q->slot_rel, n, 1);
+		if (puq->slot_time != 0)
+			fenwick_add(q->slot_eta, n, puq->slot_time);
 	}
 
-	if (eta == 0 && GNET_PROPERTY(ul_running) > GNET_PROPERTY(max_uploads)) {
-		/* We don't have an upload slot available, so a start ETA (for position
-		 * 1) is necessary.
-		 * Use the eta of another queue. First by the queue which uses more than
-		 * one upload slot. If that result is still 0, we have a small problem
-		 * as the ETA can't be calculated correctly anymore.
-		 */
+	g_assert(n == UNSIGNED(q->by_position_length));
 
-		eta = parq_probable_slot_time(which_ul_queue);
+	XFREE_NULL(q->by_slot);
+	q->by_slot = by_slot;
+	q->slot_count = count;
+	q->slot_next = n + 1;
+}
 
-		for (l = ul_parqs; l && 0 == eta; l = plist_next(l)) {
-			struct parq_ul_queue *q = l->data;
+/**
+ * Free the slot index of a queue.
+ */
+static void
+parq_ul_index_free(struct parq_ul_queue *q)
+{
+	XFREE_NULL(q->by_slot);
+	fenwick_free_null(&q->slot_used);
+	fenwick_free_null(&q->slot_rel);
+	fenwick_free_null(&q->slot_eta);
+	q->slot_count = 0;
+	q->slot_next = 1;
+}
 
-			eta = parq_probable_slot_time(q);
-		}
+/**
+ * Allocate a new arrival slot for an entry, at the end of its queue.
+ */
+static void
+parq_ul_index_insert(struct parq_ul_queued *puq)
+{
+	struct parq_ul_queue *q = puq->queue;
 
-		if (eta == 0 && GNET_PROPERTY(parq_debug))
-			g_warning("[PARQ UL] Was unable to calculate an accurate ETA");
-	}
+	parq_ul_queue_check(q);
+	g_assert(0 == puq->slot);
 
-	iter = hash_list_iterator(which_ul_queue->by_rel_pos);
+	if (q->slot_next > q->slot_count) {
+		uint count = 2 * (q->by_position_length + 1);
+		parq_ul_index_rebuild(q, MAX(count, PARQ_SLOTS_MIN));
+	}
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	g_assert(q->slot_next <= q->slot_count);
 
-		g_assert(puq->is_alive);
+	puq->slot = q->slot_next++;
+	q->by_slot[puq->slot] = puq;
+	fenwick_add(q->slot_used, puq->slot, 1);
+}
 
-		puq->eta = eta;
+/**
+ * Release the arrival slot of an entry.
+ */
+static void
+parq_ul_index_remove(struct parq_ul_queued *puq)
+{
+	struct parq_ul_queue *q = puq->queue;
 
-		if (puq->has_slot)
-			continue;			/* Skip already uploading uploads */
+	parq_ul_queue_check(q);
+	g_assert(puq->slot != 0 && puq->slot < q->slot_next);
+	g_assert(q->by_slot[puq->slot] == puq);
+	g_assert(!puq->in_rel);
+	g_assert(0 == puq->slot_time);
+
+	fenwick_add(q->slot_used, puq->slot, -1);
+	q->by_slot[puq->slot] = NULL;
+	puq->slot = 0;
+}
 
-		/*
-		 * Recalculate ETA of queued slots
-		 *
-		 * For the first "max_uploads" ones, we use the normal computation.
-		 * For slots further away, we further compute the average time it
-		 * would take to move to a runnable slot based on global removal
-		 * rate from all the queues.
-		 */
+/**
+ * @return the absolute position of the entry in its queue.
+ */
+static uint
+parq_ul_position(const struct parq_ul_queued *puq)
+{
+	return fenwick_prefix(puq->queue->slot_used, puq->slot);
+}
 
-		if (puq->relative_position > GNET_PROPERTY(max_uploads)) {
-			time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
-			uint cheap_eta = puq->relative_position * per_slot;
+/**
+ * Compute the relative position of the entry in its queue.
+ *
+ * Entries holding a regular upload slot have no relative position.  Entries
+ * not listed otherwise (frozen or dead entries) are given the position they
+ * would have if they were listed again.
+ *
+ * @return the relative position of the entry, 0 meaning it has a regular
+ * upload slot.
+ */
+static uint
+parq_ul_rel_position(const struct parq_ul_queued *puq)
+{
+	const fenwick_t *ft = puq->queue->slot_rel;
 
-			if (cheap_eta < eta)
-				puq->eta = cheap_eta;
-		}
+	if (puq->in_rel)
+		return fenwick_prefix(ft, puq->slot);
 
-		eta += parq_estimated_slot_time(puq);
-	}
+	if (puq->has_slot)
+		return 0;
 
-	hash_list_iter_release(&iter);
+	return fenwick_prefix(ft, puq->slot) + 1;
 }
 
 /**
- * Decreases the position of all queued items after the given queued item.
+ * @return the first entry listed in the relative position list, NULL if none.
  */
-static void
-parq_upload_decrease_all_after(struct parq_ul_queued *puq)
+static struct parq_ul_queued *
+parq_ul_rel_first(const struct parq_ul_queue *q)
 {
-	plist_t *l;
-	int pos_cnt = 0;	/* Used for assertion */
+	size_t slot;
 
-	g_assert(puq != NULL);
-	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_position_length > 0);
-
-	l = plist_find(puq->queue->by_position, puq);
-	pos_cnt = ((struct parq_ul_queued *) l->data)->position;
-
-	l = plist_next(l);	/* Decrease _after_ current parq */
+	if (NULL == q->slot_rel)
+		return NULL;
 
-	/*
-	 * Cycle through list and decrease all positions by one. Position should
-	 * never reach 0 which would mean the queued item is currently uploading
-	 */
-	for (;	l; l = plist_next(l)) {
-		struct parq_ul_queued *p = l->data;
+	slot = fenwick_select(q->slot_rel, 1);
+	return 0 == slot ? NULL : q->by_slot[slot];
+}
 
-		g_assert(p != NULL);
-		g_assert(p->position > 1);
-		g_assert(p->position - 1 == UNSIGNED(pos_cnt));
+/**
+ * @return the entry listed in the relative position list after the given
+ * entry (which does not need to be listed itself), NULL if none.
+ */
+static struct parq_ul_queued *
+parq_ul_rel_next(const struct parq_ul_queued *puq)
+{
+	const struct parq_ul_queue *q = puq->queue;
+	size_t slot;
 
-		p->position--;
-		pos_cnt++;
-	}
+	slot = fenwick_select(q->slot_rel,
+		fenwick_prefix(q->slot_rel, puq->slot) + 1);
+	return 0 == slot ? NULL : q->by_slot[slot];
 }
 
 /**
- * Function used to keep the relative position list sorted by absolute
- * queue positions, which refer to the order of arrival in the queue.
+ * @return the entry listed in the relative position list before the given
+ * entry (which does not need to be listed itself), NULL if none.
  */
-static int
-parq_ul_rel_pos_cmp(const void *a, const void *b)
+static struct parq_ul_queued *
+parq_ul_rel_prev(const struct parq_ul_queued *puq)
 {
-	const struct parq_ul_queued *as = a, *bs = b;
+	const struct parq_ul_queue *q = puq->queue;
+	size_t slot;
 
-	return CMP(as->position, bs->position);
+	slot = fenwick_select(q->slot_rel,
+		fenwick_prefix(q->slot_rel, puq->slot - 1));
+	return 0 == slot ? NULL : q->by_slot[slot];
 }
 
 /**
- * Insert item in relative position list.
+ * Record the estimated slot time of the entry in the queue index.
+ *
+ * Only entries listed in the relative position list and not holding an
+ * upload slot contribute to the ETA of the entries behind them.
+ *
+ * This must be called each time one of these conditions changes, and is
+ * otherwise called periodically to account for bandwidth changes.
  */
-static inline void
-parq_upload_insert_relative(struct parq_ul_queued *puq)
+static void
+parq_upload_update_slot_time(struct parq_ul_queued *puq)
 {
+	uint t;
+
 	parq_ul_queued_check(puq);
 
-	g_assert(!(puq->flags & PARQ_UL_FROZEN));
+	t = (puq->in_rel && !puq->has_slot) ? parq_estimated_slot_time(puq) : 0;
 
-	puq->relative_position = 0;
-	hash_list_insert_sorted(puq->queue->by_rel_pos, puq, parq_ul_rel_pos_cmp);
+	if (t != puq->slot_time) {
+		fenwick_add(puq->queue->slot_eta, puq->slot,
+			(int64) t - (int64) puq->slot_time);
+		puq->slot_time = t;
+	}
 }
 
 /**
- * Remove item from relative position list.
+ * Flag that the upload slot of an entry changed.
  */
-static inline void
-parq_upload_remove_relative(struct parq_ul_queued *puq)
+static void
+parq_upload_slot_changed(struct parq_ul_queued *puq)
 {
-	parq_ul_queued_check(puq);
+	parq_upload_update_slot_time(puq);
+	puq->queue->eta_stale = TRUE;
+}
 
-	hash_list_remove(puq->queue->by_rel_pos, puq);
-	parq_slots_removed++;
+/**
+ * Compute the ETA of the first position in the queue.
+ */
+static uint
+parq_upload_eta_base(struct parq_ul_queue *q)
+{
+	uint eta = 0;
+
+	if (!q->eta_stale && delta_time(tm_time(), q->eta_computed) < 1)
+		return q->eta_base;
+
+	if (q->active_uploads) {
+		uint i;
+
+		/*
+		 * Current queue has an upload slot. Use this one for a start ETA.
+		 * Locate the first active upload in this queue.
+		 */
+
+		for (i = 1; i < q->slot_next; i++) {
+			struct parq_ul_queued *puq = q->by_slot[i];
+
+			if (puq != NULL && puq->has_slot) {
+				eta += parq_estimated_slot_time(puq);
+				break;
+			}
+		}
+	}
+
+	if (eta == 0 && GNET_PROPERTY(ul_running) > GNET_PROPERTY(max_uploads)) {
+		plist_t *l;
+
+		/* We don't have an upload slot available, so a start ETA (for position
+		 * 1) is necessary.
+		 * Use the eta of another queue. First by the queue which uses more than
+		 * one upload slot. If that result is still 0, we have a small problem
+		 * as the ETA can't be calculated correctly anymore.
+		 */
+
+		eta = parq_probable_slot_time(q);
+
+		for (l = ul_parqs; l && 0 == eta; l = plist_next(l)) {
+			struct parq_ul_queue *oq = l->data;
+
+			eta = parq_probable_slot_time(oq);
+		}
+
+		if (eta == 0 && GNET_PROPERTY(parq_debug))
+			g_warning("[PARQ UL] Was unable to calculate an accurate ETA");
+	}
+
+	q->eta_base = eta;
+	q->eta_computed = tm_time();
+	q->eta_stale = FALSE;
+
+	return eta;
 }
 
 /**
- * Recomputes all absolute positions of given queue.
+ * Compute the ETA of a queued item.
  *
- * @param q		the queue for which we wish to recompute position
+ * This is the ETA of the first position, plus the estimated slot times of
+ * all the listed entries ahead of the item.
+ *
+ * For entries further than "max_uploads" away from a slot, we also compute
+ * the average time it would take to move to a runnable slot based on global
+ * removal rate from all the queues, and use it if it is more optimistic.
  */
-static void
-parq_upload_recompute_positions(struct parq_ul_queue *q)
+static uint
+parq_upload_eta(const struct parq_ul_queued *puq)
 {
-	uint pos = 0;
-	uint prev_pos = 0;
-	plist_t *l;
+	struct parq_ul_queue *q = puq->queue;
+	uint64 eta;
+	uint rel;
 
-	parq_ul_queue_check(q);
+	parq_ul_queued_check(puq);
 
-	PLIST_FOREACH(q->by_position, l) {
-		struct parq_ul_queued *puq = l->data;
+	eta = parq_upload_eta_base(q);
+	eta += fenwick_prefix(q->slot_eta, puq->slot - 1);
+	eta = MIN(eta, MAX_INT_VAL(uint));
 
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(puq->position > prev_pos,	/* Was sorted by construction */
-			"pos=%u,, prev=%u", puq->position, prev_pos);
+	if (puq->has_slot)
+		return eta;
+
+	rel = parq_ul_rel_position(puq);
+
+	if (rel > GNET_PROPERTY(max_uploads)) {
+		time_delta_t running_time = delta_time(tm_time(), parq_start);
+		time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
+		uint64 cheap_eta = (uint64) rel * per_slot;
 
-		prev_pos = puq->position;
-		puq->position = ++pos;
+		if (cheap_eta < eta)
+			eta = cheap_eta;
 	}
 
-	g_assert(pos <= UNSIGNED(q->by_position_length));
+	return eta;
 }
 
 /**
- * Recomputes all relative positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
+ * Refresh the estimated slot time of all the listed entries in the queue,
+ * if not done recently.
  */
 static void
-parq_upload_recompute_relative_positions(struct parq_ul_queue *q)
+parq_upload_refresh_slot_times(struct parq_ul_queue *q, time_t now)
 {
-	uint rel = 0;
-	uint prev_rel = 0;
-	uint prev_pos = 0;
-	hash_list_iter_t *iter;
+	struct parq_ul_queued *puq;
 
-	parq_ul_queue_check(q);
+	if (delta_time(now, q->eta_refreshed) < PARQ_ETA_REFRESH)
+		return;
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	for (puq = parq_ul_rel_first(q); puq != NULL; puq = parq_ul_rel_next(puq))
+		parq_upload_update_slot_time(puq);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	q->eta_refreshed = now;
+	q->eta_stale = TRUE;
+}
 
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(
-			0 == puq->relative_position || puq->relative_position > prev_rel,
-			"rel=%u, prev=%u", puq->relative_position, prev_rel);
-		g_assert_log(puq->position > prev_pos,			/* Was sorted */
-			"pos=%u, prev=%u", puq->position, prev_pos);
+/**
+ * Insert item in relative position list.
+ */
+static void
+parq_upload_insert_relative(struct parq_ul_queued *puq)
+{
+	parq_ul_queued_check(puq);
 
-		if (puq->relative_position != 0)
-			prev_rel = puq->relative_position;
-		prev_pos = puq->position;
-		puq->relative_position = ++rel;
-	}
+	g_assert(!(puq->flags & PARQ_UL_FROZEN));
+	g_assert(!puq->in_rel);
 
-	hash_list_iter_release(&iter);
+	puq->in_rel = TRUE;
+	fenwick_add(puq->queue->slot_rel, puq->slot, 1);
+	parq_upload_update_slot_time(puq);
+}
 
-	g_assert(rel <= UNSIGNED(q->by_position_length));
-	g_assert(hash_list_length(q->by_rel_pos) == rel);
+/**
+ * Remove item from relative position list.
+ */
+static void
+parq_upload_remove_relative(struct parq_ul_queued *puq)
+{
+	parq_ul_queued_check(puq);
+
+	if (puq->in_rel) {
+		puq->in_rel = FALSE;
+		fenwick_add(puq->queue->slot_rel, puq->slot, -1);
+		parq_upload_update_slot_time(puq);
+	}
+	parq_slots_removed++;
 }
 
 /**
@@ -1693,7 +1870,7 @@ parq_upload_free(struct parq_ul_queued *puq)
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->queue != NULL);
 	g_assert(puq->queue->by_position_length > 0);
-	g_assert(puq->queue->by_position != NULL);
+	g_assert(puq->slot != 0);
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->total > 0);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -1701,8 +1878,6 @@ parq_upload_free(struct parq_ul_queued *puq)
 	if (puq->u != NULL)
 		puq->u->parq_ul = NULL;
 
-	parq_upload_decrease_all_after(puq);
-
 	if (puq->flags & PARQ_UL_QUEUE)
 		hash_list_remove(ul_parq_queue, puq);
 
@@ -1733,36 +1908,25 @@ parq_upload_free(struct parq_ul_queued *puq)
 		hash_list_remove(puq->queue->by_date_dead, puq);
 	}
 
-	/* Remove the current queued item from all lists */
-	puq->queue->by_position = plist_remove(puq->queue->by_position, puq);
+	/*
+	 * Remove the current queued item from all lists.  The positions and
+	 * ETAs of the items behind it are derived from the queue index, hence
+	 * they are implicitly updated.
+	 */
 
 	parq_upload_remove_relative(puq);
+	if (puq->has_slot)
+		puq->queue->eta_stale = TRUE;
+	parq_ul_index_remove(puq);
 
 	hikset_remove(ul_all_parq_by_addr_and_name, puq->addr_and_name);
 	htable_remove(ul_all_parq_by_id, &puq->id);
 
 	g_assert(!hash_list_contains(puq->queue->by_date_dead, puq));
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
 
-	/*
-	 * Queued upload is now removed from all lists. So queue size can be
-	 * safely decreased and new ETAs can be calculated.
-	 */
 	g_assert(puq->queue->by_position_length > 0);
 	puq->queue->by_position_length--;
 
-	/*
-	 * Don't update ETA on shutdown, we don't need this information, so speed
-	 * up the shutdown process. Also it is better not doing so as on shutdown
-	 * not all entries are removed the 'correct' way, we just want to free
-	 * the memory
-	 */
-	if (!parq_shutdown) {
-		parq_upload_recompute_positions(puq->queue);
-		parq_upload_recompute_relative_positions(puq->queue);
-		parq_upload_update_eta(puq->queue);
-	}
-
 	/* Free the memory used by the current queued item */
 	HFREE_NULL(puq->addr_and_name);
 	atom_sha1_free_null(&puq->sha1);
@@ -1784,7 +1948,7 @@ static uint32
 parq_ul_calc_retry(struct parq_ul_queued *puq)
 {
 	int result = PARQ_TIMER_BY_POS +
-		(puq->relative_position - 1) * (PARQ_TIMER_BY_POS / 2);
+		(parq_ul_rel_position(puq) - 1) * (PARQ_TIMER_BY_POS / 2);
 
 	if (GNET_PROPERTY(parq_optimistic)) {
 		struct parq_ul_queued *puq_prev = NULL;
@@ -1793,7 +1957,7 @@ parq_ul_calc_retry(struct parq_ul_queued *puq)
 		avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
 		avg_bps = MAX(1, avg_bps);
 
-		puq_prev = hash_list_previous(puq->queue->by_rel_pos, puq);
+		puq_prev = parq_ul_rel_prev(puq);
 
 		if (puq_prev != NULL && puq_prev->has_slot) {
 			int fast_result =
@@ -1824,7 +1988,8 @@ parq_upload_new_queue(void)
 	queue->magic = PARQ_UL_QUEUE_MAGIC;
 	queue->active = TRUE;
 	queue->slot_stats = statx_make();
-	queue->by_rel_pos = hash_list_new(NULL, NULL);
+	queue->slot_next = 1;
+	queue->eta_stale = TRUE;
 	queue->by_date_dead = hash_list_new(NULL, NULL);
 
 	ul_parqs = plist_append(ul_parqs, queue);
@@ -1922,10 +2087,7 @@ parq_upload_create(struct upload *u)
 {
 	time_t now = tm_time();
 	struct parq_ul_queued *puq = NULL;
-	struct parq_ul_queued *prev_puq = NULL;
 	struct parq_ul_queue *q = NULL;
-	uint eta = 0;
-	uint rel_pos = 1;
 
 	upload_check(u);
 	g_assert(ul_all_parq_by_addr_and_name != NULL);
@@ -1934,27 +2096,6 @@ parq_upload_create(struct upload *u)
 	q = parq_upload_which_queue(u);
 	g_assert(q != NULL);
 
-	/* Locate the last alive queued item so we can calculate the ETA */
-	prev_puq = hash_list_tail(q->by_rel_pos);
-
-	if (prev_puq != NULL) {
-		parq_ul_queued_check(prev_puq);
-		g_assert(prev_puq->is_alive);	/* Must be to belong to that list */
-
-		rel_pos = prev_puq->relative_position + 1;
-
-		eta = prev_puq->eta;
-
-		if (GNET_PROPERTY(max_uploads) <= 0) {
-			eta = (uint) -1;
-		} else {
-			eta += parq_estimated_slot_time(prev_puq);
-		}
-	}
-
-	/* Will append item to the list */
-	g_assert(hash_list_length(q->by_rel_pos) + 1 == rel_pos);
-
 	/* Create new parq_upload item */
 	WALLOC0(puq);
 	puq->magic = PARQ_UL_MAGIC;
@@ -1970,9 +2111,6 @@ parq_upload_create(struct upload *u)
 	g_assert(puq->addr_and_name != NULL);
 
 	/* Fill puq structure */
-	puq->position = q->by_position_length + 1;
-	puq->relative_position = rel_pos;
-	puq->eta = eta;
 	puq->enter = now;
 	puq->updated = now;
 	puq->file_size = u->file_size;
@@ -2004,17 +2142,17 @@ parq_upload_create(struct upload *u)
 	/* Save into hash table so we can find the current parq ul later */
 	htable_insert(ul_all_parq_by_id, &puq->id, puq);
 
+	/* Append item at the end of the queue */
+	parq_ul_index_insert(puq);
 	q->by_position_length++;
-	q->by_position = plist_append(q->by_position, puq);
-
-	hash_list_append(puq->queue->by_rel_pos, puq);
+	parq_upload_insert_relative(puq);
 
 	if (GNET_PROPERTY(parq_debug) > 3) {
 		g_debug("PARQ UL Q %d/%zd (%3d[%3d]/%3d): New: %s \"%s\"; ID=\"%s\"",
 			puq->queue->num,
 			plist_length(ul_parqs),
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_position(puq),
 			puq->queue->by_position_length,
 			host_addr_to_string(puq->remote_addr),
 			puq->name,
@@ -2041,15 +2179,14 @@ parq_upload_create(struct upload *u)
 	puq->by_addr->list = plist_prepend(puq->by_addr->list, puq);
 
 	g_assert(puq != NULL);
-	g_assert(puq->position > 0);
+	g_assert(puq->slot != 0);
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->name != NULL);
 	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_rel_pos != NULL);
-	g_assert(puq->queue->by_position->data != NULL);
-	g_assert(puq->relative_position > 0);
-	g_assert(puq->relative_position <=
+	g_assert(puq->in_rel);
+	g_assert(parq_ul_rel_position(puq) ==
+		fenwick_total(puq->queue->slot_rel));
+	g_assert(parq_ul_position(puq) ==
 		UNSIGNED(puq->queue->by_position_length));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -2098,7 +2235,7 @@ parq_upload_free_queue(struct parq_ul_queue *queue)
 	ul_parqs_cnt--;
 
 	/* Free memory */
-	hash_list_free(&queue->by_rel_pos);
+	parq_ul_index_free(queue);
 	hash_list_free(&queue->by_date_dead);
 	statx_free(queue->slot_stats);
 	queue->magic = 0;
@@ -2215,8 +2352,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"not PARQ-aware, not sending QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2233,8 +2370,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"no valid address to send QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_rel_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2306,8 +2443,8 @@ parq_upload_send_queue(struct parq_ul_queued *puq)
 			"Sending QUEUE #%d to %s for ID=%s: '%s'",
 			puq->queue->num,
 			ul_parqs_cnt,
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_rel_position(puq),
 			puq->queue->by_position_length,
 			puq->queue_sent,
 			host_addr_port_to_string(puq->addr, puq->port),
@@ -2517,16 +2654,15 @@ parq_dead_timer(void *unused_udata)
 static void
 parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 {
-	hash_list_iter_t *iter;
+	struct parq_ul_queued *puq;
 	pslist_t *to_remove = *rlp;
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	parq_upload_refresh_slot_times(q, now);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+	for (puq = parq_ul_rel_first(q); puq != NULL; puq = parq_ul_rel_next(puq)) {
 		time_delta_t grace;
 
-		g_assert(puq != NULL);
+		parq_ul_queued_check(puq);
 
 		if (
 			puq->expire <= now &&
@@ -2570,8 +2706,8 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 					"Timeout: ID=%s %s '%s'",
 					puq->queue->num,
 					ul_parqs_cnt,
-					puq->position,
-					puq->relative_position,
+					parq_ul_position(puq),
+					parq_ul_rel_position(puq),
 					puq->queue->by_position_length,
 					guid_hex_str(&puq->id),
 					host_addr_to_string(puq->remote_addr),
@@ -2579,16 +2715,14 @@ parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
 
 
 			/*
-			 * Mark for removal. Can't remove now as we are still using the
-			 * ul_parq_by_position linked list. (prepend is probably the
+			 * Mark for removal. Can't remove now as we are still iterating
+			 * over the relative position list. (prepend is probably the
 			 * fastest function)
 			 */
 			to_remove = pslist_prepend(to_remove, puq);
 		}
 	}
 
-	hash_list_iter_release(&iter);
-
 	*rlp = to_remove;
 }
 
@@ -2745,7 +2879,6 @@ parq_upload_timer(time_t now)
 			parq_upload_frozen_clear(puq);
 
 		parq_upload_remove_relative(puq);
-		puq->queue->recompute = TRUE;	/* Defer costly recomputations */
 
 		if (enable_real_passive && parq_still_sharing(puq)) {
 			hash_list_append(puq->queue->by_date_dead, puq);
@@ -2753,20 +2886,6 @@ parq_upload_timer(time_t now)
 			parq_upload_free(puq);
 	}
 
-	/*
-	 * Recompute data only for the queues in which we removed items --RAM.
-	 */
-
-	PLIST_FOREACH(ul_parqs, queues) {
-		struct parq_ul_queue *q = queues->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			parq_upload_update_eta(q);
-			q->recompute = FALSE;
-		}
-	}
-
 	pslist_free_null(&to_remove);
 
 	/*
@@ -3014,11 +3133,10 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 					uqx->is_alive ? "alive" : "dead",
 					guid_hex_str(&uqx->id), uqx->queue->num,
 					host_addr_to_string(puq->by_addr->addr),
-					uqx->relative_position);
+					parq_ul_rel_position(uqx));
 
 			parq_upload_remove_relative(uqx);
 			parq_upload_frozen_set(uqx);
-			uqx->queue->recompute = TRUE;	/* Defer update */
 			extra++;
 		}
 
@@ -3031,19 +3149,6 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), frozen);
 
 	g_assert(puq->by_addr->frozen == frozen);
-
-	/*
-	 * Recompute data only for the queues in which we removed items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3067,11 +3172,7 @@ parq_upload_unfreeze_one(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr));
 
 	parq_upload_frozen_clear(puq);
-
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
-
 	parq_upload_insert_relative(puq);
-	parq_upload_recompute_relative_positions(puq->queue);
 }
 
 /**
@@ -3102,7 +3203,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			parq_upload_frozen_clear(uqx);
 			if (uqx->is_alive) {
 				parq_upload_insert_relative(uqx);
-				uqx->queue->recompute = TRUE;		/* Defer update */
 				inserted++;
 			}
 
@@ -3122,19 +3222,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), inserted);
 
 	g_assert(0 == puq->by_addr->frozen);
-
-	/*
-	 * Recompute data only for the queues in which we inserted items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3145,41 +3232,35 @@ static void
 parq_ul_dump_earlier(struct parq_ul_queued *item)
 {
 	struct parq_ul_queue *q;
-	hash_list_iter_t *iter;
-	unsigned old_relative = 0;
+	struct parq_ul_queued *puq;
+	unsigned relative = 0, item_relative;
 
 	parq_ul_queued_check(item);
 
 	q = item->queue;
 	parq_ul_queue_check(q);
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	item_relative = parq_ul_rel_position(item);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-		
+	for (puq = parq_ul_rel_first(q); puq != NULL; puq = parq_ul_rel_next(puq)) {
 		parq_ul_queued_check(puq);
-		g_assert_log(puq->relative_position > old_relative,
-			"relative=%u, old=%u", puq->relative_position, old_relative);
-		old_relative = puq->relative_position;
+		relative++;
 
 		if (
-			puq->relative_position >= item->relative_position ||
-			puq->relative_position > GNET_PROPERTY(max_uploads)
+			relative >= item_relative ||
+			relative > GNET_PROPERTY(max_uploads)
 		)
 			break;
 
 		g_debug("[PARQ UL] Q#%d pos=%u, rel=%u, slot<has=%s had=%s> updated=%s"
 			" active=%s, quick=%s, alive=%s, flags=0x%x, ID=%s, expire=%s ",
-			q->num, puq->position, puq->relative_position,
+			q->num, parq_ul_position(puq), relative,
 			puq->has_slot ? "y" : "n", puq->had_slot ? "y" : "n",
 			compact_time(delta_time(tm_time(), puq->updated)),
 			puq->active_queued ? "y" : "n", puq->quick ? "y" : "n",
 			puq->is_alive ? "y" : "n", puq->flags, guid_hex_str(&puq->id),
 			timestamp_utc_to_string(puq->expire));
 	}
-	
-	hash_list_iter_release(&iter);
 }
 
 /**
@@ -3195,7 +3276,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 
 	/*
 	 * A "frozen" entry is an entry still in the queue but removed from the
-	 * "by_rel_pos" list because it has concurrent uploads from the same
+	 * relative position list because it has concurrent uploads from the same
 	 * address and its its max number of uploads per IP.
 	 *
 	 * Such an entry gets higher retry time and expiration times, and only
@@ -3275,7 +3356,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 	 * already downloading something in another queue.
 	 */
 
-	if (puq->relative_position <= UNSIGNED(slots_free)) {
+	if (parq_ul_rel_position(puq) <= UNSIGNED(slots_free)) {
 		if (GNET_PROPERTY(parq_debug))
 			g_debug("[PARQ UL] [#%d] allowing %supload \"%s\" from %s (%s), "
 				"relative pos = %u [%s]",
@@ -3285,7 +3366,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 				host_addr_port_to_string(
 					puq->u->socket->addr, puq->u->socket->port),
 				upload_vendor_str(puq->u),
-				puq->relative_position, guid_hex_str(&puq->id));
+				parq_ul_rel_position(puq), guid_hex_str(&puq->id));
 
 		return TRUE;
 	}
@@ -3296,8 +3377,8 @@ parq_upload_continue(struct parq_ul_queued *puq)
 			puq->queue->num, puq->u->name,
 			host_addr_port_to_string(
 				puq->u->socket->addr, puq->u->socket->port),
-			upload_vendor_str(puq->u), puq->position,
-			puq->relative_position);
+			upload_vendor_str(puq->u), parq_ul_position(puq),
+			parq_ul_rel_position(puq));
 
 		if (GNET_PROPERTY(parq_debug) > 5)
 			parq_ul_dump_earlier(puq);
@@ -3449,8 +3530,8 @@ parq_upload_get(struct upload *u, const header_t *header)
 				"ETA: %s Added: %s '%s' %s",
 				puq->queue->num,
 				ul_parqs_cnt,
-				puq->position,
-				puq->relative_position,
+				parq_ul_position(puq),
+				parq_ul_rel_position(puq),
 				puq->queue->by_position_length,
 				short_time(parq_upload_lookup_eta(u)),
 				host_addr_to_string(puq->remote_addr),
@@ -3516,14 +3597,11 @@ parq_upload_get(struct upload *u, const header_t *header)
 		puq->queue->alive++;
 		puq->is_alive = TRUE;
 		g_assert(puq->queue->alive > 0);
-		g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+		g_assert(!puq->in_rel);
 
 		/* Re-insert in the relative position list, unless entry is frozen */
-		if (!(puq->flags & PARQ_UL_FROZEN)) {
+		if (!(puq->flags & PARQ_UL_FROZEN))
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
-			parq_upload_update_eta(puq->queue);
-		}
 	}
 
 	buf = header_get(header, "X-Queue");
@@ -3774,11 +3852,11 @@ parq_upload_request(struct upload *u)
 
 	if (puq->has_slot) {
 		if (!puq->quick) {
-			g_assert(puq->relative_position == 0);
+			g_assert(parq_ul_rel_position(puq) == 0);
 			return TRUE;			/* Has regular slot */
 		}
 		if (parq_upload_quick_continue(puq)) {
-			g_assert(puq->relative_position > 0);
+			g_assert(parq_ul_rel_position(puq) > 0);
 			return TRUE;			/* Has quick slot */
 		}
 		if (GNET_PROPERTY(parq_debug))
@@ -3812,10 +3890,11 @@ parq_upload_request(struct upload *u)
 		 *		--RAM, 2007-08-17
 		 */
 
-		g_assert(puq->relative_position > 0);	/* Was a quick slot */
+		g_assert(parq_ul_rel_position(puq) > 0);	/* Was a quick slot */
 
 		puq->by_addr->uploading--;
 		puq->has_slot = FALSE;
+		parq_upload_slot_changed(puq);
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
 	}
 
@@ -3854,7 +3933,7 @@ parq_upload_request(struct upload *u)
 			if (puq->flags & PARQ_UL_FROZEN)
 				puq->active_queued = FALSE;
 			else if (
-				puq->relative_position <=
+				parq_ul_rel_position(puq) <=
 				1 + UNSIGNED(free_upload_slots(puq->queue)) / 2
 			)
 				u->status = GTA_UL_QUEUED;	/* Maintain active queuing */
@@ -3873,7 +3952,7 @@ parq_upload_request(struct upload *u)
 					"switching from active to passive for %s (%s)",
 					puq->queue->num, guid_hex_str(&puq->id),
 					fd_avail_status_string(fds),
-					puq->relative_position, u->push ? "y" : "n",
+					parq_ul_rel_position(puq), u->push ? "y" : "n",
 					(puq->flags & PARQ_UL_FROZEN) ? "y" : "n",
 					host_addr_port_to_string(u->socket->addr, u->socket->port),
 					upload_vendor_str(u));
@@ -3915,7 +3994,7 @@ parq_upload_request(struct upload *u)
 		queueable = GNET_PROPERTY(sys_nofile) * 4 / 5 >
 			max_fd_used + (MIN_ALWAYS_QUEUE * GNET_PROPERTY(max_uploads));
 
-		if (puq->relative_position <= MIN_ALWAYS_QUEUE)
+		if (parq_ul_rel_position(puq) <= MIN_ALWAYS_QUEUE)
 			queueable = TRUE;
 
 		/*
@@ -3941,8 +4020,8 @@ parq_upload_request(struct upload *u)
 		}
 
 		if (
-			(u->push && puq->relative_position <= max_slot) ||
-			(queueable && puq->relative_position <=
+			(u->push && parq_ul_rel_position(puq) <= max_slot) ||
+			(queueable && parq_ul_rel_position(puq) <=
 				UNSIGNED(free_upload_slots(puq->queue)) + MIN_UPLOAD_ASLOT)
 		) {
 			if ((puq->flags & PARQ_UL_FROZEN) && !activeable) {
@@ -3997,7 +4076,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	if (GNET_PROPERTY(parq_debug) > 2) {
 		g_debug("PARQ UL [#%d] upload pos=%d rel=%d (%s, %s, %s) "
 			"is now busy [%s]",
-			puq->queue->num, puq->position, puq->relative_position,
+			puq->queue->num, parq_ul_position(puq), parq_ul_rel_position(puq),
 			puq->active_queued ? "active" : "passive",
 			puq->has_slot ? "with slot" : "no slot yet",
 			puq->quick ? "quick" : "regular",
@@ -4021,11 +4100,9 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	 *		--RAM, 2007-08-16
 	 */
 
-	if (!puq->quick && puq->relative_position) {
-		parq_upload_remove_relative(puq);
-		parq_upload_recompute_relative_positions(puq->queue);
+	if (!puq->quick && puq->in_rel) {
+		parq_upload_remove_relative(puq);	/* Signals: has regular slot */
 
-		puq->relative_position = 0;		/* Signals: has regular slot */
 		puq->had_slot = TRUE;			/* Had a regular slot */
 		puq->queue->active_uploads++;	/* Account active in queue */
 	}
@@ -4044,6 +4121,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	puq->has_slot = TRUE;
 	puq->by_addr->uploading++;
 	puq->slot_granted = tm_time();
+	parq_upload_slot_changed(puq);
 }
 
 void
@@ -4217,7 +4295,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 	 */
 
 	if (puq->has_slot) {
-		hash_list_iter_t *iter;
+		struct parq_ul_queued *puq_next;
 
 		if (GNET_PROPERTY(parq_debug) > 2)
 			g_debug("PARQ UL: [#%d] [%s] Freed an upload slot%s",
@@ -4235,11 +4313,11 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 		 * Tell next waiting upload that a slot is available, using QUEUE
 		 */
 
-		iter = hash_list_iterator(puq->queue->by_rel_pos);
-
-		while (hash_list_iter_has_next(iter)) {
-			struct parq_ul_queued *puq_next = hash_list_iter_next(iter);
-
+		for (
+			puq_next = parq_ul_rel_first(puq->queue);
+			puq_next != NULL;
+			puq_next = parq_ul_rel_next(puq_next)
+		) {
 			parq_ul_queued_check(puq_next);
 
 			if (puq_next->has_slot)
@@ -4263,13 +4341,11 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			break;
 		}
 
-		hash_list_iter_release(&iter);
-
 		/*
 		 * Put back in queue until it expires.
 		 */
 
-		if (0 == puq->relative_position) {
+		if (0 == parq_ul_rel_position(puq)) {
 			puq->queue->active_uploads--;
 			puq->expire = time_advance(now, GUARDING_TIME);
 
@@ -4282,10 +4358,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			if (puq->had_slot)
 				puq->flags |= PARQ_UL_NOQUEUE;
 
-			g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
-
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
 		}
 
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
@@ -4363,7 +4436,10 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 	}
 
 done:
-	puq->has_slot = FALSE;
+	if (puq->has_slot) {
+		puq->has_slot = FALSE;
+		parq_upload_slot_changed(puq);
+	}
 	puq->slot_granted = 0;
 
 	return FALSE;
@@ -4390,12 +4466,12 @@ parq_upload_add_old_queue_header(char *buf, size_t size,
 	if (small_reply) {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, min_poll, max_poll);
+				parq_ul_rel_position(puq), min_poll, max_poll);
 	} else {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, length=%d, "
 				"limit=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, puq->queue->by_position_length,
+				parq_ul_rel_position(puq), puq->queue->by_position_length,
 				1, min_poll, max_poll);
 	}
 	if (len >= size || (len > 0 && '\n' != buf[len - 1])) {
@@ -4431,7 +4507,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 		puq->flags |= PARQ_UL_ID_SENT;
 
 		len = concat_strings(&buf[rw], size,
-			"; position=", uint32_to_string(puq->relative_position),
+			"; position=", uint32_to_string(parq_ul_rel_position(puq)),
 			(void *) 0);
 
 		if (len < size) {
@@ -4453,7 +4529,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 						rw += len;
 						size -= len;
 						len = concat_strings(&buf[rw], size,
-							"; ETA=", uint32_to_string(puq->eta),
+							"; ETA=", uint32_to_string(parq_upload_eta(puq)),
 							(void *) 0);
 						if (len < size) {
 							rw += len;
@@ -4624,7 +4700,7 @@ parq_upload_lookup_position(const struct upload *u)
 	puq = parq_upload_find(u);
 
 	if (puq != NULL) {
-		return puq->relative_position;
+		return parq_ul_rel_position(puq);
 	} else {
 		return (uint) -1;
 	}
@@ -4656,7 +4732,7 @@ parq_upload_lookup_eta(const struct upload *u)
 
 	/* If puq == NULL the current upload isn't queued and ETA is unknown */
 	if (puq != NULL)
-		return puq->eta;
+		return parq_upload_eta(puq);
 	else
 		return (uint) -1;
 }
@@ -4845,17 +4921,33 @@ parq_upload_send_queue_conf(struct upload *u)
 /**
  * Saves an individual queued upload to disc.
  *
- * This is the callback function used by plist_foreach() in function
- * parq_upload_save_queue().
+ * Each entry is serialized as a record, prefixed by its length on 16 bits:
+ *
+ *   flags       u8      (PARQ_STORE_F_* bits)
+ *   entered     time
+ *   expire      be32    (relative, signed)
+ *   id          16 bytes
+ *   size        ule64
+ *   downloaded  ule64
+ *   ip          ipv4_or_ipv6
+ *   queue_sent  be32    (if PARQ_STORE_F_QUEUE)
+ *   last_queue  time    (if PARQ_STORE_F_QUEUE)
+ *   sha1        20 bytes (if PARQ_STORE_F_SHA1)
+ *   xip         ipv4_or_ipv6 (if PARQ_STORE_F_XNODE)
+ *   xport       be16    (if PARQ_STORE_F_XNODE)
+ *   name        string
+ *
+ * @param puq	the queued entry to save
+ * @param f		the file where record is written
+ * @param mb	message buffer used to serialize the record
  */
-static inline void
-parq_store(void *data, void *file_ptr)
+static void
+parq_store(const struct parq_ul_queued *puq, FILE *f, pmsg_t *mb)
 {
-	FILE *f = file_ptr;
-	struct parq_ul_queued *puq = data;
-	char last_buf[TIMESTAMP_BUFLEN];
-	char enter_buf[TIMESTAMP_BUFLEN];
+	uint8 flags = 0;
 	int expire;
+	bool xnode;
+	char len[2];
 
 	/* We are not saving uploads which already finished an upload */
 	if (puq->had_slot && !puq->has_slot)
@@ -4875,8 +4967,8 @@ parq_store(void *data, void *file_ptr)
 		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): Saving %s: '%s' - %s '%s'",
 			  puq->queue->num,
 			  ul_parqs_cnt,
-			  puq->position,
-			  puq->relative_position,
+			  parq_ul_position(puq),
+			  parq_ul_rel_position(puq),
 			  puq->queue->by_position_length,
 			  puq->supports_parq ? "PARQ" : "slot",
 			  guid_hex_str(&puq->id),
@@ -4884,60 +4976,51 @@ parq_store(void *data, void *file_ptr)
 			  puq->name);
 	}
 
-	timestamp_to_string_buf(puq->enter, enter_buf, sizeof enter_buf);
-	timestamp_to_string_buf(puq->last_queue_sent, last_buf, sizeof last_buf);
-	
 	/*
 	 * Save all needed parq information. The ip and port information gathered
 	 * from X-Node is saved as XIP and XPORT
 	 * The lifetime is saved as a relative value.
 	 */
-	fprintf(f,
-		"QUEUE: %d\n"
-		"POS: %d\n"
-		"ENTERED: %s\n"
-		"EXPIRE: %d\n"
-		"ID: %s\n"
-		"SIZE: %s\n"
-		"GOT: %s\n"
-		"IP: %s\n"
-		,
-		puq->queue->num,
-		puq->position,
-		enter_buf,
-		expire,
-		guid_hex_str(&puq->id),
-		uint64_to_string(puq->file_size),
-		uint64_to_string2(puq->downloaded),
-		host_addr_to_string(puq->remote_addr)
-	);
-
-	if (puq->queue_sent) {
-		fprintf(f,
-			"QUEUESSENT: %d\n"
-			"LASTQUEUE: %s\n"
-			,
-			puq->queue_sent,
-			last_buf
-		);
-	}
 
-	if (puq->sha1)
-		fprintf(f, "SHA1: %s\n", sha1_base32(puq->sha1));
+	xnode = !(puq->flags & PARQ_UL_NOQUEUE) &&
+		puq->port != 0 && is_host_addr(puq->addr);
 
 	if (puq->supports_parq)
-		fprintf(f, "PARQ:\n");	/* No value needed, tag presence is enough */
-	
-	if (
-		!(puq->flags & PARQ_UL_NOQUEUE) &&
-		puq->port != 0 && is_host_addr(puq->addr)
-	) {
-		fprintf(f,
-			"XIP: %s\n"
-			"XPORT: %u\n",
-			host_addr_to_string(puq->addr), (unsigned) puq->port);
+		flags |= PARQ_STORE_F_PARQ;
+	if (puq->queue_sent)
+		flags |= PARQ_STORE_F_QUEUE;
+	if (puq->sha1 != NULL)
+		flags |= PARQ_STORE_F_SHA1;
+	if (xnode)
+		flags |= PARQ_STORE_F_XNODE;
+
+	pmsg_reset(mb);
+	pmsg_write_u8(mb, flags);
+	pmsg_write_time(mb, puq->enter);
+	pmsg_write_be32(mb, (uint32) expire);
+	pmsg_write(mb, &puq->id, sizeof puq->id);
+	pmsg_write_ule64(mb, puq->file_size);
+	pmsg_write_ule64(mb, puq->downloaded);
+	pmsg_write_ipv4_or_ipv6_addr(mb, puq->remote_addr);
+
+	if (flags & PARQ_STORE_F_QUEUE) {
+		pmsg_write_be32(mb, puq->queue_sent);
+		pmsg_write_time(mb, puq->last_queue_sent);
 	}
-	fprintf(f, "NAME: %s\n\n", puq->name);
+
+	if (flags & PARQ_STORE_F_SHA1)
+		pmsg_write(mb, puq->sha1, SHA1_RAW_SIZE);
+
+	if (flags & PARQ_STORE_F_XNODE) {
+		pmsg_write_ipv4_or_ipv6_addr(mb, puq->addr);
+		pmsg_write_be16(mb, puq->port);
+	}
+
+	pmsg_write_fixed_string(mb, puq->name, PARQ_STORE_NAMELEN);
+
+	poke_be16(len, pmsg_written_size(mb));
+	fwrite(len, sizeof len, 1, f);
+	fwrite(pmsg_start(mb), pmsg_written_size(mb), 1, f);
 }
 
 /**
@@ -4949,8 +5032,9 @@ parq_upload_save_queue(void)
 {
 	FILE *f;
 	file_path_t fp;
-	time_t now = tm_time();
 	plist_t *queues;
+	pmsg_t *mb;
+	uint8 version = PARQ_STORE_VERSION;
 
 	if (GNET_PROPERTY(parq_debug) > 3)
 		g_debug("PARQ UL: trying to save all queue info");
@@ -4960,17 +5044,26 @@ parq_upload_save_queue(void)
 	if (!f)
 		return;
 
-	fputs("# THIS FILE IS AUTOMATICALLY GENERATED -- DO NOT EDIT\n#\n", f);
-	fprintf(f, "# Saved on %s\n", timestamp_to_string(now));
+	fwrite(parq_store_magic, CONST_STRLEN(parq_store_magic), 1, f);
+	fwrite(&version, sizeof version, 1, f);
+
+	mb = pmsg_new(PMSG_P_DATA, NULL, PARQ_STORE_MAXLEN);
 
 	for (
 		queues = plist_last(ul_parqs) ; queues != NULL; queues = queues->prev
 	) {
 		struct parq_ul_queue *queue = queues->data;
+		uint i;
 
-		PLIST_FOREACH_CALL_DATA(queue->by_position, parq_store, f);
+		for (i = 1; i < queue->slot_next; i++) {
+			const struct parq_ul_queued *puq = queue->by_slot[i];
+
+			if (puq != NULL)
+				parq_store(puq, f, mb);
+		}
 	}
 
+	pmsg_free(mb);
 	file_config_close(f, &fp);
 
 	if (GNET_PROPERTY(parq_debug) > 3)
@@ -5078,18 +5171,85 @@ typedef struct {
 } parq_entry_t;
 
 /**
- * Loads the saved queue status back into memory.
+ * Restore a queued entry loaded from disk.
+ *
+ * @param entry		the loaded entry (its SHA1 atom, if any, is taken over)
+ * @param now		current time
  */
 static void
-parq_upload_load_queue(void)
+parq_upload_restore(const parq_entry_t *entry, time_t now)
+{
+	struct upload *fake_upload;
+	struct parq_ul_queued *puq;
+
+	/* Fill a fake upload structure */
+	fake_upload = upload_alloc();
+	fake_upload->file_size = entry->filesize;
+	fake_upload->downloaded = entry->downloaded;
+	fake_upload->name = entry->name;
+	fake_upload->addr = entry->addr;
+
+	puq = parq_upload_create(fake_upload);
+	g_assert(puq != NULL);
+
+	/*
+	 * Upon restart, give them time to retry before we expire the
+	 * slot: add MIN_LIFE_TIME to all expiration times.
+	 *		--RAM, 2007-08-18
+	 */
+
+	puq->supports_parq = entry->supports_parq;
+	puq->enter = entry->entered;
+	puq->expire = time_advance(now, MIN_LIFE_TIME + entry->expire);
+	puq->addr = entry->x_addr;
+	puq->port = entry->xport;
+	puq->sha1 = entry->sha1;
+	puq->last_queue_sent = entry->last_queue_sent;
+	puq->queue_sent = entry->queue_sent;
+	puq->send_next_queue =
+		parq_upload_next_queue(entry->last_queue_sent, puq);
+
+	/* During parq_upload_create already created an ID for us */
+	htable_remove(ul_all_parq_by_id, &puq->id);
+
+	STATIC_ASSERT(sizeof entry->id == sizeof puq->id);
+	memcpy(&puq->id, &entry->id, sizeof puq->id);
+	htable_insert(ul_all_parq_by_id, &puq->id, puq);
+
+	if (GNET_PROPERTY(parq_debug) > 2) {
+		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d) ETA: %s "
+			"restored: %s%s '%s'",
+			puq->queue->num,
+			ul_parqs_cnt,
+			parq_ul_position(puq),
+		 	parq_ul_rel_position(puq),
+			puq->queue->by_position_length,
+			short_time(parq_upload_lookup_eta(fake_upload)),
+			host_addr_to_string(puq->remote_addr),
+			puq->supports_parq ? " (PARQ)" : "",
+			puq->name);
+	}
+
+	if (host_is_valid(puq->addr, puq->port)) {
+		if (GNET_PROPERTY(max_uploads) > 0)
+			parq_upload_register_send_queue(puq);
+	} else {
+		puq->flags |= PARQ_UL_NOQUEUE;
+	}
+
+	upload_free(&fake_upload);
+}
+
+/**
+ * Loads the saved queue status from a legacy text file.
+ */
+static void
+parq_upload_load_text(FILE *f)
 {
 	static const parq_entry_t zero_entry;
 	parq_entry_t entry;
-	FILE *f;
-	file_path_t fp[1];
 	char line[4096];
 	bool next = FALSE;
-	struct parq_ul_queued *puq;
 	time_t now = tm_time();
 	uint line_no = 0;
 	uint64 v;
@@ -5098,14 +5258,6 @@ parq_upload_load_queue(void)
 	bit_array_t tag_used[BIT_ARRAY_SIZE(NUM_PARQ_TAGS)];
 	bool resync = FALSE;
 
-	file_path_set(fp, settings_config_dir(), file_parq_file);
-	f = file_config_open_read("PARQ upload queue data", fp, G_N_ELEMENTS(fp));
-	if (!f)
-		return;
-
-	if (GNET_PROPERTY(parq_debug))
-		g_debug("[PARQ UL] loading queue information");
-
 	/* Reset state */
 	entry = zero_entry;
 	bit_array_init(tag_used, NUM_PARQ_TAGS);
@@ -5341,73 +5493,162 @@ parq_upload_load_queue(void)
 		}
 
 		if (next) {
-			struct upload *fake_upload;
-
 			next = FALSE;
 
 			g_assert(!damaged);
-			g_assert(entry.name != NULL);
 
-			/* Fill a fake upload structure */
-			fake_upload = upload_alloc();
-			fake_upload->file_size = entry.filesize;
-			fake_upload->downloaded = entry.downloaded;
-			fake_upload->name = entry.name;
-			fake_upload->addr = entry.addr;
+			parq_upload_restore(&entry, now);
 
-			puq = parq_upload_create(fake_upload);
-			g_assert(puq != NULL);
+			/* Reset state */
+			entry = zero_entry;
+			bit_array_clear_range(tag_used, 0, NUM_PARQ_TAGS - 1);
+		}
+	}
+}
 
-			/*
-			 * Upon restart, give them time to retry before we expire the
-			 * slot: add MIN_LIFE_TIME to all expiration times.
-			 *		--RAM, 2007-08-18
-			 */
+/**
+ * Deserialize a queued entry record saved by parq_store().
+ *
+ * @param bs		the binary stream holding the record
+ * @param entry		where the entry is filled
+ *
+ * @return TRUE if OK, FALSE if the record was damaged.
+ */
+static bool
+parq_upload_load_entry(bstr_t *bs, parq_entry_t *entry)
+{
+	uint8 flags;
+	uint32 expire;
+	uint64 v;
+	size_t slen;
+	struct sha1 sha1;
 
-			puq->supports_parq = entry.supports_parq;
-			puq->enter = entry.entered;
-			puq->expire = time_advance(now, MIN_LIFE_TIME + entry.expire);
-			puq->addr = entry.x_addr;
-			puq->port = entry.xport;
-			puq->sha1 = entry.sha1;
-			puq->last_queue_sent = entry.last_queue_sent;
-			puq->queue_sent = entry.queue_sent;
-			puq->send_next_queue =
-				parq_upload_next_queue(entry.last_queue_sent, puq);
+	bstr_read_u8(bs, &flags);
+	bstr_read_time(bs, &entry->entered);
+	bstr_read_be32(bs, &expire);
+	bstr_read(bs, &entry->id, sizeof entry->id);
 
-			/* During parq_upload_create already created an ID for us */
-			htable_remove(ul_all_parq_by_id, &puq->id);
+	if (bstr_read_ule64(bs, &v))
+		entry->filesize = v;
+	if (bstr_read_ule64(bs, &v))
+		entry->downloaded = v;
 
-			STATIC_ASSERT(sizeof entry.id == sizeof puq->id);
-			memcpy(&puq->id, &entry.id, sizeof puq->id);
-			htable_insert(ul_all_parq_by_id, &puq->id, puq);
+	bstr_read_packed_ipv4_or_ipv6_addr(bs, &entry->addr);
 
-			if (GNET_PROPERTY(parq_debug) > 2) {
-				g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d) ETA: %s "
-					"restored: %s%s '%s'",
-					puq->queue->num,
-					ul_parqs_cnt,
-					puq->position,
-				 	puq->relative_position,
-					puq->queue->by_position_length,
-					short_time(parq_upload_lookup_eta(fake_upload)),
-					host_addr_to_string(puq->remote_addr),
-					puq->supports_parq ? " (PARQ)" : "",
-					puq->name);
-			}
+	if (flags & PARQ_STORE_F_QUEUE) {
+		uint32 sent;
 
-			if (host_is_valid(puq->addr, puq->port)) {
-				if (GNET_PROPERTY(max_uploads) > 0)
-					parq_upload_register_send_queue(puq);
-			} else {
-				puq->flags |= PARQ_UL_NOQUEUE;
-			}
+		if (bstr_read_be32(bs, &sent))
+			entry->queue_sent = MIN(sent, INT_MAX);
+		bstr_read_time(bs, &entry->last_queue_sent);
+	}
 
-			/* Reset state */
-			entry = zero_entry;
-			bit_array_clear_range(tag_used, 0, NUM_PARQ_TAGS - 1);
-			upload_free(&fake_upload);	
+	if (flags & PARQ_STORE_F_SHA1)
+		bstr_read(bs, &sha1, sizeof sha1);
+
+	if (flags & PARQ_STORE_F_XNODE) {
+		uint16 port;
+
+		bstr_read_packed_ipv4_or_ipv6_addr(bs, &entry->x_addr);
+		if (bstr_read_be16(bs, &port))
+			entry->xport = port;
+	}
+
+	bstr_read_fixed_string(bs, &slen, entry->name, sizeof entry->name);
+
+	if (bstr_has_error(bs))
+		return FALSE;
+
+	entry->expire = (int32) expire;
+	entry->supports_parq = booleanize(flags & PARQ_STORE_F_PARQ);
+
+	if (flags & PARQ_STORE_F_SHA1)
+		entry->sha1 = atom_sha1_get(&sha1);
+
+	return TRUE;
+}
+
+/**
+ * Loads the saved queue status from a binary file, positionned after the
+ * file magic.
+ */
+static void
+parq_upload_load_binary(FILE *f)
+{
+	static const parq_entry_t zero_entry;
+	char buf[PARQ_STORE_MAXLEN];
+	time_t now = tm_time();
+	uint8 version;
+	uint n = 0;
+
+	if (1 != fread(&version, sizeof version, 1, f))
+		return;
+
+	if (version > PARQ_STORE_VERSION) {
+		g_warning("%s(): unknown PARQ queue format version %u",
+			G_STRFUNC, version);
+		return;
+	}
+
+	for (;;) {
+		parq_entry_t entry = zero_entry;
+		char len[2];
+		size_t reclen;
+		bstr_t *bs;
+
+		if (1 != fread(len, sizeof len, 1, f))
+			break;
+
+		reclen = peek_be16(len);
+		if (reclen > sizeof buf || 1 != fread(buf, reclen, 1, f)) {
+			g_warning("%s(): truncated or damaged PARQ entry #%u",
+				G_STRFUNC, n + 1);
+			break;
+		}
+
+		n++;
+		bs = bstr_open(buf, reclen, BSTR_F_ERROR);
+
+		if (parq_upload_load_entry(bs, &entry)) {
+			parq_upload_restore(&entry, now);
+		} else {
+			g_warning("%s(): ignoring damaged PARQ entry #%u: %s",
+				G_STRFUNC, n, bstr_error(bs));
 		}
+
+		bstr_free(&bs);
+	}
+}
+
+/**
+ * Loads the saved queue status back into memory.
+ *
+ * Queues are saved in binary form, but we still know how to read back the
+ * former text format, to be able to restore queues saved by older versions.
+ */
+static void
+parq_upload_load_queue(void)
+{
+	FILE *f;
+	file_path_t fp[1];
+	char magic[CONST_STRLEN(parq_store_magic)];
+
+	file_path_set(fp, settings_config_dir(), file_parq_file);
+	f = file_config_open_read("PARQ upload queue data", fp, G_N_ELEMENTS(fp));
+	if (!f)
+		return;
+
+	if (GNET_PROPERTY(parq_debug))
+		g_debug("[PARQ UL] loading queue information");
+
+	if (
+		1 == fread(magic, sizeof magic, 1, f) &&
+		0 == memcmp(magic, parq_store_magic, sizeof magic)
+	) {
+		parq_upload_load_binary(f);
+	} else {
+		rewind(f);
+		parq_upload_load_text(f);
 	}
 
 	fclose(f);
@@ -5487,6 +5728,7 @@ parq_close_pre(void)
 {
 	plist_t *dl, *queues;
 	pslist_t *sl, *to_remove = NULL, *to_removeq = NULL;
+	uint i;
 
 	parq_shutdown = TRUE;
 
@@ -5515,11 +5757,11 @@ parq_close_pre(void)
 	for (queues = ul_parqs; queues != NULL; queues = queues->next) {
 		struct parq_ul_queue *queue = queues->data;
 
-		PLIST_FOREACH(queue->by_position, dl) {
-			struct parq_ul_queued *puq = dl->data;
+		for (i = 1; i < queue->slot_next; i++) {
+			struct parq_ul_queued *puq = queue->by_slot[i];
 
 			if (puq == NULL)
-				break;
+				continue;
 
 			puq->by_addr->uploading = 0;
 
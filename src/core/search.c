@@ -86,6 +86,7 @@
 #include "xml/xfmt.h"
 
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/array.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
@@ -788,7 +789,7 @@ search_free_record(gnet_record_t *rc)
 	atom_sha1_free_null(&rc->sha1);
 	atom_tth_free_null(&rc->tth);
 	search_free_alt_locs(rc);
-	WFREE(rc);
+	ARENA_WFREE(rc);
 }
 
 static gnet_results_set_t *
@@ -797,7 +798,7 @@ search_new_r_set(void)
 	static const gnet_results_set_t zero_rs;
 	gnet_results_set_t *rs;
 
-	WALLOC(rs);
+	ARENA_WALLOC(rs);
 	*rs = zero_rs;
 	return rs;
 }
@@ -820,7 +821,7 @@ search_free_r_set(gnet_results_set_t *rs)
 	search_free_proxies(rs);
 
 	pslist_free_null(&rs->records);
-	WFREE(rs);
+	ARENA_WFREE(rs);
 }
 
 
@@ -830,7 +831,7 @@ search_record_new(void)
 	static const gnet_record_t zero_record;
 	gnet_record_t *rc;
 
-	WALLOC(rc);
+	ARENA_WALLOC(rc);
 	*rc = zero_record;
 	rc->create_time = (time_t) -1;
 	return rc;
@@ -5825,6 +5826,7 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 	hostiles_flags_t flags;
 	const guid_t *muid;
 	guid_t muid_buf;
+	arena_mark_t mark;
 
 	g_assert(!(NULL != t) == !NODE_TALKS_G2(n));
 
@@ -5875,8 +5877,14 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 	 *
 	 * If we're not going to dispatch it to any search or auto-download files
 	 * based on the SHA1, the packet is only parsed for validation.
+	 *
+	 * The results set, its records and the parsed extensions all die with
+	 * the processing of the message, so they are allocated from the thread
+	 * arena and released at once when we are done.
 	 */
 
+	arena_thread_enter(&mark);
+
 	if (NULL == t)
 		rs = get_results_set(n, FALSE, &flags);
 	else
@@ -6100,6 +6108,7 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
     search_free_r_set(rs);
 
 final_cleanup:
+	arena_thread_leave(&mark);
 	pslist_free(selected_searches);
 
 	return drop_it || !forward_it;
@@ -2648,6 +2648,28 @@ zalloc_always_gc_changed(property_t prop)
     return FALSE;
 }
 
+static bool
+vmm_hugepages_changed(property_t prop)
+{
+	bool val;
+
+	gnet_prop_get_boolean_val(prop, &val);
+	set_vmm_hugepages(val);
+
+    return FALSE;
+}
+
+static bool
+vmm_numa_local_changed(property_t prop)
+{
+	bool val;
+
+	gnet_prop_get_boolean_val(prop, &val);
+	set_vmm_numa_local(val);
+
+    return FALSE;
+}
+
 static bool
 zalloc_debug_changed(property_t prop)
 {
@@ -3327,6 +3349,16 @@ static prop_map_t property_map[] = {
         PROP_ZALLOC_ALWAYS_GC,
         zalloc_always_gc_changed,
         TRUE
+    },
+    {
+        PROP_VMM_HUGEPAGES,
+        vmm_hugepages_changed,
+        TRUE
+    },
+    {
+        PROP_VMM_NUMA_LOCAL,
+        vmm_numa_local_changed,
+        TRUE
     },
 	{
 		PROP_FORCE_LOCAL_IP,
@@ -48,6 +48,7 @@
 #include "lib/halloc.h"
 #include "lib/path.h"
 #include "lib/sorted_array.h"
+#include "lib/stringify.h"
 #include "lib/str.h"
 #include "lib/watcher.h"
 
@@ -74,6 +75,7 @@ enum spam_state {
 
 struct sha1_lut {
 	struct sorted_array *tab;
+	struct sorted_array *pending;	/**< SHA-1s to bulk-load in the DB */
 	enum spam_state state;
 	union {
 		dbmw_t *dw;
@@ -116,11 +118,16 @@ spam_lut_create(void)
 			 * During loading we use the dbmap directly, not the wrapper
 			 * since we don't care about that high-level cache layer which
 			 * is going to slow us down needlessly.
+			 *
+			 * SHA-1s are collected and only inserted at the end of the
+			 * loading, in one single bulk insertion.
 			 */
 
 			dbmap_set_volatile(dm, TRUE);
 			dbmap_set_cachesize(dm, SPAM_DB_LOAD_CACHESIZE);
 			sha1_lut.d.dm = dm;
+			sha1_lut.pending =
+				sorted_array_new(sizeof(struct sha1), sha1_cmp_func);
 		}
 	}
 }
@@ -135,8 +142,7 @@ spam_sha1_add(const struct sha1 *sha1)
 		sorted_array_add(sha1_lut.tab, sha1);
 	else {
 		if (SPAM_LOADING == sha1_lut.state) {
-			dbmap_datum_t val = { NULL, 0 };
-			dbmap_insert(sha1_lut.d.dm, sha1, val);
+			sorted_array_add(sha1_lut.pending, sha1);
 		} else {
 			dbmw_write(sha1_lut.d.dw, sha1, NULL, 0);
 		}
@@ -151,6 +157,36 @@ sha1_collision(const void *a, const void *b)
 	return 1;
 }
 
+/**
+ * Insert all the SHA-1s collected during loading into the database.
+ */
+static void
+spam_sha1_bulk_load(dbmap_t *dm)
+{
+	dbmap_pair_t *pairs;
+	size_t i, count;
+
+	sorted_array_sync(sha1_lut.pending, sha1_collision);
+	count = sorted_array_size(sha1_lut.pending);
+
+	HALLOC_ARRAY(pairs, count);
+
+	for (i = 0; i < count; i++) {
+		pairs[i].key = sorted_array_item(sha1_lut.pending, i);
+		pairs[i].value.data = NULL;
+		pairs[i].value.len = 0;
+	}
+
+	if (!dbmap_insert_bulk(dm, pairs, count)) {
+		g_warning("%s(): could not load %zu SHA-1%s into %s: %s",
+			G_STRFUNC, count, plural(count), db_spambase,
+			dbmap_strerror(dm));
+	}
+
+	HFREE_NULL(pairs);
+	sorted_array_free(&sha1_lut.pending);
+}
+
 void
 spam_sha1_sync(void)
 {
@@ -159,6 +195,8 @@ spam_sha1_sync(void)
 	} else if (SPAM_LOADING == sha1_lut.state) {
 		dbmap_t *dm = sha1_lut.d.dm;
 
+		spam_sha1_bulk_load(dm);
+
 		/*
 		 * Now that loading is finished, we can wrap the dbmap to use some
 		 * amount of high-level caching, and therefore reduce the amount
@@ -346,6 +384,7 @@ void
 spam_sha1_close(void)
 {
 	sorted_array_free(&sha1_lut.tab);
+	sorted_array_free(&sha1_lut.pending);
 	if (sha1_lut.d.dw) {
 		dbmw_destroy(sha1_lut.d.dw, TRUE);
 		sha1_lut.d.dw = NULL;
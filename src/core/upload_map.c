@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Shared memory-mapped windows on uploaded files.
+ *
+ * When sendfile() cannot be used (TLS connections, or after sendfile()
+ * failed), uploads used to pread() each chunk of the file into their own
+ * private buffer before handing it to the bandwidth scheduler.  Popular
+ * files being served to many hosts at the same time, the same data was
+ * read and copied over and over.
+ *
+ * This module maps fixed-size, aligned windows of shared files and lets
+ * all the uploads serving the same region of the same file share them.
+ * Windows are reference-counted: each upload holds at most one window,
+ * the one covering its current read position.  When the last reference
+ * goes away, the window is not unmapped immediately but kept in an LRU
+ * list of idle windows, so that a host coming next for the same region
+ * will find it mapped already.
+ *
+ * Upon mapping, the kernel is told that the window will be read
+ * sequentially and soon, so that it can start reading ahead.
+ *
+ * Accessing a mapped page beyond the end of a file that was truncated
+ * raises SIGBUS, so the size of the file on disk is checked when a window
+ * is acquired, and then at most once per second whilst data are fetched
+ * from it: if it no longer matches what was mapped, the window is discarded
+ * and the caller reads the data by other means.  This is not a guarantee:
+ * a file truncated by another program between two checks will still cause
+ * a SIGBUS when the uploads touch the vanished pages, which is a known
+ * hazard of serving shared files from mappings.
+ *
+ * All the routines here must be called from the main thread.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "upload_map.h"
+
+#include "share.h"
+
+#include "if/gnet_property_priv.h"
+
+#include "lib/dump_options.h"
+#include "lib/file_object.h"
+#include "lib/hashing.h"
+#include "lib/hashlist.h"
+#include "lib/hikset.h"
+#include "lib/log.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/tm.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define UPLOAD_MAP_WINDOW	(1024 * 1024)	/**< Size of a mapped window */
+#define UPLOAD_MAP_IDLE		32				/**< Max amount of idle windows */
+
+/**
+ * Window key: file and index of the window within that file.
+ */
+struct upload_map_key {
+	const shared_file_t *sf;		/**< Mapped file (referenced) */
+	filesize_t index;				/**< Window index in file */
+};
+
+enum upload_map_magic { UPLOAD_MAP_MAGIC = 0x1b7e03c9 };
+
+/**
+ * A mapped window.
+ */
+struct upload_map {
+	enum upload_map_magic magic;
+	struct upload_map_key key;		/**< Embedded key, for the hikset */
+	file_object_t *fo;				/**< Mapped file, to check its size */
+	void *base;						/**< Start of the mapped region */
+	size_t len;						/**< Length of the mapped region */
+	filesize_t start;				/**< File offset of the mapped region */
+	filesize_t size;				/**< File size when mapped */
+	time_t mtime;					/**< File modification time when mapped */
+	time_t checked;					/**< Last check of size on disk */
+	int refcnt;						/**< Amount of uploads using the window */
+};
+
+static inline void
+upload_map_check(const struct upload_map * const um)
+{
+	g_assert(um != NULL);
+	g_assert(UPLOAD_MAP_MAGIC == um->magic);
+	g_assert(um->refcnt >= 0);
+}
+
+/**
+ * Cache statistics.
+ */
+static struct upload_map_stats {
+	uint64 lookups;					/**< Window lookups */
+	uint64 hits;					/**< Window was already mapped */
+	uint64 hits_idle;				/**< Window was found in the idle list */
+	uint64 misses;					/**< Window had to be mapped */
+	uint64 failures;				/**< Failed mappings */
+	uint64 stale;					/**< Windows discarded, file changed */
+	uint64 evictions;				/**< Idle windows evicted */
+	uint64 mapped_bytes;			/**< Total amount of bytes mapped */
+} upload_map_stats;
+
+static hikset_t *upload_maps;		/**< All the windows, by key */
+static hash_list_t *upload_idle;	/**< Idle windows, most recent first */
+
+static uint
+upload_map_key_hash(const void *key)
+{
+	const struct upload_map_key *k = key;
+
+	return pointer_hash(k->sf) ^ integer_hash(k->index);
+}
+
+static bool
+upload_map_key_eq(const void *a, const void *b)
+{
+	const struct upload_map_key *ka = a, *kb = b;
+
+	return ka->sf == kb->sf && ka->index == kb->index;
+}
+
+/**
+ * Unmap window and free it, once it has been removed from the table.
+ */
+static void
+upload_map_destroy(struct upload_map *um)
+{
+	upload_map_check(um);
+	g_assert(0 == um->refcnt);
+
+	vmm_munmap(um->base, um->len);
+	file_object_release(&um->fo);
+	shared_file_unref(deconstify_pointer(&um->key.sf));
+	um->magic = 0;
+	WFREE(um);
+}
+
+/**
+ * Unmap window and free it.
+ *
+ * The window must be no longer referenced nor present in the idle list.
+ */
+static void
+upload_map_free(struct upload_map *um)
+{
+	upload_map_check(um);
+
+	hikset_remove(upload_maps, &um->key);
+	upload_map_destroy(um);
+}
+
+/**
+ * Fetch current size of the file on disk.
+ *
+ * @return TRUE if OK, with the size written in ``size''.
+ */
+static bool
+upload_map_disk_size(const file_object_t *fo, filesize_t *size)
+{
+	filestat_t buf;
+
+	if G_UNLIKELY(-1 == file_object_fstat(fo, &buf))
+		return FALSE;
+
+	*size = buf.st_size;
+	return TRUE;
+}
+
+/**
+ * Check that the size of the file on disk is still the one we mapped.
+ *
+ * Unless ``force'' is set, the check is done at most once per second.
+ *
+ * @return whether the window can still be read safely.
+ */
+static bool
+upload_map_on_disk(struct upload_map *um, bool force)
+{
+	time_t now = tm_time();
+	filesize_t disk_size;
+
+	if (!force && um->checked == now)
+		return TRUE;
+
+	if (!upload_map_disk_size(um->fo, &disk_size) || disk_size != um->size)
+		return FALSE;
+
+	um->checked = now;
+	return TRUE;
+}
+
+/**
+ * Is the window still accurately mapping its file?
+ */
+static bool
+upload_map_is_current(const struct upload_map *um)
+{
+	return um->size == shared_file_size(um->key.sf) &&
+		um->mtime == shared_file_modification_time(um->key.sf);
+}
+
+/**
+ * Trim the idle list down to its maximum length, evicting the least
+ * recently used windows.
+ */
+static void
+upload_map_trim(size_t max)
+{
+	while (hash_list_length(upload_idle) > max) {
+		struct upload_map *um = hash_list_remove_tail(upload_idle);
+
+		upload_map_stats.evictions++;
+		upload_map_free(um);
+	}
+}
+
+/**
+ * Map new window for the file.
+ *
+ * @return the new window, NULL if it could not be mapped.
+ */
+static struct upload_map *
+upload_map_create(const shared_file_t *sf, filesize_t index)
+{
+#ifdef HAS_MMAP
+	struct upload_map *um;
+	file_object_t *fo;
+	filesize_t start, size;
+	size_t len;
+	void *p;
+
+	size = shared_file_size(sf);
+	start = index * UPLOAD_MAP_WINDOW;
+
+	if G_UNLIKELY(start >= size)
+		return NULL;
+
+	fo = file_object_open(shared_file_path(sf), O_RDONLY);
+	if G_UNLIKELY(NULL == fo)
+		return NULL;
+
+	/*
+	 * Do not map a file whose size on disk is not the one we are sharing:
+	 * it is being changed and must be read with pread(), which copes with
+	 * a truncated file.
+	 */
+
+	{
+		filesize_t disk_size;
+
+		if (!upload_map_disk_size(fo, &disk_size) || disk_size != size) {
+			file_object_release(&fo);
+			return NULL;
+		}
+	}
+
+	len = MIN(UPLOAD_MAP_WINDOW, size - start);
+	p = vmm_mmap(NULL, len, PROT_READ, MAP_PRIVATE, file_object_fd(fo), start);
+
+	if G_UNLIKELY(MAP_FAILED == p) {
+		if (GNET_PROPERTY(upload_debug)) {
+			g_warning("%s(): cannot map %zu bytes at offset %s of \"%s\": %m",
+				G_STRFUNC, len, filesize_to_string(start),
+				shared_file_path(sf));
+		}
+		file_object_release(&fo);
+		return NULL;
+	}
+
+	/*
+	 * Uploads read files sequentially: let the kernel start reading the
+	 * whole window ahead of our first access.
+	 */
+
+	vmm_madvise_sequential(p, len);
+	vmm_madvise_willneed(p, len);
+
+	WALLOC0(um);
+	um->magic = UPLOAD_MAP_MAGIC;
+	um->key.sf = shared_file_ref(sf);
+	um->key.index = index;
+	um->fo = fo;
+	um->base = p;
+	um->len = len;
+	um->start = start;
+	um->size = size;
+	um->mtime = shared_file_modification_time(sf);
+	um->checked = tm_time();		/* Size on disk checked above */
+
+	hikset_insert(upload_maps, um);
+	upload_map_stats.mapped_bytes += len;
+
+	return um;
+#else	/* !HAS_MMAP */
+	(void) sf;
+	(void) index;
+	return NULL;
+#endif	/* HAS_MMAP */
+}
+
+/**
+ * Get a reference on the window of the file at given index, mapping it
+ * if needed.
+ *
+ * @return referenced window, NULL if it could not be mapped.
+ */
+static struct upload_map *
+upload_map_acquire(const shared_file_t *sf, filesize_t index)
+{
+	struct upload_map_key key;
+	struct upload_map *um;
+
+	key.sf = sf;
+	key.index = index;
+
+	upload_map_stats.lookups++;
+	um = hikset_lookup(upload_maps, &key);
+
+	if (um != NULL) {
+		upload_map_check(um);
+
+		if (0 == um->refcnt)
+			hash_list_remove(upload_idle, um);
+
+		if G_UNLIKELY(
+			!upload_map_is_current(um) || !upload_map_on_disk(um, TRUE)
+		) {
+			/*
+			 * File changed on disk since we mapped it.  Let current users
+			 * finish with the old mapping but detach it from the table so
+			 * that we map the window again.
+			 */
+
+			upload_map_stats.stale++;
+			if (0 == um->refcnt) {
+				upload_map_free(um);
+			} else {
+				hikset_remove(upload_maps, &um->key);
+			}
+			um = NULL;
+		} else {
+			upload_map_stats.hits++;
+			if (0 == um->refcnt)
+				upload_map_stats.hits_idle++;
+		}
+	}
+
+	if (NULL == um) {
+		um = upload_map_create(sf, index);
+		if G_UNLIKELY(NULL == um) {
+			upload_map_stats.failures++;
+			return NULL;
+		}
+		upload_map_stats.misses++;
+	}
+
+	um->refcnt++;
+	return um;
+}
+
+/**
+ * Release reference on window, nullifying the pointer.
+ */
+void
+upload_map_release(struct upload_map **um_ptr)
+{
+	struct upload_map *um = *um_ptr;
+
+	if (NULL == um)
+		return;
+
+	upload_map_check(um);
+	g_assert(um->refcnt > 0);
+	g_assert(thread_is_main());
+
+	*um_ptr = NULL;
+
+	if (0 != --um->refcnt)
+		return;
+
+	/*
+	 * Windows that were detached from the table because the file changed
+	 * are freed as soon as they are no longer used.  Otherwise, keep the
+	 * window around for the next host requesting the same region.
+	 */
+
+	if (hikset_lookup(upload_maps, &um->key) != um) {
+		upload_map_destroy(um);
+		return;
+	}
+
+	hash_list_prepend(upload_idle, um);
+	upload_map_trim(UPLOAD_MAP_IDLE);
+}
+
+/**
+ * Get mapped data for the file at the given offset.
+ *
+ * The window covering the offset is held in ``*um_ptr'', on behalf of the
+ * caller: a previously held window not covering the offset is released.
+ * The caller must eventually call upload_map_release() on ``*um_ptr''.
+ *
+ * @param um_ptr	where the currently held window is kept
+ * @param sf		the file being read
+ * @param offset	file offset of the data we want
+ * @param len		written with the amount of data available at returned ptr
+ *
+ * @return pointer to the data at the given offset, NULL if the file
+ * region cannot be mapped, in which case the caller must read the data
+ * by other means.
+ */
+const void *
+upload_map_data(struct upload_map **um_ptr,
+	const shared_file_t *sf, filesize_t offset, size_t *len)
+{
+	struct upload_map *um = *um_ptr;
+	filesize_t index = offset / UPLOAD_MAP_WINDOW;
+	size_t off;
+
+	g_assert(thread_is_main());
+	g_assert(len != NULL);
+
+	if (NULL == upload_maps)
+		return NULL;
+
+	if (um != NULL) {
+		upload_map_check(um);
+
+		if (um->key.sf != sf || um->key.index != index)
+			upload_map_release(um_ptr);
+	}
+
+	if (NULL == *um_ptr) {
+		um = upload_map_acquire(sf, index);
+		if (NULL == um)
+			return NULL;
+		*um_ptr = um;
+	}
+
+	g_assert(offset >= um->start);
+
+	/*
+	 * If the file changed size on disk since we mapped it, reading the
+	 * window could fault: detach it so that nobody uses it any longer.
+	 * The check is throttled to avoid a system call per chunk sent.
+	 */
+
+	if G_UNLIKELY(!upload_map_on_disk(um, FALSE)) {
+		upload_map_stats.stale++;
+		if (hikset_lookup(upload_maps, &um->key) == um)
+			hikset_remove(upload_maps, &um->key);
+		return NULL;
+	}
+
+	off = offset - um->start;
+	if G_UNLIKELY(off >= um->len)
+		return NULL;		/* File shrunk, window is stale */
+
+	*len = um->len - off;
+	return ptr_add_offset(um->base, off);
+}
+
+/**
+ * Dump cache statistics to specified logging agent.
+ */
+void
+upload_map_dump_stats_log(logagent_t *la, unsigned options)
+{
+	struct upload_map_stats stats = upload_map_stats;	/* struct copy */
+	uint64 mapped = NULL == upload_maps ? 0 : hikset_count(upload_maps);
+	uint64 idle = NULL == upload_idle ? 0 : hash_list_length(upload_idle);
+
+#define DUMP(x)	log_info(la, "UMAP %s = %s", #x,		\
+	(options & DUMP_OPT_PRETTY) ?					\
+		uint64_to_gstring(stats.x) : uint64_to_string(stats.x))
+
+#define DUMP_VAR(x)	log_info(la, "UMAP %s = %s", #x,	\
+	(options & DUMP_OPT_PRETTY) ?					\
+		uint64_to_gstring(x) : uint64_to_string(x))
+
+	DUMP(lookups);
+	DUMP(hits);
+	DUMP(hits_idle);
+	DUMP(misses);
+	DUMP(failures);
+	DUMP(stale);
+	DUMP(evictions);
+	DUMP(mapped_bytes);
+	DUMP_VAR(mapped);
+	DUMP_VAR(idle);
+
+#undef DUMP
+#undef DUMP_VAR
+
+	log_info(la, "UMAP hit_ratio = %.2f%%", 0 == stats.lookups ? 0.0 :
+		100.0 * stats.hits / stats.lookups);
+}
+
+/**
+ * Initialize the upload mapping cache.
+ */
+G_GNUC_COLD void
+upload_map_init(void)
+{
+	upload_maps = hikset_create_any(
+		offsetof(struct upload_map, key),
+		upload_map_key_hash, upload_map_key_eq);
+	upload_idle = hash_list_new(pointer_hash, NULL);
+}
+
+/**
+ * Release all the idle windows and shutdown the cache.
+ *
+ * All the uploads must have released their windows already.
+ */
+G_GNUC_COLD void
+upload_map_close(void)
+{
+	if (NULL == upload_maps)
+		return;
+
+	upload_map_trim(0);
+
+	if (0 != hikset_count(upload_maps)) {
+		g_warning("%s(): %zu window%s still referenced", G_STRFUNC,
+			hikset_count(upload_maps), plural(hikset_count(upload_maps)));
+	}
+
+	hikset_free_null(&upload_maps);
+	hash_list_free(&upload_idle);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Shared memory-mapped windows on uploaded files.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_upload_map_h_
+#define _core_upload_map_h_
+
+#include "common.h"
+
+#include "share.h"
+
+struct upload_map;
+struct logagent;
+
+/*
+ * Public interface.
+ */
+
+void upload_map_init(void);
+void upload_map_close(void);
+
+const void *upload_map_data(struct upload_map **um_ptr,
+	const shared_file_t *sf, filesize_t offset, size_t *len);
+void upload_map_release(struct upload_map **um_ptr);
+
+void upload_map_dump_stats_log(struct logagent *la, unsigned options);
+
+#endif /* _core_upload_map_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
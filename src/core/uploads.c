@@ -65,6 +65,7 @@
 #include "ipp_cache.h"
 #include "tx_deflate.h"
 #include "tx_link.h"		/* for callback structures */
+#include "upload_map.h"
 #include "upload_stats.h"
 #include "uploads.h"
 #include "verify_tth.h"
@@ -1360,6 +1361,7 @@ upload_free_resources(struct upload *u)
 
 	atom_str_free_null(&u->name);
 	file_object_release(&u->file);
+	upload_map_release(&u->map);
 
 #ifdef HAS_MMAP
 	if (u->sendfile_ctx.map) {
@@ -1440,6 +1442,7 @@ upload_clone(struct upload *u)
 	cu->sf = NULL;						/* File re-opened each time */
 	cu->file = NULL;					/* File re-opened each time */
 	cu->sendfile_ctx.map = NULL;		/* File re-opened each time */
+	cu->map = NULL;						/* File re-opened each time */
 	cu->accounted = FALSE;
 	cu->browse_host = FALSE;
     cu->skip = 0;
@@ -2599,6 +2602,7 @@ upload_wait_new_request(struct upload *u)
 	 */
 
 	file_object_release(&u->file);	/* expect_http_header() expects this */
+	upload_map_release(&u->map);
  	socket_tos_normal(u->socket);
 	expect_http_header(u, GTA_UL_EXPECTING);
 }
@@ -5346,6 +5350,7 @@ upload_request(struct upload *u, header_t *header)
 	if (NULL == u->sf || !use_sendfile(u)) {
 		u->bpos = 0;
 		u->bsize = 0;
+		u->map_failed = FALSE;
 
 		if (u->buffer == NULL) {
 			u->buf_size = READ_BUF_SIZE;
@@ -5429,6 +5434,19 @@ upload_handle_exception(struct upload *u, inputevt_cond_t cond)
 	return FALSE;
 }
 
+/**
+ * Can the upload be served from a shared mapped window of the file?
+ *
+ * Only complete files can be mapped: partial files are being written to
+ * as they are downloaded.
+ */
+static inline bool
+upload_can_map(const struct upload *u)
+{
+	return u->sf != NULL && NULL == u->file_info &&
+		!shared_file_is_partial(u->sf);
+}
+
 /**
  * Called when output source can accept more data.
  */
@@ -5439,7 +5457,7 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 	ssize_t written;
 	filesize_t amount;
 	size_t available;
-	bool using_sendfile;
+	bool using_sendfile, using_map = FALSE;
 
 	(void) unused_source;
 
@@ -5478,6 +5496,8 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		u->pos = pos;
 
 	} else {
+		const void *data = NULL;
+
 		/*
 		 * If sendfile() failed on a different connection meanwhile
 		 * u->buffer is still NULL for this connection.
@@ -5488,35 +5508,63 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		}
 
 		/*
-	 	 * If the buffer position reached the size, then we need to read
-	 	 * more data from the file.
-	 	 */
+		 * Complete files are served directly from a mapped window shared
+		 * with all the other uploads of the same file, which avoids one
+		 * read() and one copy per chunk.  If the file cannot be mapped,
+		 * fall back to reading it through our private buffer.
+		 */
 
-		if (u->bpos == u->bsize) {
-			ssize_t ret;
+		if (!u->map_failed && upload_can_map(u)) {
+			size_t len;
 
-			g_assert(u->buffer != NULL);
-			g_assert(u->buf_size > 0);
-			ret = file_object_pread(u->file, u->buffer, u->buf_size, u->pos);
-			if ((ssize_t) -1 == ret) {
-				upload_remove(u, N_("File read error: %s"), g_strerror(errno));
-				return;
-			}
-			if (0 == ret) {
-				upload_remove(u, N_("File EOF?"));
-				return;
+			data = upload_map_data(&u->map, u->sf, u->pos, &len);
+			if (NULL == data) {
+				upload_map_release(&u->map);
+				u->map_failed = TRUE;
+			} else {
+				available = MIN(amount, len);
+				available = MIN(available, READ_BUF_SIZE);
+				using_map = TRUE;
 			}
-			u->bsize = (size_t) ret;
-			u->bpos = 0;
 		}
 
-		available = u->bsize - u->bpos;
-		if (available > amount)
-			available = amount;
+		if (using_map) {
+			g_assert(available > 0 && available <= INT_MAX);
+			written = bio_write(u->bio, data, available);
+		} else {
+			/*
+		 	 * If the buffer position reached the size, then we need to read
+		 	 * more data from the file.
+		 	 */
+
+			if (u->bpos == u->bsize) {
+				ssize_t ret;
+
+				g_assert(u->buffer != NULL);
+				g_assert(u->buf_size > 0);
+				ret = file_object_pread(u->file,
+						u->buffer, u->buf_size, u->pos);
+				if ((ssize_t) -1 == ret) {
+					upload_remove(u, N_("File read error: %s"),
+						g_strerror(errno));
+					return;
+				}
+				if (0 == ret) {
+					upload_remove(u, N_("File EOF?"));
+					return;
+				}
+				u->bsize = (size_t) ret;
+				u->bpos = 0;
+			}
+
+			available = u->bsize - u->bpos;
+			if (available > amount)
+				available = amount;
 
-		g_assert(available > 0 && available <= INT_MAX);
+			g_assert(available > 0 && available <= INT_MAX);
 
-		written = bio_write(u->bio, &u->buffer[u->bpos], available);
+			written = bio_write(u->bio, &u->buffer[u->bpos], available);
+		}
 	}
 
 	if ((ssize_t) -1 == written) {
@@ -5552,7 +5600,8 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 	 	 */
 
 		u->pos += written;
-		u->bpos += written;
+		if (!using_map)
+			u->bpos += written;
 	}
 
 	gnet_prop_set_guint64_val(PROP_UL_BYTE_COUNT,
@@ -5787,6 +5836,8 @@ upload_init(void)
 
 	stall_wd = wd_make("upload stalling",
 		IO_STALL_WATCH, upload_no_more_stalling, NULL, FALSE);
+
+	upload_map_init();
 }
 
 /**
@@ -5813,6 +5864,7 @@ upload_close(void)
 	aging_destroy(&push_conn_failed);
 	wd_free_null(&early_stall_wd);
 	wd_free_null(&stall_wd);
+	upload_map_close();
 }
 
 gnet_upload_info_t *
@@ -78,6 +78,7 @@ struct upload {
 	struct shared_file *thex;		/**< THEX owner we're uploading */
 	struct bio_source *bio;			/**< Bandwidth-limited source */
 	struct sendfile_ctx sendfile_ctx;
+	struct upload_map *map;		/**< Shared mapped window, if any */
 
 	char *request;
 	struct upload_http_cb cb_parq_arg;
@@ -137,6 +138,7 @@ struct upload {
 	unsigned parq_status:1;
 	unsigned fwalt:1;			/**< Downloader accepts firewalled locations */
 	unsigned g2:1;				/**< Initiated via G2 /PUSH */
+	unsigned map_failed:1;		/**< Could not map file, use read buffer */
 };
 
 static inline void
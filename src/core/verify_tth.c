@@ -41,12 +41,19 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/atomic.h"
+#include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/file_object.h"
 #include "lib/halloc.h"
 #include "lib/once.h"
+#include "lib/stringify.h"
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/tpool.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
@@ -56,6 +63,36 @@ static struct {
 	struct tth		digest;
 } verify_tth;
 
+#define VERIFY_TTH_SLICE_WORKERS	2			/**< Slice hashing threads */
+#define VERIFY_TTH_SLICE_BUFSIZE	(64 * 1024)	/**< Read buffer size */
+
+enum verify_tth_slice_magic { VERIFY_TTH_SLICE_MAGIC = 0x3c1e0b95 };
+
+/**
+ * A slice verification request.
+ */
+struct verify_tth_slice {
+	enum verify_tth_slice_magic magic;
+	const char *pathname;			/**< File to read (atom) */
+	filesize_t offset;				/**< Start of slice */
+	filesize_t amount;				/**< Slice length */
+	struct tth digest;				/**< Computed digest */
+	bool ok;						/**< Whether digest was computed */
+	verify_tth_slice_cb_t cb;		/**< Completion callback */
+	void *arg;						/**< Callback argument */
+};
+
+static inline void
+verify_tth_slice_check(const struct verify_tth_slice * const vs)
+{
+	g_assert(vs != NULL);
+	g_assert(VERIFY_TTH_SLICE_MAGIC == vs->magic);
+}
+
+static tpool_t *verify_tth_slicer;
+static once_flag_t verify_tth_slicer_inited;
+static bool verify_tth_slicer_stopped;
+
 static const char *
 verify_tth_name(void)
 {
@@ -149,6 +186,7 @@ G_GNUC_COLD void
 verify_tth_shutdown(void)
 {
 	verify_free(&verify_tth.verify);
+	atomic_bool_set(&verify_tth_slicer_stopped, TRUE);
 }
 
 /**
@@ -158,6 +196,144 @@ G_GNUC_COLD void
 verify_tth_close(void)
 {
 	HFREE_NULL(verify_tth.context);
+	tpool_free_null(&verify_tth_slicer);
+}
+
+static void
+verify_tth_slicer_init_once(void)
+{
+	verify_tth_slicer = tpool_make("TTH slicer", VERIFY_TTH_SLICE_WORKERS);
+}
+
+/**
+ * Compute the Tiger tree hash of the slice, in one of the hashing threads.
+ *
+ * @return the request.
+ */
+static void *
+verify_tth_slice_compute(void *arg)
+{
+	struct verify_tth_slice *vs = arg;
+	file_object_t *fo;
+	TTH_CONTEXT *ctx;
+	filesize_t pos, end;
+	int error = 0;
+	char *buf;
+
+	verify_tth_slice_check(vs);
+
+	if (atomic_bool_get(&verify_tth_slicer_stopped))
+		return vs;
+
+	fo = file_object_open(vs->pathname, O_RDONLY);
+	if (NULL == fo)
+		return vs;
+
+	ctx = xmalloc(tt_size());
+	buf = xmalloc(VERIFY_TTH_SLICE_BUFSIZE);
+
+	tt_init(ctx, vs->amount);
+	end = vs->offset + vs->amount;
+
+	for (pos = vs->offset; pos < end; /* empty */) {
+		size_t n = MIN(end - pos, VERIFY_TTH_SLICE_BUFSIZE);
+		ssize_t r;
+
+		r = file_object_pread(fo, buf, n, pos);
+
+		if ((ssize_t) -1 == r) {
+			if (EINTR == errno)
+				continue;
+			error = errno;
+			break;
+		}
+
+		if (0 == r)
+			break;			/* Unexpected EOF */
+
+		tt_update(ctx, buf, r);
+		pos += r;
+
+		if G_UNLIKELY(atomic_bool_get(&verify_tth_slicer_stopped))
+			break;
+	}
+
+	if (pos == end) {
+		tt_digest(ctx, &vs->digest);
+		vs->ok = TRUE;
+	} else if (GNET_PROPERTY(tigertree_debug)) {
+		g_debug("%s(): cannot read slice [%s, %s[ of \"%s\": %s",
+			G_STRFUNC, filesize_to_string(vs->offset),
+			filesize_to_string2(end), vs->pathname,
+			0 != error ? g_strerror(error) : "unexpected EOF");
+	}
+
+	xfree(buf);
+	xfree(ctx);
+	file_object_release(&fo);
+
+	return vs;
+}
+
+/**
+ * Completion of the slice verification, in the thread that requested it.
+ */
+static void
+verify_tth_slice_done(void *result, void *unused_udata)
+{
+	struct verify_tth_slice *vs = result;
+
+	(void) unused_udata;
+	verify_tth_slice_check(vs);
+
+	(*vs->cb)(vs->ok ? &vs->digest : NULL, vs->arg);
+
+	atom_str_free_null(&vs->pathname);
+	vs->magic = 0;
+	WFREE(vs);
+}
+
+/**
+ * Compute the Tiger tree hash of a slice of a file, asynchronously.
+ *
+ * The slice must start on a boundary that is a power-of-two multiple of the
+ * tree block size, with the same power-of-two multiple for its length unless
+ * it is the trailing slice of the file, so that the computed hash is that of
+ * the corresponding node in the Tiger tree of the whole file.
+ *
+ * Hashing is done by dedicated threads, and the callback is invoked in the
+ * calling thread as cb(digest, arg) once done, with a NULL digest if the
+ * slice could not be read entirely.
+ *
+ * @param pathname		the file to read
+ * @param offset		start of the slice within the file
+ * @param amount		length of the slice
+ * @param cb			completion callback
+ * @param arg			additional callback argument
+ */
+void
+verify_tth_slice(const char *pathname, filesize_t offset, filesize_t amount,
+	verify_tth_slice_cb_t cb, void *arg)
+{
+	struct verify_tth_slice *vs;
+
+	g_assert(pathname != NULL);
+	g_assert(amount != 0);
+	g_assert(0 == offset % TTH_BLOCKSIZE);
+	g_assert(cb != NULL);
+
+	ONCE_FLAG_RUN(verify_tth_slicer_inited, verify_tth_slicer_init_once);
+
+	WALLOC0(vs);
+	vs->magic = VERIFY_TTH_SLICE_MAGIC;
+	vs->pathname = atom_str_get(pathname);
+	vs->offset = offset;
+	vs->amount = amount;
+	vs->cb = cb;
+	vs->arg = arg;
+
+	tpool_submit_notify(verify_tth_slicer,
+		verify_tth_slice_compute, vs, verify_tth_slice_done, NULL);
 }
 
 static bool 
@@ -39,6 +39,14 @@
 
 struct tth;
 
+/**
+ * Completion callback for slice verification.
+ *
+ * @param digest	the computed slice digest, NULL if slice could not be read
+ * @param arg		user-supplied argument
+ */
+typedef void (*verify_tth_slice_cb_t)(const struct tth *digest, void *arg);
+
 bool verify_tth_append(const char *pathname,
 		filesize_t offset, filesize_t amount,
 		verify_callback callback, void *user_data);
@@ -51,6 +59,10 @@ const struct tth *verify_tth_digest(const struct verify *);
 const struct tth *verify_tth_leaves(const struct verify *);
 size_t verify_tth_leave_count(const struct verify *);
 
+void verify_tth_slice(const char *pathname,
+		filesize_t offset, filesize_t amount,
+		verify_tth_slice_cb_t cb, void *arg);
+
 void verify_tth_init(void);
 void verify_tth_shutdown(void);
 void verify_tth_close(void);
@@ -36,6 +36,8 @@
 
 #include "if/dht/kuid.h"
 
+#include "lib/endian.h"
+
 /*
  * Public interface.
  */
@@ -63,6 +65,18 @@ kuid_leading_u8(const kuid_t *k)
 	return k->v[0];
 }
 
+/**
+ * Compute the leading 64 bits of the XOR distance between two KUIDs.
+ *
+ * Since the distance is compared as a big-endian number, ordering on this
+ * value is consistent with kuid_cmp3(), ties requiring a full comparison.
+ */
+static inline uint64
+kuid_distance_u64(const kuid_t *k1, const kuid_t *k2)
+{
+	return peek_be64(k1->v) ^ peek_be64(k2->v);
+}
+
 #endif /* _dht_kuid_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
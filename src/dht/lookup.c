@@ -64,6 +64,7 @@
 #include "lib/patricia.h"
 #include "lib/plist.h"
 #include "lib/pmsg.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sectoken.h"
@@ -84,6 +85,21 @@
 #define NL_FIND_DELAY		5000	/* 5 seconds, in ms */
 #define NL_VAL_DELAY		1000	/* 1 second, in ms */
 
+/**
+ * Adaptive parallelism.
+ *
+ * The amount of concurrent RPCs starts at KDA_ALPHA and is widened when
+ * we observe RPC timeouts (each timed-out RPC holds a slot for nothing
+ * until it expires) or a large RTT deviation (slow nodes are then likely
+ * to hold a slot for much longer than the average).
+ *
+ * The timeout ratio is kept as a fixed-point EMA, in 1/256th units.
+ */
+#define NL_ALPHA_MAX		(4 * KDA_ALPHA)	/* Maximum parallelism */
+#define NL_LOSS_ONE			256		/* Fixed-point 1.0 for timeout ratio */
+#define NL_LOSS_MAX			192		/* Max timeout ratio considered (75%) */
+#define NL_STABLE_REPLIES	2		/* Replies confirming the k-closest set */
+
 /**
  * Maximum number of nodes from a class C network that we can return in
  * the lookup path.  This is a way to fight against ID attacks (known as
@@ -140,7 +156,8 @@ typedef enum {
 enum parallelism {
 	LOOKUP_STRICT = 1,			/**< Strict parallelism */
 	LOOKUP_BOUNDED,				/**< Bounded parallelism */
-	LOOKUP_LOOSE				/**< Loose parallelism */
+	LOOKUP_LOOSE,				/**< Loose parallelism */
+	LOOKUP_ADAPTIVE				/**< Bounded, adaptive parallelism */
 };
 
 struct nlookup;
@@ -230,6 +247,15 @@ struct nlookup {
 	int bw_outgoing;			/**< Amount of outgoing bandwidth used */
 	int bw_incoming;			/**< Amount of incoming bandwidth used */
 	int udp_drops;				/**< Amount of UDP packet drops */
+	int alpha;					/**< Current parallelism (adaptive mode) */
+	int alpha_max;				/**< Maximum parallelism reached */
+	int stable;					/**< Replies without k-closest changes */
+	kuid_t kth;					/**< k-th closest node in ball, if known */
+	bool kth_known;				/**< Whether ``kth'' is valid */
+	uint32 rtt_avg;				/**< EMA of RPC latency, in ms */
+	uint32 rtt_dev;				/**< EMA of RPC latency deviation, in ms */
+	uint32 loss;				/**< EMA of RPC timeout ratio (fixed-point) */
+	uint32 rtt_histo[LOOKUP_RTT_SLOTS];	/**< RPC latency histogram */
 	tm_t start;					/**< Start time */
 	uint32 hops;				/**< Amount of hops in lookup so far */
 	uint32 flags;				/**< Operating flags */
@@ -379,6 +405,7 @@ lookup_parallelism_mode_to_string(enum parallelism mode)
 	case LOOKUP_STRICT:		what = "strict"; break;
 	case LOOKUP_BOUNDED:	what = "bounded"; break;
 	case LOOKUP_LOOSE:		what = "loose"; break;
+	case LOOKUP_ADAPTIVE:	what = "adaptive"; break;
 	}
 
 	return what;
@@ -555,6 +582,117 @@ lookup_result_refcnt_inc(const lookup_rs_t *rs)
 	return rs;
 }
 
+/**
+ * A candidate entry for lookup_result_derive().
+ */
+struct lookup_derived {
+	uint64 dist;				/**< Leading 64 bits of distance to new key */
+	const lookup_rc_t *rc;		/**< Entry in the original path */
+};
+
+/**
+ * Derive node lookup results for a key from the results of a STORE lookup
+ * done for a nearby key.
+ *
+ * Let r be the distance between the original key and its amount-th closest
+ * node in the path, and d the distance between the two keys.  Because the
+ * lookup converged, no node outside the path is closer than r to the
+ * original key, hence (XOR distance obeys the triangle inequality) no such
+ * node is closer than r - d to the new key.  All the nodes of the path
+ * that are closer than r - d to the new key are therefore the closest ones
+ * known to the DHT, and if there are at least ``amount'' of them, we have
+ * the answer a lookup for the new key would have produced.
+ *
+ * Distances are approximated by their leading 64 bits, with the comparison
+ * slack needed to keep the test conservative.
+ *
+ * @param rs		results of the original lookup
+ * @param origin	the key for which the original lookup was made
+ * @param kuid		the new key for which we want results
+ * @param amount	amount of closest nodes required
+ *
+ * @return new results (to be freed with lookup_result_free()) or NULL if
+ * the original path does not hold the ``amount'' closest nodes to ``kuid''.
+ */
+const lookup_rs_t *
+lookup_result_derive(const lookup_rs_t *rs,
+	const kuid_t *origin, const kuid_t *kuid, size_t amount)
+{
+	struct lookup_derived *vec;
+	lookup_rs_t *drs = NULL;
+	uint64 r, d, limit;
+	size_t i, n = 0;
+
+	lookup_result_check(rs);
+	g_assert(amount != 0);
+
+	if (rs->path_len < amount)
+		return NULL;
+
+	r = kuid_distance_u64(origin, rs->path[amount - 1].kn->id);
+	d = kuid_distance_u64(origin, kuid);
+
+	if (r <= d || r - d <= 2)
+		return NULL;
+
+	limit = r - d - 2;
+
+	WALLOC_ARRAY(vec, rs->path_len);
+
+	/*
+	 * Insert eligible nodes by increasing distance to the new key.
+	 */
+
+	for (i = 0; i < rs->path_len; i++) {
+		const lookup_rc_t *rc = &rs->path[i];
+		uint64 dist = kuid_distance_u64(kuid, rc->kn->id);
+		size_t j;
+
+		if (dist > limit)
+			continue;
+
+		for (j = n; j > 0; j--) {
+			const struct lookup_derived *ld = &vec[j - 1];
+
+			if (
+				ld->dist < dist ||
+				(ld->dist == dist && kuid_cmp3(kuid, ld->rc->kn->id, rc->kn->id) < 0)
+			)
+				break;
+
+			vec[j] = vec[j - 1];
+		}
+
+		vec[j].dist = dist;
+		vec[j].rc = rc;
+		n++;
+	}
+
+	if (n < amount)
+		goto done;
+
+	WALLOC(drs);
+	drs->magic = LOOKUP_RESULT_MAGIC;
+	drs->refcnt = 1;
+	WALLOC_ARRAY(drs->path, amount);
+	drs->path_len = amount;
+
+	for (i = 0; i < amount; i++) {
+		const lookup_rc_t *rc = vec[i].rc;
+		lookup_rc_t *drc = &drs->path[i];
+
+		drc->kn = knode_refcnt_inc(rc->kn);
+		drc->token = rc->token_len ? wcopy(rc->token, rc->token_len) : NULL;
+		drc->token_len = rc->token_len;
+	}
+
+	lookup_result_check(drs);
+
+done:
+	WFREE_ARRAY(vec, rs->path_len);
+	return drs;
+}
+
 /**
  * Free node lookup results.
  */
@@ -687,6 +825,28 @@ log_patricia_dump(nlookup_t *nl, patricia_t *pt, const char *what, uint level)
 	patricia_iterator_release(&iter);
 }
 
+/**
+ * Log the RPC latency histogram of the lookup.
+ */
+static void
+lookup_log_rtt(const nlookup_t *nl)
+{
+	str_t *s = str_new(80);
+	uint i;
+
+	for (i = 0; i < G_N_ELEMENTS(nl->rtt_histo); i++) {
+		str_catf(s, "%s%u", 0 == i ? "" : " ", nl->rtt_histo[i]);
+	}
+
+	g_debug("DHT LOOKUP[%s] RTT avg=%u ms, dev=%u ms, "
+		"timeouts=%d (%u%%), max alpha=%d, histogram (log2 ms from 32): %s",
+		nid_to_string(&nl->lid), nl->rtt_avg, nl->rtt_dev,
+		nl->rpc_timeouts, nl->loss * 100 / NL_LOSS_ONE, nl->alpha_max,
+		str_2c(s));
+
+	str_destroy_null(&s);
+}
+
 /**
  * Invoke statistics callback, if added by user.
  * Log final statistics.
@@ -700,7 +860,7 @@ lookup_final_stats(const nlookup_t *nl)
 
 	tm_now_exact(&end);
 
-	if (GNET_PROPERTY(dht_lookup_debug) > 1 || GNET_PROPERTY(dht_debug) > 1)
+	if (GNET_PROPERTY(dht_lookup_debug) > 1 || GNET_PROPERTY(dht_debug) > 1) {
 		g_debug("DHT LOOKUP[%s] type %s, took %g secs, "
 			"hops=%u, path=%u, in=%d bytes, out=%d bytes, %d RPC repl%s",
 			nid_to_string(&nl->lid), lookup_type_to_string(nl),
@@ -709,6 +869,10 @@ lookup_final_stats(const nlookup_t *nl)
 			nl->bw_incoming, nl->bw_outgoing,
 			nl->rpc_replies, plural_y(nl->rpc_replies));
 
+		if (GNET_PROPERTY(dht_lookup_debug) > 2)
+			lookup_log_rtt(nl);
+	}
+
 	/*
 	 * Optional statistics callback, added via lookup_ctrl_stats() after
 	 * successful lookup creation.
@@ -721,8 +885,12 @@ lookup_final_stats(const nlookup_t *nl)
 		stats.msg_sent = nl->msg_sent;
 		stats.msg_dropped = nl->msg_dropped;
 		stats.rpc_replies = nl->rpc_replies;
+		stats.rpc_timeouts = nl->rpc_timeouts;
 		stats.bw_outgoing = nl->bw_outgoing;
 		stats.bw_incoming = nl->bw_incoming;
+		stats.alpha_max = nl->alpha_max;
+		STATIC_ASSERT(sizeof stats.rtt_histo == sizeof nl->rtt_histo);
+		memcpy(stats.rtt_histo, nl->rtt_histo, sizeof stats.rtt_histo);
 
 		(*nl->stats)(nl->kuid, &stats, nl->arg);
 	}
@@ -2640,6 +2808,105 @@ log_status(nlookup_t *nl)
 	}
 }
 
+/**
+ * @return whether lookup enforces a maximum amount of outstanding RPCs.
+ */
+static inline bool
+lookup_is_bounded(const nlookup_t *nl)
+{
+	return LOOKUP_BOUNDED == nl->mode || LOOKUP_ADAPTIVE == nl->mode;
+}
+
+/**
+ * Recompute the parallelism of an adaptive lookup, based on the observed
+ * RPC timeout ratio and the RTT deviation.
+ */
+static void
+lookup_update_alpha(nlookup_t *nl)
+{
+	uint32 loss;
+	int alpha;
+
+	lookup_check(nl);
+
+	if (nl->mode != LOOKUP_ADAPTIVE)
+		return;
+
+	/*
+	 * With a timeout ratio of p, only (1 - p) of the outstanding RPCs are
+	 * going to be useful, so we need alpha / (1 - p) slots to keep alpha
+	 * RPCs making progress.
+	 */
+
+	loss = MIN(nl->loss, NL_LOSS_MAX);
+	alpha = (KDA_ALPHA * NL_LOSS_ONE + NL_LOSS_ONE - loss - 1) /
+		(NL_LOSS_ONE - loss);
+
+	/*
+	 * When the RTT deviation is large compared to the average, some of
+	 * the pending RPCs are bound to take much longer than the others:
+	 * allow one more RPC to proceed meanwhile.
+	 */
+
+	if (nl->rtt_dev > nl->rtt_avg / 2)
+		alpha++;
+
+	alpha = MIN(alpha, NL_ALPHA_MAX);
+
+	if (alpha != nl->alpha && GNET_PROPERTY(dht_lookup_debug) > 2) {
+		g_debug("DHT LOOKUP[%s] parallelism now %d (was %d): "
+			"RTT avg=%u ms, dev=%u ms, timeouts=%u%%",
+			nid_to_string(&nl->lid), alpha, nl->alpha,
+			nl->rtt_avg, nl->rtt_dev, nl->loss * 100 / NL_LOSS_ONE);
+	}
+
+	nl->alpha = alpha;
+	nl->alpha_max = MAX(nl->alpha_max, alpha);
+}
+
+/**
+ * Record the k-th closest node in the ball, which delimits the k-closest set.
+ *
+ * Any node entering the k-closest set pushes the previous k-th closest out,
+ * hence the set is unchanged as long as its k-th closest node remains the
+ * same.
+ *
+ * @return TRUE if the k-th closest node is the one recorded on the previous
+ * call, i.e. if the k-closest set did not change since then.
+ */
+static bool
+lookup_kclosest_unchanged(nlookup_t *nl)
+{
+	patricia_iter_t *iter;
+	knode_t *kn = NULL;
+	size_t n = 0;
+	bool same;
+
+	lookup_check(nl);
+
+	iter = patricia_metric_iterator_lazy(nl->ball, nl->kuid, TRUE);
+
+	while (n < UNSIGNED(nl->amount) && patricia_iter_has_next(iter)) {
+		kn = patricia_iter_next_value(iter);
+		n++;
+	}
+
+	patricia_iterator_release(&iter);
+
+	if (n < UNSIGNED(nl->amount)) {
+		nl->kth_known = FALSE;
+		return FALSE;			/* Not enough nodes for a k-closest set */
+	}
+
+	knode_check(kn);
+
+	same = nl->kth_known && kuid_eq(&nl->kth, kn->id);
+	kuid_copy(&nl->kth, kn->id);
+	nl->kth_known = TRUE;
+
+	return same;
+}
+
 /**
  * Iterate if current parallelism mode allows it.
  */
@@ -2673,6 +2940,7 @@ lookup_iterate_if_possible(nlookup_t *nl)
 		/* FALL THROUGH */
 	case LOOKUP_BOUNDED:
 	case LOOKUP_LOOSE:
+	case LOOKUP_ADAPTIVE:
 		lookup_iterate(nl);
 		break;
 	}
@@ -3564,6 +3832,49 @@ lk_rpc_cancelled(void *obj, uint32 hop)
 	}
 }
 
+/**
+ * @return the RPC latency histogram slot for a reply received after ``ms''.
+ */
+static inline uint
+lookup_rtt_slot(uint ms)
+{
+	if (ms < 32)
+		return 0;
+
+	return MIN(UNSIGNED(highest_bit_set(ms)) - 4, LOOKUP_RTT_SLOTS - 1);
+}
+
+static void
+lk_rpc_latency(void *obj, const knode_t *kn, uint ms, uint32 hop)
+{
+	nlookup_t *nl = obj;
+
+	lookup_check(nl);
+	(void) kn;
+	(void) hop;
+
+	nl->rtt_histo[lookup_rtt_slot(ms)]++;
+
+	/*
+	 * Same EMAs as the ones used for TCP retransmission timers: the
+	 * average with a smoothing factor of 1/8 and the mean deviation with
+	 * a smoothing factor of 1/4.
+	 */
+
+	if (0 == nl->rtt_avg) {
+		nl->rtt_avg = MAX(ms, 1);
+		nl->rtt_dev = ms / 2;
+	} else {
+		uint32 delta = ms > nl->rtt_avg ? ms - nl->rtt_avg : nl->rtt_avg - ms;
+
+		nl->rtt_dev += (delta >> 2) - (nl->rtt_dev >> 2);
+		nl->rtt_avg += (ms >> 3) - (nl->rtt_avg >> 3);
+	}
+
+	nl->loss -= nl->loss >> 3;
+	lookup_update_alpha(nl);
+}
+
 static void
 lk_handling_rpc(void *obj, enum dht_rpc_ret type,
 	const knode_t *kn, uint32 hop)
@@ -3598,6 +3909,8 @@ lk_handling_rpc(void *obj, enum dht_rpc_ret type,
 		knode_t *an;
 
 		nl->rpc_timeouts++;
+		nl->loss += (NL_LOSS_ONE >> 3) - (nl->loss >> 3);
+		lookup_update_alpha(nl);
 
 		an = map_lookup(nl->alternate, kn->id);
 		if (an != NULL) {
@@ -3668,8 +3981,10 @@ lk_handle_reply(void *obj, const knode_t *kn,
 
 	g_assert(KDA_MSG_FIND_NODE_RESPONSE == function);
 
-	if (!lookup_handle_reply(nl, kn, payload, len, hop))
+	if (!lookup_handle_reply(nl, kn, payload, len, hop)) {
+		nl->stable = 0;
 		return TRUE;	/* Iterate */
+	}
 
 	/*
 	 * If we are in a loose parallelism mode and the amount of items in
@@ -3768,6 +4083,11 @@ lk_handle_reply(void *obj, const knode_t *kn,
 
 	nl->flags &= ~NL_F_COMPLETED;	/* A priori not completed yet */
 
+	if (lookup_kclosest_unchanged(nl))
+		nl->stable++;
+	else
+		nl->stable = 0;
+
 	if (
 		nl->closest == nl->prev_closest &&
 		lookup_closest_ok(nl)
@@ -3780,10 +4100,26 @@ lk_handle_reply(void *obj, const knode_t *kn,
 		/*
 		 * End only when we got all the replies from the latest hop, in case
 		 * we get improvements from the others.
+		 *
+		 * In adaptive mode, we do not wait for the slowest RPCs once enough
+		 * consecutive replies left the k-closest set unchanged: they bound
+		 * the latency of the whole lookup.  Value lookups must wait since
+		 * any of the pending RPCs could bring back the value.
 		 */
 
 		if (0 == nl->rpc_latest_pending) {
 			lookup_completed(nl);
+		} else if (
+			LOOKUP_ADAPTIVE == nl->mode && LOOKUP_VALUE != nl->type &&
+			nl->stable >= NL_STABLE_REPLIES
+		) {
+			if (GNET_PROPERTY(dht_lookup_debug) > 1) {
+				g_debug("DHT LOOKUP[%s] ending early, k-closest set stable "
+					"after %d replies (%d RPC%s still pending)",
+					nid_to_string(&nl->lid), nl->stable,
+					nl->rpc_latest_pending, plural(nl->rpc_latest_pending));
+			}
+			lookup_completed(nl);
 		} else {
 			/*
 			 * Flag lookup as completed, in case we time-out the lookup during
@@ -3845,7 +4181,7 @@ lk_iterate(void *obj, enum dht_rpc_ret type, uint32 hop)
 	 */
 
 	if (
-		nl->mode != LOOKUP_BOUNDED &&
+		!lookup_is_bounded(nl) &&
 		(DHT_RPC_TIMEOUT == type || hop != nl->hops)
 	) {
 		if (0 == nl->rpc_pending) {
@@ -3876,6 +4212,7 @@ static struct revent_ops lookup_ops = {
 	lk_handling_rpc,			/* handling_rpc */
 	lk_handle_reply,			/* handle_reply */
 	lk_iterate,					/* iterate */
+	lk_rpc_latency,				/* rpc_latency */
 };
 
 /**
@@ -4037,7 +4374,10 @@ lookup_iterate(nlookup_t *nl)
 	 * Enforce bounded parallelism here.
 	 */
 
-	if (LOOKUP_BOUNDED == nl->mode) {
+	if (lookup_is_bounded(nl)) {
+		if (LOOKUP_ADAPTIVE == nl->mode)
+			alpha = nl->alpha;
+
 		alpha -= nl->rpc_pending;
 
 		if (alpha <= 0) {
@@ -4236,6 +4576,16 @@ lookup_load_shortlist(nlookup_t *nl)
 	return contactable > 0;		/* Proceed only if we have at least one node */
 }
 
+/**
+ * @return the parallelism mode to use for lookups that need to converge
+ * quickly.
+ */
+static enum parallelism
+lookup_fast_mode(void)
+{
+	return GNET_PROPERTY(dht_lookup_adaptive) ? LOOKUP_ADAPTIVE : LOOKUP_LOOSE;
+}
+
 /**
  * Create a KUID lookup.
  *
@@ -4270,6 +4620,7 @@ lookup_create(const kuid_t *kuid, lookup_type_t type,
 	nl->arg = arg;
 	nl->expire_ev = cq_main_insert(NL_MAX_LIFETIME, lookup_expired, nl);
 	nl->max_common_bits = KDA_C + dht_get_kball_furthest();
+	nl->alpha = nl->alpha_max = KDA_ALPHA;
 	tm_now_exact(&nl->start);
 
 	htable_insert(nlookups, &nl->lid, nl);
@@ -4343,7 +4694,7 @@ lookup_find_node(
 	nl = lookup_create(kuid, LOOKUP_NODE, error, arg);
 	nl->amount = KDA_K;
 	nl->u.fn.ok = ok;
-	nl->mode = LOOKUP_LOOSE;
+	nl->mode = lookup_fast_mode();
 
 	if (!lookup_load_shortlist(nl)) {
 		lookup_free(nl);
@@ -4376,7 +4727,7 @@ lookup_store_nodes(
 	nl = lookup_create(kuid, LOOKUP_STORE, error, arg);
 	nl->amount = KDA_K;
 	nl->u.fn.ok = ok;
-	nl->mode = LOOKUP_LOOSE;
+	nl->mode = lookup_fast_mode();
 
 	if (!lookup_load_shortlist(nl)) {
 		lookup_free(nl);
@@ -4519,7 +4870,7 @@ lookup_find_value(
 	nl->amount = KDA_K;
 	nl->u.fv.ok = ok;
 	nl->u.fv.vtype = type;
-	nl->mode = LOOKUP_LOOSE;	/* Converge quickly */
+	nl->mode = lookup_fast_mode();	/* Converge quickly */
 
 	if (!lookup_load_shortlist(nl)) {
 		lookup_free(nl);
@@ -4923,6 +5274,7 @@ static struct revent_ops lookup_value_ops = {
 	lk_value_handling_rpc,			/* handling_rpc */
 	lk_value_handle_reply,			/* handle_reply */
 	lk_value_iterate,				/* iterate */
+	NULL,							/* rpc_latency */
 };
 
 /**
@@ -64,6 +64,15 @@ typedef enum {
 	LOOKUP_REFRESH				/**< Refresh lookup */
 } lookup_type_t;
 
+/**
+ * Amount of slots in the RPC latency histogram of a lookup.
+ *
+ * Slot 0 counts replies received in less than 32 ms, slot i > 0 counts
+ * replies received in [2^(i+4), 2^(i+5)[ ms and the last slot also
+ * accounts for all the slower replies.
+ */
+#define LOOKUP_RTT_SLOTS	10
+
 /**
  * Lookup statistics.
  */
@@ -72,8 +81,11 @@ struct lookup_stats {
 	int msg_sent;				/**< Amount of messages sent */
 	int msg_dropped;			/**< Amount of messages dropped */
 	int rpc_replies;			/**< Amount of valid RPC replies */
+	int rpc_timeouts;			/**< Amount of RPC timeouts */
 	int bw_outgoing;			/**< Amount of outgoing bandwidth used */
 	int bw_incoming;			/**< Amount of incoming bandwidth used */
+	int alpha_max;				/**< Maximum parallelism reached */
+	uint32 rtt_histo[LOOKUP_RTT_SLOTS];	/**< RPC latency histogram */
 };
 
 /**
@@ -140,6 +152,8 @@ nlookup_t *lookup_token(const knode_t *kn,
 	lookup_cb_ok_t ok, lookup_cb_err_t error, void *arg);
 
 void lookup_ctrl_stats(nlookup_t *nl, lookup_cb_stats_t stats);
+const lookup_rs_t *lookup_result_derive(const lookup_rs_t *rs,
+	const kuid_t *origin, const kuid_t *kuid, size_t amount);
 void lookup_cancel(nlookup_t *nl, bool callback);
 
 #endif	/* _dht_lookup_h_ */
@@ -1652,6 +1652,7 @@ static struct revent_ops publish_cache_ops = {
 	pb_cache_handling_rpc,		/* handling_rpc */
 	pb_cache_handle_reply,		/* handle_reply */
 	pb_iterate,					/* iterate */
+	NULL,						/* rpc_latency */
 };
 
 static struct revent_ops publish_value_ops = {
@@ -1668,6 +1669,7 @@ static struct revent_ops publish_value_ops = {
 	pb_value_handling_rpc,		/* handling_rpc */
 	pb_value_handle_reply,		/* handle_reply */
 	pb_iterate,					/* iterate */
+	NULL,						/* rpc_latency */
 };
 
 /**
@@ -69,6 +69,7 @@
 
 #include "lib/nid.h"
 #include "lib/stringify.h"
+#include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -89,6 +90,7 @@ struct revent_rpc_info {
 	struct nid rid;			/**< ID of RPC event, to spot outdated replies */
 	struct revent_ops *ops;	/**< Callbacks */
 	struct revent_pmsg_info *pmi;	/**< In case the RPC times out */
+	tm_t start;				/**< When RPC was issued, to measure latency */
 	uint32 udata;			/**< User-supplied information (opaque to us) */
 };
 
@@ -118,6 +120,7 @@ revent_rpi_alloc(struct nid id, uint32 udata, struct revent_ops *ops)
 	rpi->ops = ops;
 	rpi->udata = udata;
 	rpi->pmi = NULL;
+	tm_now_exact(&rpi->start);
 
 	return rpi;
 }
@@ -371,6 +374,14 @@ revent_rpc_cb(
 			type == DHT_RPC_TIMEOUT ? "timeout" : "reply",
 			ops->udata_name, rpi->udata, knode_to_string(kn));
 
+	if (DHT_RPC_REPLY == type && ops->rpc_latency) {
+		tm_t now;
+
+		tm_now_exact(&now);
+		(*ops->rpc_latency)(obj, kn, tm_elapsed_ms(&now, &rpi->start),
+			rpi->udata);
+	}
+
 	if (ops->handling_rpc)
 		(*ops->handling_rpc)(obj, type, kn, rpi->udata);
 
@@ -58,6 +58,8 @@ struct revent_ops {
 	bool (*handle_reply)(void *obj, const knode_t *kn,
 		kda_msg_t function, const char *payload, size_t len, uint32 udata);
 	void (*iterate)(void *obj, enum dht_rpc_ret type, uint32 udata);
+	/* optional RPC latency reporting, before handling_rpc() on replies */
+	void (*rpc_latency)(void *obj, const knode_t *kn, uint ms, uint32 udata);
 };
 
 /*
@@ -4413,16 +4413,137 @@ dht_size(void)
 }
 
 /**
- * GList sort callback.
+ * Maximum amount of candidates a leaf bucket can supply.
  */
-static int
-distance_to(const void *a, const void *b, void *user_data)
+#define K_BUCKET_MAX_NODES	(K_BUCKET_GOOD + K_BUCKET_STALE + K_BUCKET_PENDING)
+
+/**
+ * A candidate node, with the leading 64 bits of its XOR distance to the
+ * target cached to avoid full KUID comparisons in the common case.
+ */
+struct closest_cand {
+	uint64 dist;				/* Leading 64 bits of the XOR distance */
+	knode_t *kn;				/* The candidate node */
+};
+
+/**
+ * Context for fill_closest_in_bucket() traversals.
+ */
+struct closest_ctx {
+	struct closest_cand vec[K_BUCKET_MAX_NODES];	/* Sorted candidates */
+	const kuid_t *id;			/* Target KUID */
+	const kuid_t *exclude;		/* KUID to exclude, NULL if none */
+	time_t now;					/* Current time */
+	int max;					/* Maximum amount of candidates we keep */
+	int count;					/* Amount of candidates kept in vec[] */
+	int available;				/* Amount of candidates seen */
+	bool alive;					/* Whether we want only alive nodes */
+};
+
+/**
+ * @return whether node `kn' at leading distance `d' is strictly closer to
+ * the target than the candidate `c'.
+ */
+static inline bool
+closest_is_closer(const struct closest_ctx *ctx,
+	uint64 d, const knode_t *kn, const struct closest_cand *c)
+{
+	if (d != c->dist)
+		return d < c->dist;
+
+	return kuid_cmp3(ctx->id, kn->id, c->kn->id) < 0;
+}
+
+/**
+ * Record a new candidate node, keeping the candidate vector sorted by
+ * increasing distance to the target and bounded to the `max' closest ones.
+ */
+static void
+closest_insert(struct closest_ctx *ctx, knode_t *kn)
+{
+	uint64 d = kuid_distance_u64(ctx->id, kn->id);
+	int i = ctx->count;
+
+	ctx->available++;
+
+	if (ctx->max == i) {
+		if (!closest_is_closer(ctx, d, kn, &ctx->vec[i - 1]))
+			return;
+		i--;				/* Farthest candidate will be evicted */
+	} else {
+		ctx->count++;
+	}
+
+	while (i > 0 && closest_is_closer(ctx, d, kn, &ctx->vec[i - 1])) {
+		ctx->vec[i] = ctx->vec[i - 1];
+		i--;
+	}
+
+	ctx->vec[i].dist = d;
+	ctx->vec[i].kn = kn;
+}
+
+/**
+ * hash_list_foreach() callback to consider good nodes.
+ */
+static void
+closest_add_good(void *data, void *udata)
+{
+	knode_t *kn = data;
+	struct closest_ctx *ctx = udata;
+
+	knode_check(kn);
+	g_assert(KNODE_GOOD == kn->status);
+
+	if (
+		(!ctx->exclude || !kuid_eq(kn->id, ctx->exclude)) &&
+		(!ctx->alive || (kn->flags & KNODE_F_ALIVE))
+	)
+		closest_insert(ctx, kn);
+}
+
+/**
+ * hash_list_foreach() callback to consider stale nodes.
+ */
+static void
+closest_add_stale(void *data, void *udata)
+{
+	knode_t *kn = data;
+	struct closest_ctx *ctx = udata;
+
+	knode_check(kn);
+	g_assert(KNODE_STALE == kn->status);
+
+	if (
+		(!ctx->exclude || !kuid_eq(kn->id, ctx->exclude)) &&
+		knode_still_alive_probability(kn) >= ALIVE_PROBA_LOW_THRESH
+	)
+		closest_insert(ctx, kn);
+}
+
+/**
+ * hash_list_foreach() callback to consider pending nodes.
+ */
+static void
+closest_add_pending(void *data, void *udata)
 {
-	const knode_t *ka = a;
-	const knode_t *kb = b;
-	const kuid_t *id = user_data;
+	knode_t *kn = data;
+	struct closest_ctx *ctx = udata;
+
+	knode_check(kn);
+	g_assert(KNODE_PENDING == kn->status);
 
-	return kuid_cmp3(id, ka->id, kb->id);
+	if (
+		!(kn->flags & KNODE_F_SHUTDOWNING) &&
+		(!ctx->exclude || !kuid_eq(kn->id, ctx->exclude)) &&
+		(!ctx->alive ||
+			(
+				(kn->flags & KNODE_F_ALIVE) &&
+				delta_time(ctx->now, kn->last_seen) < alive_period()
+			)
+		)
+	)
+		closest_insert(ctx, kn);
 }
 
 /**
@@ -4430,6 +4551,9 @@ distance_to(const void *a, const void *b, void *user_data)
  * nodes from the current bucket, inserting them by increasing distance
  * to the supplied ID.
  *
+ * Candidates are collected in a bounded on-stack vector, kept sorted as
+ * they are inserted, so that no memory allocation is required.
+ *
  * @param id		the KUID for which we're finding the closest neighbours
  * @param kb		the bucket used
  * @param kvec		base of the "knode_t *" vector
@@ -4444,14 +4568,22 @@ fill_closest_in_bucket(
 	const kuid_t *id, struct kbucket *kb,
 	knode_t **kvec, int kcnt, const kuid_t *exclude, bool alive)
 {
-	plist_t *nodes = NULL, *good, *l;
-	int added;
-	int available = 0;
+	struct closest_ctx ctx;
+	int i;
 
 	g_assert(id);
 	g_assert(is_leaf(kb));
 	g_assert(kvec);
 
+	if G_UNLIKELY(kcnt <= 0)
+		return 0;
+
+	ctx.id = id;
+	ctx.exclude = exclude;
+	ctx.alive = alive;
+	ctx.max = MIN(kcnt, K_BUCKET_MAX_NODES);
+	ctx.count = ctx.available = 0;
+
 	/*
 	 * If we can determine that we do not have enough good nodes in the bucket
 	 * to fill the vector, consider "stale" nodes and then "pending" nodes
@@ -4459,24 +4591,7 @@ fill_closest_in_bucket(
 	 * recently (defined by the aliveness period).
 	 */
 
-	good = hash_list_list(kb->nodes->good);
-
-	while (good != NULL) {
-		knode_t *kn = good->data;
-
-		knode_check(kn);
-		g_assert(KNODE_GOOD == kn->status);
-
-		if (
-			(!exclude || !kuid_eq(kn->id, exclude)) &&
-			(!alive || (kn->flags & KNODE_F_ALIVE))
-		) {
-			nodes = plist_prepend(nodes, kn);
-			available++;
-		}
-
-		good = plist_remove(good, kn);
-	}
+	hash_list_foreach(kb->nodes->good, closest_add_good, &ctx);
 
 	/*
 	 * Only stale nodes that are still somewhat likely to be alive are
@@ -4489,75 +4604,26 @@ fill_closest_in_bucket(
 	 * without having to ping them explicitly.
 	 */
 
-	if (!alive) {
-		plist_t *stale = hash_list_list(kb->nodes->stale);
-
-		while (stale != NULL) {
-			knode_t *kn = stale->data;
-
-			knode_check(kn);
-			g_assert(KNODE_STALE == kn->status);
-
-			if (
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
-				knode_still_alive_probability(kn) >= ALIVE_PROBA_LOW_THRESH
-			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
-			}
-
-			stale = plist_remove(stale, kn);
-		}
-	}
+	if (!alive)
+		hash_list_foreach(kb->nodes->stale, closest_add_stale, &ctx);
 
 	/*
 	 * Pending nodes come last, if we miss nodes.
 	 */
 
-	if (available < kcnt) {
-		plist_t *pending = hash_list_list(kb->nodes->pending);
-		time_t now = tm_time();
-
-		while (pending != NULL) {
-			knode_t *kn = pending->data;
-
-			knode_check(kn);
-			g_assert(KNODE_PENDING == kn->status);
-
-			if (
-				!(kn->flags & KNODE_F_SHUTDOWNING) &&
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
-				(!alive ||
-					(
-						(kn->flags & KNODE_F_ALIVE) &&
-						delta_time(now, kn->last_seen) < alive_period()
-					)
-				)
-			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
-			}
-
-			pending = plist_remove(pending, kn);
-		}
+	if (ctx.available < kcnt) {
+		ctx.now = tm_time();
+		hash_list_foreach(kb->nodes->pending, closest_add_pending, &ctx);
 	}
 
 	/*
-	 * Sort the candidates by increasing distance to the target KUID and
-	 * insert them in the vector.
+	 * Candidates are already sorted by increasing distance to the target.
 	 */
 
-	nodes = plist_sort_with_data(nodes, distance_to, deconstify_pointer(id));
-
-	for (added = 0, l = nodes; l && kcnt; l = plist_next(l)) {
-		*kvec++ = l->data;
-		kcnt--;
-		added++;
-	}
-
-	plist_free(nodes);
+	for (i = 0; i < ctx.count; i++)
+		kvec[i] = ctx.vec[i].kn;
 
-	return added;
+	return ctx.count;
 }
 
 /**
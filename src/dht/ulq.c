@@ -66,8 +66,10 @@
 #include "lib/atoms.h"
 #include "lib/cq.h"
 #include "lib/fifo.h"
+#include "lib/patricia.h"
 #include "lib/slist.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -75,6 +77,7 @@
 #define ULQ_MAX_RUNNING		3		/**< Initial amount of concurrent reqs */
 #define ULQ_UDP_DELAY		5000	/**< Delay in ms if UDP flow-controlled */
 #define ULQ_EMA_SHIFT		7		/**< Shifting during EMA computation */
+#define ULQ_SHARE_MAX		KDA_K	/**< Max lookups served by one path */
 
 #define vema(x)	((x) >> ULQ_EMA_SHIFT)
 
@@ -120,6 +123,8 @@ struct ulq_item {
 	lookup_cb_start_t start;		/**< Optional starting callback */
 	lookup_cb_err_t err;			/**< Error callback */
 	void *arg;						/**< Common callback opaque argument */
+	bool indexed;					/**< Whether item is in store_pending */
+	bool served;					/**< Served from another lookup path */
 };
 
 /**
@@ -140,6 +145,17 @@ enum ulq_qtype {
 static struct ulq *ulq[ULQ_QUEUE_COUNT];	/**< The user lookup queues */
 static cevent_t *service_ev;				/**< Servicing event */
 
+/**
+ * Enqueued STORE lookups, indexed by KUID.
+ *
+ * When a STORE lookup completes, the enqueued lookups for keys lying close
+ * enough to the one that was looked up can be served from the same lookup
+ * path, saving one full lookup each time.  When publishing many keys, this
+ * happens often as soon as the amount of keys is not negligible compared to
+ * the size of the DHT.
+ */
+static patricia_t *store_pending;
+
 /**
  * Scheduling informations.
  */
@@ -188,6 +204,8 @@ allocate_ulq_item(lookup_type_t type, const kuid_t *kuid,
 	ui->start = start;
 	ui->err = err;
 	ui->arg = arg;
+	ui->indexed = FALSE;
+	ui->served = FALSE;
 
 	return ui;
 }
@@ -199,6 +217,7 @@ static void
 free_ulq_item(struct ulq_item *ui)
 {
 	ulq_item_check(ui);
+	g_assert(!ui->indexed);
 
 	kuid_atom_free(ui->kuid);
 	ui->kuid = NULL;
@@ -293,6 +312,101 @@ ulq_value_found_cb(const kuid_t *kuid, const lookup_val_rs_t *rs, void *arg)
 	ulq_completed(ui);
 }
 
+/**
+ * Remove item from the index of pending STORE lookups, if present.
+ */
+static void
+ulq_store_unindex(struct ulq_item *ui)
+{
+	ulq_item_check(ui);
+
+	if (ui->indexed) {
+		bool removed = patricia_remove(store_pending, ui->kuid);
+		g_assert(removed);
+		ui->indexed = FALSE;
+	}
+}
+
+/**
+ * Serve enqueued STORE lookups for keys close to the one that was just
+ * looked up, using the lookup path we got.
+ *
+ * Served items are left in their FIFO, flagged as such, and will be
+ * discarded when they reach its head: removing them now would require
+ * a linear scan of the queue.
+ *
+ * @param kuid		the key that was looked up
+ * @param rs		the lookup results
+ */
+static void
+ulq_store_share(const kuid_t *kuid, const lookup_rs_t *rs)
+{
+	struct {
+		struct ulq_item *ui;
+		const lookup_rs_t *rs;
+	} served[ULQ_SHARE_MAX];
+	patricia_iter_t *iter;
+	int i, count = 0;
+
+	if (0 == patricia_count(store_pending))
+		return;
+
+	/*
+	 * Enqueued keys are considered by increasing distance to the key we
+	 * looked up: as soon as the path can no longer be used for one of
+	 * them, it will not work for further keys either (barring rounding).
+	 */
+
+	iter = patricia_metric_iterator_lazy(store_pending, kuid, TRUE);
+
+	while (count < ULQ_SHARE_MAX && patricia_iter_has_next(iter)) {
+		struct ulq_item *ui = patricia_iter_next_value(iter);
+		const lookup_rs_t *drs;
+
+		ulq_item_check(ui);
+		g_assert(LOOKUP_STORE == ui->type);
+
+		drs = lookup_result_derive(rs, kuid, ui->kuid, KDA_K);
+		if (NULL == drs)
+			break;
+
+		served[count].ui = ui;
+		served[count].rs = drs;
+		count++;
+	}
+
+	patricia_iterator_release(&iter);
+
+	if (0 == count)
+		return;
+
+	if (GNET_PROPERTY(dht_ulq_debug) > 1) {
+		g_debug("DHT ULQ lookup path for %s serving %d enqueued STORE lookup%s",
+			kuid_to_hex_string(kuid), count, plural(count));
+	}
+
+	/*
+	 * Items are marked as served before invoking any callback, since these
+	 * may enqueue new lookups.
+	 */
+
+	for (i = 0; i < count; i++) {
+		struct ulq_item *ui = served[i].ui;
+
+		ulq_store_unindex(ui);
+		ui->served = TRUE;
+		g_assert(sched.pending > 0);
+		sched.pending--;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct ulq_item *ui = served[i].ui;
+
+		(*ui->u.fn.ok)(ui->kuid, served[i].rs, ui->arg);
+		lookup_result_free(served[i].rs);
+	}
+}
+
 /**
  * Intercepting "node found" callback.
  */
@@ -306,6 +420,7 @@ ulq_node_found_cb(const kuid_t *kuid, const lookup_rs_t *rs, void *arg)
 	g_assert(ui->kuid == kuid);		/* Atoms */
 
 	(*ui->u.fn.ok)(ui->kuid, rs, ui->arg);
+	ulq_store_share(ui->kuid, rs);
 	ulq_completed(ui);
 }
 
@@ -408,10 +523,16 @@ ulq_launch(struct ulq *uq)
 	g_assert(sched.pending > 0);
 
 	ui = fifo_remove(uq->q);
-	sched.pending--;
-
 	ulq_item_check(ui);
 
+	if (ui->served) {
+		free_ulq_item(ui);		/* Already accounted for and completed */
+		return FALSE;
+	}
+
+	sched.pending--;
+	ulq_store_unindex(ui);
+
 	/*
 	 * If there is a "starting" callback, make sure it returns TRUE
 	 * before launching the request.
@@ -766,6 +887,16 @@ ulq_find_store_roots(const kuid_t *kuid, bool prioritary,
 	ui = allocate_ulq_item(LOOKUP_STORE,  kuid, NULL, error, arg);
 	ui->u.fn.ok = ok;
 
+	/*
+	 * Only one item per KUID can be indexed, others will be looked up
+	 * normally.
+	 */
+
+	if (!patricia_contains(store_pending, ui->kuid)) {
+		patricia_insert(store_pending, ui->kuid, ui);
+		ui->indexed = TRUE;
+	}
+
 	ulq_putq(uq, ui);
 }
 
@@ -884,6 +1015,7 @@ ulq_init(void)
 
 	ZERO(&sched);
 	sched.runq = slist_new();
+	store_pending = patricia_create(KUID_RAW_BITSIZE);
 }
 
 /**
@@ -903,9 +1035,10 @@ free_fifo_item(void *item, void *data)
 	 * lookups were cancelled, so that they may cleanup after themselves.
 	 */
 
-	if (!*exiting)
+	if (!*exiting && !ui->served)
 		(*ui->err)(ui->kuid, LOOKUP_E_CANCELLED, ui->arg);
 
+	ulq_store_unindex(ui);
 	free_ulq_item(ui);
 }
 
@@ -945,6 +1078,9 @@ ulq_close(bool exiting)
 			ulq[i] = NULL;
 		}
 	}
+
+	patricia_destroy(store_pending);
+	store_pending = NULL;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
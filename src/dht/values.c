@@ -83,8 +83,10 @@
 #include "lib/cq.h"
 #include "lib/dbmw.h"
 #include "lib/dbstore.h"
+#include "lib/erbtree.h"
 #include "lib/hashing.h"
 #include "lib/host_addr.h"
+#include "lib/hikset.h"
 #include "lib/hset.h"
 #include "lib/log.h"				/* For log_file_printable() */
 #include "lib/mempcpy.h"
@@ -196,6 +198,24 @@ static acct_net_t *values_per_class_c;
  */
 static hset_t *expired;
 
+/**
+ * In-core expiration index entry for a value.
+ *
+ * The expiration time of each value is also kept in the valuedata database,
+ * but we need it in core to be able to expire values without reading the
+ * database: values waiting for expiration are kept in a tree sorted by
+ * increasing expiration time.
+ */
+struct value_expiry {
+	uint64 dbkey;				/**< The 64-bit DB key of the value */
+	time_t expire;				/**< Expiration time */
+	rbnode_t node;				/**< Embedded node in the expiry tree */
+	bool queued;				/**< Whether entry is in the expiry tree */
+};
+
+static hikset_t *values_expiry;		/**< DB key => struct value_expiry */
+static erbtree_t values_expiry_tree;	/**< Sorted by expiration time */
+
 /**
  * DBM wrapper to store valuedata.
  */
@@ -934,6 +954,63 @@ kuid_pair_was_republished(const kuid_t *key, const kuid_t *skey)
 	dbmw_delete(db_expired, buf);
 }
 
+/**
+ * Comparison routine for the expiry tree, by increasing expiration time.
+ */
+static int
+value_expiry_cmp(const void *a, const void *b)
+{
+	const struct value_expiry *va = a, *vb = b;
+	int c = CMP(va->expire, vb->expire);
+
+	return 0 == c ? CMP(va->dbkey, vb->dbkey) : c;
+}
+
+/**
+ * Record or update the expiration time of a value in the expiry index.
+ */
+static void
+values_expiry_set(uint64 dbkey, time_t expire)
+{
+	struct value_expiry *ve;
+
+	ve = hikset_lookup(values_expiry, &dbkey);
+
+	if (NULL == ve) {
+		WALLOC0(ve);
+		ve->dbkey = dbkey;
+		hikset_insert(values_expiry, ve);
+	} else if (ve->queued) {
+		if (ve->expire == expire)
+			return;
+		erbtree_remove(&values_expiry_tree, &ve->node);
+	}
+
+	ve->expire = expire;
+	ve->queued = TRUE;
+	erbtree_insert(&values_expiry_tree, &ve->node);
+}
+
+/**
+ * Remove value from the expiry index.
+ */
+static void
+values_expiry_remove(uint64 dbkey)
+{
+	struct value_expiry *ve;
+
+	ve = hikset_lookup(values_expiry, &dbkey);
+
+	if (NULL == ve)
+		return;
+
+	if (ve->queued)
+		erbtree_remove(&values_expiry_tree, &ve->node);
+
+	hikset_remove(values_expiry, &dbkey);
+	WFREE(ve);
+}
+
 /**
  * Get valuedata from database.
  */
@@ -973,6 +1050,8 @@ delete_valuedata(uint64 dbkey, bool has_expired)
 
 	g_assert(values_managed > 0);
 
+	values_expiry_remove(dbkey);
+
 	vd = get_valuedata(dbkey);
 	if (NULL == vd)
 		return;			/* I/O error or corrupted data */
@@ -1019,24 +1098,15 @@ values_reclaim_expired(void)
 	hset_foreach_remove(expired, reclaim_dbkey, NULL);
 }
 
-/**
- *  Callout queue periodic event for value expiration.
- */
-static bool
-values_periodic_expire(void *unused_obj)
-{
-	(void) unused_obj;
-
-	values_reclaim_expired();
-	return TRUE;		/* Keep calling */
-}
-
 /**
  * Log statistics about an expired value.
  */
 static void
 log_expired_value_stats(uint64 dbkey, const struct valuedata *vd)
 {
+	if (NULL == vd)
+		vd = get_valuedata(dbkey);
+
 	if (NULL == vd)
 		return;
 
@@ -1124,6 +1194,25 @@ bool
 values_has_expired(uint64 dbkey, time_t now, time_t *expire)
 {
 	struct valuedata *vd;
+	const struct value_expiry *ve;
+
+	/*
+	 * The expiry index saves us from reading the value from the database.
+	 */
+
+	ve = hikset_lookup(values_expiry, &dbkey);
+
+	if (ve != NULL) {
+		if (expire != NULL)
+			*expire = ve->expire;
+
+		if (delta_time(now, ve->expire) >= 0)  {
+			values_expire(dbkey, NULL);
+			return TRUE;
+		}
+
+		return FALSE;
+	}
 
 	vd = get_valuedata(dbkey);
 
@@ -1141,6 +1230,40 @@ values_has_expired(uint64 dbkey, time_t now, time_t *expire)
 	return FALSE;
 }
 
+/**
+ * Flag all the values whose expiration time has been reached as expired,
+ * using the expiry index.
+ */
+static void
+values_expire_due(time_t now)
+{
+	rbnode_t *rn;
+
+	while (NULL != (rn = erbtree_first(&values_expiry_tree))) {
+		struct value_expiry *ve = erbtree_data(&values_expiry_tree, rn);
+
+		if (delta_time(now, ve->expire) < 0)
+			break;
+
+		erbtree_remove(&values_expiry_tree, rn);
+		ve->queued = FALSE;
+		values_expire(ve->dbkey, NULL);
+	}
+}
+
+/**
+ *  Callout queue periodic event for value expiration.
+ */
+static bool
+values_periodic_expire(void *unused_obj)
+{
+	(void) unused_obj;
+
+	values_expire_due(tm_time());
+	values_reclaim_expired();
+	return TRUE;		/* Keep calling */
+}
+
 /**
  * Validate that sender and valued's creator agree on other things than
  * just the KUID: they must agree on everything.
@@ -1743,6 +1866,7 @@ values_publish(const knode_t *kn, const dht_value_t *v)
 	}
 
 	dbmw_write(db_valuedata, &dbkey, vd, sizeof *vd);
+	values_expiry_set(dbkey, vd->expire);
 
 	return STORE_SC_OK;
 
@@ -2023,6 +2147,7 @@ values_reload(void *key, void *value, size_t u_len, void *data)
 	 */
 
 	keys_add_value(&vd->id, &vd->cid, *dbk, vd->expire);
+	values_expiry_set(*dbk, vd->expire);
 	acct_net_update(values_per_class_c, vd->addr, NET_CLASS_C_MASK, +1);
 	acct_net_update(values_per_ip, vd->addr, NET_IPv4_MASK, +1);
 
@@ -2095,6 +2220,7 @@ values_init(void)
 	g_assert(NULL == values_per_ip);
 	g_assert(NULL == values_per_class_c);
 	g_assert(NULL == expired);
+	g_assert(NULL == values_expiry);
 	g_assert(NULL == values_expire_ev);
 
 	db_valuedata = dbstore_open(db_valwhat, settings_dht_db_dir(),
@@ -2113,6 +2239,10 @@ values_init(void)
 	values_per_ip = acct_net_create();
 	values_per_class_c = acct_net_create();
 	expired = hset_create_any(uint64_hash, NULL, uint64_eq);
+	values_expiry = hikset_create_any(
+		offsetof(struct value_expiry, dbkey), uint64_hash, uint64_eq);
+	erbtree_init(&values_expiry_tree, value_expiry_cmp,
+		offsetof(struct value_expiry, node));
 
 	values_expire_ev = cq_periodic_main_add(EXPIRE_PERIOD * 1000,
 		values_periodic_expire, NULL);
@@ -2182,6 +2312,16 @@ values_init_data(const hset_t *dbkeys)
 	}
 }
 
+static void
+values_expiry_free(void *value, void *u_data)
+{
+	struct value_expiry *ve = value;
+
+	(void) u_data;
+
+	WFREE(ve);
+}
+
 static void
 expired_free_k(const void *key, void *u_data)
 {
@@ -2211,6 +2351,10 @@ values_close(void)
 
 	hset_foreach(expired, expired_free_k, NULL);
 	hset_free_null(&expired);
+
+	erbtree_clear(&values_expiry_tree);
+	hikset_foreach(values_expiry, values_expiry_free, NULL);
+	hikset_free_null(&values_expiry);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
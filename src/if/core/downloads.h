@@ -191,6 +191,10 @@ enum dl_pipeline_magic { DL_PIPELINE_MAGIC = 0x58ba60ce };	/**< Magic number */
 /**
  * Pipelined HTTP request (sent ahead whilst data for the previous HTTP request
  * is being received).
+ *
+ * Several requests can be outstanding: they are linked in the order they
+ * were sent, which is the order in which the server will reply to them.
+ * Only the last one can be in the SELECTED or SENDING state.
  */
 struct dl_pipeline {
 	enum dl_pipeline_magic magic;	/**< Magic number */
@@ -198,6 +202,7 @@ struct dl_pipeline {
 	struct dl_chunk chunk;			/**< Requested chunk */
 	struct http_buffer *req;		/**< Partially sent HTTP request */
 	pmsg_t *extra;					/**< Extra data received */
+	struct dl_pipeline *next;		/**< Next pipelined request, sent after */
 };
 
 static inline void
@@ -235,7 +240,7 @@ struct download {
 	struct dl_chunk chunk;		/**< Requested chunk */
 	filesize_t pos;				/**< Current file data writing position */
 
-	struct dl_pipeline *pipeline;	/**< If non-NULL: pipelined HTTP request */
+	struct dl_pipeline *pipeline;	/**< If non-NULL: pipelined HTTP requests */
 
 	struct gnutella_socket *socket;
 	struct file_object *out_file;	/**< downloaded file */
@@ -266,6 +271,7 @@ struct download {
 	time_t last_dmesh;			/**< Time when last download mesh was sent */
 
 	http_rangeset_t *ranges;	/**< PFSP -- known set of ranges, or NULL */
+	http_rangeset_t *avail_ranges;	/**< Ranges counted in fileinfo map */
 	filesize_t ranges_size;		/**< PFSP -- size of remotely available data */
 	filesize_t sinkleft;		/**< Amount of data left to sink */
 
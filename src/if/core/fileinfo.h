@@ -26,6 +26,7 @@
 
 #include "common.h"
 
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -35,6 +36,7 @@
 
 struct shared_file;
 struct download;
+struct fi_journal;
 
 /*
  * Operating flags.
@@ -155,6 +157,9 @@ typedef struct dl_file_info {
 		struct tth *leaves;	/**< Tigertree leaves */
 		size_t num_leaves;	/**< Number of tigertree leaves */
 		filesize_t slice_size;	/* Slice size (bytes covered by a leaf) */
+		uint8 *verified;	/**< Per-slice verification state */
+		uint8 *generation;	/**< Per-slice invalidation count */
+		size_t good;		/**< Amount of slices verified good */
 	} tigertree;
 	int32 refcount;			/**< Reference count of file (number of sources)*/
 	pslist_t *sources;		/**< list of sources (struct download *) */
@@ -170,9 +175,16 @@ typedef struct dl_file_info {
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
-	eslist_t available;		/**< List of ranges available, with source count */
+	erbtree_t chunktree;	/**< Same ranges, indexed by offset */
+	erbtree_t available;	/**< Ranges available, with source count */
+	erbtree_t rarest;		/**< Same ranges, rarest first */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
+	uint32 checkpoint;		/**< Generation of last full trailer on disk */
+	uint32 trailer_len;		/**< Length of last full trailer, 0 if unknown */
+	uint32 journal_len;		/**< Length of journal appended after trailer */
+	uint32 journal_sum;		/**< Running checksum of journal records */
+	struct fi_journal *journal;	/**< Pending chunk changes, not yet flushed */
 	struct shared_file *sf;	/**< When PFSP-server is enabled, share this file */
 	uint32 active_queued;	/**< Actively queued sources */
 	uint32 passive_queued;	/**< Passively queued sources */
@@ -207,6 +219,7 @@ typedef struct dl_file_info {
 	unsigned dirty_status:1;  	/**< Notify status change on next interval */
 	unsigned hashed:1;			/**< In hash tables? */
 	unsigned tth_check:1;		/**< TTH checking performed? */
+	unsigned no_empty:1;		/**< No EMPTY chunk left (endgame)? */
 } fileinfo_t;
 
 static inline void
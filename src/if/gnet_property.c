@@ -1108,6 +1108,16 @@ guint32  gnet_property_variable_g2_browse_served     = 0;
 static const guint32  gnet_property_variable_g2_browse_served_default = 0;
 gboolean gnet_property_variable_log_sending_g2     = FALSE;
 static const gboolean gnet_property_variable_log_sending_g2_default = FALSE;
+gboolean gnet_property_variable_dht_lookup_adaptive     = FALSE;
+static const gboolean gnet_property_variable_dht_lookup_adaptive_default = FALSE;
+gboolean gnet_property_variable_vmm_hugepages     = FALSE;
+static const gboolean gnet_property_variable_vmm_hugepages_default = FALSE;
+gboolean gnet_property_variable_vmm_numa_local     = FALSE;
+static const gboolean gnet_property_variable_vmm_numa_local_default = FALSE;
+guint32  gnet_property_variable_dl_pipeline_depth     = 4;
+static const guint32  gnet_property_variable_dl_pipeline_depth_default = 4;
+guint32  gnet_property_variable_dl_chunk_duration     = 30;
+static const guint32  gnet_property_variable_dl_chunk_duration_default = 30;
 
 static prop_set_t *gnet_property;
 
@@ -10756,6 +10766,102 @@ gnet_prop_init(void) {
     gnet_property->props[480].data.boolean.def   = (void *) &gnet_property_variable_log_sending_g2_default;
     gnet_property->props[480].data.boolean.value = (void *) &gnet_property_variable_log_sending_g2;
 
+
+    /*
+     * PROP_DHT_LOOKUP_ADAPTIVE:
+     *
+     * General data:
+     */
+    gnet_property->props[481].name = "dht_lookup_adaptive";
+    gnet_property->props[481].desc = _("Whether DHT lookups adapt their parallelism to the observed RPC round-trip times and timeouts.");
+    gnet_property->props[481].ev_changed = event_new("dht_lookup_adaptive_changed");
+    gnet_property->props[481].save = TRUE;
+    gnet_property->props[481].vector_size = 1;
+	mutex_init(&gnet_property->props[481].lock);
+
+    /* Type specific data: */
+    gnet_property->props[481].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[481].data.boolean.def   = (void *) &gnet_property_variable_dht_lookup_adaptive_default;
+    gnet_property->props[481].data.boolean.value = (void *) &gnet_property_variable_dht_lookup_adaptive;
+
+
+    /*
+     * PROP_VMM_HUGEPAGES:
+     *
+     * General data:
+     */
+    gnet_property->props[482].name = "vmm_hugepages";
+    gnet_property->props[482].desc = _("Whether large memory regions, such as hash tables or routing tables, should be backed by transparent huge pages, to reduce TLB misses on large memory footprints. Regions are only advised to use huge pages and the kernel remains free to ignore the advice.");
+    gnet_property->props[482].ev_changed = event_new("vmm_hugepages_changed");
+    gnet_property->props[482].save = TRUE;
+    gnet_property->props[482].vector_size = 1;
+	mutex_init(&gnet_property->props[482].lock);
+
+    /* Type specific data: */
+    gnet_property->props[482].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[482].data.boolean.def   = (void *) &gnet_property_variable_vmm_hugepages_default;
+    gnet_property->props[482].data.boolean.value = (void *) &gnet_property_variable_vmm_hugepages;
+
+
+    /*
+     * PROP_VMM_NUMA_LOCAL:
+     *
+     * General data:
+     */
+    gnet_property->props[483].name = "vmm_numa_local";
+    gnet_property->props[483].desc = _("Whether memory regions returned to the page cache should have their physical pages released, so that re-using them allocates pages on the NUMA node of the thread touching them first. This is only useful on NUMA machines since it causes extra page faults.");
+    gnet_property->props[483].ev_changed = event_new("vmm_numa_local_changed");
+    gnet_property->props[483].save = TRUE;
+    gnet_property->props[483].vector_size = 1;
+	mutex_init(&gnet_property->props[483].lock);
+
+    /* Type specific data: */
+    gnet_property->props[483].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[483].data.boolean.def   = (void *) &gnet_property_variable_vmm_numa_local_default;
+    gnet_property->props[483].data.boolean.value = (void *) &gnet_property_variable_vmm_numa_local;
+
+
+    /*
+     * PROP_DL_PIPELINE_DEPTH:
+     *
+     * General data:
+     */
+    gnet_property->props[484].name = "dl_pipeline_depth";
+    gnet_property->props[484].desc = _("Maximum amount of HTTP requests that can be pipelined to a download source, beyond the one being served. The actual depth used for each source is tuned from its measured latency and throughput, up to this limit.");
+    gnet_property->props[484].ev_changed = event_new("dl_pipeline_depth_changed");
+    gnet_property->props[484].save = TRUE;
+    gnet_property->props[484].vector_size = 1;
+	mutex_init(&gnet_property->props[484].lock);
+
+    /* Type specific data: */
+    gnet_property->props[484].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[484].data.guint32.def   = (void *) &gnet_property_variable_dl_pipeline_depth_default;
+    gnet_property->props[484].data.guint32.value = (void *) &gnet_property_variable_dl_pipeline_depth;
+    gnet_property->props[484].data.guint32.choices = NULL;
+    gnet_property->props[484].data.guint32.max   = 16;
+    gnet_property->props[484].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_DL_CHUNK_DURATION:
+     *
+     * General data:
+     */
+    gnet_property->props[485].name = "dl_chunk_duration";
+    gnet_property->props[485].desc = _("Target duration, in seconds, of each chunk request made to a download source. Chunk sizes are computed from the measured throughput and latency of each source so that requests last about that long, and shrink when the file is about to be completed. Chunk sizes remain bounded by the minimum and maximum chunk sizes.");
+    gnet_property->props[485].ev_changed = event_new("dl_chunk_duration_changed");
+    gnet_property->props[485].save = TRUE;
+    gnet_property->props[485].vector_size = 1;
+	mutex_init(&gnet_property->props[485].lock);
+
+    /* Type specific data: */
+    gnet_property->props[485].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[485].data.guint32.def   = (void *) &gnet_property_variable_dl_chunk_duration_default;
+    gnet_property->props[485].data.guint32.value = (void *) &gnet_property_variable_dl_chunk_duration;
+    gnet_property->props[485].data.guint32.choices = NULL;
+    gnet_property->props[485].data.guint32.max   = 600;
+    gnet_property->props[485].data.guint32.min   = 5;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
@@ -517,6 +517,11 @@ typedef enum {
     PROP_G2_BROWSE_COUNT,
     PROP_G2_BROWSE_SERVED,
     PROP_LOG_SENDING_G2,
+    PROP_DHT_LOOKUP_ADAPTIVE,
+    PROP_VMM_HUGEPAGES,
+    PROP_VMM_NUMA_LOCAL,
+    PROP_DL_PIPELINE_DEPTH,
+    PROP_DL_CHUNK_DURATION,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -531,7 +531,11 @@ extern const gboolean gnet_property_variable_log_query_hit_records;
 extern const guint32  gnet_property_variable_g2_browse_count;
 extern const guint32  gnet_property_variable_g2_browse_served;
 extern const gboolean gnet_property_variable_log_sending_g2;
-
+extern const gboolean gnet_property_variable_dht_lookup_adaptive;
+extern const gboolean gnet_property_variable_vmm_hugepages;
+extern const gboolean gnet_property_variable_vmm_numa_local;
+extern const guint32  gnet_property_variable_dl_pipeline_depth;
+extern const guint32  gnet_property_variable_dl_chunk_duration;
 
 prop_set_t *gnet_prop_init(void);
 void gnet_prop_shutdown(void);
@@ -47,6 +47,11 @@
  * Writing to the queue never blocks, but reading will if there is nothing
  * pending to be read, unless a non-blocking read is performed.
  *
+ * Writers do not even take a lock: items are appended to a lock-free
+ * multiple-producer single-consumer queue and the lock is only grabbed
+ * to wake up readers when the queue becomes non-empty.  The lock serializes
+ * readers, who are therefore seen as a single consumer by the queue.
+ *
  * It is possible to add an asynchronous waiter object to the queue which will
  * get signaled when there is pending data to read.  This allows an I/O-driven
  * thread to select() on the waiter's file descriptor to get informed that
@@ -101,6 +106,7 @@
 #include "cond.h"
 #include "eslist.h"
 #include "log.h"
+#include "mpscq.h"
 #include "mutex.h"
 #include "stringify.h"
 #include "tm.h"
@@ -117,8 +123,8 @@ enum async_queue_magic { ASYNC_QUEUE_MAGIC = 0x51647584 };
 struct async_queue {
 	enum async_queue_magic magic;	/* Magic number */
 	int refcnt;						/* Reference count */
-	eslist_t queue;					/* The list implementing the queue */
-	mutex_t lock;					/* Thread-safe lock */
+	mpscq_t queue;					/* The lock-free queue */
+	mutex_t lock;					/* Serializes readers */
 	cond_t event;					/* To wait/signal events on queue */
 };
 
@@ -166,7 +172,7 @@ aq_make_full(bool signals)
 	WALLOC0(aq);
 	aq->magic = ASYNC_QUEUE_MAGIC;
 	aq->refcnt = 1;
-	eslist_init(&aq->queue, offsetof(struct async_queue_item, lk));
+	mpscq_init(&aq->queue, offsetof(struct async_queue_item, lk));
 	mutex_init(&aq->lock);
 	cond_init_full(&aq->event, &aq->lock, signals);
 
@@ -215,16 +221,20 @@ aq_free_item(void *item, void *unused_data)
 static void
 aq_free(aqueue_t *aq)
 {
+	eslist_t items = ESLIST_INIT(offsetof(struct async_queue_item, lk));
+
 	aq_check(aq);
 	g_assert(0 == aq->refcnt);
 
-	if G_UNLIKELY(0 != eslist_count(&aq->queue)) {
-		size_t count = eslist_count(&aq->queue);
+	if G_UNLIKELY(0 != mpscq_count(&aq->queue)) {
+		size_t count = mpscq_count(&aq->queue);
 		s_carp("%s() freeing asynchronous queue still holding %zu item%s",
 			G_STRFUNC, count, plural(count));
 	}
 
-	eslist_foreach(&aq->queue, aq_free_item, NULL);
+	mpscq_drain(&aq->queue, &items);
+	mpscq_discard(&aq->queue);
+	eslist_foreach(&items, aq_free_item, NULL);
 	mutex_destroy(&aq->lock);
 	cond_destroy(&aq->event);
 
@@ -281,6 +291,9 @@ aq_destroy_null(aqueue_t **aq_ptr)
 
 /**
  * Explicitly lock the queue to perform several operations atomically.
+ *
+ * This only excludes other readers: writers never take the lock and
+ * can still append items whilst the queue is locked.
  */
 void
 aq_lock(aqueue_t *aq)
@@ -307,16 +320,9 @@ aq_unlock(aqueue_t *aq)
 size_t
 aq_count(const aqueue_t *aq)
 {
-	aqueue_t *waq = deconstify_pointer(aq);
-	size_t count;
-
 	aq_check(aq);
 
-	mutex_lock(&waq->lock);
-	count = eslist_count(&aq->queue);
-	mutex_unlock(&waq->lock);
-
-	return count;
+	return mpscq_count(&aq->queue);
 }
 
 /**
@@ -341,15 +347,50 @@ aq_put(aqueue_t *aq, void *data)
 	WALLOC0(aqi);
 	aqi->data = data;
 
-	mutex_lock(&aq->lock);
+	count = mpscq_put(&aq->queue, aqi);
+
+	/*
+	 * Readers only wait when the queue is empty, checking it under the lock.
+	 * If we made the queue non-empty, grab the lock to signal them: they are
+	 * either already waiting, or will see our item before waiting.
+	 *
+	 * When the queue was not empty, there is no need to signal: readers
+	 * wake up each other when they leave items behind them.
+	 */
+
+	if (1 == count) {
+		mutex_lock(&aq->lock);
+		cond_signal(&aq->event, &aq->lock);
+		mutex_unlock(&aq->lock);
+	}
+
+	return count;
+}
 
-	eslist_append(&aq->queue, aqi);
-	count = eslist_count(&aq->queue);
-	cond_signal(&aq->event, &aq->lock);
+/**
+ * Remove the oldest item from the queue, with the lock held.
+ *
+ * If items remain and other readers are waiting, signal the next one since
+ * writers only signal when the queue becomes non-empty.
+ *
+ * @return the item, NULL if the queue was empty.
+ */
+static struct async_queue_item *
+aq_shift(aqueue_t *aq)
+{
+	struct async_queue_item *aqi;
 
-	mutex_unlock(&aq->lock);
+	assert_mutex_is_owned(&aq->lock);
 
-	return count;
+	aqi = mpscq_shift(&aq->queue);
+
+	if (
+		aqi != NULL && 0 != mpscq_count(&aq->queue) &&
+		0 != cond_pending_count(&aq->event)
+	)
+		cond_signal(&aq->event, &aq->lock);
+
+	return aqi;
 }
 
 /**
@@ -381,11 +422,11 @@ aq_timed_remove(aqueue_t *aq, const tm_t *timeout)
 	tm_add(&end, timeout);
 
 	mutex_lock(&aq->lock);
-	while (has_data && 0 == eslist_count(&aq->queue))
+	while (has_data && 0 == mpscq_count(&aq->queue))
 		has_data = cond_wait_until_clean(&aq->event, &aq->lock, &end);
 
 	if (has_data)
-		aqi = eslist_shift(&aq->queue);
+		aqi = aq_shift(aq);
 	mutex_unlock(&aq->lock);
 
 	if (has_data) {
@@ -422,10 +463,10 @@ aq_remove(aqueue_t *aq)
 	aq_check(aq);
 
 	mutex_lock(&aq->lock);
-	while (0 == eslist_count(&aq->queue))
+	while (0 == mpscq_count(&aq->queue))
 		cond_wait_clean(&aq->event, &aq->lock);
 
-	aqi = eslist_shift(&aq->queue);
+	aqi = aq_shift(aq);
 	mutex_unlock(&aq->lock);
 
 	g_assert(aqi != NULL);
@@ -455,7 +496,7 @@ aq_remove_try(aqueue_t *aq)
 	aq_check(aq);
 
 	mutex_lock(&aq->lock);
-	aqi = eslist_shift(&aq->queue);
+	aqi = aq_shift(aq);
 	mutex_unlock(&aq->lock);
 
 	if (aqi != NULL) {
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Region allocator with checkpoint / reset, and per-thread arenas.
+ *
+ * An arena is a chain of chunks from which memory is allocated by simply
+ * bumping a pointer.  Individual blocks are never freed: instead, one takes
+ * a checkpoint of the arena and later resets the arena to that checkpoint,
+ * releasing everything that was allocated since at once.  Contrary to the
+ * chunk allocator (ckalloc), the arena grows as needed by chaining new chunks.
+ *
+ * This is ideal for parsing incoming messages: the many small objects
+ * created whilst parsing all have the same lifetime, that of the message
+ * processing, and releasing them one by one is pure overhead.
+ *
+ * Each thread gets its own arena, which it can activate by entering a scope
+ * with arena_thread_enter() and deactivate with arena_thread_leave(), which
+ * releases all the memory allocated within the scope.  Scopes nest.
+ *
+ * Code that may run within such a scope can then use arena_walloc() instead
+ * of walloc(), and arena_wfree() instead of wfree(): when a thread scope is
+ * active, memory comes from the thread arena and freeing is a no-op, the
+ * whole being reclaimed when the scope is left.  Outside of any scope, these
+ * routines simply redirect to walloc() and wfree().
+ *
+ * Blocks allocated within a scope must therefore not be referenced once
+ * the scope is left, and must be freed by the thread that allocated them.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "arena.h"
+
+#include "misc.h"			/* For round_pagesize() */
+#include "stringify.h"		/* For plural() */
+#include "thread.h"			/* For thread_small_id() */
+#include "unsigned.h"
+#include "vmm.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define ARENA_ALIGNBYTES	MEM_ALIGNBYTES
+#define ARENA_MASK			(ARENA_ALIGNBYTES - 1)
+#define arena_round(s) \
+	((ulong) (((ulong) (s) + ARENA_MASK) & ~ARENA_MASK))
+
+/**
+ * An arena chunk, this header being at the start of the chunk.
+ */
+struct arena_chunk {
+	struct arena_chunk *prev;	/**< Previous chunk in the arena */
+	char *avail;				/**< First free byte */
+	char *end;					/**< First byte beyond chunk */
+	size_t size;				/**< Chunk size, as allocated */
+};
+
+#define ARENA_CHUNK_OVERHEAD	arena_round(sizeof(struct arena_chunk))
+
+enum arena_magic { ARENA_MAGIC = 0x1f6b0e53 };
+
+/**
+ * An arena.
+ */
+struct arena {
+	enum arena_magic magic;
+	struct arena_chunk *chunk;	/**< Current chunk, NULL if none yet */
+	struct arena_chunk *spare;	/**< Released chunk kept for re-use */
+	size_t chunk_size;			/**< Size of regular chunks */
+	uint depth;					/**< Thread scope nesting depth */
+};
+
+static inline void
+arena_check(const struct arena * const a)
+{
+	g_assert(a != NULL);
+	g_assert(ARENA_MAGIC == a->magic);
+}
+
+static arena_t *arena_threads[THREAD_MAX];	/**< Per-thread arenas */
+
+/**
+ * Create a new arena.
+ *
+ * @param chunk_size	size of the chunks from which we allocate
+ *
+ * @return a new empty arena, which will allocate its first chunk on demand.
+ */
+arena_t *
+arena_make(size_t chunk_size)
+{
+	arena_t *a;
+
+	g_assert(size_is_positive(chunk_size));
+
+	XMALLOC0(a);
+	a->magic = ARENA_MAGIC;
+	a->chunk_size = round_pagesize(MAX(chunk_size, 2 * ARENA_CHUNK_OVERHEAD));
+
+	return a;
+}
+
+/**
+ * Release chunk that is no longer part of the arena.
+ */
+static void
+arena_chunk_release(arena_t *a, struct arena_chunk *c)
+{
+	if (a->chunk_size == c->size && NULL == a->spare) {
+		c->prev = NULL;
+		a->spare = c;
+	} else {
+		vmm_core_free(c, c->size);
+	}
+}
+
+/**
+ * Release all the memory used by the arena, and nullify its pointer.
+ */
+void
+arena_free_null(arena_t **a_ptr)
+{
+	arena_t *a = *a_ptr;
+
+	if (a != NULL) {
+		arena_check(a);
+		g_assert_log(0 == a->depth,
+			"%s(): arena %p still has %u active scope%s",
+			G_STRFUNC, a, a->depth, plural(a->depth));
+
+		arena_clear(a);
+		if (a->spare != NULL)
+			vmm_core_free(a->spare, a->spare->size);
+		a->magic = 0;
+		xfree(a);
+		*a_ptr = NULL;
+	}
+}
+
+/**
+ * Allocate new chunk able to hold at least ``len'' bytes, and make it the
+ * current chunk of the arena.
+ */
+static struct arena_chunk *
+arena_chunk_add(arena_t *a, size_t len)
+{
+	struct arena_chunk *c;
+	size_t size = size_saturate_add(len, ARENA_CHUNK_OVERHEAD);
+
+	if (size <= a->chunk_size) {
+		if (a->spare != NULL) {
+			c = a->spare;
+			a->spare = NULL;
+		} else {
+			c = vmm_core_alloc(a->chunk_size);
+			c->size = a->chunk_size;
+		}
+	} else {
+		size = round_pagesize(size);
+		c = vmm_core_alloc(size);
+		c->size = size;
+	}
+
+	c->avail = ptr_add_offset(c, ARENA_CHUNK_OVERHEAD);
+	c->end = ptr_add_offset(c, c->size);
+	c->prev = a->chunk;
+	a->chunk = c;
+
+	return c;
+}
+
+/**
+ * Allocate ``len'' bytes from the arena.
+ *
+ * @return pointer to the start of the block, suitably aligned.
+ */
+void *
+arena_alloc(arena_t *a, size_t len)
+{
+	struct arena_chunk *c;
+	void *p;
+
+	arena_check(a);
+	g_assert(size_is_positive(len));
+
+	len = arena_round(len);
+	c = a->chunk;
+
+	if G_UNLIKELY(NULL == c || ptr_diff(c->end, c->avail) < len)
+		c = arena_chunk_add(a, len);
+
+	p = c->avail;
+	c->avail += len;
+
+	return p;
+}
+
+/**
+ * Allocate ``len'' zeroed bytes from the arena.
+ */
+void *
+arena_alloc0(arena_t *a, size_t len)
+{
+	void *p = arena_alloc(a, len);
+
+	memset(p, 0, len);
+	return p;
+}
+
+/**
+ * Copy ``len'' bytes starting at ``p'' into the arena.
+ *
+ * @return pointer to the copy.
+ */
+void *
+arena_copy(arena_t *a, const void *p, size_t len)
+{
+	void *cp = arena_alloc(a, len);
+
+	memcpy(cp, p, len);
+	return cp;
+}
+
+/**
+ * Duplicate string into the arena.
+ *
+ * @return pointer to the copy, NULL if ``str'' was NULL.
+ */
+char *
+arena_strdup(arena_t *a, const char *str)
+{
+	return NULL == str ? NULL : arena_copy(a, str, 1 + strlen(str));
+}
+
+/**
+ * Record the current allocation point of the arena.
+ *
+ * @param a		the arena
+ * @param m		the checkpoint to fill
+ */
+void
+arena_checkpoint(const arena_t *a, arena_mark_t *m)
+{
+	arena_check(a);
+	g_assert(m != NULL);
+
+	m->chunk = a->chunk;
+	m->avail = NULL == a->chunk ? NULL : a->chunk->avail;
+	m->depth = a->depth;
+}
+
+/**
+ * Reset the arena to a previous checkpoint, releasing all the memory that
+ * was allocated since that checkpoint was taken.
+ *
+ * Checkpoints must be reset in the reverse order they were taken, and a
+ * checkpoint becomes invalid once the arena is reset to an older one.
+ */
+void
+arena_reset(arena_t *a, const arena_mark_t *m)
+{
+	arena_check(a);
+	g_assert(m != NULL);
+
+	while (a->chunk != m->chunk) {
+		struct arena_chunk *c = a->chunk;
+
+		g_assert_log(c != NULL,
+			"%s(): checkpoint %p not found in arena %p", G_STRFUNC, m, a);
+
+		a->chunk = c->prev;
+		arena_chunk_release(a, c);
+	}
+
+	if (a->chunk != NULL) {
+		g_assert(ptr_cmp(m->avail, a->chunk) > 0);
+		g_assert(ptr_cmp(m->avail, a->chunk->avail) <= 0);
+
+		a->chunk->avail = deconstify_pointer(m->avail);
+	}
+}
+
+/**
+ * Release all the memory allocated from the arena.
+ */
+void
+arena_clear(arena_t *a)
+{
+	arena_mark_t empty;
+
+	arena_check(a);
+
+	ZERO(&empty);
+	arena_reset(a, &empty);
+}
+
+/**
+ * Check whether block lies within a chunk.
+ */
+static inline bool
+arena_chunk_has(const struct arena_chunk *c, const void *p)
+{
+	return ptr_cmp(p, c) >= 0 && ptr_cmp(p, c->end) < 0;
+}
+
+/**
+ * @return whether the block was allocated from the arena.
+ */
+bool
+arena_owns(const arena_t *a, const void *p)
+{
+	const struct arena_chunk *c;
+
+	arena_check(a);
+
+	for (c = a->chunk; c != NULL; c = c->prev) {
+		if (arena_chunk_has(c, p))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * @return amount of bytes allocated from the arena.
+ */
+size_t
+arena_used(const arena_t *a)
+{
+	const struct arena_chunk *c;
+	size_t used = 0;
+
+	arena_check(a);
+
+	for (c = a->chunk; c != NULL; c = c->prev) {
+		used += ptr_diff(c->avail, c) - ARENA_CHUNK_OVERHEAD;
+	}
+
+	return used;
+}
+
+/**
+ * @return the arena of the current thread, created on demand.
+ */
+arena_t *
+arena_thread(void)
+{
+	uint stid = thread_small_id();
+	arena_t *a = arena_threads[stid];
+
+	if G_UNLIKELY(NULL == a)
+		a = arena_threads[stid] = arena_make(ARENA_CHUNK_SIZE);
+
+	return a;
+}
+
+/**
+ * Enter a new allocation scope for the current thread.
+ *
+ * Until the matching arena_thread_leave() call, arena_walloc() will
+ * allocate from the thread arena.
+ *
+ * @param m		the checkpoint to fill, to be given to arena_thread_leave()
+ */
+void
+arena_thread_enter(arena_mark_t *m)
+{
+	arena_t *a = arena_thread();
+
+	arena_checkpoint(a, m);
+	m->depth = ++a->depth;
+}
+
+/**
+ * Leave allocation scope, releasing all the memory allocated from the thread
+ * arena since the matching arena_thread_enter().
+ *
+ * @param m		the checkpoint filled by arena_thread_enter()
+ */
+void
+arena_thread_leave(const arena_mark_t *m)
+{
+	arena_t *a = arena_threads[thread_small_id()];
+
+	arena_check(a);
+	g_assert(m != NULL);
+	g_assert_log(m->depth == a->depth,
+		"%s(): leaving scope at depth %u, current depth is %u",
+		G_STRFUNC, m->depth, a->depth);
+
+	arena_reset(a, m);
+	a->depth--;
+}
+
+/**
+ * @return whether the current thread is within an arena allocation scope.
+ */
+bool
+arena_thread_active(void)
+{
+	arena_t *a = arena_threads[thread_small_id()];
+
+	return a != NULL && a->depth != 0;
+}
+
+/**
+ * Allocate ``size'' bytes from the thread arena if we are within a thread
+ * allocation scope, or via walloc() otherwise.
+ *
+ * The block must be released through arena_wfree().
+ */
+void *
+arena_walloc(size_t size)
+{
+	arena_t *a = arena_threads[thread_small_id()];
+
+	if (a != NULL && a->depth != 0)
+		return arena_alloc(a, size);
+
+	return walloc(size);
+}
+
+/**
+ * Same as arena_walloc() but zeroes the allocated block.
+ */
+void *
+arena_walloc0(size_t size)
+{
+	arena_t *a = arena_threads[thread_small_id()];
+
+	if (a != NULL && a->depth != 0)
+		return arena_alloc0(a, size);
+
+	return walloc0(size);
+}
+
+/**
+ * Free block allocated via arena_walloc().
+ *
+ * Blocks coming from the thread arena are left alone, since they will be
+ * released when the current scope is left.  Other blocks are wfree()'d.
+ */
+void
+arena_wfree(void *p, size_t size)
+{
+	arena_t *a = arena_threads[thread_small_id()];
+
+	g_assert(p != NULL);
+
+	if (a != NULL && a->depth != 0 && arena_owns(a, p))
+		return;
+
+	g_assert_log(NULL == a || NULL == a->spare || !arena_chunk_has(a->spare, p),
+		"%s(): block %p was released when its scope was left",
+		G_STRFUNC, p);
+
+	wfree(p, size);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
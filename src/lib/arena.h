@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Region allocator with checkpoint / reset, and per-thread arenas.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _arena_h_
+#define _arena_h_
+
+#define ARENA_CHUNK_SIZE	(32 * 1024)		/**< Default chunk size */
+
+struct arena;
+typedef struct arena arena_t;
+
+/**
+ * An arena checkpoint, to which the arena can later be reset.
+ *
+ * This is meant to be allocated on the stack by the caller, its fields
+ * are private.
+ */
+typedef struct arena_mark {
+	const void *chunk;		/**< Current chunk at checkpoint time */
+	const void *avail;		/**< First free byte in that chunk */
+	uint depth;				/**< Thread scope depth, for assertions */
+} arena_mark_t;
+
+/*
+ * Public interface.
+ */
+
+arena_t *arena_make(size_t chunk_size);
+void arena_free_null(arena_t **a_ptr);
+void *arena_alloc(arena_t *a, size_t len) WARN_UNUSED_RESULT G_GNUC_MALLOC;
+void *arena_alloc0(arena_t *a, size_t len) WARN_UNUSED_RESULT G_GNUC_MALLOC;
+void *arena_copy(arena_t *a, const void *p, size_t len) WARN_UNUSED_RESULT;
+char *arena_strdup(arena_t *a, const char *str) WARN_UNUSED_RESULT;
+void arena_checkpoint(const arena_t *a, arena_mark_t *m);
+void arena_reset(arena_t *a, const arena_mark_t *m);
+void arena_clear(arena_t *a);
+bool arena_owns(const arena_t *a, const void *p);
+size_t arena_used(const arena_t *a);
+
+arena_t *arena_thread(void);
+void arena_thread_enter(arena_mark_t *m);
+void arena_thread_leave(const arena_mark_t *m);
+bool arena_thread_active(void);
+
+void *arena_walloc(size_t size) WARN_UNUSED_RESULT G_GNUC_MALLOC;
+void *arena_walloc0(size_t size) WARN_UNUSED_RESULT G_GNUC_MALLOC;
+void arena_wfree(void *p, size_t size);
+
+#define ARENA_WALLOC(p)				\
+G_STMT_START {						\
+	p = arena_walloc(sizeof *p);	\
+} G_STMT_END
+
+#define ARENA_WALLOC0(p)			\
+G_STMT_START {						\
+	p = arena_walloc0(sizeof *p);	\
+} G_STMT_END
+
+#define ARENA_WFREE(p)				\
+G_STMT_START {						\
+	arena_wfree(p, sizeof *p);		\
+} G_STMT_END
+
+#endif /* _arena_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
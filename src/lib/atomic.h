@@ -122,6 +122,14 @@ atomic_ptr_xchg_if_eq(void **p, void *ov, void *nv)
 	return __sync_bool_compare_and_swap(p, ov, nv);
 }
 
+static inline ALWAYS_INLINE void *
+atomic_ptr_xchg(void **p, void *nv)
+{
+	/* __sync_lock_test_and_set() is only an acquire barrier */
+	atomic_mb();
+	return __sync_lock_test_and_set(p, nv);		/* Previous value */
+}
+
 /*
  * These can be used on "opaque" types like sig_atomic_t
  * Otherwise, use the type-safe inline routines whenever possible.
@@ -187,6 +195,14 @@ atomic_ptr_xchg_if_eq(void **p, void *ov, void *nv)
 	ATOMIC_XCHG_IF_EQ(p, ov, nv);
 }
 
+static inline void *
+atomic_ptr_xchg(void **p, void *nv)
+{
+	void *ov = *p;
+	*p = nv;
+	return ov;
+}
+
 #endif	/* HAS_SYNC_ATOMIC */
 
 /**
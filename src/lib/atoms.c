@@ -50,6 +50,7 @@
 #include "spinlock.h"
 #include "str.h"
 #include "stringify.h"
+#include "vmm.h"
 #include "walloc.h"
 #include "xmalloc.h"
 
@@ -63,6 +64,14 @@
 #define ATOMS_HAVE_MAGIC
 #endif
 
+/*
+ * Unless atoms are being debugged, string atoms are held in a compact store.
+ */
+#if !defined(PROTECT_ATOMS) && !defined(ATOMS_HAVE_MAGIC) && \
+	!defined(TRACK_ATOMS)
+#define ATOMS_STR_STORE
+#endif
+
 /*
  * With PROTECT_ATOMS all atoms are mapped read-only so that they cannot
  * be modified accidently. This is achieved through mprotect(). The CPU
@@ -554,7 +563,7 @@ static const char *gnet_host_str(const void *v);
 static size_t packed_host_addr_len(const void *v);
 static const char *packed_host_addr_str(const void *v);
 
-#define str_hash	string_mix_hash
+#define str_hash	string_wide_hash
 #define str_eq		string_eq
 #define fs_hash		filesize_hash
 #define fs_eq		filesize_eq
@@ -932,6 +941,433 @@ uint32_str(const void *v)
 	return buf;
 }
 
+#ifdef ATOMS_STR_STORE
+
+/*
+ * Compact store for string atoms.
+ *
+ * String atoms are by far the most numerous (file names, words, URLs...)
+ * and they are usually short, so the overhead of a separate allocation
+ * plus the hash table slot holding the key, the value and the hashed key
+ * is significant.
+ *
+ * Instead, strings are packed into large pages, along with their reference
+ * count, and are identified within the store by a 32-bit handle.  The
+ * table locating atoms only holds the handle and the hashed value, using
+ * open addressing with linear probing.
+ *
+ * Freed entries are put back in free lists, one per entry size, for reuse.
+ * Pages are never released until the atom layer is shut down.
+ *
+ * Strings whose entry would be larger than ATOM_STR_ENTRY_MAX bytes are
+ * managed like the other atom types.
+ *
+ * All the routines here must be called with the lock of the ATOM_STRING
+ * atom descriptor held.
+ */
+
+#define ATOM_STR_PAGE_SHIFT	16		/* Pages of 64 KiB */
+#define ATOM_STR_PAGE		(1U << ATOM_STR_PAGE_SHIFT)
+#define ATOM_STR_ALIGN		4		/* Entry alignment, for the refcount */
+#define ATOM_STR_OFF_BITS	(ATOM_STR_PAGE_SHIFT - 2)	/* Offset / 4 */
+#define ATOM_STR_OFF_MASK	((1U << ATOM_STR_OFF_BITS) - 1)
+#define ATOM_STR_PAGES_MAX	((1U << (32 - ATOM_STR_OFF_BITS)) - 1)
+#define ATOM_STR_ENTRY_MAX	512		/* Max entry size: refcount + string */
+#define ATOM_STR_CLASSES	(ATOM_STR_ENTRY_MAX / ATOM_STR_ALIGN + 1)
+#define ATOM_STR_MIN_BITS	10		/* Minimum table size is 1024 slots */
+
+/**
+ * A slot in the table, the handle being 0 for empty slots.
+ */
+struct atom_str_slot {
+	uint32 hash;				/**< Hashed string */
+	uint32 handle;				/**< Handle of entry in the store */
+};
+
+/**
+ * The string atom store.
+ */
+static struct atom_str_store {
+	char **pages;				/**< Allocated pages */
+	struct atom_str_slot *slots;	/**< Table of atoms */
+	size_t npages;				/**< Amount of pages allocated */
+	size_t avail;				/**< First free byte in last page */
+	size_t bits;				/**< log2 of table size */
+	size_t items;				/**< Amount of atoms held */
+	uint32 freelist[ATOM_STR_CLASSES];	/**< Free entries, by size / 4 */
+} atom_str_store;
+
+/**
+ * @return size of the store entry for a string of ``len'' bytes, excluding
+ * the trailing NUL.
+ */
+static inline size_t
+atom_str_entry_size(size_t len)
+{
+	return round_size_fast(ATOM_STR_ALIGN, sizeof(uint32) + len + 1);
+}
+
+/**
+ * @return the entry in the store given its handle, pointing to the
+ * reference count, the string following.
+ */
+static inline uint32 *
+atom_str_entry(uint32 handle)
+{
+	struct atom_str_store *as = &atom_str_store;
+	uint32 h = handle - 1;
+	size_t page = h >> ATOM_STR_OFF_BITS;
+
+	g_assert(handle != 0);
+	g_assert(page < as->npages);
+
+	return (uint32 *) &as->pages[page][(h & ATOM_STR_OFF_MASK) << 2];
+}
+
+/**
+ * @return the string atom given its handle.
+ */
+static inline const char *
+atom_str_string(uint32 handle)
+{
+	return (const char *) (atom_str_entry(handle) + 1);
+}
+
+/**
+ * Allocate a new entry of ``size'' bytes in the store.
+ *
+ * @return the handle of the new entry.
+ */
+static uint32
+atom_str_alloc(size_t size)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t class = size / ATOM_STR_ALIGN;
+	uint32 handle;
+
+	g_assert(size <= ATOM_STR_ENTRY_MAX);
+	g_assert(0 == size % ATOM_STR_ALIGN);
+
+	handle = as->freelist[class];
+
+	if (handle != 0) {
+		uint32 *e = atom_str_entry(handle);
+
+		g_assert(0 == e[0]);
+		as->freelist[class] = e[1];		/* Next free entry */
+		return handle;
+	}
+
+	if G_UNLIKELY(0 == as->npages || as->avail + size > ATOM_STR_PAGE) {
+		if G_UNLIKELY(as->npages >= ATOM_STR_PAGES_MAX)
+			s_error("%s(): string atom store is full", G_STRFUNC);
+
+		XREALLOC_ARRAY(as->pages, as->npages + 1);
+		as->pages[as->npages++] = vmm_core_alloc(ATOM_STR_PAGE);
+		as->avail = 0;
+	}
+
+	handle = ((as->npages - 1) << ATOM_STR_OFF_BITS) | (as->avail >> 2);
+	as->avail += size;
+
+	return handle + 1;		/* Handle 0 is reserved for empty slots */
+}
+
+/**
+ * Put entry back into the free list for its size.
+ */
+static void
+atom_str_dealloc(uint32 handle, size_t size)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t class = size / ATOM_STR_ALIGN;
+	uint32 *e = atom_str_entry(handle);
+
+	e[0] = 0;						/* Reference count */
+	e[1] = as->freelist[class];		/* Next free entry */
+	as->freelist[class] = handle;
+}
+
+/**
+ * Install a new table of 2^bits slots, re-inserting all the atoms.
+ */
+static void
+atom_str_resize(size_t bits)
+{
+	struct atom_str_store *as = &atom_str_store;
+	struct atom_str_slot *old = as->slots;
+	size_t i, osize = NULL == old ? 0 : 1U << as->bits;
+	size_t mask = (1U << bits) - 1;
+
+	XMALLOC0_ARRAY(as->slots, 1U << bits);
+	as->bits = bits;
+
+	for (i = 0; i < osize; i++) {
+		size_t j;
+
+		if (0 == old[i].handle)
+			continue;
+
+		for (j = old[i].hash & mask; as->slots[j].handle != 0; j = (j + 1) & mask)
+			/* empty */;
+
+		as->slots[j] = old[i];
+	}
+
+	xfree(old);
+}
+
+/**
+ * Find slot for string atom.
+ *
+ * @param s		the string to look for
+ * @param hash	hashed value of string
+ *
+ * @return the index of the slot holding the atom if found, otherwise the
+ * index of the empty slot where it should be inserted, ORed with ~mask.
+ */
+static size_t
+atom_str_find(const char *s, uint32 hash)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t mask = (1U << as->bits) - 1;
+	size_t i;
+
+	for (i = hash & mask; as->slots[i].handle != 0; i = (i + 1) & mask) {
+		const struct atom_str_slot *slot = &as->slots[i];
+
+		if (slot->hash == hash) {
+			const char *a = atom_str_string(slot->handle);
+
+			if (a == s || 0 == strcmp(a, s))
+				return i;
+		}
+	}
+
+	return i | ~mask;
+}
+
+/**
+ * Lookup string atom.
+ *
+ * @return the string atom if found, NULL otherwise.
+ */
+static const char *
+atom_str_lookup(const char *s, uint32 hash)
+{
+	size_t i;
+
+	if G_UNLIKELY(NULL == atom_str_store.slots)
+		return NULL;
+
+	i = atom_str_find(s, hash);
+
+	if (i > ((1U << atom_str_store.bits) - 1))
+		return NULL;
+
+	return atom_str_string(atom_str_store.slots[i].handle);
+}
+
+/**
+ * Lookup string in the store.
+ *
+ * @param s		the string to look for
+ * @param atom	where the string atom is written, NULL if not found
+ *
+ * @return FALSE if the string is too large to be held in the store.
+ */
+static bool
+atom_str_stored(const char *s, const char **atom)
+{
+	size_t len = strlen(s);
+	atom_desc_t *ad;
+
+	if (atom_str_entry_size(len) > ATOM_STR_ENTRY_MAX)
+		return FALSE;
+
+	ad = &atoms[ATOM_STRING];
+	ATOM_TABLE_LOCK(ad);
+	*atom = atom_str_lookup(s, wide_hash(s, len));
+	ATOM_TABLE_UNLOCK(ad);
+
+	return TRUE;
+}
+
+/**
+ * Remove atom from the slot at index ``i'', shifting back the following
+ * atoms of the probe sequence to keep lookups working without tombstones.
+ */
+static void
+atom_str_remove_slot(size_t i)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t mask = (1U << as->bits) - 1;
+	size_t j = i;
+
+	for (;;) {
+		size_t k;
+
+		j = (j + 1) & mask;
+		if (0 == as->slots[j].handle)
+			break;
+
+		/*
+		 * Slot ``j'' can move to ``i'' if its home index ``k'' does not lie
+		 * cyclically within (i, j].
+		 */
+
+		k = as->slots[j].hash & mask;
+
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			as->slots[i] = as->slots[j];
+			i = j;
+		}
+	}
+
+	as->slots[i].handle = 0;
+	as->slots[i].hash = 0;
+	as->items--;
+
+	if (as->bits > ATOM_STR_MIN_BITS && as->items < (1U << as->bits) / 8)
+		atom_str_resize(as->bits - 1);
+}
+
+/**
+ * Get string atom, creating it if needed.
+ *
+ * @return the string atom, NULL if the string is too large for the store.
+ */
+static const char *
+atom_str_get_stored(const char *s)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t len = strlen(s), size, i;
+	uint32 hash, handle, *e;
+	atom_desc_t *ad;
+
+	size = atom_str_entry_size(len);
+
+	if (size > ATOM_STR_ENTRY_MAX)
+		return NULL;
+
+	hash = wide_hash(s, len);
+	ad = &atoms[ATOM_STRING];
+	ATOM_TABLE_LOCK(ad);
+
+	if G_UNLIKELY(NULL == as->slots)
+		atom_str_resize(ATOM_STR_MIN_BITS);
+
+	i = atom_str_find(s, hash);
+
+	if (i <= ((1U << as->bits) - 1)) {
+		e = atom_str_entry(as->slots[i].handle);
+		g_assert(e[0] != 0);
+		e[0]++;
+		ATOM_TABLE_UNLOCK(ad);
+		return (const char *) (e + 1);
+	}
+
+	handle = atom_str_alloc(size);
+	e = atom_str_entry(handle);
+	e[0] = 1;
+	memcpy(e + 1, s, len + 1);
+
+	i &= (1U << as->bits) - 1;
+	as->slots[i].hash = hash;
+	as->slots[i].handle = handle;
+
+	if (++as->items > (1U << as->bits) / 4 * 3)
+		atom_str_resize(as->bits + 1);
+
+	ATOM_TABLE_UNLOCK(ad);
+	return (const char *) (e + 1);
+}
+
+/**
+ * Remove one reference from string atom, disposing of it when nobody
+ * references it any more.
+ *
+ * @return FALSE if the string is too large to be held in the store.
+ */
+static bool
+atom_str_free_stored(const char *s)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t len = strlen(s), size, i;
+	uint32 hash, *e;
+	atom_desc_t *ad;
+
+	size = atom_str_entry_size(len);
+
+	if (size > ATOM_STR_ENTRY_MAX)
+		return FALSE;
+
+	hash = wide_hash(s, len);
+	ad = &atoms[ATOM_STRING];
+	ATOM_TABLE_LOCK(ad);
+
+	g_assert_log(as->slots != NULL,
+		"attempting to free unknown %s atom at %p", ad->type, s);
+
+	i = atom_str_find(s, hash);
+
+	g_assert_log(i <= ((1U << as->bits) - 1),
+		"attempting to free unknown %s atom at %p", ad->type, s);
+
+	e = atom_str_entry(as->slots[i].handle);
+
+	g_assert_log(s == (const char *) (e + 1),
+		"attempt to free %s atom copy at %p, atom was at %p",
+		ad->type, s, e + 1);
+	g_assert(e[0] != 0);
+
+	if (0 == --e[0]) {
+		atom_str_dealloc(as->slots[i].handle, size);
+		atom_str_remove_slot(i);
+	}
+
+	ATOM_TABLE_UNLOCK(ad);
+	return TRUE;
+}
+
+/**
+ * Warn about remaining string atoms and release the store.
+ */
+static void
+atom_str_close(void)
+{
+	struct atom_str_store *as = &atom_str_store;
+	size_t i, size;
+
+	size = NULL == as->slots ? 0 : 1U << as->bits;
+
+	for (i = 0; i < size; i++) {
+		uint32 handle = as->slots[i].handle;
+
+		if (handle != 0) {
+			g_warning("found remaining %s atom %p, refcnt=%u: \"%s\"",
+				atoms[ATOM_STRING].type, atom_str_string(handle),
+				*atom_str_entry(handle), atom_str_string(handle));
+		}
+	}
+
+	/*
+	 * Since remaining atoms are leaks, we keep the pages holding them.
+	 */
+
+	if (0 == as->items) {
+		for (i = 0; i < as->npages; i++) {
+			vmm_core_free(as->pages[i], ATOM_STR_PAGE);
+		}
+		XFREE_NULL(as->pages);
+		as->npages = 0;
+	}
+
+	XFREE_NULL(as->slots);
+}
+
+#endif	/* ATOMS_STR_STORE */
+
 /**
  * Initialize atom structures.
  */
@@ -1012,6 +1448,15 @@ atom_exists(enum atom_type type, const void *key)
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
+#ifdef ATOMS_STR_STORE
+	if (ATOM_STRING == type) {
+		const char *atom;
+
+		if (atom_str_stored(key, &atom))
+			return atom != NULL;
+	}
+#endif	/* ATOMS_STR_STORE */
+
 	return htable_contains(atoms[type].table, key);
 }
 
@@ -1030,6 +1475,15 @@ atom_is_atom(enum atom_type type, const void *key)
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
+#ifdef ATOMS_STR_STORE
+	if (ATOM_STRING == type) {
+		const char *s;
+
+		if (atom_str_stored(key, &s))
+			return key == s;
+	}
+#endif	/* ATOMS_STR_STORE */
+
 	return htable_lookup_extended(atoms[type].table, key, &atom, NULL)
 		&& key == atom;
 }
@@ -1085,6 +1539,15 @@ atom_get(enum atom_type type, const void *key)
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		atoms_init();
 
+#ifdef ATOMS_STR_STORE
+	if (ATOM_STRING == type) {
+		const char *atom = atom_str_get_stored(key);
+
+		if (atom != NULL)
+			return atom;
+	}
+#endif	/* ATOMS_STR_STORE */
+
 	ad = &atoms[type];		/* Where atoms of this type are held */
 	ATOM_TABLE_LOCK(ad);
 
@@ -1163,6 +1626,11 @@ atom_free(enum atom_type type, const void *key)
     g_assert(key != NULL);
 	g_assert(UNSIGNED(type) < G_N_ELEMENTS(atoms));
 
+#ifdef ATOMS_STR_STORE
+	if (ATOM_STRING == type && atom_str_free_stored(key))
+		return;
+#endif	/* ATOMS_STR_STORE */
+
 	ad = &atoms[type];		/* Where atoms of this type are held */
 	ATOM_TABLE_LOCK(ad);
 
@@ -1436,6 +1904,10 @@ atoms_close(void)
 		ATOM_TABLE_LOCK(ad);
 		htable_foreach(ad->table, atom_warn_free, ad);
 		htable_free_null(&ad->table);
+#ifdef ATOMS_STR_STORE
+		if (ATOM_STRING == i)
+			atom_str_close();
+#endif	/* ATOMS_STR_STORE */
 		ATOM_TABLE_UNLOCK(ad);
 	}
 }
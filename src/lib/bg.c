@@ -105,7 +105,9 @@
 
 #include "bg.h"
 
+#include "atomic.h"
 #include "atoms.h"
+#include "barrier.h"
 #include "cq.h"
 #include "elist.h"
 #include "entropy.h"
@@ -118,6 +120,8 @@
 #include "spinlock.h"
 #include "stacktrace.h"
 #include "stringify.h"		/* For short_time_ascii() and plural() */
+#include "teq.h"
+#include "thread.h"
 #include "tm.h"
 #include "walloc.h"
 
@@ -148,6 +152,11 @@ enum bgsched_magic {
  * in a thread, it can only be called for that thread.  This constraint is
  * needed to be able to know on which thread a task is running, to handle
  * cancellation from foreign threads.
+ *
+ * A scheduler created by bg_sched_create_thread() owns a dedicated thread
+ * which runs it whenever it has runnable tasks.  The "done" callbacks of
+ * its tasks are then delivered back to the thread that created each task,
+ * through its thread event queue.
  */
 struct bgsched {
 	enum bgsched_magic magic;	/**< Magic number */
@@ -165,6 +174,10 @@ struct bgsched {
 	cperiodic_t *pev;			/**< Ticker periodic event */
 	mutex_t lock;				/**< Thread-safe lock */
 	link_t lnk;					/**< Links all active schedulers */
+	unsigned tid;				/**< Dedicated thread, if threaded */
+	bool threaded;				/**< Whether scheduler runs in own thread */
+	volatile bool exiting;		/**< Dedicated thread must exit */
+	uint notifying;				/**< Pending "done" notifications */
 };
 
 static inline void
@@ -218,6 +231,7 @@ struct bgtask {
 	bgclean_cb_t uctx_free;	/**< Free routine for context */
 	bgdone_cb_t done_cb;	/**< Called when done */
 	void *done_arg;			/**< "done" callback argument */
+	unsigned owner;			/**< Thread which created the task */
 	int exitcode;			/**< Final "exit" code */
 	bgsig_t signal;			/**< Last signal delivered */
 	pslist_t *signals;		/**< List of signals pending delivery */
@@ -501,6 +515,31 @@ bg_task_is_sleeping(bgtask_t *bt, const char *routine)
 		G_STRFUNC, bt, bt->name, routine, bt->flags, bt->uflags);
 }
 
+/**
+ * Event posted to the dedicated thread of a scheduler, merely to get it
+ * out of its teq_wait() call so that it notices the runnable tasks.
+ */
+static void
+bg_sched_nudged(void *unused_arg)
+{
+	(void) unused_arg;
+}
+
+/**
+ * Make sure the dedicated thread of a scheduler, if any, will notice that
+ * some of its tasks became runnable.
+ *
+ * This must be called without holding the task or the scheduler lock.
+ */
+static void
+bg_sched_nudge(const bgsched_t *bs)
+{
+	bg_sched_check(bs);
+
+	if (bs->threaded && !bs->exiting && thread_small_id() != bs->stid)
+		teq_post(bs->stid, bg_sched_nudged, NULL);
+}
+
 /**
  * Add new task to its scheduler (run queue).
  */
@@ -859,6 +898,7 @@ bg_task_create_internal(
 	bt->uctx_free = ucontext_free;
 	bt->done_cb = done_cb;
 	bt->done_arg = done_arg;
+	bt->owner = thread_small_id();
 
 	bt->stepcnt = stepcnt;
 	bt->stepvec = WCOPY_ARRAY(steps, stepcnt);
@@ -871,6 +911,9 @@ bg_task_create_internal(
 		bg_sched_sleep(bt);				/* Record sleeping task */
 	BG_SCHED_UNLOCK(bt->sched);
 
+	if (running)
+		bg_sched_nudge(bt->sched);
+
 	if (bg_debug > 1) {
 		s_debug("BGTASK created task \"%s\" (%d step%s) in %s scheduler",
 			name, stepcnt, plural(stepcnt), bt->sched->name);
@@ -975,6 +1018,8 @@ bg_task_run(bgtask_t *bt)
 	if G_UNLIKELY(!awoken) {
 		s_carp("%s(): task %p \"%s\" was already running",
 			G_STRFUNC, bt, bt->name);
+	} else {
+		bg_sched_nudge(bt->sched);
 	}
 }
 
@@ -1029,6 +1074,7 @@ bg_daemon_create(
 	bt->name = atom_str_get(name);
 	bt->ucontext = ucontext;
 	bt->uctx_free = ucontext_free;
+	bt->owner = thread_small_id();
 
 	bt->stepcnt = stepcnt;
 	bt->stepvec = WCOPY_ARRAY(steps, stepcnt);
@@ -1082,6 +1128,9 @@ bg_daemon_enqueue(bgtask_t *bt, void *item)
 
 	BG_TASK_UNLOCK(bt);
 
+	if (awoken)
+		bg_sched_nudge(bt->sched);
+
 	if (awoken && bg_debug > 1)
 		s_debug("BGTASK waking up daemon \"%s\" task %p", bt->name, bt);
 
@@ -1132,28 +1181,11 @@ bg_task_free(bgtask_t *bt)
 }
 
 /**
- * Task has finished and is ready to be reclaimed, as long as its reference
- * count has dropped to 1 or 0.
+ * Invoke the "done" callback of a finished task and free its user context.
  */
 static void
-bg_task_finished(bgtask_t *bt)
+bg_task_notify_done(bgtask_t *bt)
 {
-	g_assert(bt->refcnt >= 0);
-	g_assert(bt->flags & TASK_F_EXITED);
-
-	/*
-	 * If the task is still referenced, put it back to the sleeping queue.
-	 * It should never be scheduled again (it would need to be awoken first,
-	 * but since it is finished, that would be a user-code error).
-	 *
-	 * It will be reclaimed via bg_task_unref() calls.
-	 */
-
-	if (bt->refcnt > 1) {
-		bg_sched_sleep(bt);
-		return;
-	}
-
 	/*
 	 * Let the user know this task has now ended.
 	 * Upon return from this callback, further user-reference of the
@@ -1182,7 +1214,15 @@ bg_task_finished(bgtask_t *bt)
 		s_carp("user code lost exit status of task %p \"%s\": %s",
 			bt, bt->name, bgstatus_to_string(bt->status));
 	}
+}
 
+/**
+ * Record task as dead, to be reclaimed by its scheduler.
+ */
+static void
+bg_task_dead(bgtask_t *bt)
+{
+	bgsched_t *bs = bt->sched;
 
 	bt->magic = BGTASK_DEAD_MAGIC;	/* Prevent further uses! */
 
@@ -1194,9 +1234,83 @@ bg_task_finished(bgtask_t *bt)
 	 * It will be freed at the next scheduler run.
 	 */
 
-	BG_SCHED_LOCK(bt->sched);
-	eslist_prepend(&bt->sched->dead_tasks, bt);
-	BG_SCHED_UNLOCK(bt->sched);
+	BG_SCHED_LOCK(bs);
+	eslist_prepend(&bs->dead_tasks, bt);
+	BG_SCHED_UNLOCK(bs);
+}
+
+/**
+ * Deferred "done" notification of a finished task, running in the thread
+ * that created the task.
+ */
+static void
+bg_task_finished_deferred(void *arg)
+{
+	bgtask_t *bt = arg;
+	bgsched_t *bs;
+
+	bg_task_check(bt);
+	g_assert(bt->flags & TASK_F_EXITED);
+
+	bs = bt->sched;
+	bg_task_notify_done(bt);
+
+	/*
+	 * The scheduler thread may still be probing the task, so it is only
+	 * handed back to the scheduler, which will free it.
+	 */
+
+	bg_task_dead(bt);
+
+	BG_SCHED_LOCK(bs);
+	g_assert(bs->notifying != 0);
+	bs->notifying--;
+	BG_SCHED_UNLOCK(bs);
+}
+
+/**
+ * Task has finished and is ready to be reclaimed, as long as its reference
+ * count has dropped to 1 or 0.
+ */
+static void
+bg_task_finished(bgtask_t *bt)
+{
+	g_assert(bt->refcnt >= 0);
+	g_assert(bt->flags & TASK_F_EXITED);
+
+	/*
+	 * If the task is still referenced, put it back to the sleeping queue.
+	 * It should never be scheduled again (it would need to be awoken first,
+	 * but since it is finished, that would be a user-code error).
+	 *
+	 * It will be reclaimed via bg_task_unref() calls.
+	 */
+
+	if (bt->refcnt > 1) {
+		bg_sched_sleep(bt);
+		return;
+	}
+
+	/*
+	 * When the task ran in the dedicated thread of its scheduler, the
+	 * completion is reported to the thread that created it, provided that
+	 * thread can receive events.  This lets existing "done" callbacks,
+	 * which assume they run in the creating thread, be used unchanged.
+	 */
+
+	if (
+		bt->sched->threaded && bt->owner != thread_small_id() &&
+		teq_is_supported(bt->owner)
+	) {
+		BG_SCHED_LOCK(bt->sched);
+		bt->sched->notifying++;
+		BG_SCHED_UNLOCK(bt->sched);
+		teq_post(bt->owner, bg_task_finished_deferred, bt);
+		return;
+	}
+
+	bg_task_notify_done(bt);
+	bg_task_dead(bt);
 }
 
 /**
@@ -1581,6 +1695,7 @@ bg_task_cancel(bgtask_t *bt)
 		if (bg_debug > 1)
 			s_debug("BGTASK recorded foreign cancel for \"%s\", "
 				"currently in %s()", bt->name, bg_task_step_name(bt));
+		bg_sched_nudge(bs);
 		return;
 	}
 
@@ -1760,6 +1875,9 @@ bg_task_wakeup(bgtask_t *bt)
 
 	BG_SCHED_UNLOCK(bs);
 	BG_TASK_UNLOCK(bt);
+
+	if (!only_requested)
+		bg_sched_nudge(bs);
 }
 
 /**
@@ -2331,6 +2449,101 @@ bg_sched_create(const char *name, ulong max_life)
 	return bg_sched_alloc(name, max_life, FALSE);
 }
 
+/**
+ * Is there work for the dedicated scheduler thread, or should it exit?
+ */
+static bool
+bg_sched_thread_has_work(void *arg)
+{
+	const bgsched_t *bs = arg;
+
+	return bs->exiting || 0 != bg_sched_runcount(bs);
+}
+
+/**
+ * Arguments passed to the dedicated scheduler thread.
+ */
+struct bg_sched_thread_arg {
+	bgsched_t *bs;				/* Scheduler to run */
+	barrier_t *b;				/* Setup barrier */
+};
+
+/**
+ * Dedicated scheduler thread main loop.
+ */
+static void *
+bg_sched_thread_main(void *p)
+{
+	struct bg_sched_thread_arg *args = p;
+	bgsched_t *bs = args->bs;
+	barrier_t *b = args->b;
+
+	thread_set_name(bs->name);
+	teq_create();				/* To be awoken when tasks become runnable */
+	bs->stid = thread_small_id();
+	barrier_wait(b);			/* Thread has initialized, `args' now gone */
+	barrier_free_null(&b);
+
+	if (bg_debug)
+		s_debug("BGTASK %s scheduler thread started", bs->name);
+
+	while (!bs->exiting) {
+		teq_wait(bg_sched_thread_has_work, bs);
+
+		while (!bs->exiting && 0 != bg_sched_run(bs))
+			thread_check_suspended();
+	}
+
+	if (bg_debug)
+		s_debug("BGTASK %s scheduler thread exiting", bs->name);
+
+	return NULL;
+}
+
+/**
+ * Create a new background task scheduler running in its own thread.
+ *
+ * Tasks attached to this scheduler run in the dedicated thread, off the
+ * main loop, but their "done" callback is invoked in the thread that
+ * created the task, as long as that thread has a thread event queue.
+ * Hence existing tasks can be moved to such a scheduler provided their
+ * processing steps are thread-safe.
+ *
+ * The thread is stopped when the scheduler is destroyed.
+ *
+ * @param name		scheduler name (for logging purposes, and thread name)
+ * @param max_life	maximum life time of a scheduling tick, in usecs
+ */
+bgsched_t *
+bg_sched_create_thread(const char *name, ulong max_life)
+{
+	struct bg_sched_thread_arg args;
+	bgsched_t *bs;
+	barrier_t *b;
+	int r;
+
+	bs = bg_sched_alloc(name, max_life, FALSE);
+	bs->threaded = TRUE;
+
+	b = barrier_new(2);
+	args.bs = bs;
+	args.b = barrier_refcnt_inc(b);
+
+	r = thread_create(bg_sched_thread_main, &args,
+			THREAD_F_NO_CANCEL | THREAD_F_NO_POOL, THREAD_STACK_DFLT);
+
+	if (-1 == r)
+		s_error("%s(): cannot create thread for %s scheduler: %m",
+			G_STRFUNC, name);
+
+	bs->tid = r;
+
+	barrier_wait(b);			/* Wait for thread to initialize */
+	barrier_free_null(&b);
+
+	return bs;
+}
+
 /**
  * Destroy a background task scheduler, terminating all its tasks.
  */
@@ -2339,6 +2552,38 @@ bg_sched_destroy(bgsched_t *bs)
 {
 	uint count;
 
+	/*
+	 * Stop the dedicated thread first, if any, then turn the scheduler
+	 * back into a regular one run by the calling thread, so that the
+	 * remaining tasks can be terminated from here.
+	 */
+
+	if (bs->threaded) {
+		g_assert(thread_small_id() != bs->stid);
+
+		bs->exiting = TRUE;
+		teq_post(bs->stid, bg_sched_nudged, NULL);
+
+		if (-1 == thread_join(bs->tid, NULL)) {
+			s_warning("%s(): cannot join %s scheduler thread: %m",
+				G_STRFUNC, bs->name);
+		}
+
+		bs->threaded = FALSE;
+		bs->stid = thread_small_id();
+
+		/*
+		 * Wait for the "done" notifications still pending in the owning
+		 * threads, since they will hand the tasks back to this scheduler.
+		 * Some may be queued for us.
+		 */
+
+		while (0 != atomic_uint_get(&bs->notifying)) {
+			if (0 == teq_dispatch())
+				thread_yield();
+		}
+	}
+
 	bg_sched_list_remove(bs);
 
 	BG_SCHED_LOCK(bs);
@@ -158,6 +158,7 @@ void bg_set_debug(unsigned level);
 void bg_close(void);
 
 bgsched_t *bg_sched_create(const char *name, ulong max_life);
+bgsched_t *bg_sched_create_thread(const char *name, ulong max_life);
 void bg_sched_destroy_null(bgsched_t **bs_ptr);
 int bg_sched_run(bgsched_t *bs);
 int bg_sched_runcount(const bgsched_t *bs);
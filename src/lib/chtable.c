@@ -0,0 +1,765 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Concurrent hash table with incremental resizing.
+ *
+ * This is a variant of the htable, meant for big tables that can be
+ * accessed by several threads concurrently, or whose resizing must not
+ * cause long pauses.
+ *
+ * The table is protected by a fixed set of striped locks: the stripe of
+ * a key is given by the trailing bits of its hash value.  Since the table
+ * size is a power of 2 that is always larger than the amount of stripes,
+ * the bucket of a key is always covered by the same stripe, whatever the
+ * size of the table.  Threads working on keys from different stripes
+ * therefore do not contend.
+ *
+ * Items are chained in buckets.  When a stripe gets too loaded (or too
+ * empty), a new bucket array is installed, which briefly requires all the
+ * stripe locks but involves no rehashing.  Items are then migrated from
+ * the old array to the new one incrementally: each operation within a
+ * stripe first migrates the old bucket where its key would lie, plus a
+ * few more of the stripe.  When all the stripes have migrated their part,
+ * the old array is freed.
+ *
+ * The callbacks invoked by chtable_foreach() and chtable_foreach_remove()
+ * run with the lock of the stripe being traversed held, hence they must
+ * not operate on the table.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "chtable.h"
+
+#include "atomic.h"
+#include "hashing.h"
+#include "mutex.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define CHTABLE_STRIPE_BITS	5
+#define CHTABLE_STRIPES		(1U << CHTABLE_STRIPE_BITS)
+#define CHTABLE_MIN_BITS	(CHTABLE_STRIPE_BITS + 1)
+#define CHTABLE_MIGRATE		2		/* Extra buckets migrated per operation */
+#define CHTABLE_SHRINK		8		/* Shrink when load drops below 1/8 */
+
+enum chtable_magic { CHTABLE_MAGIC = 0x1c55e2a7 };
+
+/**
+ * An item in the table.
+ */
+struct chnode {
+	const void *key;
+	void *value;
+	struct chnode *next;		/* Next in bucket */
+	uint hv;					/* Hashed key */
+};
+
+/**
+ * A lock stripe, covering all the buckets whose index has the same
+ * trailing CHTABLE_STRIPE_BITS bits.
+ */
+struct chstripe {
+	mutex_t lock;
+	size_t items;				/* Items held in the stripe */
+	size_t moved;				/* Old buckets already migrated */
+};
+
+/**
+ * A concurrent hash table.
+ *
+ * The bucket arrays and their sizes can only change when all the stripes
+ * are locked, so they are stable when any stripe lock is held.
+ */
+struct chtable {
+	enum chtable_magic magic;
+	enum hash_key_type ktype;	/* Type of keys */
+	hash_fn_t hash;				/* Key hashing */
+	eq_fn_t eq;					/* Key equality test, NULL for '==' */
+	size_t keysize;				/* For HASH_KEY_FIXED */
+	struct chnode **buckets;	/* Current bucket array */
+	struct chnode **old;		/* Array being migrated, NULL if none */
+	size_t bits;				/* log2 of buckets array size */
+	size_t old_bits;			/* log2 of old array size */
+	int pending;				/* Stripes not fully migrated */
+	int resizing;				/* Set when some thread is resizing */
+	int count;					/* Total items, updated atomically */
+	struct chstripe stripe[CHTABLE_STRIPES];
+};
+
+static inline void
+chtable_check(const struct chtable * const ht)
+{
+	g_assert(ht != NULL);
+	g_assert(CHTABLE_MAGIC == ht->magic);
+}
+
+/**
+ * Compute hashed value of key.
+ */
+static inline uint
+chtable_hash(const chtable_t *ht, const void *key)
+{
+	uint hv;
+
+	switch (ht->ktype) {
+	case HASH_KEY_SELF:
+		hv = pointer_hash_fast(key);
+		break;
+	case HASH_KEY_FIXED:
+		hv = binary_hash(key, ht->keysize);
+		break;
+	default:
+		hv = u32_hash((*ht->hash)(key));	/* Spread trailing bits */
+		break;
+	}
+
+	return hv;
+}
+
+/**
+ * Compare two keys.
+ */
+static inline bool
+chtable_equals(const chtable_t *ht, const void *k1, const void *k2)
+{
+	if (k1 == k2)
+		return TRUE;
+
+	switch (ht->ktype) {
+	case HASH_KEY_SELF:
+		return FALSE;
+	case HASH_KEY_FIXED:
+		return binary_eq(k1, k2, ht->keysize);
+	default:
+		return NULL == ht->eq ? FALSE : (*ht->eq)(k1, k2);
+	}
+}
+
+static inline struct chstripe *
+chtable_stripe(const chtable_t *ht, uint hv)
+{
+	return deconstify_pointer(&ht->stripe[hv & (CHTABLE_STRIPES - 1)]);
+}
+
+/**
+ * Allocate a new table.
+ */
+static chtable_t *
+chtable_allocate(enum hash_key_type ktype)
+{
+	chtable_t *ht;
+	size_t i;
+
+	XMALLOC0(ht);
+	ht->magic = CHTABLE_MAGIC;
+	ht->ktype = ktype;
+	ht->bits = CHTABLE_MIN_BITS;
+	XMALLOC0_ARRAY(ht->buckets, 1U << ht->bits);
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		mutex_init(&ht->stripe[i].lock);
+	}
+
+	return ht;
+}
+
+/**
+ * Create a new hash table for given key type.
+ *
+ * @param ktype		the type of keys
+ * @param keysize	expected for HASH_KEY_FIXED to give key size, otherwise 0
+ */
+chtable_t *
+chtable_create(enum hash_key_type ktype, size_t keysize)
+{
+	chtable_t *ht;
+
+	g_assert(HASH_KEY_SELF == ktype || HASH_KEY_STRING == ktype ||
+		HASH_KEY_FIXED == ktype);
+	g_assert((HASH_KEY_FIXED == ktype) == (keysize != 0));
+
+	ht = chtable_allocate(ktype);
+
+	if (HASH_KEY_STRING == ktype) {
+		ht->hash = string_wide_hash;
+		ht->eq = string_eq;
+	}
+	ht->keysize = keysize;
+
+	return ht;
+}
+
+/**
+ * Create a new hash table using general keys.
+ *
+ * @param primary	primary hash function (cannot be NULL)
+ * @param unused	secondary hash function, ignored: there is no double hashing
+ * @param eq		key equality function (NULL means '==' checks)
+ */
+chtable_t *
+chtable_create_any(hash_fn_t primary, hash_fn_t unused, eq_fn_t eq)
+{
+	chtable_t *ht;
+
+	g_assert(primary != NULL);
+	(void) unused;
+
+	ht = chtable_allocate(HASH_KEY_ANY);
+	ht->hash = primary;
+	ht->eq = eq;
+
+	return ht;
+}
+
+/**
+ * Move all the items from an old bucket to the new array.
+ *
+ * The stripe covering the bucket must be locked.
+ */
+static void
+chtable_migrate_bucket(chtable_t *ht, size_t idx)
+{
+	struct chnode *n, *next;
+	size_t mask = (1U << ht->bits) - 1;
+
+	for (n = ht->old[idx]; n != NULL; n = next) {
+		size_t i = n->hv & mask;
+
+		next = n->next;
+		n->next = ht->buckets[i];
+		ht->buckets[i] = n;
+	}
+
+	ht->old[idx] = NULL;
+}
+
+/**
+ * Migrate the next old bucket of the stripe.
+ *
+ * @return TRUE if migration of the stripe is now complete.
+ */
+static bool
+chtable_migrate_next(chtable_t *ht, struct chstripe *cs)
+{
+	size_t s = cs - &ht->stripe[0];
+	size_t count = (1U << ht->old_bits) >> CHTABLE_STRIPE_BITS;
+
+	g_assert(cs->moved < count);
+
+	chtable_migrate_bucket(ht, s + (cs->moved << CHTABLE_STRIPE_BITS));
+
+	if (++cs->moved < count)
+		return FALSE;
+
+	/*
+	 * Stripe fully migrated.  The last one to finish frees the old array:
+	 * other stripes no longer look at it since they are done.
+	 */
+
+	if (atomic_int_dec_is_zero(&ht->pending)) {
+		struct chnode **old = ht->old;
+
+		ht->old = NULL;
+		atomic_mb();
+		xfree(old);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Make sure the bucket where the key lies in the old array is migrated,
+ * and make some progress with the migration of the stripe.
+ *
+ * The stripe must be locked.
+ */
+static void
+chtable_migrate(chtable_t *ht, struct chstripe *cs, uint hv)
+{
+	size_t k, count, i;
+
+	if G_LIKELY(NULL == ht->old)
+		return;
+
+	count = (1U << ht->old_bits) >> CHTABLE_STRIPE_BITS;
+	if (cs->moved >= count)
+		return;
+
+	k = (hv & ((1U << ht->old_bits) - 1)) >> CHTABLE_STRIPE_BITS;
+	if (k >= cs->moved)
+		chtable_migrate_bucket(ht, hv & ((1U << ht->old_bits) - 1));
+
+	/*
+	 * Buckets migrated out of order are found empty when their turn comes.
+	 */
+
+	for (i = 0; i < CHTABLE_MIGRATE; i++) {
+		if (chtable_migrate_next(ht, cs))
+			break;
+	}
+}
+
+/**
+ * Migrate all the remaining old buckets of the stripe.
+ *
+ * The stripe must be locked.
+ */
+static void
+chtable_migrate_all(chtable_t *ht, struct chstripe *cs)
+{
+	if (NULL == ht->old)
+		return;
+
+	while (cs->moved < ((1U << ht->old_bits) >> CHTABLE_STRIPE_BITS)) {
+		if (chtable_migrate_next(ht, cs))
+			break;
+	}
+}
+
+/**
+ * Should the table be resized, given the load of a stripe?
+ *
+ * A skewed stripe alone does not warrant a resize, which chtable_resize()
+ * would decline after grabbing all the stripe locks: the overall load of
+ * the table must call for it as well.
+ *
+ * @return +1 to grow, -1 to shrink, 0 if no resize is needed.
+ */
+static int
+chtable_resize_needed(const chtable_t *ht, const struct chstripe *cs)
+{
+	size_t size = 1U << ht->bits;
+	size_t per_stripe = size >> CHTABLE_STRIPE_BITS;
+	size_t total = atomic_int_get(&ht->count);
+
+	if (cs->items > per_stripe)
+		return total > size / 2 ? +1 : 0;
+
+	if (ht->bits > CHTABLE_MIN_BITS && cs->items < per_stripe / CHTABLE_SHRINK)
+		return total < size / CHTABLE_SHRINK ? -1 : 0;
+
+	return 0;
+}
+
+/**
+ * Install a new bucket array, twice as large or twice as small.
+ *
+ * All the stripe locks are grabbed whilst we switch the arrays, but the
+ * items are moved later, incrementally.
+ *
+ * @param ht		the table
+ * @param dir		+1 to grow, -1 to shrink
+ */
+static void
+chtable_resize(chtable_t *ht, int dir)
+{
+	size_t i, total = 0, size;
+
+	/*
+	 * Only one thread can resize at a time, the others will simply see
+	 * the new array when they are done.
+	 */
+
+	if (!atomic_int_xchg_if_eq(&ht->resizing, 0, 1))
+		return;
+
+	/*
+	 * If a previous migration is not complete, finish it first, one stripe
+	 * at a time.
+	 */
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		struct chstripe *cs = &ht->stripe[i];
+
+		mutex_lock(&cs->lock);
+		chtable_migrate_all(ht, cs);
+		mutex_unlock(&cs->lock);
+	}
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		mutex_lock(&ht->stripe[i].lock);
+		total += ht->stripe[i].items;
+	}
+
+	g_assert(NULL == ht->old);
+
+	/*
+	 * A loaded stripe triggered the resize: make sure the overall load
+	 * justifies it, since a previous resize may have occurred since then.
+	 */
+
+	size = 1U << ht->bits;
+
+	if (dir > 0 ? total <= size / 2 : total >= size / CHTABLE_SHRINK)
+		goto done;
+
+	ht->old = ht->buckets;
+	ht->old_bits = ht->bits;
+	ht->bits += dir;
+	XMALLOC0_ARRAY(ht->buckets, 1U << ht->bits);
+	ht->pending = CHTABLE_STRIPES;
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		ht->stripe[i].moved = 0;
+	}
+
+done:
+	for (i = CHTABLE_STRIPES; i != 0; i--) {
+		mutex_unlock(&ht->stripe[i - 1].lock);	/* In reverse order */
+	}
+
+	atomic_int_set(&ht->resizing, 0);
+}
+
+/**
+ * Lookup node for key in the current array.
+ *
+ * The stripe must be locked and migrated for the key.
+ *
+ * @return pointer to the link referencing the node, or to the trailing NULL
+ * link of the bucket if key was not found.
+ */
+static struct chnode **
+chtable_find(const chtable_t *ht, const void *key, uint hv)
+{
+	struct chnode **np = &ht->buckets[hv & ((1U << ht->bits) - 1)];
+
+	for (/* empty */; *np != NULL; np = &(*np)->next) {
+		struct chnode *n = *np;
+
+		if (n->hv == hv && chtable_equals(ht, n->key, key))
+			break;
+	}
+
+	return np;
+}
+
+/**
+ * Lock stripe for key and migrate the key's bucket.
+ *
+ * @return the locked stripe.
+ */
+static struct chstripe *
+chtable_lock_key(chtable_t *ht, uint hv)
+{
+	struct chstripe *cs = chtable_stripe(ht, hv);
+
+	mutex_lock(&cs->lock);
+	chtable_migrate(ht, cs, hv);
+
+	return cs;
+}
+
+/**
+ * Insert item in hash table.
+ *
+ * Any previously existing value for the key is replaced by the new one.
+ * NULL is a valid value.
+ *
+ * @param ht		the hash table
+ * @param key		the key
+ * @param value		the value
+ */
+void
+chtable_insert(chtable_t *ht, const void *key, void *value)
+{
+	struct chstripe *cs;
+	struct chnode **np;
+	int resize = 0;
+	uint hv;
+
+	chtable_check(ht);
+
+	hv = chtable_hash(ht, key);
+	cs = chtable_lock_key(ht, hv);
+	np = chtable_find(ht, key, hv);
+
+	if (*np != NULL) {
+		(*np)->key = key;		/* Could be a new pointer, so always update */
+		(*np)->value = value;
+	} else {
+		struct chnode *n;
+
+		WALLOC(n);
+		n->key = key;
+		n->value = value;
+		n->hv = hv;
+		n->next = NULL;
+		*np = n;
+		cs->items++;
+		atomic_int_inc(&ht->count);
+		resize = chtable_resize_needed(ht, cs);
+	}
+
+	mutex_unlock(&cs->lock);
+
+	if G_UNLIKELY(resize != 0)
+		chtable_resize(ht, resize);
+}
+
+/**
+ * Lookup key in the table.
+ *
+ * @param ht		the table
+ * @param key		the key to look for
+ * @param keyptr	if non-NULL, where the original key is written
+ * @param valptr	if non-NULL, where the value is written
+ *
+ * @return whether key was found.
+ */
+bool
+chtable_lookup_extended(const chtable_t *ht, const void *key,
+	const void **keyptr, void **valptr)
+{
+	chtable_t *wht = deconstify_pointer(ht);
+	struct chstripe *cs;
+	struct chnode *n;
+	uint hv;
+
+	chtable_check(ht);
+
+	hv = chtable_hash(ht, key);
+	cs = chtable_lock_key(wht, hv);
+	n = *chtable_find(ht, key, hv);
+
+	if (n != NULL) {
+		if (keyptr != NULL)
+			*keyptr = n->key;
+		if (valptr != NULL)
+			*valptr = n->value;
+	}
+
+	mutex_unlock(&cs->lock);
+
+	return n != NULL;
+}
+
+/**
+ * Lookup key in the table.
+ *
+ * @return value associated with key, NULL if not found.
+ */
+void *
+chtable_lookup(const chtable_t *ht, const void *key)
+{
+	void *value = NULL;
+
+	chtable_lookup_extended(ht, key, NULL, &value);
+	return value;
+}
+
+/**
+ * Check whether key is held in the table.
+ */
+bool
+chtable_contains(const chtable_t *ht, const void *key)
+{
+	return chtable_lookup_extended(ht, key, NULL, NULL);
+}
+
+/**
+ * Remove key from the table.
+ *
+ * @return whether the key was found and removed.
+ */
+bool
+chtable_remove(chtable_t *ht, const void *key)
+{
+	struct chstripe *cs;
+	struct chnode **np, *n;
+	int resize = 0;
+	uint hv;
+
+	chtable_check(ht);
+
+	hv = chtable_hash(ht, key);
+	cs = chtable_lock_key(ht, hv);
+	np = chtable_find(ht, key, hv);
+	n = *np;
+
+	if (n != NULL) {
+		*np = n->next;
+		cs->items--;
+		atomic_int_dec(&ht->count);
+		resize = chtable_resize_needed(ht, cs);
+	}
+
+	mutex_unlock(&cs->lock);
+
+	if (n != NULL)
+		WFREE(n);
+
+	if G_UNLIKELY(resize != 0)
+		chtable_resize(ht, resize);
+
+	return n != NULL;
+}
+
+/**
+ * @return amount of items in the table, only indicative when there are
+ * concurrent updates.
+ */
+size_t
+chtable_count(const chtable_t *ht)
+{
+	chtable_check(ht);
+
+	return atomic_int_get(&ht->count);
+}
+
+/**
+ * Traverse the table, invoking callback on each item and removing it
+ * when the callback returns TRUE.
+ *
+ * Each stripe is locked whilst it is traversed: the callback must not
+ * operate on the table.
+ *
+ * @return the amount of items removed.
+ */
+static size_t
+chtable_traverse(chtable_t *ht, ckeyval_fn_t fn, ckeyval_rm_fn_t rm,
+	void *data)
+{
+	size_t i, removed = 0;
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		struct chstripe *cs = &ht->stripe[i];
+		size_t b, size;
+
+		mutex_lock(&cs->lock);
+		chtable_migrate_all(ht, cs);
+		size = 1U << ht->bits;
+
+		for (b = i; b < size; b += CHTABLE_STRIPES) {
+			struct chnode **np = &ht->buckets[b];
+
+			while (*np != NULL) {
+				struct chnode *n = *np;
+
+				if (NULL == rm) {
+					(*fn)(n->key, n->value, data);
+				} else if ((*rm)(n->key, n->value, data)) {
+					*np = n->next;
+					cs->items--;
+					atomic_int_dec(&ht->count);
+					removed++;
+					WFREE(n);
+					continue;
+				}
+				np = &n->next;
+			}
+		}
+
+		mutex_unlock(&cs->lock);
+	}
+
+	return removed;
+}
+
+/**
+ * Invoke callback on all the items of the table.
+ */
+void
+chtable_foreach(const chtable_t *ht, ckeyval_fn_t fn, void *data)
+{
+	chtable_check(ht);
+	g_assert(fn != NULL);
+
+	chtable_traverse(deconstify_pointer(ht), fn, NULL, data);
+}
+
+/**
+ * Invoke callback on all the items of the table, removing the items for
+ * which it returns TRUE.
+ *
+ * @return the amount of items removed.
+ */
+size_t
+chtable_foreach_remove(chtable_t *ht, ckeyval_rm_fn_t fn, void *data)
+{
+	chtable_check(ht);
+	g_assert(fn != NULL);
+
+	return chtable_traverse(ht, NULL, fn, data);
+}
+
+static bool
+chtable_remove_all(const void *unused_key, void *unused_value, void *unused)
+{
+	(void) unused_key;
+	(void) unused_value;
+	(void) unused;
+
+	return TRUE;
+}
+
+/**
+ * Remove all the items from the table.
+ */
+void
+chtable_clear(chtable_t *ht)
+{
+	chtable_check(ht);
+
+	chtable_traverse(ht, NULL, chtable_remove_all, NULL);
+}
+
+/**
+ * Free table and nullify its pointer.
+ *
+ * There must not be any concurrent access to the table.
+ */
+void
+chtable_free_null(chtable_t **ht_ptr)
+{
+	chtable_t *ht = *ht_ptr;
+	size_t i;
+
+	if (NULL == ht)
+		return;
+
+	chtable_check(ht);
+
+	chtable_clear(ht);
+
+	for (i = 0; i < CHTABLE_STRIPES; i++) {
+		mutex_destroy(&ht->stripe[i].lock);
+	}
+
+	xfree(ht->buckets);
+	ht->magic = 0;
+	xfree(ht);
+	*ht_ptr = NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
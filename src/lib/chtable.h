@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Concurrent hash table with incremental resizing.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _chtable_h_
+#define _chtable_h_
+
+#include "hash.h"			/* For enum hash_key_type */
+
+struct chtable;
+typedef struct chtable chtable_t;
+
+/*
+ * Public interface.
+ *
+ * This mirrors the htable API, for the subset of it that makes sense when
+ * the table can be concurrently accessed.
+ */
+
+chtable_t *chtable_create(enum hash_key_type ktype, size_t keysize);
+chtable_t *chtable_create_any(hash_fn_t primary, hash_fn_t unused, eq_fn_t eq);
+void chtable_free_null(chtable_t **);
+void chtable_clear(chtable_t *);
+
+bool chtable_contains(const chtable_t *, const void *key);
+void chtable_insert(chtable_t *, const void *key, void *value);
+void *chtable_lookup(const chtable_t *, const void *key);
+bool chtable_lookup_extended(const chtable_t *, const void *key,
+	const void **keyptr, void **valptr);
+bool chtable_remove(chtable_t *, const void *key);
+size_t chtable_count(const chtable_t *);
+void chtable_foreach(const chtable_t *, ckeyval_fn_t fn, void *data);
+size_t chtable_foreach_remove(chtable_t *, ckeyval_rm_fn_t fn, void *data);
+
+static inline void
+chtable_insert_const(chtable_t *ht, const void *key, const void *value)
+{
+	chtable_insert(ht, key, deconstify_pointer(value));
+}
+
+#endif /* _chtable_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -81,6 +81,7 @@ struct cevent {
 	cq_time_t ce_time;			/**< Absolute trigger time (virtual cq time) */
 	struct cevent *ce_bnext;	/**< Next item in hash bucket */
 	struct cevent *ce_bprev;	/**< Prev item in hash bucket */
+	struct chash *ce_slot;		/**< Wheel slot where event is linked */
 	cqueue_t *ce_cq;			/**< Callout queue where event is registered */
 	cq_service_t ce_fn;			/**< Callback routine */
 	void *ce_arg;				/**< Argument to pass to said callback */
@@ -142,11 +143,21 @@ cevent_is_extended(const cevent_t *ce)
  * We don't want to go through all the items in the list to find the proper
  * position for insertion.
  *
- * To do that, we maintain a parallel hash list of all the events, each event
- * being inserted in the bucket i, where i is computed by abs_time % size,
- * abs_time being the absolute time where the event is to be triggered
- * and size being the size of the hash list. All the items under the bucket
- * list are further sorted by increasing trigger time.
+ * To do that, events are kept in a hierarchical timing wheel.  Time is
+ * divided into "granules" of CQ_GRANULE units and the first level of the
+ * wheel holds one slot per granule for the next CQ_L0_SIZE granules.  Each
+ * of the upper levels holds CQ_LN_SIZE slots, every slot covering as many
+ * granules as the whole level below.  Events are linked in the slot of the
+ * lowest level that can hold them, and are moved down ("cascaded") when
+ * the wheel reaches the time range covered by their slot.
+ *
+ * Insertion and removal are therefore done in constant time, except for
+ * events landing in the first level, whose slots are kept sorted by
+ * increasing trigger time.  Since a first-level slot only covers a single
+ * granule, these lists are short and events are usually appended.
+ *
+ * Each level has a bitmap of non-empty slots, which lets cq_clock() skip
+ * over empty slots and cq_delay() find the next event quickly.
  *
  * To be completely generic, the callout queue "absolute time" is a mere
  * unsigned long value. It can represent an amount of ms, or an amount of
@@ -160,6 +171,48 @@ struct chash {
 	cevent_t *ch_tail;			/**< Bucket list tail */
 };
 
+/*
+ * The wheel granule is 2^5 or 32 units of time.  This means our time
+ * resolution is at least 32 units.  If we increment cq_clock() with
+ * milliseconds, we won't move to the next wheel slot unless at least
+ * 32 milliseconds have elapsed.
+ *
+ * With 4 levels, the wheel spans 2^26 granules, i.e. 2^31 units of time,
+ * which is the largest delay one can supply to cq_insert().
+ */
+#define CQ_GRANULE_BITS	5
+#define CQ_GRANULE		(1U << CQ_GRANULE_BITS)
+#define CQ_L0_BITS		8			/**< 256 slots on first level */
+#define CQ_L0_SIZE		(1U << CQ_L0_BITS)
+#define CQ_L0_MASK		(CQ_L0_SIZE - 1)
+#define CQ_LN_BITS		6			/**< 64 slots on upper levels */
+#define CQ_LN_SIZE		(1U << CQ_LN_BITS)
+#define CQ_LN_MASK		(CQ_LN_SIZE - 1)
+#define CQ_LEVELS		4
+#define CQ_SPAN_BITS	(CQ_L0_BITS + (CQ_LEVELS - 1) * CQ_LN_BITS)
+#define CQ_SLOTS		(CQ_L0_SIZE + (CQ_LEVELS - 1) * CQ_LN_SIZE)
+#define CQ_MAP_WORDS	(CQ_SLOTS / 64)
+
+#define EV_GRANULE(x)	((x) >> CQ_GRANULE_BITS)
+
+/**
+ * @return shift to apply to a granule to get the slot index at given level.
+ */
+static inline uint
+cq_level_shift(uint level)
+{
+	return 0 == level ? 0 : CQ_L0_BITS + (level - 1) * CQ_LN_BITS;
+}
+
+/**
+ * @return index of the first slot of the level in the wheel array.
+ */
+static inline uint
+cq_level_base(uint level)
+{
+	return 0 == level ? 0 : CQ_L0_SIZE + (level - 1) * CQ_LN_SIZE;
+}
+
 enum cqueue_magic  {
 	CQUEUE_MAGIC    = 0x140332ddU,
 	CSUBQUEUE_MAGIC = 0x64d037feU
@@ -170,8 +223,11 @@ struct cqueue {
 	tm_t cq_last_heartbeat;		/**< Real time of last heartbeat */
 	cq_time_t cq_time;			/**< "current time" */
 	const char *cq_name;		/**< Queue name, for logging */
-	struct chash *cq_hash;		/**< Array of buckets for hash list */
-	struct chash *cq_current;	/**< Current bucket scanned in cq_clock() */
+	struct chash *cq_wheel;		/**< Timing wheel slots, all levels */
+	struct chash *cq_current;	/**< Current slot scanned in cq_clock() */
+	cq_time_t cq_wclk;			/**< Current wheel granule */
+	cq_time_t cq_wakeup;		/**< Published wakeup time of sleeping thread */
+	uint64 cq_map[CQ_MAP_WORDS];/**< Bitmap of non-empty wheel slots */
 	elist_t cq_periodic;		/**< Periodic events registered */
 	hset_t *cq_idle;			/**< Idle events registered */
 	const cevent_t *cq_call;	/**< Event being called out, for cq_zero() */
@@ -179,7 +235,6 @@ struct cqueue {
 	unsigned cq_stid;			/**< Thread where callout queue runs */
 	int cq_ticks;				/**< Number of cq_clock() calls processed */
 	int cq_items;				/**< Amount of recorded events */
-	int cq_last_bucket;			/**< Last bucket slot we were at */
 	int cq_period;				/**< Regular callout period, in ms */
 	uint8 cq_call_extended;		/**< Is cq_call an extended event? */
 	time_t cq_last_idle;		/**< Last time we ran the idle callbacks */
@@ -196,17 +251,6 @@ cqueue_check(const struct cqueue * const cq)
 	g_assert(CQUEUE_MAGIC == cq->cq_magic || CSUBQUEUE_MAGIC == cq->cq_magic);
 }
 
-#define HASH_SIZE	2048		/**< Hash list size, must be a power of 2 */
-#define HASH_MASK	(HASH_SIZE - 1)
-
-/*
- * The hashing function divides the time by 2^5 or 32, to avoid cq_clock()
- * scanning too many hash buckets each time.  This means our time resolution
- * is at least 32 units.  If we increment cq_clock() with milliseconds, we
- * won't trigger any queue run unless at least 32 milliseconds have elapsed.
- */
-#define EV_HASH(x) (((x) >> 5) & HASH_MASK)
-#define EV_OVER(x) (((x) >> 5) & ~HASH_MASK)
 
 /**
  * Locking of the callout queue for short period of time, in sections that
@@ -296,14 +340,14 @@ static cqueue_t *
 cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
 {
 	/*
-	 * The cq_hash hash list is used to speed up insert/delete operations.
+	 * The cq_wheel timing wheel is used to speed up insert/delete operations.
 	 */
 
 	cq->cq_magic = CQUEUE_MAGIC;
 	cq->cq_name = atom_str_get(name);
-	XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+	XMALLOC0_ARRAY(cq->cq_wheel, CQ_SLOTS);
 	cq->cq_time = now;
-	cq->cq_last_bucket = EV_HASH(now);
+	cq->cq_wclk = EV_GRANULE(now);
 	cq->cq_period = period;
 	cq->cq_stid = THREAD_INVALID_ID;
 	mutex_init(&cq->cq_lock);
@@ -449,15 +493,69 @@ ev_free(cevent_t *ev)
 	}
 }
 
+/**
+ * Mark wheel slot as being used.
+ */
+static inline void
+cq_map_set(cqueue_t *cq, const struct chash *ch)
+{
+	size_t n = ch - cq->cq_wheel;
+
+	cq->cq_map[n / 64] |= (uint64) 1 << (n % 64);
+}
+
+/**
+ * Mark wheel slot as being empty.
+ */
+static inline void
+cq_map_clear(cqueue_t *cq, const struct chash *ch)
+{
+	size_t n = ch - cq->cq_wheel;
+
+	cq->cq_map[n / 64] &= ~((uint64) 1 << (n % 64));
+}
+
+/**
+ * Look for the next non-empty slot at a given level of the wheel, starting
+ * at index ``from'' within the level and wrapping around.
+ *
+ * @return the distance from ``from'' to the first non-empty slot found,
+ * -1 if all the slots of the level are empty.
+ */
+static int
+cq_wheel_next(const cqueue_t *cq, uint level, uint from)
+{
+	uint base = cq_level_base(level);
+	uint size = 0 == level ? CQ_L0_SIZE : CQ_LN_SIZE;
+	uint i = 0;
+
+	/*
+	 * Levels are aligned on 64-bit words in the bitmap, so all the bits
+	 * we look at within a word belong to the level.
+	 */
+
+	while (i <= size) {
+		uint slot = base + ((from + i) & (size - 1));
+		uint64 word = cq->cq_map[slot / 64] >> (slot % 64);
+
+		if (word != 0)
+			return i + ctz64(word);
+
+		i += 64 - (slot % 64);
+	}
+
+	return -1;
+}
+
 /**
  * Link event into the callout queue.
  */
 static void
 ev_link(cevent_t *ev)
 {
-	struct chash *ch;		/* Hashing bucket */
+	struct chash *ch;		/* Wheel slot */
 	cq_time_t trigger;		/* Trigger time */
-	cevent_t *hev;			/* To loop through the hash bucket */
+	cevent_t *hev;			/* To loop through the slot */
 	cqueue_t *cq;
 
 	cevent_check(ev);
@@ -473,25 +571,69 @@ ev_link(cevent_t *ev)
 	/*
 	 * Important corner case: we may be rescheduling an event BEFORE
 	 * the current clock time, in which case we must insert the event
-	 * in the current bucket, so it gets fired during the current
+	 * in the current slot, so it gets fired during the current
 	 * cq_clock() run.
 	 */
 
-	if (trigger <= cq->cq_time)
-		ch = cq->cq_current;
-	else
-		ch = &cq->cq_hash[EV_HASH(trigger)];
+	if (trigger <= cq->cq_time) {
+		ch = &cq->cq_wheel[cq->cq_wclk & CQ_L0_MASK];
+	} else {
+		cq_time_t g = EV_GRANULE(trigger);
+		cq_time_t idx = g - cq->cq_wclk;
+		uint level;
+
+		/*
+		 * Events too far in the future are put in the last slot of the
+		 * highest level: they will be relinked at the proper place when
+		 * that slot is cascaded.
+		 */
+
+		if G_UNLIKELY(idx >= ((cq_time_t) 1 << CQ_SPAN_BITS))
+			g = cq->cq_wclk + ((cq_time_t) 1 << CQ_SPAN_BITS) - 1;
+
+		if (idx < CQ_L0_SIZE) {
+			ch = &cq->cq_wheel[g & CQ_L0_MASK];
+			goto sorted;
+		}
+
+		for (level = 1; level < CQ_LEVELS - 1; level++) {
+			if (idx < (cq_time_t) 1 << cq_level_shift(level + 1))
+				break;
+		}
 
-	g_assert(ch);
+		ch = &cq->cq_wheel[cq_level_base(level) +
+			((g >> cq_level_shift(level)) & CQ_LN_MASK)];
+
+		/*
+		 * Slots in the upper levels are not sorted: they will be when
+		 * the events are cascaded down to the first level.
+		 */
+
+		ev->ce_slot = ch;
+		ev->ce_bnext = NULL;
+		ev->ce_bprev = ch->ch_tail;
+		if (NULL == ch->ch_tail) {
+			ch->ch_head = ev;
+			cq_map_set(cq, ch);
+		} else {
+			ch->ch_tail->ce_bnext = ev;
+		}
+		ch->ch_tail = ev;
+		return;
+	}
+
+sorted:
+	ev->ce_slot = ch;
 
 	/*
-	 * If bucket is empty, the event is the new head.
+	 * If slot is empty, the event is the new head.
 	 */
 
 	if (ch->ch_head == NULL) {
 		g_assert(ch->ch_tail == NULL);
 		ch->ch_tail = ch->ch_head = ev;
 		ev->ce_bnext = ev->ce_bprev = NULL;
+		cq_map_set(cq, ch);
 		return;
 	}
 
@@ -552,7 +694,7 @@ ev_link(cevent_t *ev)
 static void
 ev_unlink(cevent_t *ev)
 {
-	struct chash *ch;			/* Hashing bucket */
+	struct chash *ch;			/* Wheel slot */
 	cqueue_t *cq;
 
 	cevent_check(ev);
@@ -560,7 +702,7 @@ ev_unlink(cevent_t *ev)
 	cqueue_check(cq);
 	assert_mutex_is_owned(&cq->cq_lock);
 
-	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
+	ch = ev->ce_slot;
 	cq->cq_items--;
 
 	/*
@@ -577,10 +719,102 @@ ev_unlink(cevent_t *ev)
 	if (ev->ce_bnext)
 		ev->ce_bnext->ce_bprev = ev->ce_bprev;
 
+	if (NULL == ch->ch_head)
+		cq_map_clear(cq, ch);
+
 	g_assert(ch->ch_head == NULL || ch->ch_head->ce_bprev == NULL);
 	g_assert(ch->ch_tail == NULL || ch->ch_tail->ce_bnext == NULL);
 }
 
+/**
+ * Relink all the events from a wheel slot, moving them to lower levels.
+ */
+static void
+cq_wheel_relink(cqueue_t *cq, struct chash *ch)
+{
+	cevent_t *ev, *next;
+
+	ev = ch->ch_head;
+	ch->ch_head = ch->ch_tail = NULL;
+	cq_map_clear(cq, ch);
+
+	for (/* empty */; ev != NULL; ev = next) {
+		next = ev->ce_bnext;
+		cq->cq_items--;		/* Will be incremented again by ev_link() */
+		ev_link(ev);
+	}
+}
+
+/**
+ * Cascade events from the upper levels when the wheel reaches granule ``w'',
+ * the start of a new revolution of the first level.
+ */
+static void
+cq_wheel_cascade(cqueue_t *cq, cq_time_t w)
+{
+	uint level;
+
+	for (level = 1; level < CQ_LEVELS; level++) {
+		uint idx = (w >> cq_level_shift(level)) & CQ_LN_MASK;
+
+		cq_wheel_relink(cq, &cq->cq_wheel[cq_level_base(level) + idx]);
+
+		if (idx != 0)
+			break;		/* Upper level not starting a new revolution */
+	}
+}
+
+/**
+ * Move the wheel forward, towards granule ``target'', stopping at the next
+ * non-empty slot of the first level or when a cascade is due.
+ *
+ * Empty slots are skipped over, so this costs at most one step per
+ * revolution of the first level when the queue is idle.
+ */
+static void
+cq_wheel_advance(cqueue_t *cq, cq_time_t target)
+{
+	cq_time_t w = cq->cq_wclk + 1;
+
+	g_assert(cq->cq_wclk < target);
+
+	if (0 != (w & CQ_L0_MASK)) {
+		cq_time_t end = (w | CQ_L0_MASK) + 1;	/* Next revolution */
+		int d = cq_wheel_next(cq, 0, w & CQ_L0_MASK);
+
+		if (d >= 0)
+			end = MIN(end, w + d);
+
+		w = MIN(end, target);
+	}
+
+	cq->cq_wclk = w;
+
+	if (0 == (w & CQ_L0_MASK))
+		cq_wheel_cascade(cq, w);
+}
+
+/**
+ * Check whether the thread running the callout queue, currently sleeping,
+ * needs to be woken up to trigger the event in time.
+ *
+ * The thread publishes in cq_wakeup the time at which it will end its
+ * sleep, or 0 when it is not sleeping in cq_thread_main().
+ *
+ * @return TRUE if the thread must be signalled once the queue is unlocked.
+ */
+static inline bool
+cq_needs_wakeup(cqueue_t *cq, const cevent_t *ev)
+{
+	assert_mutex_is_owned(&cq->cq_lock);
+
+	if G_LIKELY(0 == cq->cq_wakeup || ev->ce_time >= cq->cq_wakeup)
+		return FALSE;
+
+	cq->cq_wakeup = 0;		/* Signal the thread only once */
+	return TRUE;
+}
+
 /**
  * Internal initialization and insertion of event in the callout queue.
  *
@@ -596,6 +830,8 @@ static cevent_t *
 cq_insert_internal(cqueue_t *cq, cevent_t *ev,
 	int delay, cq_service_t fn, void *arg)
 {
+	bool wakeup;
+
 	cqueue_check(cq);
 	cevent_check(ev);
 	g_assert(fn);
@@ -613,8 +849,12 @@ cq_insert_internal(cqueue_t *cq, cevent_t *ev,
 	CQ_LOCK(cq);
 	ev->ce_time = cq->cq_time + delay;
 	ev_link(ev);
+	wakeup = cq_needs_wakeup(cq, ev);
 	CQ_UNLOCK(cq);
 
+	if G_UNLIKELY(wakeup)
+		thread_kill(cq->cq_stid, TSIG_1);
+
 	return ev;
 }
 
@@ -838,6 +1078,7 @@ bool
 cq_resched(cevent_t *ev, int delay)
 {
 	cqueue_t *cq;
+	bool wakeup;
 
 	cq = EV_CQ_LOCK(ev);
 
@@ -872,8 +1113,12 @@ cq_resched(cevent_t *ev, int delay)
 	ev_unlink(ev);
 	ev->ce_time = cq->cq_time + delay;
 	ev_link(ev);
+	wakeup = cq_needs_wakeup(cq, ev);
 	CQ_UNLOCK(cq);
 
+	if G_UNLIKELY(wakeup)
+		thread_kill(cq->cq_stid, TSIG_1);
+
 	return TRUE;
 }
 
@@ -1062,13 +1307,10 @@ cq_replace(cevent_t *ev, cq_service_t fn, void *arg)
 static size_t
 cq_clock(cqueue_t *cq, int elapsed)
 {
-	int bucket;
-	int last_bucket, old_last_bucket;
 	struct chash *ch, *old_current;
 	cevent_t *ev;
 	const cevent_t *old_call;
 	bool old_call_extended, force_idle = FALSE;
-	cq_time_t now;
 	size_t processed = 0;
 
 	cqueue_check(cq);
@@ -1079,10 +1321,10 @@ cq_clock(cqueue_t *cq, int elapsed)
 	 * Recursive calls are possible: in the middle of an event, we could
 	 * trigger something that will call cq_dispatch() manually for instance.
 	 *
-	 * Therefore, we save the cq_current and cq_last_bucket fields upon
-	 * entry and restore them at the end as appropriate. If cq_current is
-	 * NULL initially, it means we were not in the middle of any recursion
-	 * so we won't have to restore cq_last_bucket.
+	 * Therefore, we save the cq_current field upon entry and restore it at
+	 * the end.  If cq_current is NULL initially, it means we were not in
+	 * the middle of any recursion.  The wheel position only moves forward,
+	 * so the loop below re-reads it after each event to cope with recursion.
 	 *
 	 * Note that we enforce recursive calls to cq_clock() to be on the
 	 * same thread due to the use of a mutex. However, each initial run of
@@ -1092,75 +1334,38 @@ cq_clock(cqueue_t *cq, int elapsed)
 	old_current = cq->cq_current;
 	old_call = cq->cq_call;
 	old_call_extended = cq->cq_call_extended;
-	old_last_bucket = cq->cq_last_bucket;
 
 	cq->cq_ticks++;
 	cq->cq_time += elapsed;
-	now = cq->cq_time;
-
-	bucket = cq->cq_last_bucket;		/* Bucket we traversed last time */
-	ch = &cq->cq_hash[bucket];
-	last_bucket = EV_HASH(now);			/* Last bucket to traverse now */
-
-	/*
-	 * If `elapsed' has overflowed the hash size, then we'll need to look at
-	 * all the buckets in the table (wrap around).
-	 */
-
-	if (EV_OVER(elapsed))
-		last_bucket = bucket;
-
-	/*
-	 * Since the hashed time is a not a strictly monotonic function of time,
-	 * we have to rescan the last bucket, in case the earliest event have
-	 * expired now, before moving forward.
-	 */
-
-	cq->cq_current = ch;
-
-	while ((ev = ch->ch_head) && ev->ce_time <= now) {
-		cq_expire_internal(cq, ev);
-		processed++;
-	}
 
 	/*
-	 * If we don't have to move forward (elapsed is too small), we're done.
+	 * Since each first-level slot is sorted, we can stop our walkthrough
+	 * as soon as we reach an event scheduled after the current time.
+	 *
+	 * We always rescan the slot we were at last time, since we may have
+	 * stopped in the middle of its granule.  Then we move the wheel forward,
+	 * skipping empty slots and cascading events from upper levels as needed.
 	 */
 
-	if (cq->cq_last_bucket == last_bucket && !EV_OVER(elapsed))
-		goto done;
-
-	cq->cq_last_bucket = last_bucket;
-
-	do {
-		ch++;
-		if (++bucket >= HASH_SIZE) {
-			bucket = 0;
-			ch = cq->cq_hash;
-		}
-
-		/*
-		 * Since each bucket is sorted, we can stop our walkthrough as
-		 * soon as we reach an event scheduled after `now'.
-		 */
-
+	for (;;) {
+		ch = &cq->cq_wheel[cq->cq_wclk & CQ_L0_MASK];
 		cq->cq_current = ch;
 
-		while ((ev = ch->ch_head) && ev->ce_time <= now) {
+		while ((ev = ch->ch_head) && ev->ce_time <= cq->cq_time) {
 			cq_expire_internal(cq, ev);
 			processed++;
 		}
 
-	} while (bucket != last_bucket);
+		if (cq->cq_wclk >= EV_GRANULE(cq->cq_time))
+			break;
+
+		cq_wheel_advance(cq, EV_GRANULE(cq->cq_time));
+	}
 
-done:
 	cq->cq_current = old_current;
 	cq->cq_call = old_call;
 	cq->cq_call_extended = old_call_extended;
 
-	if G_UNLIKELY(old_current != NULL)
-		cq->cq_last_bucket = old_last_bucket;	/* Was in recursive call */
-
 	if (cq_debugging(5)) {
 		s_debug("CQ: %squeue \"%s\" %striggered %zu event%s (%d item%s)",
 			cq->cq_magic == CSUBQUEUE_MAGIC ? "sub" : "",
@@ -1221,45 +1426,72 @@ int
 cq_delay(const cqueue_t *cq)
 {
 	int delay = MAX_INT_VAL(int);
-	int last_bucket;
-	int i;
-	cq_time_t now;
-	bool adjusted = FALSE;
+	uint level, scanned = 0;
+	cq_time_t now, w, next = 0;
+	bool found = FALSE, adjusted = FALSE;
 
 	cqueue_check(cq);
 
 	mutex_lock_const(&cq->cq_lock);
 
-	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
+	w = cq->cq_wclk;
 	now = cq->cq_time;
 
-	for (i = 0; i < HASH_SIZE; i++) {
-		int b = (last_bucket + i) & HASH_MASK;
-		struct chash *ch = &cq->cq_hash[b];
-		cevent_t *ev = ch->ch_head;
-		int edelay;
+	/*
+	 * First-level slots are sorted, hence the first non-empty slot from
+	 * the current position holds the earliest event of that level.
+	 */
 
-		/*
-		 * If the delay we have so far is not too large (does not overflow
-		 * the size of the hashing array) and we have moved away from the
-		 * last scanned bucket by an amount that is large-enough, we know
-		 * we cannot find a smaller delay ahead in the buckets.
-		 */
+	{
+		int d = cq_wheel_next(cq, 0, w & CQ_L0_MASK);
 
-		if (!EV_OVER(delay) && i > EV_HASH(delay))
-			break;
+		if (d >= 0) {
+			next = cq->cq_wheel[(w + d) & CQ_L0_MASK].ch_head->ce_time;
+			found = TRUE;
+		}
+	}
+
+	/*
+	 * Upper-level slots are not sorted, but the first non-empty slot after
+	 * the current one at a given level covers the earliest time range of
+	 * that level.  We only need to scan it when that range starts before
+	 * the earliest event we have found so far.
+	 */
 
-		if (NULL == ev)
+	for (level = 1; level < CQ_LEVELS; level++) {
+		uint shift = cq_level_shift(level);
+		cq_time_t start;
+		const struct chash *ch;
+		const cevent_t *ev;
+		int d;
+
+		d = cq_wheel_next(cq, level, ((w >> shift) + 1) & CQ_LN_MASK);
+
+		if (d < 0)
 			continue;
 
-		edelay = ev->ce_time - now;
+		start = ((w >> shift) + 1 + d) << shift;	/* First granule */
 
-		if G_UNLIKELY(edelay <= 0) {
-			delay = 0;
-			break;
+		if (found && EV_GRANULE(next) < start)
+			continue;
+
+		ch = &cq->cq_wheel[cq_level_base(level) +
+			(((w >> shift) + 1 + d) & CQ_LN_MASK)];
+
+		for (ev = ch->ch_head; ev != NULL; ev = ev->ce_bnext) {
+			if (!found || ev->ce_time < next) {
+				next = ev->ce_time;
+				found = TRUE;
+			}
 		}
+		scanned++;
+	}
 
-		delay = MIN(delay, edelay);
+	if (found) {
+		if (next <= now)
+			delay = 0;
+		else if (next - now < (cq_time_t) MAX_INT_VAL(int))
+			delay = next - now;
 	}
 
 	/*
@@ -1287,9 +1519,9 @@ cq_delay(const cqueue_t *cq)
 	mutex_unlock_const(&cq->cq_lock);
 
 	if (cq_debugging(4)) {
-		s_debug("%s(%s): %smin delay is %d, scanned %d bucket%s",
+		s_debug("%s(%s): %smin delay is %d, scanned %u upper slot%s",
 			G_STRFUNC, cq->cq_name, adjusted ? "adjusted " : "",
-			delay, i, plural(i));
+			delay, scanned, plural(scanned));
 	}
 
 	return delay;
@@ -1946,6 +2178,7 @@ cq_time_to_string(cq_time_t t)
  ***/
 
 #define CALLOUT_PERIOD			25	/* milliseconds */
+#define CALLOUT_MAX_SLEEP		(8 * CALLOUT_PERIOD)
 #define CALLOUT_THREAD_STACK	(32 * PTRSIZE * 1024)
 
 static uint callout_timer_id;
@@ -1959,12 +2192,16 @@ static bool callout_thread;
  *
  * A working callout queue is necessary for semaphore emulation, otherwise
  * timed operations will not work and deadlocks can occur.
+ *
+ * Rather than beating every CALLOUT_PERIOD, the thread sleeps until the next
+ * registered event is due, up to CALLOUT_MAX_SLEEP, so that it does not
+ * wake up needlessly when the queue is idle.  This bound stays below the
+ * 10 periods beyond which cq_heartbeat() considers the clock was adjusted.
  */
 static void *
 cq_thread_main(void *unused_arg)
 {
-	tsigset_t set;
-	tm_t period;
+	tsigset_t nset;
 
 	(void) unused_arg;
 
@@ -1974,14 +2211,43 @@ cq_thread_main(void *unused_arg)
 	 * To let cq_dispatch() work properly in case the callout queue does not
 	 * run in the same thread as the one calling cq_dispatch(), we use an
 	 * interruptible sleep in the callout queue thread.
+	 *
+	 * The same TSIG_1 signal is sent by threads inserting an event that
+	 * would fire before the end of our sleep -- see cq_needs_wakeup().
 	 */
 
-	tsig_emptyset(&set);
-	tm_fill_ms(&period, CALLOUT_PERIOD);
+	tsig_emptyset(&nset);
+	tsig_addset(&nset, TSIG_1);
 
 	while (callout_thread) {
+		tsigset_t oset;
+		tm_t ms;
+		int delay;
+
 		cq_heartbeat(callout_queue);
-		thread_timed_sigsuspend(&set, &period);		/* Interruptible sleep */
+
+		/*
+		 * Block TSIG_1 whilst we compute and publish our wakeup time, so
+		 * that a signal sent in-between is kept pending and will abort the
+		 * thread_timed_sigsuspend() call below immediately.
+		 */
+
+		thread_sigmask(TSIG_BLOCK, &nset, &oset);
+
+		delay = cq_delay(callout_queue);
+		delay = MIN(delay, CALLOUT_MAX_SLEEP);
+		delay = MAX(delay, CALLOUT_PERIOD);
+		tm_fill_ms(&ms, delay);
+
+		CQ_LOCK(callout_queue);
+		callout_queue->cq_wakeup = callout_queue->cq_time + delay;
+		CQ_UNLOCK(callout_queue);
+
+		thread_timed_sigsuspend(&oset, &ms);		/* Interruptible sleep */
+
+		CQ_LOCK(callout_queue);
+		callout_queue->cq_wakeup = 0;
+		CQ_UNLOCK(callout_queue);
 	}
 
 	return NULL;
@@ -2050,7 +2316,8 @@ cq_global_init(void)
 void
 cq_init(cq_invoke_t idle, const uint32 *debug)
 {
-	STATIC_ASSERT(IS_POWER_OF_2(HASH_SIZE));
+	STATIC_ASSERT(0 == CQ_SLOTS % 64);		/* Levels aligned in cq_map[] */
+	STATIC_ASSERT(CQ_SPAN_BITS + CQ_GRANULE_BITS >= 31);	/* Any int delay */
 
 	cq_main_init();
 	cq_debug_ptr = debug;
@@ -2134,7 +2401,7 @@ cq_free(cqueue_t *cq)
 {
 	cevent_t *ev;
 	cevent_t *ev_next;
-	int i;
+	uint i;
 	struct chash *ch;
 
 	cqueue_check(cq);
@@ -2148,7 +2415,7 @@ cq_free(cqueue_t *cq)
 
 	mutex_lock(&cq->cq_lock);
 
-	for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
+	for (ch = cq->cq_wheel, i = 0; i < CQ_SLOTS; i++, ch++) {
 		for (ev = ch->ch_head; ev; ev = ev_next) {
 			ev_next = ev->ce_bnext;
 			ev_free(ev);
@@ -2165,7 +2432,7 @@ cq_free(cqueue_t *cq)
 		hset_free_null(&cq->cq_idle);
 	}
 
-	XFREE_NULL(cq->cq_hash);
+	XFREE_NULL(cq->cq_wheel);
 	atom_str_free_null(&cq->cq_name);
 
 	/*
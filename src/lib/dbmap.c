@@ -55,6 +55,7 @@
 #include "stringify.h"			/* For compact_time() */
 #include "unsigned.h"			/* For size_is_non_negative() */
 #include "walloc.h"
+#include "xmalloc.h"
 
 #include "sdbm/sdbm.h"
 
@@ -685,6 +686,74 @@ dbmap_insert(dbmap_t *dm, const void *key, dbmap_datum_t value)
 	return TRUE;
 }
 
+/**
+ * Insert a batch of key/value pairs in the DB map, replacing existing values.
+ *
+ * For SDBM maps, this is much more efficient than inserting each pair
+ * individually when filling an empty map: see sdbm_store_bulk().
+ *
+ * @param dm		the DB map
+ * @param pairs		the array of pairs to insert
+ * @param count		amount of pairs in the array
+ *
+ * @return success status.  On failure, some of the pairs may have been
+ * inserted already.
+ */
+bool
+dbmap_insert_bulk(dbmap_t *dm, const dbmap_pair_t *pairs, size_t count)
+{
+	dbmap_check(dm);
+	g_assert(pairs != NULL || 0 == count);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		{
+			size_t i;
+
+			for (i = 0; i < count; i++) {
+				if (!dbmap_insert(dm, pairs[i].key, pairs[i].value))
+					return FALSE;
+			}
+		}
+		break;
+	case DBMAP_SDBM:
+		{
+			datum_pair *dp;
+			size_t i;
+			long created;
+
+			if G_UNLIKELY(0 == count)
+				break;
+
+			XMALLOC_ARRAY(dp, count);
+
+			for (i = 0; i < count; i++) {
+				const dbmap_pair_t *p = &pairs[i];
+
+				dp[i].key.dptr = deconstify_pointer(p->key);
+				dp[i].key.dsize = dbmap_keylen(dm, p->key);
+				dp[i].val.dptr = deconstify_pointer(p->value.data);
+				dp[i].val.dsize = p->value.len;
+			}
+
+			errno = dm->error = 0;
+			created = sdbm_store_bulk(dm->u.s.sdbm, dp, count, DBM_REPLACE);
+			XFREE_NULL(dp);
+
+			if (-1 == created) {
+				dbmap_sdbm_error_check(dm);
+				return FALSE;
+			}
+			dm->count += created;
+		}
+		break;
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return TRUE;
+}
+
 /**
  * Remove a key from the DB map.
  *
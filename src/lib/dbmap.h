@@ -57,6 +57,14 @@ typedef struct dbmap_datum {
 	size_t len;
 } dbmap_datum_t;
 
+/**
+ * A key/value pair, for bulk insertions.
+ */
+typedef struct dbmap_pair {
+	const void *key;
+	dbmap_datum_t value;
+} dbmap_pair_t;
+
 /**
  * Routine returning the length of the serialized key given its serialized form.
  * This allows variable-length keys to be stored in a dbmap.
@@ -89,6 +97,7 @@ void dbmap_sdbm_set_name(const dbmap_t *dm, const char *name);
  */
 
 bool dbmap_insert(dbmap_t *dm, const void *key, dbmap_datum_t value);
+bool dbmap_insert_bulk(dbmap_t *dm, const dbmap_pair_t *pairs, size_t count);
 bool dbmap_remove(dbmap_t *dm, const void *key);
 bool dbmap_contains(dbmap_t *dm, const void *key);
 dbmap_datum_t dbmap_lookup(dbmap_t *dm, const void *key);
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Epoch-based reclamation, for read-mostly shared data.
+ *
+ * This allows data structures that are seldom updated, but frequently
+ * looked up, to be read concurrently by any thread without taking a lock.
+ * The writer, usually the main thread, never modifies a version that can
+ * be seen by readers: it builds a new version, publishes it by replacing
+ * the shared pointer, and retires the old version.
+ *
+ * Readers bracket their traversal with epoch_enter() and epoch_leave(),
+ * which only record in a per-thread slot the global epoch at which the
+ * thread started to read.  Sections can be nested, but must not block
+ * for long since they delay reclamation.
+ *
+ * Retired objects are tagged with the current global epoch, which is then
+ * advanced.  An object can be freed once no reader is in a section that
+ * started at or before its tag, since all the later readers can only see
+ * the new version.
+ *
+ * Here is how a shared table is handled:
+ *
+ *     reader:
+ *
+ *         epoch_enter();
+ *         t = EPOCH_READ(table);
+ *         ...lookup in t...
+ *         epoch_leave();
+ *
+ *     writer:
+ *
+ *         old = table;
+ *         EPOCH_PUBLISH(table, new);
+ *         epoch_retire(old, table_free);
+ *
+ * Retired objects are reclaimed opportunistically by epoch_retire() and
+ * periodically from the main callout queue as long as some are pending.
+ * At shutdown, epoch_synchronize() can be used to wait for readers and
+ * free everything that was retired.  Once epoch_shutdown() has been called,
+ * the callout queue may no longer run, so epoch_retire() synchronizes
+ * immediately instead of deferring reclamation.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "epoch.h"
+
+#include "atomic.h"
+#include "cq.h"
+#include "eslist.h"
+#include "log.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define EPOCH_CACHELINE		64		/* Avoid false sharing between slots */
+#define EPOCH_PERIOD		1000	/* ms: periodic reclamation */
+
+/**
+ * Per-thread reader state, aligned on its own cache line.
+ */
+static union epoch_slot {
+	struct {
+		uint epoch;			/* Epoch at section start, 0 if quiescent */
+		uint depth;			/* Nesting depth of reader sections */
+	} s;
+	char pad[EPOCH_CACHELINE];
+} epoch_slot[THREAD_MAX];
+
+/**
+ * A retired object, pending reclamation.
+ */
+struct epoch_retired {
+	void *p;				/* The object */
+	free_fn_t fn;			/* How to free it */
+	uint epoch;				/* Epoch at which it was retired */
+	slink_t lk;				/* Embedded link */
+};
+
+static uint epoch_global = 1;		/* Never 0, which flags quiescent slots */
+static spinlock_t epoch_slk = SPINLOCK_INIT;
+static eslist_t epoch_retired = ESLIST_INIT(offsetof(struct epoch_retired, lk));
+static bool epoch_periodic;		/* Whether periodic reclaiming is installed */
+static bool epoch_stopping;		/* Final shutdown started, no more deferring */
+
+#define EPOCH_LOCK		spinlock(&epoch_slk)
+#define EPOCH_UNLOCK	spinunlock(&epoch_slk)
+
+/**
+ * Compare two epochs, with wrap-around.
+ *
+ * @return TRUE if epoch ``a'' is strictly before ``b''.
+ */
+static inline bool
+epoch_before(uint a, uint b)
+{
+	return (int) (a - b) < 0;
+}
+
+/**
+ * Enter a reader section.
+ *
+ * Objects seen from now on through published pointers will not be freed
+ * until the matching epoch_leave().
+ */
+void
+epoch_enter(void)
+{
+	union epoch_slot *es = &epoch_slot[thread_small_id()];
+
+	if (0 == es->s.depth++) {
+		es->s.epoch = atomic_uint_get(&epoch_global);
+
+		/*
+		 * The memory barrier ensures our slot is visible before we read
+		 * any published pointer: a writer that sees our slot as quiescent
+		 * has therefore published its new version before we can read it.
+		 */
+
+		atomic_mb();
+	}
+}
+
+/**
+ * Leave a reader section.
+ */
+void
+epoch_leave(void)
+{
+	union epoch_slot *es = &epoch_slot[thread_small_id()];
+
+	g_assert_log(es->s.depth != 0,
+		"%s(): not within a reader section in %s", G_STRFUNC, thread_name());
+
+	if (0 == --es->s.depth) {
+		atomic_mb();			/* All our reads are done before we leave */
+		atomic_uint_set(&es->s.epoch, 0);
+	}
+}
+
+/**
+ * @return whether the current thread is within a reader section.
+ */
+bool
+epoch_active(void)
+{
+	return 0 != epoch_slot[thread_small_id()].s.depth;
+}
+
+/**
+ * Compute the oldest epoch at which a running reader section started.
+ *
+ * @param now	the current global epoch, returned when no reader is active
+ */
+static uint
+epoch_oldest(uint now)
+{
+	uint oldest = now;
+	size_t i;
+
+	atomic_mb();
+
+	for (i = 0; i < G_N_ELEMENTS(epoch_slot); i++) {
+		uint e = epoch_slot[i].s.epoch;
+
+		if (e != 0 && epoch_before(e, oldest))
+			oldest = e;
+	}
+
+	return oldest;
+}
+
+/**
+ * Free all the retired objects that can no longer be seen by readers.
+ *
+ * @return the amount of objects freed.
+ */
+size_t
+epoch_reclaim(void)
+{
+	eslist_t done = ESLIST_INIT(offsetof(struct epoch_retired, lk));
+	struct epoch_retired *er;
+	size_t n = 0;
+	uint oldest;
+
+	oldest = epoch_oldest(atomic_uint_get(&epoch_global));
+
+	/*
+	 * Objects are retired with increasing epochs, so the ones we can
+	 * reclaim are at the head of the list.
+	 */
+
+	EPOCH_LOCK;
+	while (NULL != (er = eslist_head(&epoch_retired))) {
+		if (!epoch_before(er->epoch, oldest))
+			break;
+		eslist_shift(&epoch_retired);
+		eslist_append(&done, er);
+	}
+	EPOCH_UNLOCK;
+
+	/*
+	 * Free outside the critical section: freeing routines can be costly.
+	 */
+
+	while (NULL != (er = eslist_shift(&done))) {
+		(*er->fn)(er->p);
+		WFREE(er);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Periodic reclamation of retired objects.
+ *
+ * @return TRUE to keep calling, as long as objects are pending.
+ */
+static bool
+epoch_periodic_reclaim(void *unused_obj)
+{
+	bool pending;
+
+	(void) unused_obj;
+
+	epoch_reclaim();
+
+	EPOCH_LOCK;
+	pending = 0 != eslist_count(&epoch_retired);
+	if (!pending)
+		epoch_periodic = FALSE;
+	EPOCH_UNLOCK;
+
+	return pending;
+}
+
+/**
+ * Retire an object which is no longer reachable by new readers.
+ *
+ * The object must have been unpublished before, i.e. the shared pointer
+ * referencing it has been replaced.  It will be freed through ``fn''
+ * once all the readers that could have seen it are gone.
+ *
+ * @param p		the object to retire (NULL is ignored)
+ * @param fn	the freeing routine to invoke on the object
+ */
+void
+epoch_retire(void *p, free_fn_t fn)
+{
+	struct epoch_retired *er;
+	bool install = FALSE;
+
+	g_assert(fn != NULL);
+
+	if (NULL == p)
+		return;
+
+	WALLOC(er);
+	er->p = p;
+	er->fn = fn;
+
+	EPOCH_LOCK;
+	er->epoch = atomic_uint_inc(&epoch_global);	/* Tag with previous epoch */
+	if G_UNLIKELY(0 == epoch_global)
+		epoch_global = 1;						/* 0 flags quiescent slots */
+	eslist_append(&epoch_retired, er);
+	if (!epoch_periodic && !epoch_stopping)
+		install = epoch_periodic = TRUE;
+	EPOCH_UNLOCK;
+
+	if G_UNLIKELY(epoch_stopping && !epoch_active()) {
+		epoch_synchronize();
+		return;
+	}
+
+	epoch_reclaim();
+
+	if (install)
+		cq_periodic_main_add(EPOCH_PERIOD, epoch_periodic_reclaim, NULL);
+}
+
+/**
+ * Wait until all the objects retired so far can be reclaimed, and free them.
+ *
+ * This must not be called within a reader section, or it would deadlock.
+ */
+void
+epoch_synchronize(void)
+{
+	uint now;
+
+	g_assert_log(!epoch_active(),
+		"%s(): called within a reader section in %s",
+		G_STRFUNC, thread_name());
+
+	EPOCH_LOCK;
+	now = atomic_uint_inc(&epoch_global) + 1;
+	if G_UNLIKELY(0 == epoch_global)
+		epoch_global = now = 1;
+	EPOCH_UNLOCK;
+
+	while (epoch_before(epoch_oldest(now), now)) {
+		thread_yield();
+	}
+
+	epoch_reclaim();
+}
+
+/**
+ * Record that final shutdown has started.
+ *
+ * From now on, retired objects are freed as soon as the readers are gone,
+ * without relying on the callout queue, which is about to be halted.
+ */
+void
+epoch_shutdown(void)
+{
+	EPOCH_LOCK;
+	epoch_stopping = TRUE;
+	EPOCH_UNLOCK;
+}
+
+/**
+ * @return the amount of retired objects pending reclamation.
+ */
+size_t
+epoch_pending(void)
+{
+	size_t count;
+
+	EPOCH_LOCK;
+	count = eslist_count(&epoch_retired);
+	EPOCH_UNLOCK;
+
+	return count;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Epoch-based reclamation, for read-mostly shared data.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _epoch_h_
+#define _epoch_h_
+
+#include "atomic.h"
+
+/**
+ * Publish a new version of a shared pointer.
+ *
+ * All the initialization of the new version done before is made visible to
+ * readers before the pointer itself.
+ */
+#define EPOCH_PUBLISH(var, value) G_STMT_START {	\
+	atomic_mb();									\
+	(var) = (value);								\
+	atomic_mb();									\
+} G_STMT_END
+
+/**
+ * Read a shared pointer, within an epoch_enter() / epoch_leave() section.
+ */
+#define EPOCH_READ(var)		ATOMIC_GET(&(var))
+
+/*
+ * Public interface.
+ */
+
+void epoch_enter(void);
+void epoch_leave(void);
+bool epoch_active(void);
+
+void epoch_retire(void *p, free_fn_t fn);
+size_t epoch_reclaim(void);
+void epoch_synchronize(void);
+void epoch_shutdown(void);
+size_t epoch_pending(void);
+
+#endif /* _epoch_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
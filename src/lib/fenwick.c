@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Fenwick trees (binary indexed trees), for prefix sums and ranks.
+ *
+ * A Fenwick tree holds ``n'' non-negative values, indexed from 1 to n, and
+ * allows both updating a value and computing the sum of the first ``i''
+ * values in O(log n).  The tree is implicit: it is stored as a plain array
+ * where each cell holds the sum of a range of values whose length is given
+ * by the lowest bit set in the cell index.
+ *
+ * When values are 0 or 1, marking whether a given index is present in a
+ * set, the prefix sum is the rank of an index in the set, and selecting
+ * the index with a given rank is also possible in O(log n), making the tree
+ * an order-statistics structure over its index space.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "fenwick.h"
+
+#include "pow2.h"
+#include "unsigned.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+enum fenwick_magic { FENWICK_MAGIC = 0x1e3c5d2b };
+
+/**
+ * A Fenwick tree.
+ */
+struct fenwick {
+	enum fenwick_magic magic;
+	size_t n;				/**< Amount of values */
+	size_t top;				/**< Highest power of 2 not greater than n */
+	uint64 total;			/**< Sum of all the values */
+	uint64 *cell;			/**< Cells, indexed from 1 to n */
+};
+
+static inline void
+fenwick_check(const struct fenwick * const ft)
+{
+	g_assert(ft != NULL);
+	g_assert(FENWICK_MAGIC == ft->magic);
+}
+
+/**
+ * Create a new Fenwick tree holding ``n'' values, all zero.
+ *
+ * @param n		amount of values, indexed from 1 to n.
+ *
+ * @return a new Fenwick tree.
+ */
+fenwick_t *
+fenwick_make(size_t n)
+{
+	fenwick_t *ft;
+
+	g_assert(size_is_positive(n));
+	g_assert(n <= MAX_INT_VAL(uint32));
+
+	WALLOC0(ft);
+	ft->magic = FENWICK_MAGIC;
+	ft->n = n;
+	ft->top = (size_t) 1 << highest_bit_set(n);
+	XMALLOC0_ARRAY(ft->cell, n + 1);
+
+	return ft;
+}
+
+/**
+ * Free Fenwick tree and nullify its pointer.
+ */
+void
+fenwick_free_null(fenwick_t **ft_ptr)
+{
+	fenwick_t *ft = *ft_ptr;
+
+	if (ft != NULL) {
+		fenwick_check(ft);
+		XFREE_NULL(ft->cell);
+		ft->magic = 0;
+		WFREE(ft);
+		*ft_ptr = NULL;
+	}
+}
+
+/**
+ * @return the amount of values held in the tree.
+ */
+size_t
+fenwick_size(const fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	return ft->n;
+}
+
+/**
+ * Reset all the values to zero.
+ */
+void
+fenwick_clear(fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	memset(ft->cell, 0, (ft->n + 1) * sizeof ft->cell[0]);
+	ft->total = 0;
+}
+
+/**
+ * Add ``delta'' to the value at index ``i''.
+ *
+ * The resulting value must remain non-negative.
+ */
+void
+fenwick_add(fenwick_t *ft, size_t i, int64 delta)
+{
+	fenwick_check(ft);
+	g_assert(i >= 1 && i <= ft->n);
+	g_assert(delta >= 0 || ft->total >= (uint64) -delta);
+
+	ft->total += delta;
+
+	for (; i <= ft->n; i += i & -i) {
+		ft->cell[i] += delta;
+	}
+}
+
+/**
+ * @return the sum of the values at indices 1 to ``i'', 0 if ``i'' is 0.
+ */
+uint64
+fenwick_prefix(const fenwick_t *ft, size_t i)
+{
+	uint64 sum = 0;
+
+	fenwick_check(ft);
+	g_assert(i <= ft->n);
+
+	for (; i != 0; i -= i & -i) {
+		sum += ft->cell[i];
+	}
+
+	return sum;
+}
+
+/**
+ * @return the sum of all the values.
+ */
+uint64
+fenwick_total(const fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	return ft->total;
+}
+
+/**
+ * Find the smallest index whose prefix sum reaches ``k''.
+ *
+ * When the tree holds 0 or 1 values, this is the index having rank ``k''
+ * in the set of indices whose value is 1.
+ *
+ * @return the index found, 0 if ``k'' is 0 or greater than the total sum.
+ */
+size_t
+fenwick_select(const fenwick_t *ft, uint64 k)
+{
+	size_t i = 0, step;
+
+	fenwick_check(ft);
+
+	if G_UNLIKELY(0 == k || k > ft->total)
+		return 0;
+
+	for (step = ft->top; step != 0; step >>= 1) {
+		size_t j = i + step;
+
+		if (j <= ft->n && ft->cell[j] < k) {
+			i = j;
+			k -= ft->cell[j];
+		}
+	}
+
+	g_assert(i < ft->n);
+
+	return i + 1;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -88,6 +88,9 @@
 #include "atoms.h"
 #include "compat_misc.h"
 #include "compat_pio.h"
+#include "compat_sleep_ms.h"
+#include "cond.h"
+#include "elist.h"
 #include "fd.h"
 #include "file.h"
 #include "hikset.h"
@@ -97,9 +100,12 @@
 #include "once.h"
 #include "path.h"
 #include "pslist.h"
-#include "spinlock.h"
 #include "str.h"			/* For str_private() */
+#include "teq.h"
+#include "thread.h"
+#include "tpool.h"
 #include "walloc.h"
+#include "xmalloc.h"
 
 #include "override.h"       /* Must be the last header included */
 
@@ -154,8 +160,11 @@ struct file_descriptor {
 	int refcnt;					/* Reference count */
 	int fd;						/* The file descriptor, opened O_RDWR usually */
 	int omode;					/* Opening mode of file descriptor */
+	int aio_pending;			/* Asynchronous writes not performed yet */
 	bool revoked;				/* Whether descriptor was revoked */
-	spinlock_t lock;			/* Concurrent access protection */
+	mutex_t lock;				/* Concurrent access protection */
+	elist_t aio_writes;			/* Pending asynchronous writes */
+	cond_t aio_done;			/* Signals completion of asynchronous writes */
 };
 
 static inline void
@@ -165,17 +174,46 @@ file_descriptor_check(const struct file_descriptor * const fd)
 	g_assert(FILE_DESCRIPTOR_MAGIC == fd->magic);
 }
 
+enum file_object_aio_magic { FILE_OBJECT_AIO_MAGIC = 0x3a8e4f1d };
+
+/**
+ * An asynchronous write request.
+ */
+struct file_object_aio {
+	enum file_object_aio_magic magic;
+	struct file_descriptor *fd;	/* Referenced file descriptor */
+	iovec_t *iov;				/* Copy of the I/O vector */
+	int iov_cnt;				/* Amount of entries in I/O vector */
+	int error;					/* The errno value, if the write failed */
+	filesize_t offset;			/* Offset where data is to be written */
+	filesize_t size;			/* Amount of bytes to write */
+	ssize_t written;			/* Amount of bytes written */
+	file_object_aio_cb_t cb;	/* Completion callback */
+	void *arg;					/* Callback argument */
+	link_t lk;					/* Links pending writes of descriptor */
+};
+
+static inline void
+file_object_aio_check(const struct file_object_aio * const fa)
+{
+	g_assert(fa != NULL);
+	g_assert(FILE_OBJECT_AIO_MAGIC == fa->magic);
+}
+
 /*
  * It is necessary to lock descriptors for each operation accessing the
  * kernel file descriptor held within because of possible concurrent renaming
  * or file moving operation that could happen.  This means all pread() and
  * pwrite() I/Os done from here are serialized for a given file descriptor.
+ *
+ * Since asynchronous writes can hold the lock for the duration of a slow
+ * disk I/O, this is a mutex and not a spinlock.
  */
 
-#define FILE_DESCRIPTOR_LOCK(fd)	spinlock_const(&(fd)->lock)
-#define FILE_DESCRIPTOR_UNLOCK(fd)	spinunlock_const(&(fd)->lock)
+#define FILE_DESCRIPTOR_LOCK(fd)	mutex_lock_const(&(fd)->lock)
+#define FILE_DESCRIPTOR_UNLOCK(fd)	mutex_unlock_const(&(fd)->lock)
 
-#define FILE_DESCRIPTOR_LOCKED(fd)	spinlock_is_held(&(fd)->lock)
+#define FILE_DESCRIPTOR_LOCKED(fd)	mutex_is_owned(&(fd)->lock)
 
 static inline void
 file_object_check(const file_object_t * const fo)
@@ -273,9 +311,12 @@ file_object_free_descriptor(struct file_descriptor * const fd)
 	file_descriptor_check(fd);
 	g_assert(0 == fd->refcnt);
 
+	g_assert(0 == elist_count(&fd->aio_writes));
+
 	fd_close(&fd->fd);
 	atom_str_free_null(&fd->pathname);
-	spinlock_destroy(&fd->lock);
+	cond_destroy(&fd->aio_done);
+	mutex_destroy(&fd->lock);
 	fd->magic = 0;
 	WFREE(fd);
 }
@@ -306,7 +347,9 @@ file_object_new_descriptor(const int d, const char * const pathname, int omode)
 	WALLOC0(fdn);
 	fdn->magic = FILE_DESCRIPTOR_MAGIC;
 	fdn->fd = d;
-	spinlock_init(&fdn->lock);
+	mutex_init(&fdn->lock);
+	elist_init(&fdn->aio_writes, offsetof(struct file_object_aio, lk));
+	cond_init(&fdn->aio_done, &fdn->lock);
 
 	FILE_OBJECTS_LOCK;
 	fd = file_object_find(pathname);
@@ -981,6 +1024,42 @@ file_object_writable(const file_object_t * const fo)
 	return O_WRONLY == fo->accmode || O_RDWR == fo->accmode;
 }
 
+/**
+ * Is there a pending asynchronous write overlapping the [from, to[ range?
+ */
+static bool
+file_object_aio_overlaps(const struct file_descriptor * const fd,
+	const filesize_t from, const filesize_t to)
+{
+	const struct file_object_aio *fa;
+
+	g_assert(FILE_DESCRIPTOR_LOCKED(fd));
+
+	ELIST_FOREACH_DATA(&fd->aio_writes, fa) {
+		if (fa->offset < to && fa->offset + fa->size > from)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Wait until all the asynchronous writes overlapping the [from, to[ range
+ * of the locked file descriptor have been performed, so that reads never
+ * return data older than what was written.
+ *
+ * The descriptor lock is released whilst waiting.
+ */
+static inline void
+file_object_aio_barrier(const struct file_descriptor * const fd,
+	const filesize_t from, const filesize_t to)
+{
+	while G_UNLIKELY(file_object_aio_overlaps(fd, from, to)) {
+		struct file_descriptor *wfd = deconstify_pointer(fd);
+		cond_wait(&wfd->aio_done, &wfd->lock);
+	}
+}
+
 /**
  * Write the given data to a file object at the given offset.
  *
@@ -1075,6 +1154,7 @@ file_object_pread(const file_object_t * const fo,
 
 	fd = fo->fd;
 	FILE_DESCRIPTOR_LOCK(fd);
+	file_object_aio_barrier(fd, offset, offset + size);
 
 	if G_UNLIKELY(!is_valid_fd(fd->fd))
 		r = file_object_ebadf();
@@ -1112,6 +1192,8 @@ file_object_preadv(const file_object_t * const fo,
 
 	fd = fo->fd;
 	FILE_DESCRIPTOR_LOCK(fd);
+	file_object_aio_barrier(fd, offset,
+		offset + iov_calculate_size(iov, MIN(iov_cnt, MAX_IOV_COUNT)));
 
 	if G_UNLIKELY(!is_valid_fd(fd->fd))
 		r = file_object_ebadf();
@@ -1125,6 +1207,214 @@ file_object_preadv(const file_object_t * const fo,
 	return r;
 }
 
+/***
+ *** Asynchronous writes.
+ ***/
+
+#define FILE_OBJECT_AIO_WORKERS	2		/* Threads performing the writes */
+
+static tpool_t *file_object_writer;
+static once_flag_t file_object_writer_inited;
+static int file_object_aio_count;		/* Total pending writes */
+
+static void
+file_object_writer_init_once(void)
+{
+	file_object_writer = tpool_make("file writer", FILE_OBJECT_AIO_WORKERS);
+}
+
+/**
+ * Perform the write, in one of the writer threads.
+ *
+ * Partial writes are resumed until all the data are written or an error
+ * occurs.
+ *
+ * @return the request.
+ */
+static void *
+file_object_aio_write(void *arg)
+{
+	struct file_object_aio *fa = arg;
+	struct file_descriptor *fd;
+	iovec_t *iov;
+	int iov_cnt;
+
+	file_object_aio_check(fa);
+
+	fd = fa->fd;
+	iov = fa->iov;
+	iov_cnt = fa->iov_cnt;
+
+	while (iov_cnt > 0 && 0 == fa->error) {
+		ssize_t w;
+		size_t n;
+
+		FILE_DESCRIPTOR_LOCK(fd);
+
+		if G_UNLIKELY(!is_valid_fd(fd->fd))
+			w = file_object_ebadf();
+		else
+			w = compat_pwritev(fd->fd, iov, MIN(iov_cnt, MAX_IOV_COUNT),
+				fa->offset + fa->written);
+
+		FILE_DESCRIPTOR_UNLOCK(fd);
+
+		if ((ssize_t) -1 == w) {
+			if (EINTR != errno)
+				fa->error = errno;
+			continue;
+		}
+
+		if (0 == w)
+			break;			/* Partial write, caller will notice */
+
+		fa->written += w;
+
+		/*
+		 * Skip the entries that were fully written and adjust the first
+		 * one that was only partially written.
+		 */
+
+		for (n = w; iov_cnt > 0 && n >= iovec_len(iov); iov++, iov_cnt--) {
+			n -= iovec_len(iov);
+		}
+
+		if (n != 0) {
+			g_assert(iov_cnt > 0);
+			iovec_set_base(iov, ptr_add_offset(iovec_base(iov), n));
+			iovec_set_len(iov, iovec_len(iov) - n);
+		}
+	}
+
+	/*
+	 * Data now handed to the kernel: wake up readers waiting for them.
+	 */
+
+	FILE_DESCRIPTOR_LOCK(fd);
+	elist_remove(&fd->aio_writes, fa);
+	cond_broadcast(&fd->aio_done, &fd->lock);
+	FILE_DESCRIPTOR_UNLOCK(fd);
+
+	atomic_int_dec(&fd->aio_pending);
+
+	return fa;
+}
+
+/**
+ * Completion of the write, in the thread that requested it.
+ */
+static void
+file_object_aio_done(void *result, void *unused_udata)
+{
+	struct file_object_aio *fa = result;
+
+	(void) unused_udata;
+	file_object_aio_check(fa);
+
+	(*fa->cb)(0 == fa->written && fa->error != 0 ? -1 : fa->written,
+		fa->error, fa->arg);
+
+	file_object_unref_descriptor(fa->fd);
+	XFREE_NULL(fa->iov);
+	fa->magic = 0;
+	WFREE(fa);
+
+	atomic_int_dec(&file_object_aio_count);
+}
+
+/**
+ * Write the data described by the I/O vector to the file object from the
+ * given offset, asynchronously.
+ *
+ * The write is performed by a dedicated thread, which retries partial writes
+ * until all the data are written or an error occurs.  When the write is
+ * completed, the callback is invoked in the calling thread as
+ * cb(written, error, arg), where ``written'' is -1 if nothing could be
+ * written and ``error'' is the errno value of the failure, 0 if none.
+ *
+ * The I/O vector is copied, but the data it references must remain valid
+ * until the callback is invoked.  The file object can be released before
+ * completion.
+ *
+ * @param fo		an initialized file object
+ * @param iov		the I/O vector describing the data to write
+ * @param iov_cnt	the amount of entries in the I/O vector
+ * @param offset	the file offset at which to start writing the data
+ * @param cb		the completion callback
+ * @param arg		additional argument for the callback
+ */
+void
+file_object_pwritev_async(const file_object_t * const fo,
+	const iovec_t *iov, const int iov_cnt, const filesize_t offset,
+	file_object_aio_cb_t cb, void *arg)
+{
+	struct file_object_aio *fa;
+
+	file_object_check(fo);
+	g_assert(iov != NULL);
+	g_assert(iov_cnt > 0);
+	g_assert(cb != NULL);
+
+	ONCE_FLAG_RUN(file_object_writer_inited, file_object_writer_init_once);
+
+	WALLOC0(fa);
+	fa->magic = FILE_OBJECT_AIO_MAGIC;
+	fa->fd = fo->fd;
+	fa->iov = xcopy(iov, iov_cnt * sizeof iov[0]);
+	fa->iov_cnt = iov_cnt;
+	fa->offset = offset;
+	fa->size = iov_calculate_size(iov, iov_cnt);
+	fa->cb = cb;
+	fa->arg = arg;
+
+	if G_UNLIKELY(!file_object_writable(fo)) {
+		file_object_eperm(fo, "write", G_STRFUNC);
+		fa->error = errno;
+	}
+
+	atomic_int_inc(&fa->fd->refcnt);		/* Released when completed */
+	atomic_int_inc(&fa->fd->aio_pending);
+	atomic_int_inc(&file_object_aio_count);
+
+	FILE_DESCRIPTOR_LOCK(fa->fd);
+	elist_append(&fa->fd->aio_writes, fa);
+	FILE_DESCRIPTOR_UNLOCK(fa->fd);
+
+	tpool_submit_notify(file_object_writer,
+		file_object_aio_write, fa, file_object_aio_done, NULL);
+}
+
+/**
+ * @return amount of asynchronous writes to the file not performed yet.
+ */
+size_t
+file_object_aio_pending(const file_object_t * const fo)
+{
+	file_object_check(fo);
+
+	return atomic_int_get(&fo->fd->aio_pending);
+}
+
+/**
+ * Wait for the completion of all the asynchronous writes issued by the
+ * calling thread, including the invocation of their callbacks.
+ *
+ * Since the completion events are dispatched from here, this is meant to be
+ * used at shutdown time, and the calling thread must have a thread event
+ * queue.
+ */
+void
+file_object_aio_sync_all(void)
+{
+	g_assert_log(teq_is_supported(thread_small_id()),
+		"%s(): called with no event queue in %s", G_STRFUNC, thread_name());
+
+	while (0 != atomic_int_get(&file_object_aio_count)) {
+		if (0 == teq_dispatch())
+			compat_sleep_ms(1);
+	}
+}
+
 /**
  * Get opened file status.
  *
@@ -1140,6 +1430,7 @@ file_object_fstat(const file_object_t * const fo, filestat_t *buf)
 
 	fd = fo->fd;
 	FILE_DESCRIPTOR_LOCK(fd);
+	file_object_aio_barrier(fd, 0, MAX_INT_VAL(filesize_t));
 
 	g_assert(is_valid_fd(fd->fd));
 	s = fstat(fd->fd, buf);
@@ -1164,6 +1455,7 @@ file_object_ftruncate(const file_object_t * const fo, filesize_t off)
 
 	fd = fo->fd;
 	FILE_DESCRIPTOR_LOCK(fd);
+	file_object_aio_barrier(fd, 0, MAX_INT_VAL(filesize_t));
 
 	g_assert(is_valid_fd(fd->fd));
 	s = ftruncate(fd->fd, off);
@@ -1347,6 +1639,14 @@ file_object_close(void)
 {
 #define D(x) &x, #x
 
+	/*
+	 * Pending asynchronous writes were flushed by file_object_aio_sync_all()
+	 * when downloads were closed, so the writer threads are now idle.
+	 */
+
+	g_assert(0 == atomic_int_get(&file_object_aio_count));
+
+	tpool_free_null(&file_object_writer);
 	file_object_destroy_table(D(file_descriptors));
 
 #undef D
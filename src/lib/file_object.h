@@ -62,6 +62,15 @@ file_object_info_check(const file_object_info_t * const foi)
 	g_assert(FILE_OBJECT_INFO_MAGIC == foi->magic);
 }
 
+/**
+ * Completion callback for asynchronous writes.
+ *
+ * @param written	amount of bytes written, -1 if nothing could be written
+ * @param error		the errno value if the write failed, 0 otherwise
+ * @param arg		user-supplied argument
+ */
+typedef void (*file_object_aio_cb_t)(ssize_t written, int error, void *arg);
+
 void file_object_init(void);
 void file_object_close(void);
 
@@ -80,6 +89,12 @@ ssize_t file_object_pwrite(const file_object_t *fo,
 					const void *data, size_t buf, filesize_t offset);
 ssize_t file_object_pwritev(const file_object_t *fo,
 					const iovec_t *iov, int iov_cnt, filesize_t offset);
+void file_object_pwritev_async(const file_object_t *fo,
+					const iovec_t *iov, int iov_cnt, filesize_t offset,
+					file_object_aio_cb_t cb, void *arg);
+size_t file_object_aio_pending(const file_object_t *fo);
+void file_object_aio_sync_all(void);
+
 ssize_t file_object_pread(const file_object_t *fo,
 					void *data, size_t size, filesize_t pos);
 ssize_t file_object_preadv(const file_object_t *fo,
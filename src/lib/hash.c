@@ -363,7 +363,7 @@ hash_keyhash_setup(struct hkeys *hk, enum hash_key_type ktype, size_t keysize)
 		hk->uk.eq = NULL;			/* Will use '==' comparison */
 		break;
 	case HASH_KEY_STRING:
-		hk->uh.h.hash = string_mix_hash;
+		hk->uh.h.hash = string_wide_hash;
 		hk->uh.h.hash2 = string_hash;
 		hk->uk.eq = string_eq;
 		break;
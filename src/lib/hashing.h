@@ -81,6 +81,8 @@ unsigned port_hash2(uint16 v) G_GNUC_CONST;
 unsigned universal_hash(const void *data, size_t len) G_GNUC_PURE;
 unsigned universal_mix_hash(const void *data, size_t len) G_GNUC_PURE;
 unsigned string_mix_hash(const void *s) G_GNUC_PURE;
+unsigned wide_hash(const void *data, size_t len) G_GNUC_PURE;
+unsigned string_wide_hash(const void *s) G_GNUC_PURE;
 
 bool pointer_eq(const void *a, const void *b) G_GNUC_CONST;
 bool binary_eq(const void *a, const void *b, size_t len) G_GNUC_PURE;
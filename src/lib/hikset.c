@@ -230,7 +230,7 @@ hikset_key_setup(hikset_t *hik, enum hash_key_type ktype, size_t keysize)
 		hik->uik.eq = NULL;			/* Will use == comparison */
 		break;
 	case HASH_KEY_STRING:
-		hik->ihash = string_mix_hash;
+		hik->ihash = string_wide_hash;
 		hik->uik.eq = string_eq;
 		break;
 	case HASH_KEY_FIXED:
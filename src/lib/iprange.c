@@ -135,6 +135,46 @@ iprange_reset_ipv6(struct iprange_db *idb)
 	idb->tab6_unsorted = FALSE;
 }
 
+/**
+ * Copy all the IPv4 ranges of database ``src'' into ``dst''.
+ */
+void
+iprange_copy_ipv4(struct iprange_db *dst, const struct iprange_db *src)
+{
+	size_t i, n;
+
+	iprange_db_check(dst);
+	iprange_db_check(src);
+
+	n = sorted_array_size(src->tab4);
+
+	for (i = 0; i < n; i++)
+		sorted_array_add(dst->tab4, sorted_array_item(src->tab4, i));
+
+	if (n != 0)
+		dst->tab4_unsorted = TRUE;
+}
+
+/**
+ * Copy all the IPv6 ranges of database ``src'' into ``dst''.
+ */
+void
+iprange_copy_ipv6(struct iprange_db *dst, const struct iprange_db *src)
+{
+	size_t i, n;
+
+	iprange_db_check(dst);
+	iprange_db_check(src);
+
+	n = sorted_array_size(src->tab6);
+
+	for (i = 0; i < n; i++)
+		sorted_array_add(dst->tab6, sorted_array_item(src->tab6, i));
+
+	if (n != 0)
+		dst->tab6_unsorted = TRUE;
+}
+
 /**
  * Create a new IP range database.
  */
@@ -59,6 +59,8 @@ void iprange_sync(struct iprange_db *idb);
 void iprange_free(struct iprange_db **idb_ptr);
 void iprange_reset_ipv4(struct iprange_db *idb);
 void iprange_reset_ipv6(struct iprange_db *idb);
+void iprange_copy_ipv4(struct iprange_db *dst, const struct iprange_db *src);
+void iprange_copy_ipv6(struct iprange_db *dst, const struct iprange_db *src);
 
 unsigned iprange_get_item_count(const struct iprange_db *idb);
 unsigned iprange_get_item_count4(const struct iprange_db *idb);
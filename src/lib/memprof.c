@@ -0,0 +1,850 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sampled memory allocation profiling.
+ *
+ * When profiling is enabled, one allocation every "rate" bytes is sampled
+ * on average.  Each thread counts down the amount of bytes it allocates and
+ * takes a sample when the counter drops to zero, drawing the next interval
+ * from an exponential distribution of mean "rate": this way, periodic
+ * allocation patterns cannot bias the results, and a block of s bytes is
+ * sampled with probability 1 - exp(-s/rate), which lets us scale the
+ * samples back to estimate the real allocation figures.
+ *
+ * Each sample records the allocating stack frame (the call site) and the
+ * time of the allocation.  Samples are aggregated per call site, and are
+ * tracked until the block is freed, so that we know, for each site, the
+ * estimated amount of live bytes, the allocation rate since profiling was
+ * turned on, the range of sizes requested and the lifetime histogram of
+ * freed blocks.
+ *
+ * The per-site statistics can be logged or exported in the legacy text
+ * heap profile format understood by pprof (heap_v2, carrying the raw
+ * sample counts and the sampling rate so that pprof can do the scaling).
+ *
+ * Since this is hooked within the memory allocators, the fast paths are
+ * inlined and merely check a global variable.  To avoid taking a lock
+ * on every freeing when samples are live, a small counting filter indexed
+ * by the pointer hash tells us whether a block can possibly be a sample.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#ifdef I_MATH
+#include <math.h>
+#endif	/* I_MATH */
+
+#include "memprof.h"
+
+#include "dump_options.h"
+#include "file.h"
+#include "hashing.h"
+#include "hashtable.h"
+#include "log.h"
+#include "misc.h"
+#include "mutex.h"
+#include "rand31.h"
+#include "stacktrace.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "vsort.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define MEMPROF_FILTER_BITS		16
+#define MEMPROF_FILTER_SIZE		(1U << MEMPROF_FILTER_BITS)
+#define MEMPROF_FILTER_MAX		MAX_INT_VAL(uint8)
+#define MEMPROF_LIFETIMES		6		/**< Lifetime histogram buckets */
+#define MEMPROF_DUMP_MAX		100		/**< Max amount of sites logged */
+
+#define MEMPROF_FILTER_IDX(p) \
+	hashing_keep(pointer_hash_fast(p), MEMPROF_FILTER_BITS)
+
+/**
+ * Upper limits (excluded) of the lifetime histogram buckets, in seconds.
+ * The last bucket collects all the blocks living longer.
+ */
+static const time_delta_t memprof_lifetime_limit[MEMPROF_LIFETIMES - 1] = {
+	1, 10, 60, 600, 3600,
+};
+
+static const char * const memprof_lifetime_name[MEMPROF_LIFETIMES] = {
+	"<1s", "<10s", "<1m", "<10m", "<1h", ">=1h",
+};
+
+static const char * const memprof_allocator_name[MEMPROF_ALLOCATOR_MAX] = {
+	"xmalloc", "tmalloc", "zalloc",
+};
+
+enum memprof_site_magic { MEMPROF_SITE_MAGIC = 0x5a2e10d3 };
+
+/**
+ * Statistics for a given allocation call site.
+ *
+ * The "sampled" fields record raw sample figures, the others are the
+ * estimated figures derived by weighting each sample by the inverse of
+ * its sampling probability.
+ */
+struct memprof_site {
+	enum memprof_site_magic magic;
+	const struct stackatom *stack;	/**< Allocating stack (atom) */
+	enum memprof_allocator which;	/**< Allocator used */
+	size_t min_size;				/**< Smallest sampled block */
+	size_t max_size;				/**< Largest sampled block */
+	uint64 samples;					/**< Total amount of samples */
+	uint64 sampled_bytes;			/**< Total size of samples */
+	size_t live;					/**< Amount of live samples */
+	size_t live_sampled_bytes;		/**< Total size of live samples */
+	double allocs;					/**< Estimated amount of allocations */
+	double bytes;					/**< Estimated amount of bytes */
+	double live_allocs;				/**< Estimated amount of live blocks */
+	double live_bytes;				/**< Estimated amount of live bytes */
+	uint64 lifetime[MEMPROF_LIFETIMES];	/**< Freed samples, per lifetime */
+};
+
+static inline void
+memprof_site_check(const struct memprof_site * const ms)
+{
+	g_assert(ms != NULL);
+	g_assert(MEMPROF_SITE_MAGIC == ms->magic);
+}
+
+enum memprof_sample_magic { MEMPROF_SAMPLE_MAGIC = 0x1e5c7b48 };
+
+/**
+ * A sampled live block.
+ */
+struct memprof_sample {
+	enum memprof_sample_magic magic;
+	struct memprof_site *site;		/**< Allocating site */
+	size_t size;					/**< Block size */
+	double weight;					/**< Inverse of sampling probability */
+	time_t born;					/**< Allocation time */
+};
+
+static inline void
+memprof_sample_check(const struct memprof_sample * const s)
+{
+	g_assert(s != NULL);
+	g_assert(MEMPROF_SAMPLE_MAGIC == s->magic);
+}
+
+size_t memprof_sampling_rate;		/**< Mean sampling interval, 0 = off */
+size_t memprof_live_samples;		/**< Amount of live samples */
+
+static ssize_t memprof_countdown[THREAD_MAX];	/**< Bytes before sampling */
+static uint8 memprof_filter[MEMPROF_FILTER_SIZE];	/**< Counting filter */
+static hash_table_t *memprof_sites;		/**< stackatom -> memprof_site */
+static hash_table_t *memprof_samples;	/**< block -> memprof_sample */
+static time_t memprof_since;			/**< When profiling was enabled */
+static unsigned memprof_recursion;		/**< Recursion detection */
+static mutex_t memprof_lock = MUTEX_INIT;
+
+#define MEMPROF_LOCK	mutex_lock(&memprof_lock)
+#define MEMPROF_UNLOCK	mutex_unlock(&memprof_lock)
+
+/**
+ * Draw the amount of bytes to allocate before taking the next sample.
+ */
+static ssize_t
+memprof_interval(void)
+{
+	double u = 1.0 - rand31_double();	/* In ]0, 1] */
+	double v = -log(u) * memprof_sampling_rate;
+
+	return v >= (double) MAX_INT_VAL(ssize_t) ? MAX_INT_VAL(ssize_t) :
+		(ssize_t) v + 1;
+}
+
+/**
+ * Record block in the counting filter.
+ */
+static inline void
+memprof_filter_add(const void *p)
+{
+	uint8 *c = &memprof_filter[MEMPROF_FILTER_IDX(p)];
+
+	if G_LIKELY(*c != MEMPROF_FILTER_MAX)
+		(*c)++;
+}
+
+/**
+ * Remove block from the counting filter.
+ *
+ * Saturated counters are never decremented since we no longer know how
+ * many blocks they account for.
+ */
+static inline void
+memprof_filter_remove(const void *p)
+{
+	uint8 *c = &memprof_filter[MEMPROF_FILTER_IDX(p)];
+
+	g_assert(*c != 0);
+
+	if G_LIKELY(*c != MEMPROF_FILTER_MAX)
+		(*c)--;
+}
+
+/**
+ * Remove sample from the live set, with the lock held.
+ *
+ * @param p		the sampled block
+ * @param s		the sample record
+ * @param freed	whether the block is being freed (updates lifetimes)
+ */
+static void
+memprof_unlink(const void *p, struct memprof_sample *s, bool freed)
+{
+	struct memprof_site *ms = s->site;
+
+	memprof_sample_check(s);
+	memprof_site_check(ms);
+	g_assert(mutex_is_owned(&memprof_lock));
+	g_assert(ms->live != 0);
+
+	hash_table_remove(memprof_samples, p);
+	memprof_filter_remove(p);
+	memprof_live_samples--;
+
+	ms->live--;
+	ms->live_sampled_bytes -= s->size;
+
+	if (0 == ms->live) {
+		ms->live_allocs = ms->live_bytes = 0.0;	/* Discard rounding errors */
+	} else {
+		ms->live_allocs -= s->weight;
+		ms->live_bytes -= s->weight * s->size;
+	}
+
+	if (freed) {
+		time_delta_t d = delta_time(tm_time(), s->born);
+		uint i;
+
+		for (i = 0; i < G_N_ELEMENTS(memprof_lifetime_limit); i++) {
+			if (d < memprof_lifetime_limit[i])
+				break;
+		}
+		ms->lifetime[i]++;
+	}
+
+	s->magic = 0;
+	xfree(s);
+}
+
+/**
+ * Record new sample, with the lock held.
+ */
+static void NO_INLINE
+memprof_record(const void *p, size_t size, enum memprof_allocator which)
+{
+	struct stacktrace t;
+	const struct stackatom *ast;
+	struct memprof_site *ms;
+	struct memprof_sample *s;
+
+	g_assert(mutex_is_owned(&memprof_lock));
+
+	stacktrace_get_offset(&t, 2);	/* Remove ourselves and our caller */
+	ast = stacktrace_get_atom(&t);	/* Never freed, always same address */
+
+	ms = hash_table_lookup(memprof_sites, ast);
+	if G_UNLIKELY(NULL == ms) {
+		XMALLOC0(ms);
+		ms->magic = MEMPROF_SITE_MAGIC;
+		ms->stack = ast;
+		ms->which = which;
+		ms->min_size = ms->max_size = size;
+		hash_table_insert(memprof_sites, ast, ms);
+	}
+
+	memprof_site_check(ms);
+
+	/*
+	 * A block that we still see as live was freed without us noticing,
+	 * probably through an allocator we do not hook: forget about it.
+	 */
+
+	s = hash_table_lookup(memprof_samples, p);
+	if G_UNLIKELY(s != NULL)
+		memprof_unlink(p, s, FALSE);
+
+	XMALLOC(s);
+	s->magic = MEMPROF_SAMPLE_MAGIC;
+	s->site = ms;
+	s->size = size;
+	s->weight = 1.0 / (1.0 - exp(-(double) size / memprof_sampling_rate));
+	s->born = tm_time();
+
+	hash_table_insert(memprof_samples, p, s);
+	memprof_filter_add(p);
+	memprof_live_samples++;
+
+	ms->min_size = MIN(ms->min_size, size);
+	ms->max_size = MAX(ms->max_size, size);
+	ms->samples++;
+	ms->sampled_bytes += size;
+	ms->live++;
+	ms->live_sampled_bytes += size;
+	ms->allocs += s->weight;
+	ms->bytes += s->weight * size;
+	ms->live_allocs += s->weight;
+	ms->live_bytes += s->weight * size;
+}
+
+/**
+ * Charge ``size'' allocated bytes to the running thread.
+ *
+ * @return whether the thread has allocated enough to take a sample.
+ */
+static inline bool
+memprof_countdown_expired(size_t size)
+{
+	ssize_t *cd = &memprof_countdown[thread_small_id()];
+
+	if G_UNLIKELY(0 == *cd)
+		*cd = memprof_sampling_rate;
+
+	*cd -= size;
+
+	return *cd <= 0;
+}
+
+/**
+ * Account for the allocation of ``size'' bytes at ``p'', sampling it when
+ * the thread has allocated enough since the last sample.
+ *
+ * This is only called when profiling is enabled, via memprof_malloc().
+ */
+void
+memprof_sample(const void *p, size_t size, enum memprof_allocator which)
+{
+	if G_LIKELY(!memprof_countdown_expired(size))
+		return;
+
+	MEMPROF_LOCK;
+
+	/*
+	 * Recording the sample allocates memory, which can bring us back here.
+	 * The recursion counter is only changed with the lock held, and the
+	 * lock being re-entrant, we can safely detect recursions.
+	 */
+
+	if G_LIKELY(0 == memprof_recursion && memprof_sampling_rate != 0) {
+		memprof_recursion++;
+		memprof_countdown[thread_small_id()] = memprof_interval();
+		memprof_record(p, size, which);
+		memprof_recursion--;
+	}
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * Account for the freeing of block ``p''.
+ *
+ * This is only called when there are live samples, via memprof_free().
+ */
+void
+memprof_forget(const void *p)
+{
+	struct memprof_sample *s;
+
+	if G_LIKELY(0 == memprof_filter[MEMPROF_FILTER_IDX(p)])
+		return;
+
+	MEMPROF_LOCK;
+
+	if G_LIKELY(0 == memprof_recursion && memprof_samples != NULL) {
+		memprof_recursion++;
+		s = hash_table_lookup(memprof_samples, p);
+		if (s != NULL)
+			memprof_unlink(p, s, TRUE);
+		memprof_recursion--;
+	}
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * Account for block ``old'' having been moved to ``p''.
+ *
+ * This is only called when there are live samples, via memprof_move().
+ */
+void
+memprof_relocate(const void *old, const void *p)
+{
+	struct memprof_sample *s;
+
+	if (old == p || 0 == memprof_filter[MEMPROF_FILTER_IDX(old)])
+		return;
+
+	MEMPROF_LOCK;
+
+	if G_LIKELY(0 == memprof_recursion && memprof_samples != NULL) {
+		memprof_recursion++;
+		s = hash_table_lookup(memprof_samples, old);
+		if (s != NULL) {
+			hash_table_remove(memprof_samples, old);
+			memprof_filter_remove(old);
+			hash_table_insert(memprof_samples, p, s);
+			memprof_filter_add(p);
+		}
+		memprof_recursion--;
+	}
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * Account for block ``old'' of ``old_size'' bytes having been resized to
+ * ``size'' bytes, now at ``p''.
+ *
+ * A sampled block keeps its sample, which is updated to reflect the new
+ * size.  Otherwise, only the growth is charged as new allocation, and the
+ * block is sampled with its new size if that brings the thread past its
+ * sampling interval.
+ *
+ * This is only called when profiling is active, via memprof_realloc().
+ */
+void
+memprof_resize(const void *old, const void *p,
+	size_t old_size, size_t size, enum memprof_allocator which)
+{
+	struct memprof_sample *s;
+	bool sampled = FALSE;
+
+	if G_UNLIKELY(0 != memprof_filter[MEMPROF_FILTER_IDX(old)]) {
+		MEMPROF_LOCK;
+
+		if G_LIKELY(0 == memprof_recursion && memprof_samples != NULL) {
+			memprof_recursion++;
+			s = hash_table_lookup(memprof_samples, old);
+			if (s != NULL) {
+				struct memprof_site *ms = s->site;
+				double delta = (double) size - (double) s->size;
+
+				memprof_sample_check(s);
+				memprof_site_check(ms);
+
+				if (old != p) {
+					hash_table_remove(memprof_samples, old);
+					memprof_filter_remove(old);
+					hash_table_insert(memprof_samples, p, s);
+					memprof_filter_add(p);
+				}
+
+				if (size > s->size) {
+					ms->sampled_bytes += size - s->size;
+					ms->bytes += s->weight * delta;
+				}
+				ms->live_sampled_bytes += size;
+				ms->live_sampled_bytes -= s->size;
+				ms->live_bytes += s->weight * delta;
+				ms->min_size = MIN(ms->min_size, size);
+				ms->max_size = MAX(ms->max_size, size);
+				s->size = size;
+				sampled = TRUE;
+			}
+			memprof_recursion--;
+		}
+
+		MEMPROF_UNLOCK;
+	}
+
+	if (
+		sampled || 0 == memprof_sampling_rate || size <= old_size ||
+		!memprof_countdown_expired(size - old_size)
+	)
+		return;
+
+	MEMPROF_LOCK;
+
+	if G_LIKELY(0 == memprof_recursion && memprof_sampling_rate != 0) {
+		memprof_recursion++;
+		memprof_countdown[thread_small_id()] = memprof_interval();
+		memprof_record(p, size, which);
+		memprof_recursion--;
+	}
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * Set the allocation sampling rate, the mean amount of bytes allocated
+ * between two samples.
+ *
+ * A rate of 0 stops sampling, but still tracks the freeing of the live
+ * samples, so that the collected statistics remain accurate.
+ */
+void
+memprof_set_rate(size_t rate)
+{
+	/*
+	 * Make sure the random number generator is seeded before we need it
+	 * from within memory allocation routines.
+	 */
+
+	if (rate != 0)
+		(void) rand31_double();
+
+	MEMPROF_LOCK;
+
+	if (rate != 0 && NULL == memprof_sites) {
+		memprof_recursion++;
+		memprof_sites = hash_table_new();
+		memprof_samples = hash_table_new();
+		memprof_recursion--;
+	}
+
+	if (rate != 0 && 0 == memprof_sampling_rate)
+		memprof_since = tm_time();
+
+	memprof_sampling_rate = rate;
+	ZERO(&memprof_countdown);		/* Draw new intervals with new rate */
+
+	MEMPROF_UNLOCK;
+}
+
+/**
+ * @return current sampling rate, 0 meaning profiling is disabled.
+ */
+size_t
+memprof_get_rate(void)
+{
+	return memprof_sampling_rate;
+}
+
+static bool
+memprof_free_sample(const void *unused_key, void *value, void *unused_data)
+{
+	struct memprof_sample *s = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	memprof_sample_check(s);
+	s->magic = 0;
+	xfree(s);
+
+	return TRUE;
+}
+
+static bool
+memprof_free_site(const void *unused_key, void *value, void *unused_data)
+{
+	struct memprof_site *ms = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	memprof_site_check(ms);
+	ms->magic = 0;
+	xfree(ms);
+
+	return TRUE;
+}
+
+/**
+ * Discard all the collected statistics.
+ *
+ * Sampling continues if it was enabled, the profile restarting from now.
+ */
+void
+memprof_reset(void)
+{
+	MEMPROF_LOCK;
+
+	if (memprof_sites != NULL) {
+		memprof_recursion++;
+		hash_table_foreach_remove(memprof_samples, memprof_free_sample, NULL);
+		hash_table_foreach_remove(memprof_sites, memprof_free_site, NULL);
+		memprof_recursion--;
+	}
+
+	ZERO(&memprof_filter);
+	memprof_live_samples = 0;
+	memprof_since = tm_time();
+
+	MEMPROF_UNLOCK;
+}
+
+struct memprof_snapshot {
+	struct memprof_site *sites;		/**< Copy of sites */
+	size_t count;					/**< Amount of sites copied */
+	size_t rate;					/**< Sampling rate */
+	time_t since;					/**< When profiling started */
+};
+
+static void
+memprof_snapshot_item(const void *unused_key, void *value, void *data)
+{
+	struct memprof_snapshot *ss = data;
+	const struct memprof_site *ms = value;
+
+	(void) unused_key;
+	memprof_site_check(ms);
+
+	ss->sites[ss->count++] = *ms;
+}
+
+static int
+memprof_site_cmp(const void *a, const void *b)
+{
+	const struct memprof_site *ma = a, *mb = b;
+
+	/* Decreasing live bytes, then decreasing allocated bytes */
+
+	if (ma->live_bytes != mb->live_bytes)
+		return ma->live_bytes > mb->live_bytes ? -1 : +1;
+
+	return ma->bytes > mb->bytes ? -1 : ma->bytes < mb->bytes ? +1 : 0;
+}
+
+/**
+ * Take a consistent snapshot of the current profile, so that we can
+ * report on it without holding the lock.
+ *
+ * The sites in the snapshot are sorted by decreasing amount of live bytes
+ * and must be freed by the caller via xfree().
+ */
+static void
+memprof_snapshot(struct memprof_snapshot *ss)
+{
+	ZERO(ss);
+
+	MEMPROF_LOCK;
+	memprof_recursion++;
+
+	if (memprof_sites != NULL) {
+		size_t n = hash_table_size(memprof_sites);
+
+		if (n != 0) {
+			XMALLOC_ARRAY(ss->sites, n);
+			hash_table_foreach(memprof_sites, memprof_snapshot_item, ss);
+			g_assert(ss->count == n);
+		}
+	}
+
+	ss->rate = memprof_sampling_rate;
+	ss->since = memprof_since;
+
+	memprof_recursion--;
+	MEMPROF_UNLOCK;
+
+	if (ss->count != 0)
+		vsort(ss->sites, ss->count, sizeof ss->sites[0], memprof_site_cmp);
+}
+
+static const char *
+memprof_u64(uint64 v, unsigned opt, char *buf, size_t len)
+{
+	if (opt & DUMP_OPT_PRETTY)
+		uint64_to_gstring_buf(v, buf, len);
+	else
+		uint64_to_string_buf(v, buf, len);
+
+	return buf;
+}
+
+/**
+ * Log the profile to specified log agent, sites being sorted by decreasing
+ * amount of estimated live bytes.
+ *
+ * @param la		the log agent
+ * @param options	dumping options (DUMP_OPT_PRETTY is honored)
+ */
+void
+memprof_dump_log(logagent_t *la, unsigned options)
+{
+	struct memprof_snapshot ss;
+	time_delta_t elapsed;
+	size_t i, n;
+
+	memprof_snapshot(&ss);
+
+	if (0 == ss.since) {
+		log_info(la, "Allocation profiling was never enabled");
+		return;
+	}
+
+	elapsed = MAX(1, delta_time(tm_time(), ss.since));
+	n = MIN(ss.count, MEMPROF_DUMP_MAX);
+
+	if (0 == ss.rate) {
+		log_info(la, "Allocation profiling is OFF (profile spans %s)",
+			compact_time(elapsed));
+	} else {
+		log_info(la, "Allocation profiling every %zu bytes for %s",
+			ss.rate, compact_time(elapsed));
+	}
+
+	log_info(la, "Showing %zu of %zu call site%s by decreasing live size:",
+		n, ss.count, plural(ss.count));
+
+	for (i = 0; i < n; i++) {
+		const struct memprof_site *ms = &ss.sites[i];
+		char live[UINT64_DEC_GRP_BUFLEN], total[UINT64_DEC_GRP_BUFLEN];
+		char rate[UINT64_DEC_GRP_BUFLEN];
+		char lt[MEMPROF_LIFETIMES][UINT64_DEC_GRP_BUFLEN];
+		uint j;
+
+		for (j = 0; j < MEMPROF_LIFETIMES; j++)
+			memprof_u64(ms->lifetime[j], options, lt[j], sizeof lt[j]);
+
+		log_info(la, "#%zu %s() of %zu to %zu bytes: "
+			"live=%s (%s blocks), total=%s (%s blocks), rate=%s B/s",
+			i + 1, memprof_allocator_name[ms->which],
+			ms->min_size, ms->max_size,
+			compact_size(MAX(0.0, ms->live_bytes), FALSE),
+			memprof_u64(MAX(0.0, ms->live_allocs), options,
+				live, sizeof live),
+			compact_size2(ms->bytes, FALSE),
+			memprof_u64(ms->allocs, options, total, sizeof total),
+			memprof_u64(ms->bytes / elapsed, options, rate, sizeof rate));
+		log_info(la, "    sampled: %zu live of %s, freed after "
+			"%s=%s %s=%s %s=%s %s=%s %s=%s %s=%s",
+			ms->live, uint64_to_string(ms->samples),
+			memprof_lifetime_name[0], lt[0],
+			memprof_lifetime_name[1], lt[1],
+			memprof_lifetime_name[2], lt[2],
+			memprof_lifetime_name[3], lt[3],
+			memprof_lifetime_name[4], lt[4],
+			memprof_lifetime_name[5], lt[5]);
+		stacktrace_atom_log(la, ms->stack);
+	}
+
+	XFREE_NULL(ss.sites);
+}
+
+/**
+ * Copy the memory mappings of the process to the profile, so that pprof
+ * can symbolize addresses lying in shared libraries.
+ */
+static void
+memprof_export_maps(FILE *f)
+{
+	FILE *maps;
+	char buf[1024];
+	size_t n;
+
+	fputs("\nMAPPED_LIBRARIES:\n", f);
+
+	maps = fopen("/proc/self/maps", "r");
+	if (NULL == maps)
+		return;
+
+	while (0 != (n = fread(buf, 1, sizeof buf, maps)))
+		fwrite(buf, 1, n, f);
+
+	fclose(maps);
+}
+
+/**
+ * Export the profile to specified file, in the legacy pprof heap profile
+ * text format, so that it can be analyzed with "pprof PROGRAM FILE".
+ *
+ * The file records the raw samples for each call site and the sampling
+ * rate, pprof being in charge of scaling them back.
+ *
+ * @param path		the file where the profile is written
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+memprof_export(const char *path)
+{
+	struct memprof_snapshot ss;
+	uint64 live = 0, live_bytes = 0, allocs = 0, bytes = 0;
+	FILE *f;
+	size_t i;
+	int error = 0;
+
+	g_assert(path != NULL);
+
+	f = file_fopen(path, "w");
+	if (NULL == f)
+		return -1;
+
+	memprof_snapshot(&ss);
+
+	for (i = 0; i < ss.count; i++) {
+		const struct memprof_site *ms = &ss.sites[i];
+
+		live += ms->live;
+		live_bytes += ms->live_sampled_bytes;
+		allocs += ms->samples;
+		bytes += ms->sampled_bytes;
+	}
+
+	{
+		char lb[UINT64_DEC_BUFLEN], b[UINT64_DEC_BUFLEN];
+
+		uint64_to_string_buf(live_bytes, lb, sizeof lb);
+		uint64_to_string_buf(bytes, b, sizeof b);
+
+		fprintf(f, "heap profile: %s: %s [%s: %s] @ heap_v2/%zu\n",
+			uint64_to_string(live), lb, uint64_to_string2(allocs), b,
+			MAX(ss.rate, 1));
+	}
+
+	for (i = 0; i < ss.count; i++) {
+		const struct memprof_site *ms = &ss.sites[i];
+		size_t j;
+
+		fprintf(f, "%zu: %zu [%s: %s] @",
+			ms->live, ms->live_sampled_bytes,
+			uint64_to_string(ms->samples),
+			uint64_to_string2(ms->sampled_bytes));
+
+		for (j = 0; j < ms->stack->len; j++)
+			fprintf(f, " 0x%lx", pointer_to_ulong(ms->stack->stack[j]));
+
+		fputc('\n', f);
+	}
+
+	memprof_export_maps(f);
+	XFREE_NULL(ss.sites);
+
+	if (ferror(f))
+		error = errno;
+	if (0 != fclose(f) && 0 == error)
+		error = errno;
+
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
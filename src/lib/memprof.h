@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sampled memory allocation profiling.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _memprof_h_
+#define _memprof_h_
+
+#define MEMPROF_RATE_DEFAULT	(512 * 1024)	/**< Mean bytes between samples */
+
+/**
+ * Allocators feeding the profiler.
+ */
+enum memprof_allocator {
+	MEMPROF_XMALLOC = 0,		/**< xmalloc() and friends */
+	MEMPROF_TMALLOC,			/**< walloc() served by thread magazines */
+	MEMPROF_ZALLOC,				/**< walloc() served by zones directly */
+
+	MEMPROF_ALLOCATOR_MAX
+};
+
+/*
+ * Hidden variables, only exported for the inlined fast paths below.
+ */
+
+extern size_t memprof_sampling_rate;
+extern size_t memprof_live_samples;
+
+void memprof_sample(const void *p, size_t size, enum memprof_allocator which);
+void memprof_forget(const void *p);
+void memprof_relocate(const void *old, const void *p);
+void memprof_resize(const void *old, const void *p,
+	size_t old_size, size_t size, enum memprof_allocator which);
+
+/**
+ * @return whether allocations need to be reported to the profiler.
+ */
+static inline bool
+memprof_is_active(void)
+{
+	return memprof_sampling_rate != 0 || memprof_live_samples != 0;
+}
+
+/**
+ * Record allocation of ``size'' bytes at ``p'' when profiling is enabled.
+ */
+static inline void
+memprof_malloc(const void *p, size_t size, enum memprof_allocator which)
+{
+	if G_UNLIKELY(memprof_sampling_rate != 0)
+		memprof_sample(p, size, which);
+}
+
+/**
+ * Record freeing of block ``p'' when we still have live samples.
+ */
+static inline void
+memprof_free(const void *p)
+{
+	if G_UNLIKELY(memprof_live_samples != 0)
+		memprof_forget(p);
+}
+
+/**
+ * Record that block ``old'' was moved to ``p'' when we have live samples.
+ */
+static inline void
+memprof_move(const void *old, const void *p)
+{
+	if G_UNLIKELY(memprof_live_samples != 0)
+		memprof_relocate(old, p);
+}
+
+/**
+ * Record that block ``old'' of ``old_size'' bytes was resized to ``size''
+ * bytes and now lives at ``p'', when profiling is active.
+ */
+static inline void
+memprof_realloc(const void *old, const void *p,
+	size_t old_size, size_t size, enum memprof_allocator which)
+{
+	if G_UNLIKELY(memprof_is_active())
+		memprof_resize(old, p, old_size, size, which);
+}
+
+/*
+ * Public interface.
+ */
+
+struct logagent;
+
+void memprof_set_rate(size_t rate);
+size_t memprof_get_rate(void);
+void memprof_reset(void);
+void memprof_dump_log(struct logagent *la, unsigned options);
+int memprof_export(const char *path);
+
+#endif /* _memprof_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
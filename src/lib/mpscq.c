@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock-free multiple-producer / single-consumer embedded queue.
+ *
+ * Producers never block: appending an item is a single atomic exchange
+ * on the head of the queue, followed by the linking of the previous head
+ * to the new item.  Only one thread at a time may remove items, which is
+ * the case for thread event queues, or can be enforced by an external lock
+ * serializing readers, as done for asynchronous queues.
+ *
+ * The list is a chain of links ending at ``head'', the oldest item being
+ * the one after ``tail''.  A stub link is re-inserted by the consumer when
+ * it removes the last item, so that the chain is never empty and producers
+ * never need to touch ``tail''.
+ *
+ * Between the exchange and the linking, a producer leaves the chain
+ * temporarily broken and the consumer cannot see items past that point.
+ * To keep the semantics simple for callers, items are counted once they
+ * are fully linked and the consumer only attempts removal when it knows
+ * there are published items, briefly spinning over the broken link if
+ * needed.  Hence mpscq_shift() returns NULL only when the queue held no
+ * published item.
+ *
+ * The value returned by mpscq_put() lets producers know whether they made
+ * the queue non-empty, which is when the consumer needs to be woken up.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "mpscq.h"
+
+#include "atomic.h"
+#include "eslist.h"
+#include "log.h"
+#include "stringify.h"			/* For plural() */
+#include "unsigned.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define MPSCQ_SPIN		100		/* Loop iterations before yielding */
+
+/**
+ * Read the next pointer of a link, bypassing any compiler caching.
+ */
+static inline slink_t *
+mpscq_next(const slink_t *lk)
+{
+	return *(slink_t * const volatile *) &lk->next;
+}
+
+/**
+ * Initialize a queue.
+ *
+ * @param q			the queue to initialize
+ * @param offset	the offset of the embedded link field within items
+ */
+void
+mpscq_init(mpscq_t *q, size_t offset)
+{
+	g_assert(q != NULL);
+	g_assert(size_is_non_negative(offset));
+
+	q->magic = MPSCQ_MAGIC;
+	q->stub.next = NULL;
+	q->head = &q->stub;
+	q->tail = &q->stub;
+	q->offset = offset;
+	q->count = 0;
+	atomic_mb();
+}
+
+/**
+ * Discard queue, making the queue object invalid.
+ *
+ * This does not free any of the items, the queue should be empty.
+ */
+void
+mpscq_discard(mpscq_t *q)
+{
+	mpscq_check(q);
+
+	if G_UNLIKELY(0 != q->count) {
+		s_carp("%s(): discarding queue still holding %d item%s",
+			G_STRFUNC, q->count, plural(q->count));
+	}
+
+	q->magic = 0;
+}
+
+/**
+ * Append link to the chain.
+ */
+static inline void
+mpscq_link(mpscq_t *q, slink_t *lk)
+{
+	slink_t *prev;
+
+	lk->next = NULL;
+	prev = atomic_ptr_xchg((void **) &q->head, lk);
+	prev->next = lk;			/* Repairs the chain */
+}
+
+/**
+ * Append item to the queue.
+ *
+ * This never blocks and can be called concurrently by any amount of threads.
+ *
+ * @param q		the queue
+ * @param data	the item to append
+ *
+ * @return the amount of published items after the insertion, 1 meaning the
+ * queue was empty.
+ */
+size_t
+mpscq_put(mpscq_t *q, void *data)
+{
+	mpscq_check(q);
+	g_assert(data != NULL);
+
+	mpscq_link(q, ptr_add_offset(data, q->offset));
+
+	/*
+	 * The atomic increment is a full memory barrier, so the linking is
+	 * visible before the item is published.
+	 */
+
+	return atomic_int_inc(&q->count) + 1;
+}
+
+/**
+ * Attempt to remove the oldest link from the chain.
+ *
+ * @return the link, NULL if none is available or if a producer is in the
+ * middle of an insertion and the chain is broken.
+ */
+static slink_t *
+mpscq_pop(mpscq_t *q)
+{
+	slink_t *tail = q->tail, *next = mpscq_next(tail);
+
+	if (&q->stub == tail) {
+		if (NULL == next)
+			return NULL;
+		q->tail = tail = next;
+		next = mpscq_next(next);
+	}
+
+	if (next != NULL) {
+		q->tail = next;
+		return tail;
+	}
+
+	/*
+	 * The tail is the last link we can see.  If it is not the head, then
+	 * a producer has swapped the head but not linked yet.
+	 */
+
+	atomic_mb();
+	if (tail != q->head)
+		return NULL;
+
+	/*
+	 * Re-insert the stub so that we can remove the last item whilst
+	 * leaving a valid chain behind.
+	 */
+
+	mpscq_link(q, &q->stub);
+	next = mpscq_next(tail);
+
+	if (next != NULL) {
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+/**
+ * Remove the oldest published item, which must exist.
+ */
+static void *
+mpscq_pop_published(mpscq_t *q)
+{
+	slink_t *lk;
+	int i = 0;
+
+	while (NULL == (lk = mpscq_pop(q))) {
+		/*
+		 * A producer is between its exchange and its linking: this is
+		 * a very short window, unless it was preempted.
+		 */
+
+		if G_UNLIKELY(++i >= MPSCQ_SPIN) {
+			do_sched_yield();
+			i = 0;
+		}
+		atomic_mb();
+	}
+
+	atomic_int_dec(&q->count);
+
+	return ptr_add_offset(lk, -q->offset);
+}
+
+/**
+ * Remove the oldest item from the queue.
+ *
+ * Only one thread at a time can call this routine.
+ *
+ * @return the item, NULL if the queue has no published item.
+ */
+void *
+mpscq_shift(mpscq_t *q)
+{
+	mpscq_check(q);
+
+	if (0 == atomic_int_get(&q->count))
+		return NULL;
+
+	return mpscq_pop_published(q);
+}
+
+/**
+ * Move all the published items into the supplied list, in queue order.
+ *
+ * Only one thread at a time can call this routine.  The list must use the
+ * same link offset as the queue.
+ *
+ * @return the amount of items moved.
+ */
+size_t
+mpscq_drain(mpscq_t *q, eslist_t *list)
+{
+	size_t n, i;
+
+	mpscq_check(q);
+	eslist_check(list);
+	g_assert(list->offset == q->offset);
+
+	n = atomic_int_get(&q->count);
+
+	for (i = 0; i < n; i++) {
+		eslist_append(list, mpscq_pop_published(q));
+	}
+
+	return n;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
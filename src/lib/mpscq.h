@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock-free multiple-producer / single-consumer embedded queue.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _mpscq_h_
+#define _mpscq_h_
+
+#include "atomic.h"
+#include "eslist.h"			/* For slink_t */
+
+enum mpscq_magic { MPSCQ_MAGIC = 0x4b1e5d09 };
+
+/**
+ * A multiple-producer / single-consumer queue.
+ *
+ * Like an embedded list, items carry their own slink_t field, at the
+ * offset given when the queue is initialized.
+ *
+ * The fields are private: producers only touch ``head'' and ``count'' and
+ * the consumer owns ``tail''.
+ */
+typedef struct mpscq {
+	enum mpscq_magic magic;
+	slink_t *head;			/* Last enqueued link (producer side) */
+	slink_t *tail;			/* Next link to dequeue (consumer side) */
+	slink_t stub;			/* Sentinel, keeps the chain non-empty */
+	size_t offset;			/* Offset of embedded slink in the item structure */
+	int count;				/* Amount of published items */
+} mpscq_t;
+
+static inline void
+mpscq_check(const mpscq_t * const q)
+{
+	g_assert(q != NULL);
+	g_assert(MPSCQ_MAGIC == q->magic);
+}
+
+/**
+ * @return the amount of items published in the queue.
+ *
+ * This is only indicative when producers are concurrently active.
+ */
+static inline size_t
+mpscq_count(const mpscq_t * const q)
+{
+	mpscq_check(q);
+	return atomic_int_get(&q->count);
+}
+
+/*
+ * Public interface.
+ */
+
+void mpscq_init(mpscq_t *q, size_t offset);
+void mpscq_discard(mpscq_t *q);
+size_t mpscq_put(mpscq_t *q, void *data);
+void *mpscq_shift(mpscq_t *q);
+size_t mpscq_drain(mpscq_t *q, eslist_t *list);
+
+#endif /* _mpscq_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
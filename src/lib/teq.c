@@ -49,6 +49,9 @@
  *
  * Events are processed by the receiving thread in the order they were sent,
  * as soon as the targeted thread is able to process the TSIG_TEQ signal.
+ * Posting never takes a lock: events go to a lock-free multiple-producer
+ * single-consumer queue, which the receiving thread drains in batches, and
+ * the signal is only sent by the producer that made the queue non-empty.
  *
  * TEQs allows work dispatching to "slave threads" and the possibility
  * for the "master thread" to be informed that a processing is finished.
@@ -78,6 +81,7 @@
 #include "evq.h"
 #include "inputevt.h"
 #include "log.h"
+#include "mpscq.h"
 #include "once.h"
 #include "pow2.h"
 #include "spinlock.h"
@@ -187,8 +191,9 @@ struct teq {
 	int throttle_delay;			/**< If throttled, delay in ms */
 	int refcnt;					/**< Reference count */
 	time_t last_handling;		/**< When we last handled the TSIG_TEQ signal */
-	eslist_t queue;				/**< Queue receiving events */
-	spinlock_t lock;			/**< Thread-safe lock protecting the queue */
+	mpscq_t queue;				/**< Lock-free queue receiving events */
+	eslist_t batch;				/**< Events drained, pending processing */
+	spinlock_t lock;			/**< Thread-safe lock for I/O queue and stats */
 	cevent_t *throttle_ev;		/**< Throttle event (no throttling if NULL) */
 };
 
@@ -344,7 +349,10 @@ teq_destroy(struct teq *teq)
 	 * events in its queue, but it is not necessarily critical.
 	 */
 
-	while (NULL != (ev = eslist_shift(&teq->queue))) {
+	mpscq_drain(&teq->queue, &teq->batch);
+	mpscq_discard(&teq->queue);
+
+	while (NULL != (ev = eslist_shift(&teq->batch))) {
 		teq_destroy_event(teq, ev);
 	}
 
@@ -514,6 +522,11 @@ teq_ack(const struct tevent_acked *eva)
 
 /**
  * Add event to the queue, signaling targeted thread.
+ *
+ * Producers do not serialize: the event is appended to the lock-free queue
+ * and only the producer making the queue non-empty needs to signal the
+ * thread.  Any other producer knows that the thread has not yet drained
+ * the queue and will therefore see its event as well.
  */
 static void
 teq_put(struct teq *teq, void *ev)
@@ -521,11 +534,8 @@ teq_put(struct teq *teq, void *ev)
 	teq_check(teq);
 	tevent_check(ev);
 
-	TEQ_LOCK(teq);
-	eslist_append(&teq->queue, ev);
-	TEQ_UNLOCK(teq);
-
-	thread_kill(teq->stid, TSIG_TEQ);
+	if (1 == mpscq_put(&teq->queue, ev))
+		thread_kill(teq->stid, TSIG_TEQ);
 }
 
 /**
@@ -554,6 +564,10 @@ teq_io_enqueue(struct teq *teq, void *ev)
 /**
  * Remove next event from the queue, if any.
  *
+ * Only the thread owning the queue can remove events.  All the events
+ * pending in the lock-free queue are drained at once into a private batch
+ * list, from which they are then handed out one by one.
+ *
  * @return the unqueued event, NULL if no more events are pending.
  */
 static void *
@@ -563,9 +577,10 @@ teq_remove(struct teq *teq)
 
 	teq_check(teq);
 
-	TEQ_LOCK(teq);
-	ev = eslist_shift(&teq->queue);
-	TEQ_UNLOCK(teq);
+	ev = eslist_shift(&teq->batch);
+
+	if (NULL == ev && 0 != mpscq_drain(&teq->queue, &teq->batch))
+		ev = eslist_shift(&teq->batch);
 
 	return ev;
 }
@@ -1228,8 +1243,9 @@ teq_count(unsigned id)
 	if (NULL == teq)
 		return 0;
 
+	count = mpscq_count(&teq->queue) + eslist_count(&teq->batch);
+
 	TEQ_LOCK(teq);
-	count = eslist_count(&teq->queue);
 	if (teq_is_io(teq)) {
 		struct teq_io *teq_io = TEQ_IO(teq);
 		count += eslist_count(&teq_io->ioq);
@@ -1249,7 +1265,8 @@ teq_initialize(struct teq *teq, unsigned id)
 	teq->stid = id;
 	teq->generation = atomic_uint_inc(&teq_generation);
 	teq->refcnt = 1;
-	eslist_init(&teq->queue, offsetof(struct tevent, lk));
+	mpscq_init(&teq->queue, offsetof(struct tevent, lk));
+	eslist_init(&teq->batch, offsetof(struct tevent, lk));
 	spinlock_init(&teq->lock);
 }
 
@@ -1386,8 +1403,9 @@ teq_monitor(void *unused_obj)
 
 			teq_check(teq);
 
+			count = mpscq_count(&teq->queue) + eslist_count(&teq->batch);
+
 			TEQ_LOCK(teq);
-			count = eslist_count(&teq->queue);
 			last = teq->last_handling;
 			throttled = teq->throttle_ev != NULL;
 			TEQ_UNLOCK(teq);
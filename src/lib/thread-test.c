@@ -35,6 +35,8 @@
 #include "aq.h"
 #include "atomic.h"
 #include "barrier.h"
+#include "bg.h"
+#include "chtable.h"
 #include "compat_poll.h"
 #include "compat_sleep_ms.h"
 #include "cond.h"
@@ -46,6 +48,7 @@
 #include "hset.h"
 #include "log.h"
 #include "misc.h"
+#include "mpscq.h"
 #include "mutex.h"
 #include "once.h"
 #include "parse.h"
@@ -63,6 +66,7 @@
 #include "teq.h"
 #include "thread.h"
 #include "tm.h"
+#include "tpool.h"
 #include "tsig.h"
 #include "waiter.h"
 #include "walloc.h"
@@ -88,7 +92,7 @@ static void G_GNUC_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-hejsvwxABCDEFIKMNOPQRSVWX] [-a type] [-b size] [-c CPU]\n"
+		"Usage: %s [-hejsvwxABCDEFGHIKLMNOPQRSUVWX] [-a type] [-b size] [-c CPU]\n"
 		"       [-f count] [-n count] [-r percent] [-t ms] [-T msecs]\n"
 		"       [-z fn1,fn2...]\n"
 		"  -a : allocator to exlusively test via -X (see below for type)\n"
@@ -112,8 +116,11 @@ usage(void)
 		"  -D : test synchronization dams\n"
 		"  -E : test thread signals\n"
 		"  -F : test thread fork\n"
+		"  -G : test work-stealing thread pool\n"
+		"  -H : test background tasks in a threaded scheduler\n"
 		"  -I : test inter-thread waiter signaling\n"
 		"  -K : test thread cancellation\n"
+		"  -L : benchmark lock-free queue against locked lists, TEQ and AQ\n"
 		"  -M : monitors tennis match via waiters\n"
 		"  -N : add broadcast noise during tennis session\n"
 		"  -O : test thread stack overflow\n"
@@ -122,6 +129,7 @@ usage(void)
 		"  -R : test the read-write lock layer\n"
 		"  -S : test semaphore layer\n"
 		"  -T : test condition layer via tennis session for specified msecs\n"
+		"  -U : test concurrent hash table updates across resizes\n"
 		"  -V : test thread event queue (TEQ)\n"
 		"  -W : test local event queue (EVQ)\n"
 		"  -X : exercise concurrent memory allocation\n"
@@ -2176,6 +2184,555 @@ test_evq(unsigned repeat)
 	}
 }
 
+static tpool_t *tpool_test;
+static int tpool_notified;
+
+/*
+ * Naive recursive Fibonacci computation, spawning sub-tasks in the pool
+ * and waiting for them: this exercises work-stealing and helping waiters.
+ */
+static void *
+tpool_fib(void *arg)
+{
+	ulong n = pointer_to_ulong(arg);
+	tpool_future_t *f;
+	ulong a, b;
+
+	if (n < 2)
+		return ulong_to_pointer(n);
+
+	if (n < 12) {
+		a = pointer_to_ulong(tpool_fib(ulong_to_pointer(n - 1)));
+		b = pointer_to_ulong(tpool_fib(ulong_to_pointer(n - 2)));
+		return ulong_to_pointer(a + b);
+	}
+
+	f = tpool_submit(tpool_test, tpool_fib, ulong_to_pointer(n - 1));
+	b = pointer_to_ulong(tpool_fib(ulong_to_pointer(n - 2)));
+	a = pointer_to_ulong(tpool_future_wait(&f));
+	g_assert(NULL == f);
+
+	return ulong_to_pointer(a + b);
+}
+
+static void *
+tpool_square(void *arg)
+{
+	ulong n = pointer_to_ulong(arg);
+
+	return ulong_to_pointer(n * n);
+}
+
+static void
+tpool_square_done(void *result, void *udata)
+{
+	ulong n = pointer_to_ulong(udata);
+
+	g_assert_log(pointer_to_ulong(result) == n * n,
+		"%s(): got %lu for %lu squared", G_STRFUNC,
+		pointer_to_ulong(result), n);
+
+	tpool_notified++;
+}
+
+static bool
+tpool_all_notified(void *arg)
+{
+	return tpool_notified == pointer_to_int(arg);
+}
+
+static void
+test_tpool(unsigned repeat)
+{
+	teq_create_if_none();
+
+	while (repeat--) {
+		tpool_future_t *f;
+		ulong result;
+		tm_t start, end;
+		int i;
+
+		tpool_test = tpool_make("test", cpu_count);
+		emit("%s(): created pool with %u worker%s", G_STRFUNC,
+			tpool_workers(tpool_test), plural(tpool_workers(tpool_test)));
+
+		tm_now_exact(&start);
+		f = tpool_submit(tpool_test, tpool_fib, ulong_to_pointer(30));
+		result = pointer_to_ulong(tpool_future_wait(&f));
+		tm_now_exact(&end);
+		g_assert_log(832040 == result, "%s(): fib(30) = %lu", G_STRFUNC, result);
+		emit("%s(): fib(30) = %lu in %'lu ms", G_STRFUNC, result,
+			(ulong) tm_elapsed_ms(&end, &start));
+
+		tpool_notified = 0;
+
+		for (i = 0; i < 1000; i++) {
+			tpool_submit_notify(tpool_test, tpool_square, ulong_to_pointer(i),
+				tpool_square_done, ulong_to_pointer(i));
+		}
+
+		teq_wait(tpool_all_notified, int_to_pointer(1000));
+		emit("%s(): got %d completion notifications", G_STRFUNC,
+			tpool_notified);
+
+		tpool_free_null(&tpool_test);
+	}
+}
+
+#define CHTABLE_KEYS	20000
+#define CHTABLE_ROUNDS	5
+
+static chtable_t *chtable_test;
+
+/*
+ * Each thread inserts and removes its own set of keys, concurrently with
+ * the others, so that the table keeps growing and shrinking whilst being
+ * updated from all the stripes.
+ */
+static void *
+chtable_updater(void *arg)
+{
+	ulong base = pointer_to_ulong(arg) * CHTABLE_KEYS + 1;
+	int round;
+	ulong i;
+
+	for (round = 0; round < CHTABLE_ROUNDS; round++) {
+		for (i = base; i < base + CHTABLE_KEYS; i++) {
+			chtable_insert(chtable_test, ulong_to_pointer(i),
+				ulong_to_pointer(i + round));
+		}
+
+		for (i = base; i < base + CHTABLE_KEYS; i++) {
+			void *v = chtable_lookup(chtable_test, ulong_to_pointer(i));
+			g_assert_log(pointer_to_ulong(v) == i + round,
+				"%s(): key %lu has value %lu, expected %lu",
+				G_STRFUNC, i, pointer_to_ulong(v), i + round);
+		}
+
+		for (i = base; i < base + CHTABLE_KEYS; i += 2) {
+			g_assert(chtable_remove(chtable_test, ulong_to_pointer(i)));
+		}
+
+		for (i = base; i < base + CHTABLE_KEYS; i++) {
+			bool removed = 0 == (i - base) % 2;
+			bool present = chtable_contains(chtable_test, ulong_to_pointer(i));
+
+			g_assert_log(removed != present,
+				"%s(): key %lu is %s", G_STRFUNC, i,
+				present ? "still present" : "missing");
+		}
+
+		for (i = base + 1; i < base + CHTABLE_KEYS; i += 2) {
+			g_assert(chtable_remove(chtable_test, ulong_to_pointer(i)));
+			g_assert(!chtable_remove(chtable_test, ulong_to_pointer(i)));
+		}
+	}
+
+	return NULL;
+}
+
+static void
+test_chtable(unsigned repeat)
+{
+	long cpus = 0 == cpu_count ? getcpucount() : cpu_count;
+	long n = MAX(cpus, 2);
+
+	while (repeat--) {
+		int t[8];
+		tm_t start, end;
+		long i;
+
+		n = MIN(n, (long) G_N_ELEMENTS(t));
+		chtable_test = chtable_create(HASH_KEY_SELF, 0);
+
+		tm_now_exact(&start);
+
+		for (i = 0; i < n; i++) {
+			t[i] = thread_create(chtable_updater, ulong_to_pointer(i),
+				0, THREAD_STACK_MIN);
+			if (-1 == t[i])
+				s_error("%s(): cannot create thread: %m", G_STRFUNC);
+		}
+
+		for (i = 0; i < n; i++) {
+			thread_join(t[i], NULL);
+		}
+
+		tm_now_exact(&end);
+
+		g_assert_log(0 == chtable_count(chtable_test),
+			"%s(): %lu items left", G_STRFUNC,
+			(ulong) chtable_count(chtable_test));
+
+		emit("%s(): %ld thread%s did %d rounds of %d keys in %'lu ms",
+			G_STRFUNC, n, plural(n), CHTABLE_ROUNDS, CHTABLE_KEYS,
+			(ulong) tm_elapsed_ms(&end, &start));
+
+		chtable_free_null(&chtable_test);
+	}
+}
+
+#define BGTHREAD_TASKS	100
+#define BGTHREAD_COUNT	10000
+
+static int bgthread_done;
+static int bgthread_cancelled;
+
+struct bgthread_ctx {
+	unsigned creator;		/* Thread which created the task */
+	unsigned runner;		/* Thread running the task steps */
+	int count;				/* Amount of items processed */
+};
+
+static bgret_t
+bgthread_step(bgtask_t *h, void *u, int ticks)
+{
+	struct bgthread_ctx *ctx = u;
+	int i;
+
+	(void) h;
+
+	ctx->runner = thread_small_id();
+	g_assert(ctx->runner != ctx->creator);
+
+	for (i = 0; i < ticks && ctx->count < BGTHREAD_COUNT; i++)
+		ctx->count++;
+
+	return ctx->count < BGTHREAD_COUNT ? BGR_MORE : BGR_DONE;
+}
+
+static void
+bgthread_free(void *u)
+{
+	struct bgthread_ctx *ctx = u;
+
+	g_assert(thread_small_id() == ctx->creator);
+	WFREE(ctx);
+}
+
+static void
+bgthread_task_done(bgtask_t *h, void *u, bgstatus_t status, void *arg)
+{
+	struct bgthread_ctx *ctx = u;
+
+	(void) h;
+	(void) arg;
+
+	g_assert_log(thread_small_id() == ctx->creator,
+		"%s(): called in %s, task created by %s", G_STRFUNC,
+		thread_name(), thread_id_name(ctx->creator));
+
+	if (BGS_CANCELLED == status) {
+		bgthread_cancelled++;
+	} else {
+		g_assert_log(BGS_OK == status, "%s(): status is %s",
+			G_STRFUNC, bgstatus_to_string(status));
+		g_assert(BGTHREAD_COUNT == ctx->count);
+	}
+
+	bgthread_done++;
+}
+
+static bool
+bgthread_all_done(void *arg)
+{
+	return bgthread_done == pointer_to_int(arg);
+}
+
+static void
+test_bgthread(unsigned repeat)
+{
+	const bgstep_cb_t step = bgthread_step;
+
+	teq_create_if_none();
+
+	while (repeat--) {
+		bgsched_t *bs;
+		bgtask_t *cancel;
+		int i;
+
+		bs = bg_sched_create_thread("bgtest", 10000);	/* 10 ms */
+		bgthread_done = bgthread_cancelled = 0;
+
+		for (i = 0; i < BGTHREAD_TASKS; i++) {
+			struct bgthread_ctx *ctx;
+
+			WALLOC0(ctx);
+			ctx->creator = thread_small_id();
+			(void) bg_task_create(bs, "bgtest", &step, 1,
+				ctx, bgthread_free, bgthread_task_done, NULL);
+		}
+
+		/*
+		 * Also check that a task can be cancelled from the creating thread
+		 * whilst it is held by the scheduler thread.
+		 */
+
+		{
+			struct bgthread_ctx *ctx;
+
+			WALLOC0(ctx);
+			ctx->creator = thread_small_id();
+			cancel = bg_task_create_stopped(bs, "bgcancel", &step, 1,
+				ctx, bgthread_free, bgthread_task_done, NULL);
+			bg_task_cancel(cancel);
+		}
+
+		teq_wait(bgthread_all_done, int_to_pointer(BGTHREAD_TASKS + 1));
+		emit("%s(): got %d completion notifications, %d cancelled",
+			G_STRFUNC, bgthread_done, bgthread_cancelled);
+		g_assert(1 == bgthread_cancelled);
+
+		bg_sched_destroy_null(&bs);
+	}
+}
+
+#define QBENCH_ITEMS		200000	/* Items sent by each producer */
+#define QBENCH_PRODUCERS	8		/* Max amount of producers */
+
+enum qbench_mode {
+	QBENCH_SPINLOCK = 0,	/* Spinlock-protected list, former TEQ scheme */
+	QBENCH_MUTEX,			/* Mutex-protected list, former AQ scheme */
+	QBENCH_LOCKFREE,		/* Lock-free queue, one item at a time */
+	QBENCH_BATCHED,			/* Lock-free queue, drained in batches */
+
+	QBENCH_MODES
+};
+
+static const char *qbench_names[] = {
+	"spinlock", "mutex", "lock-free", "batched",
+};
+
+struct qbench_item {
+	slink_t lk;
+};
+
+static enum qbench_mode qbench_mode;
+static bool qbench_go;
+static spinlock_t qbench_slk = SPINLOCK_INIT;
+static mutex_t qbench_mtx = MUTEX_INIT;
+static eslist_t qbench_list = ESLIST_INIT(offsetof(struct qbench_item, lk));
+static mpscq_t qbench_q;
+static aqueue_t *qbench_aq;
+static unsigned qbench_consumer;
+static int qbench_received;
+
+static void
+qbench_event(void *unused_arg)
+{
+	(void) unused_arg;
+	qbench_received++;
+}
+
+static bool
+qbench_all_received(void *arg)
+{
+	return qbench_received == pointer_to_int(arg);
+}
+
+static void *
+qbench_producer(void *arg)
+{
+	struct qbench_item *items = arg;
+	size_t i;
+
+	while (!atomic_bool_get(&qbench_go))
+		thread_yield();
+
+	for (i = 0; i < QBENCH_ITEMS; i++) {
+		switch (qbench_mode) {
+		case QBENCH_SPINLOCK:
+			spinlock(&qbench_slk);
+			eslist_append(&qbench_list, &items[i]);
+			spinunlock(&qbench_slk);
+			break;
+		case QBENCH_MUTEX:
+			mutex_lock(&qbench_mtx);
+			eslist_append(&qbench_list, &items[i]);
+			mutex_unlock(&qbench_mtx);
+			break;
+		case QBENCH_LOCKFREE:
+		case QBENCH_BATCHED:
+			mpscq_put(&qbench_q, &items[i]);
+			break;
+		case QBENCH_MODES:
+			g_assert_not_reached();
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Consume ``total'' items from the queue under test.
+ */
+static void
+qbench_consume(int total)
+{
+	eslist_t batch = ESLIST_INIT(offsetof(struct qbench_item, lk));
+	int n = 0;
+
+	while (n < total) {
+		void *p = NULL;
+
+		switch (qbench_mode) {
+		case QBENCH_SPINLOCK:
+			spinlock(&qbench_slk);
+			p = eslist_shift(&qbench_list);
+			spinunlock(&qbench_slk);
+			break;
+		case QBENCH_MUTEX:
+			mutex_lock(&qbench_mtx);
+			p = eslist_shift(&qbench_list);
+			mutex_unlock(&qbench_mtx);
+			break;
+		case QBENCH_LOCKFREE:
+			p = mpscq_shift(&qbench_q);
+			break;
+		case QBENCH_BATCHED:
+			if (0 != mpscq_drain(&qbench_q, &batch)) {
+				n += eslist_count(&batch);
+				eslist_clear(&batch);
+				continue;
+			}
+			break;
+		case QBENCH_MODES:
+			g_assert_not_reached();
+		}
+
+		if (NULL == p)
+			thread_yield();
+		else
+			n++;
+	}
+}
+
+/*
+ * Producers sending completions to the main thread, the way workers do.
+ */
+static void *
+qbench_teq_producer(void *unused_arg)
+{
+	size_t i;
+
+	(void) unused_arg;
+
+	while (!atomic_bool_get(&qbench_go))
+		thread_yield();
+
+	for (i = 0; i < QBENCH_ITEMS; i++) {
+		teq_post(qbench_consumer, qbench_event, NULL);
+	}
+
+	return NULL;
+}
+
+static void *
+qbench_aq_producer(void *unused_arg)
+{
+	size_t i;
+
+	(void) unused_arg;
+
+	while (!atomic_bool_get(&qbench_go))
+		thread_yield();
+
+	for (i = 0; i < QBENCH_ITEMS; i++) {
+		aq_put(qbench_aq, int_to_pointer(1));
+	}
+
+	return NULL;
+}
+
+/**
+ * Launch producers, run consumer and report throughput.
+ */
+static void
+qbench_run(const char *what, int producers, thread_main_t producer,
+	struct qbench_item **items)
+{
+	int t[QBENCH_PRODUCERS];
+	int i, total = producers * QBENCH_ITEMS;
+	tm_t start, end;
+	double secs;
+
+	atomic_bool_set(&qbench_go, FALSE);
+
+	for (i = 0; i < producers; i++) {
+		t[i] = thread_create(producer, NULL == items ? NULL : items[i],
+			0, THREAD_STACK_MIN);
+		g_assert_log(-1 != t[i],
+			"%s(): cannot create thread: %m", G_STRFUNC);
+	}
+
+	tm_now_exact(&start);
+	atomic_bool_set(&qbench_go, TRUE);
+
+	if (qbench_producer == producer) {
+		qbench_consume(total);
+	} else if (qbench_teq_producer == producer) {
+		teq_wait(qbench_all_received, int_to_pointer(total));
+	} else {
+		for (i = 0; i < total; i++) {
+			void *p = aq_remove(qbench_aq);
+			g_assert(p != NULL);
+		}
+	}
+
+	tm_now_exact(&end);
+
+	for (i = 0; i < producers; i++) {
+		thread_join(t[i], NULL);
+	}
+
+	secs = tm_elapsed_f(&end, &start);
+	emit("%-10s %d producer%s: %'d items in %.3f secs, %.3f M items/s",
+		what, producers, plural(producers), total, secs,
+		total / secs / 1e6);
+}
+
+static void
+test_qbench(unsigned repeat)
+{
+	long cpus = 0 == cpu_count ? getcpucount() : cpu_count;
+	int n = MAX(1, MIN(cpus - 1, QBENCH_PRODUCERS));
+	struct qbench_item *items[QBENCH_PRODUCERS];
+	int i;
+
+	teq_create_if_none();
+	qbench_consumer = thread_small_id();
+	mpscq_init(&qbench_q, offsetof(struct qbench_item, lk));
+	qbench_aq = aq_make();
+
+	for (i = 0; i < QBENCH_PRODUCERS; i++) {
+		XMALLOC_ARRAY(items[i], QBENCH_ITEMS);
+	}
+
+	while (repeat--) {
+		int p;
+
+		for (p = 1; p <= n; p = p < n ? MIN(p * 2, n) : n + 1) {
+			enum qbench_mode m;
+
+			for (m = 0; m < QBENCH_MODES; m++) {
+				qbench_mode = m;
+				qbench_run(qbench_names[m], p, qbench_producer, items);
+			}
+
+			qbench_received = 0;
+			qbench_run("teq_post", p, qbench_teq_producer, NULL);
+			qbench_run("aq_put", p, qbench_aq_producer, NULL);
+		}
+	}
+
+	for (i = 0; i < QBENCH_PRODUCERS; i++) {
+		XFREE_NULL(items[i]);
+	}
+
+	aq_destroy_null(&qbench_aq);
+	mpscq_discard(&qbench_q);
+}
+
 static unsigned
 get_number(const char *arg, int opt)
 {
@@ -2203,8 +2760,9 @@ main(int argc, char **argv)
 	bool inter = FALSE, forking = FALSE, aqueue = FALSE, rwlock = FALSE;
 	bool signals = FALSE, barrier = FALSE, overflow = FALSE, memory = FALSE;
 	bool stats = FALSE, teq = FALSE, cancel = FALSE, dam = FALSE, evq = FALSE;
+	bool tpool = FALSE, bgthread = FALSE, qbench = FALSE, chtable = FALSE;
 	unsigned repeat = 1, play_time = 0;
-	const char options[] = "a:b:c:ef:hjn:r:st:vwxz:ABCDEFIKMNOPQRST:VWX";
+	const char options[] = "a:b:c:ef:hjn:r:st:vwxz:ABCDEFGHIKLMNOPQRST:UVWX";
 
 	mingw_early_init();
 	progname = filepath_basename(argv[0]);
@@ -2233,12 +2791,21 @@ main(int argc, char **argv)
 		case 'F':			/* test thread_fork() */
 			forking = TRUE;
 			break;
+		case 'G':			/* test work-stealing thread pool */
+			tpool = TRUE;
+			break;
+		case 'H':			/* test background tasks in threaded scheduler */
+			bgthread = TRUE;
+			break;
 		case 'I':			/* test inter-thread signaling */
 			inter = TRUE;
 			break;
 		case 'K':			/* test thread cancellation */
 			cancel = TRUE;
 			break;
+		case 'L':			/* benchmark lock-free queue */
+			qbench = TRUE;
+			break;
 		case 'M':			/* monitor tennis match */
 			monitor = TRUE;
 			break;
@@ -2264,6 +2831,9 @@ main(int argc, char **argv)
 			play_time = get_number(optarg, c);
 			play_tennis = TRUE;
 			break;
+		case 'U':			/* test concurrent hash table */
+			chtable = TRUE;
+			break;
 		case 'V':			/* test thread event queue */
 			teq = TRUE;
 			break;
@@ -2416,6 +2986,18 @@ main(int argc, char **argv)
 	if (evq)
 		test_evq(repeat);
 
+	if (tpool)
+		test_tpool(repeat);
+
+	if (chtable)
+		test_chtable(repeat);
+
+	if (bgthread)
+		test_bgthread(repeat);
+
+	if (qbench)
+		test_qbench(repeat);
+
 	/*
 	 * Print final statistics.
 	 */
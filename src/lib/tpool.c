@@ -0,0 +1,751 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Work-stealing thread pool.
+ *
+ * A thread pool runs CPU-bound tasks on a fixed set of worker threads, so
+ * that heavy computations can be moved out of the main thread and share
+ * the available CPUs instead of each subsystem creating its own threads.
+ *
+ * Each worker owns a double-ended queue of tasks.  Tasks submitted by a
+ * worker are pushed at the front of its own queue and the worker always
+ * takes its next task from the front, processing the most recently created
+ * (and likely cache-hot) tasks first.  When its queue is empty, a worker
+ * steals the oldest task at the back of the queue of another worker.
+ * Tasks submitted from outside the pool are spread over the workers in a
+ * round-robin fashion.  Idle workers sleep on a condition variable.
+ *
+ * There are two ways to get the result of a task:
+ *
+ * - tpool_submit() returns a future, on which tpool_future_wait() can be
+ *   called to wait for the result.  Whilst waiting, the calling thread helps
+ *   the pool by running pending tasks, which prevents deadlocks when tasks
+ *   wait for other tasks they have spawned.
+ *
+ * - tpool_submit_notify() invokes a completion callback in the thread that
+ *   submitted the task, by posting it to its thread event queue (TEQ).  If
+ *   the submitting thread has no TEQ, the callback is invoked from the main
+ *   callout queue.
+ *
+ * Here is pseudo-code showing a typical usage from the main thread:
+ *
+ *     static void *compress(void *arg) { ... return result; }
+ *     static void compressed(void *result, void *udata) { ... }
+ *
+ *     tpool_submit_notify(tpool_default(), compress, data, compressed, ctx);
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "tpool.h"
+
+#include "atomic.h"
+#include "atoms.h"
+#include "cond.h"
+#include "cq.h"
+#include "elist.h"
+#include "getcpucount.h"
+#include "log.h"
+#include "mutex.h"
+#include "once.h"
+#include "random.h"
+#include "spinlock.h"
+#include "str.h"
+#include "stringify.h"
+#include "teq.h"
+#include "thread.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define TPOOL_STACK		(512 * 1024)	/* Stack size for workers */
+#define TPOOL_DONE		(-2U)			/* Task completed, in ``waiter'' */
+
+enum tpool_task_magic { TPOOL_TASK_MAGIC = 0x3a1c6e05 };
+
+/**
+ * A task, which is also the future returned to the submitter.
+ */
+struct tpool_task {
+	enum tpool_task_magic magic;
+	struct tpool *tp;				/**< Pool running the task */
+	tpool_task_fn_t fn;				/**< Routine to run */
+	void *arg;						/**< Routine argument */
+	void *result;					/**< Result of the routine */
+	tpool_done_fn_t done;			/**< Completion callback, if any */
+	void *udata;					/**< Completion callback argument */
+	unsigned stid;					/**< Thread that submitted the task */
+	unsigned waiter;				/**< Waiting thread, or TPOOL_DONE */
+	bool use_teq;					/**< Notify submitter via its TEQ */
+	link_t lk;						/**< Embedded link in worker queue */
+};
+
+static inline void
+tpool_task_check(const struct tpool_task * const t)
+{
+	g_assert(t != NULL);
+	g_assert(TPOOL_TASK_MAGIC == t->magic);
+}
+
+/**
+ * A worker in the pool.
+ */
+struct tpool_worker {
+	struct tpool *tp;				/**< Pool to which worker belongs */
+	elist_t queue;					/**< Tasks, front is the "hot" side */
+	spinlock_t lock;				/**< Protects the queue */
+	unsigned stid;					/**< Thread running the worker */
+	uint idx;						/**< Index in the pool */
+	size_t stolen;					/**< Amount of tasks stolen by worker */
+};
+
+enum tpool_magic { TPOOL_MAGIC = 0x6e8b1f47 };
+
+/**
+ * A thread pool.
+ */
+struct tpool {
+	enum tpool_magic magic;
+	const char *name;				/**< Pool name (atom) */
+	struct tpool_worker *workers;	/**< Array of workers */
+	uint count;						/**< Amount of workers */
+	uint next;						/**< Next worker for external tasks */
+	int pending;					/**< Tasks queued, not yet started */
+	int idle;						/**< Workers sleeping on ``wakeup'' */
+	bool shutdown;					/**< Set when pool is being destroyed */
+	mutex_t lock;					/**< Lock for ``wakeup'' */
+	cond_t wakeup;					/**< To wake-up idle workers */
+};
+
+static inline void
+tpool_check(const struct tpool * const tp)
+{
+	g_assert(tp != NULL);
+	g_assert(TPOOL_MAGIC == tp->magic);
+}
+
+/**
+ * Maps a thread small ID to the pool worker it runs, if any.
+ */
+static struct tpool_worker *tpool_self[THREAD_MAX];
+
+static tpool_t *tpool_dflt;		/**< Default pool */
+static once_flag_t tpool_dflt_inited;
+
+#define TPOOL_WORKER_LOCK(w)	spinlock_hidden(&(w)->lock)
+#define TPOOL_WORKER_UNLOCK(w)	spinunlock_hidden(&(w)->lock)
+
+/**
+ * @return the pool worker running in the current thread, NULL if none.
+ */
+static inline struct tpool_worker *
+tpool_worker_self(const tpool_t *tp)
+{
+	unsigned stid = thread_small_id();
+	struct tpool_worker *w;
+
+	if G_UNLIKELY(stid >= THREAD_MAX)
+		return NULL;
+
+	w = tpool_self[stid];
+
+	return (w != NULL && w->tp == tp) ? w : NULL;
+}
+
+/**
+ * @return whether current thread is one of the workers of the pool.
+ */
+bool
+tpool_is_worker(const tpool_t *tp)
+{
+	tpool_check(tp);
+
+	return NULL != tpool_worker_self(tp);
+}
+
+/**
+ * @return the amount of workers in the pool.
+ */
+uint
+tpool_workers(const tpool_t *tp)
+{
+	tpool_check(tp);
+
+	return tp->count;
+}
+
+/**
+ * @return the amount of tasks queued and not yet started.
+ */
+size_t
+tpool_pending(const tpool_t *tp)
+{
+	tpool_check(tp);
+
+	return atomic_int_get(&tp->pending);
+}
+
+/**
+ * Take the most recent task from the worker's own queue.
+ *
+ * @return task, NULL if queue was empty.
+ */
+static struct tpool_task *
+tpool_pop(struct tpool_worker *w)
+{
+	struct tpool_task *t;
+
+	TPOOL_WORKER_LOCK(w);
+	t = elist_shift(&w->queue);
+	TPOOL_WORKER_UNLOCK(w);
+
+	return t;
+}
+
+/**
+ * Steal the oldest task from another worker's queue.
+ *
+ * @return task, NULL if queue was empty.
+ */
+static struct tpool_task *
+tpool_steal_from(struct tpool_worker *w)
+{
+	struct tpool_task *t;
+
+	if (0 == elist_count(&w->queue))
+		return NULL;		/* Unlocked peek, avoids contention */
+
+	TPOOL_WORKER_LOCK(w);
+	t = elist_tail(&w->queue);
+	if (t != NULL)
+		elist_remove(&w->queue, t);
+	TPOOL_WORKER_UNLOCK(w);
+
+	return t;
+}
+
+/**
+ * Find a task to run, looking at our own queue first if we are a worker,
+ * then stealing from the other workers, starting at a random one.
+ *
+ * @param tp		the thread pool
+ * @param self		the worker running in current thread, NULL if none
+ *
+ * @return a task, NULL if none was found.
+ */
+static struct tpool_task *
+tpool_next_task(tpool_t *tp, struct tpool_worker *self)
+{
+	struct tpool_task *t = NULL;
+	uint i, start;
+
+	if (self != NULL && NULL != (t = tpool_pop(self)))
+		goto found;
+
+	if (0 == atomic_int_get(&tp->pending))
+		return NULL;
+
+	start = random_value(tp->count - 1);
+
+	for (i = 0; i < tp->count; i++) {
+		struct tpool_worker *w = &tp->workers[(start + i) % tp->count];
+
+		if (w == self)
+			continue;
+
+		if (NULL != (t = tpool_steal_from(w))) {
+			if (self != NULL)
+				self->stolen++;
+			goto found;
+		}
+	}
+
+	return NULL;
+
+found:
+	tpool_task_check(t);
+	atomic_int_dec(&tp->pending);
+	return t;
+}
+
+/**
+ * Deliver completion callback in the thread that submitted the task.
+ */
+static void
+tpool_notify(void *data)
+{
+	struct tpool_task *t = data;
+
+	tpool_task_check(t);
+
+	(*t->done)(t->result, t->udata);
+	t->magic = 0;
+	WFREE(t);
+}
+
+/**
+ * Callout queue trampoline for completion callbacks.
+ */
+static void
+tpool_notify_callout(cqueue_t *unused_cq, void *data)
+{
+	(void) unused_cq;
+
+	tpool_notify(data);
+}
+
+/**
+ * Run task and signal its completion.
+ */
+static void
+tpool_run(struct tpool_task *t)
+{
+	tpool_task_check(t);
+
+	t->result = (*t->fn)(t->arg);
+
+	if (t->done != NULL) {
+		if (t->use_teq)
+			teq_post(t->stid, tpool_notify, t);
+		else
+			cq_main_insert(1, tpool_notify_callout, t);
+	} else {
+		unsigned waiter;
+
+		/*
+		 * Atomically swap the waiting thread with TPOOL_DONE, to know
+		 * whether we need to unblock a thread.  Once the swap is done, the
+		 * future can be freed by the waiting thread so we must not touch it.
+		 */
+
+		do {
+			waiter = atomic_uint_get(&t->waiter);
+		} while (!atomic_uint_xchg_if_eq(&t->waiter, waiter, TPOOL_DONE));
+
+		if (waiter != THREAD_INVALID_ID)
+			thread_unblock(waiter);
+	}
+}
+
+/**
+ * Worker thread main loop.
+ */
+static void *
+tpool_worker_main(void *arg)
+{
+	struct tpool_worker *w = arg;
+	tpool_t *tp = w->tp;
+	str_t *name;
+	unsigned stid = thread_small_id();
+
+	tpool_check(tp);
+
+	name = str_new(0);
+	str_printf(name, "%s pool #%u", tp->name, w->idx);
+	thread_set_name(str_2c(name));
+	str_destroy_null(&name);
+
+	g_assert(stid < THREAD_MAX);
+	tpool_self[stid] = w;
+
+	for (;;) {
+		struct tpool_task *t = tpool_next_task(tp, w);
+
+		if (t != NULL) {
+			tpool_run(t);
+			continue;
+		}
+
+		/*
+		 * Nothing to do, go to sleep.
+		 *
+		 * We flag ourselves as idle before checking for pending tasks again,
+		 * and submitters increase the pending count before checking for idle
+		 * workers: one of the two sides is bound to see the other, so no
+		 * wakeup can be lost.
+		 */
+
+		mutex_lock(&tp->lock);
+		atomic_int_inc(&tp->idle);
+
+		while (
+			0 == atomic_int_get(&tp->pending) &&
+			!atomic_bool_get(&tp->shutdown)
+		) {
+			cond_wait_clean(&tp->wakeup, &tp->lock);
+		}
+
+		atomic_int_dec(&tp->idle);
+		mutex_unlock(&tp->lock);
+
+		if (
+			atomic_bool_get(&tp->shutdown) &&
+			0 == atomic_int_get(&tp->pending)
+		)
+			break;
+	}
+
+	tpool_self[stid] = NULL;
+	return NULL;
+}
+
+/**
+ * Create a new thread pool.
+ *
+ * @param name		pool name, used to name the worker threads
+ * @param workers	amount of workers, 0 meaning one per CPU
+ *
+ * @return a new thread pool.
+ */
+tpool_t *
+tpool_make(const char *name, uint workers)
+{
+	tpool_t *tp;
+	uint i;
+
+	g_assert(name != NULL);
+
+	if (0 == workers)
+		workers = getcpucount();
+
+	workers = MAX(1, workers);
+	workers = MIN(workers, TPOOL_WORKERS_MAX);
+
+	WALLOC0(tp);
+	tp->magic = TPOOL_MAGIC;
+	tp->name = atom_str_get(name);
+	tp->count = workers;
+	mutex_init(&tp->lock);
+	cond_init(&tp->wakeup, &tp->lock);
+	XMALLOC0_ARRAY(tp->workers, workers);
+
+	for (i = 0; i < workers; i++) {
+		struct tpool_worker *w = &tp->workers[i];
+
+		w->tp = tp;
+		w->idx = i;
+		w->stid = THREAD_INVALID_ID;
+		elist_init(&w->queue, offsetof(struct tpool_task, lk));
+		spinlock_init(&w->lock);
+	}
+
+	for (i = 0; i < workers; i++) {
+		struct tpool_worker *w = &tp->workers[i];
+		int r;
+
+		r = thread_create(tpool_worker_main, w, THREAD_F_NO_CANCEL,
+				TPOOL_STACK);
+
+		if (-1 == r) {
+			s_error("%s(): cannot create worker #%u for \"%s\" pool: %m",
+				G_STRFUNC, i, name);
+		}
+
+		/*
+		 * Record thread ID now, so that tpool_free_null() can join the
+		 * thread even if it has not started to run yet.
+		 */
+
+		w->stid = r;
+	}
+
+	return tp;
+}
+
+/**
+ * Create the default pool.
+ */
+static void
+tpool_default_init(void)
+{
+	tpool_dflt = tpool_make("default", 0);
+}
+
+/**
+ * @return the default thread pool, with one worker per CPU.
+ */
+tpool_t *
+tpool_default(void)
+{
+	ONCE_FLAG_RUN(tpool_dflt_inited, tpool_default_init);
+
+	return tpool_dflt;
+}
+
+/**
+ * Enqueue new task in the pool.
+ */
+static void
+tpool_enqueue(tpool_t *tp, struct tpool_task *t)
+{
+	struct tpool_worker *w;
+
+	tpool_check(tp);
+	g_assert_log(!atomic_bool_get(&tp->shutdown),
+		"%s(): \"%s\" pool is being destroyed", G_STRFUNC, tp->name);
+
+	/*
+	 * A worker spawning tasks keeps them for itself, other workers will
+	 * steal them if they have nothing else to do.  External submissions are
+	 * spread evenly among workers.
+	 */
+
+	w = tpool_worker_self(tp);
+
+	if (NULL == w)
+		w = &tp->workers[atomic_uint_inc(&tp->next) % tp->count];
+
+	t->tp = tp;
+
+	/*
+	 * The pending count must be raised before the task becomes visible:
+	 * a worker can pick it up as soon as it is queued and will then
+	 * decrease the count.
+	 */
+
+	atomic_int_inc(&tp->pending);
+
+	TPOOL_WORKER_LOCK(w);
+	elist_prepend(&w->queue, t);
+	TPOOL_WORKER_UNLOCK(w);
+
+	if (0 != atomic_int_get(&tp->idle)) {
+		mutex_lock(&tp->lock);
+		cond_signal(&tp->wakeup, &tp->lock);
+		mutex_unlock(&tp->lock);
+	}
+}
+
+/**
+ * Allocate a new task.
+ */
+static struct tpool_task *
+tpool_task_alloc(tpool_task_fn_t fn, void *arg)
+{
+	struct tpool_task *t;
+
+	g_assert(fn != NULL);
+
+	WALLOC0(t);
+	t->magic = TPOOL_TASK_MAGIC;
+	t->fn = fn;
+	t->arg = arg;
+	t->stid = thread_small_id();
+	t->waiter = THREAD_INVALID_ID;
+
+	return t;
+}
+
+/**
+ * Submit task to the pool.
+ *
+ * The returned future must be given to tpool_future_wait() to collect the
+ * result of the task and release the future.
+ *
+ * @param tp		the thread pool
+ * @param fn		the routine to run
+ * @param arg		routine argument
+ *
+ * @return future for the task.
+ */
+tpool_future_t *
+tpool_submit(tpool_t *tp, tpool_task_fn_t fn, void *arg)
+{
+	struct tpool_task *t = tpool_task_alloc(fn, arg);
+
+	tpool_enqueue(tp, t);
+	return t;
+}
+
+/**
+ * Submit task to the pool, with a completion callback.
+ *
+ * The callback is invoked as done(result, udata) in the context of the
+ * calling thread, via its thread event queue.  If the calling thread does
+ * not have a thread event queue, the callback is invoked from the main
+ * callout queue.
+ *
+ * @param tp		the thread pool
+ * @param fn		the routine to run
+ * @param arg		routine argument
+ * @param done		completion callback
+ * @param udata		additional argument for the completion callback
+ */
+void
+tpool_submit_notify(tpool_t *tp, tpool_task_fn_t fn, void *arg,
+	tpool_done_fn_t done, void *udata)
+{
+	struct tpool_task *t = tpool_task_alloc(fn, arg);
+
+	g_assert(done != NULL);
+
+	t->done = done;
+	t->udata = udata;
+	t->use_teq = teq_is_supported(t->stid);
+
+	tpool_enqueue(tp, t);
+}
+
+/**
+ * @return whether the task associated with the future has completed.
+ */
+bool
+tpool_future_is_done(const tpool_future_t *f)
+{
+	tpool_task_check(f);
+
+	return TPOOL_DONE == atomic_uint_get(&f->waiter);
+}
+
+/**
+ * Wait for the completion of the task and return its result.
+ *
+ * Whilst the task is not completed, the calling thread runs pending tasks
+ * from the pool, blocking only when there is nothing left to run.
+ *
+ * The future is freed and its pointer nullified.
+ *
+ * @param f_ptr		pointer to the future returned by tpool_submit()
+ *
+ * @return the value returned by the task.
+ */
+void *
+tpool_future_wait(tpool_future_t **f_ptr)
+{
+	struct tpool_task *f = *f_ptr;
+	struct tpool_worker *self;
+	tpool_t *tp;
+	void *result;
+	unsigned stid = thread_small_id();
+
+	tpool_task_check(f);
+	g_assert(NULL == f->done);
+
+	/*
+	 * We only help the pool running the task: the tasks we run are then
+	 * the ones ahead of it, or the ones it is waiting for.
+	 */
+
+	tp = f->tp;
+	tpool_check(tp);
+	self = tpool_worker_self(tp);
+
+	while (TPOOL_DONE != atomic_uint_get(&f->waiter)) {
+		struct tpool_task *t;
+		unsigned events;
+
+		t = tpool_next_task(tp, self);
+
+		if (t != NULL) {
+			tpool_run(t);
+			continue;
+		}
+
+		/*
+		 * Nothing to run, block until the task completes.
+		 *
+		 * The thread_block_prepare() call is necessary to prevent a race
+		 * condition with thread_block_self(), since the task can complete
+		 * right after we published our ID.  If publishing fails, the task
+		 * has completed already.
+		 */
+
+		events = thread_block_prepare();
+
+		if (
+			stid == atomic_uint_get(&f->waiter) ||
+			atomic_uint_xchg_if_eq(&f->waiter, THREAD_INVALID_ID, stid)
+		)
+			thread_block_self(events);
+	}
+
+	result = f->result;
+	f->magic = 0;
+	WFREE(f);
+	*f_ptr = NULL;
+
+	return result;
+}
+
+/**
+ * Destroy thread pool, waiting for all the pending tasks to be run and for
+ * the workers to terminate.
+ */
+void
+tpool_free_null(tpool_t **tp_ptr)
+{
+	tpool_t *tp = *tp_ptr;
+	uint i;
+
+	if (NULL == tp)
+		return;
+
+	tpool_check(tp);
+	g_assert_log(!tpool_is_worker(tp),
+		"%s(): cannot be called from a worker of \"%s\" pool",
+		G_STRFUNC, tp->name);
+
+	mutex_lock(&tp->lock);
+	atomic_bool_set(&tp->shutdown, TRUE);
+	cond_broadcast(&tp->wakeup, &tp->lock);
+	mutex_unlock(&tp->lock);
+
+	for (i = 0; i < tp->count; i++) {
+		struct tpool_worker *w = &tp->workers[i];
+
+		if (-1 == thread_join(w->stid, NULL)) {
+			s_warning("%s(): cannot join worker #%u of \"%s\" pool: %m",
+				G_STRFUNC, i, tp->name);
+		}
+		g_assert(0 == elist_count(&w->queue));
+		spinlock_destroy(&w->lock);
+	}
+
+	XFREE_NULL(tp->workers);
+	cond_destroy(&tp->wakeup);
+	mutex_destroy(&tp->lock);
+	atom_str_free_null(&tp->name);
+	tp->magic = 0;
+	WFREE(tp);
+	*tp_ptr = NULL;
+}
+
+/**
+ * Final cleanup, destroying the default pool if it was created.
+ */
+void
+tpool_close(void)
+{
+	if (ONCE_DONE(tpool_dflt_inited))
+		tpool_free_null(&tpool_dflt);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
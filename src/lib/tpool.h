@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Work-stealing thread pool.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _tpool_h_
+#define _tpool_h_
+
+#define TPOOL_WORKERS_MAX	16		/**< Max amount of workers in a pool */
+
+struct tpool;
+typedef struct tpool tpool_t;
+
+struct tpool_task;
+typedef struct tpool_task tpool_future_t;
+
+/**
+ * A task run by the pool, returning its result.
+ */
+typedef void *(*tpool_task_fn_t)(void *arg);
+
+/**
+ * Completion callback, invoked in the thread that submitted the task.
+ */
+typedef void (*tpool_done_fn_t)(void *result, void *udata);
+
+/*
+ * Public interface.
+ */
+
+tpool_t *tpool_make(const char *name, uint workers);
+tpool_t *tpool_default(void);
+void tpool_free_null(tpool_t **tp_ptr);
+uint tpool_workers(const tpool_t *tp);
+size_t tpool_pending(const tpool_t *tp);
+bool tpool_is_worker(const tpool_t *tp);
+
+tpool_future_t *tpool_submit(tpool_t *tp, tpool_task_fn_t fn, void *arg);
+void tpool_submit_notify(tpool_t *tp, tpool_task_fn_t fn, void *arg,
+	tpool_done_fn_t done, void *udata);
+
+bool tpool_future_is_done(const tpool_future_t *f);
+void *tpool_future_wait(tpool_future_t **f_ptr);
+
+void tpool_close(void);
+
+#endif /* _tpool_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -171,6 +171,21 @@
 #define VMM_PROTECT_FREE_PAGES
 #endif
 
+/*
+ * Large regions can be backed by transparent huge pages, to reduce TLB
+ * pressure on large long-lived arenas, when set_vmm_hugepages() is used.
+ * Only the part of the region aligned on VMM_HUGEPAGE_SIZE can be backed
+ * by huge pages.
+ *
+ * When set_vmm_numa_local() is used, the physical pages of the regions put
+ * back into the cache are released, so that re-using them triggers new
+ * page faults: with the default "first touch" policy of the kernel, this
+ * allocates the pages on the NUMA node of the thread using the memory next,
+ * instead of keeping pages that could lie on a remote node.
+ */
+#define VMM_HUGEPAGE_SIZE	(2 * 1024 * 1024)	/**< Usual PMD huge page size */
+#define VMM_NUMA_MINPAGES	16		/**< Min cached region size to release */
+
 static size_t kernel_pagesize = 0;
 static size_t kernel_pagemask = 0;
 static unsigned kernel_pageshift = 0;
@@ -296,6 +311,8 @@ static struct vmm_stats {
 	AU64(cache_splits);				/**< Split cached entries in allocations */
 	AU64(cache_high_coalescing);	/**< Large regions successfully coalesced */
 	AU64(cache_too_large);			/**< Allocation too large for cache */
+	AU64(hugepage_advised);			/**< Regions advised to use huge pages */
+	AU64(numa_released);			/**< Cached regions physically released */
 	uint64 pmap_foreign_discards;	/**< Foreign regions discarded */
 	uint64 pmap_foreign_discarded_pages;	/**< Foreign pages discarded */
 	AU64(pmap_overruled);			/**< Regions overruled by kernel */
@@ -399,6 +416,8 @@ static tmalloc_t *vmm_magazine[VMM_MAGAZINE_PAGEMAX];
 static bool safe_to_log;			/**< True when we can log */
 static bool stop_freeing;			/**< No longer release memory */
 static uint32 vmm_debug;			/**< Debug level */
+static bool vmm_hugepages;			/**< Use huge pages for large regions */
+static bool vmm_numa_local;			/**< Release physical pages when caching */
 static int sp_direction;			/**< Growing direction of the stack */
 static const void *vmm_base;		/**< Where we'll start allocating */
 static const void *stack_base;		/**< Where stack starts (its "bottom") */
@@ -442,6 +461,7 @@ static void pmap_overrule(struct pmap *pm,
 static struct vm_fragment *pmap_lookup(const struct pmap *pm,
 	const void *p, size_t *low_ptr);
 static void vmm_reserve_stack(size_t amount);
+static void vmm_madvise_release(void *p, size_t size);
 static void *page_cache_find_pages(size_t n, bool emergency);
 static void page_cache_free_all(bool locked);
 
@@ -1577,6 +1597,19 @@ vmm_invalidate_pages(void *p, size_t size)
 #ifdef VMM_INVALIDATE_FREE_PAGES
 	vmm_madvise_free(p, size);
 #endif	/* VMM_INVALIDATE_FREE_PAGES */
+
+	/*
+	 * A cached region can be split to serve smaller allocations, for which
+	 * huge pages would only waste memory.
+	 */
+
+	if (vmm_hugepages && size >= VMM_HUGEPAGE_SIZE)
+		vmm_madvise_hugepage(p, size, FALSE);
+
+	if (vmm_numa_local && size >= nsize_fast(VMM_NUMA_MINPAGES)) {
+		vmm_madvise_release(p, size);
+		VMM_STATS_INCX(numa_released);
+	}
 }
 
 /**
@@ -3845,6 +3878,23 @@ page_cache_coalesce_pages(void **base_ptr, size_t *pages_ptr)
 	return FALSE;
 }
 
+/**
+ * Discard the physical pages backing the region, immediately.
+ *
+ * Contrary to vmm_madvise_free(), we do not want MADV_FREE here, since the
+ * kernel would then keep the current physical pages until memory pressure
+ * forces it to reclaim them.
+ */
+static void
+vmm_madvise_release(void *p, size_t size)
+{
+	g_assert(p);
+	g_assert(size_is_positive(size));
+#if defined(HAS_MADVISE) && defined(MADV_DONTNEED)
+	madvise(p, size, MADV_DONTNEED);
+#endif	/* MADV_DONTNEED */
+}
+
 void
 vmm_madvise_normal(void *p, size_t size)
 {
@@ -3887,6 +3937,38 @@ vmm_madvise_willneed(void *p, size_t size)
 #endif	/* MADV_WILLNEED */
 }
 
+/**
+ * Advise the kernel whether it should back the region with huge pages.
+ *
+ * Only the part of the region that is aligned on huge page boundaries is
+ * advised, the kernel being unable to use huge pages elsewhere.
+ *
+ * @param p		the start of the region
+ * @param size	the size of the region
+ * @param on	whether huge pages should be used
+ */
+void
+vmm_madvise_hugepage(void *p, size_t size, bool on)
+{
+	g_assert(p);
+	g_assert(size_is_positive(size));
+#if defined(HAS_MADVISE) && defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	{
+		size_t start, end;
+
+		start = round_size_fast(VMM_HUGEPAGE_SIZE, pointer_to_size(p));
+		end = (pointer_to_size(p) + size) & ~((size_t) VMM_HUGEPAGE_SIZE - 1);
+
+		if (start < end) {
+			madvise(size_to_pointer(start), end - start,
+				on ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+		}
+	}
+#else
+	(void) on;
+#endif	/* MADV_HUGEPAGE */
+}
+
 /**
  * Allocates a page-aligned memory chunk, possibly returning a cached region
  * and only allocating a new region when necessary.
@@ -3973,6 +4055,16 @@ update_stats:
 	}
 	VMM_STATS_UNLOCK;
 
+	/*
+	 * Large regions are usually long-lived arenas (hash tables, routing
+	 * tables, etc...) for which huge pages will limit TLB misses.
+	 */
+
+	if (vmm_hugepages && size >= VMM_HUGEPAGE_SIZE) {
+		vmm_madvise_hugepage(p, size, TRUE);
+		VMM_STATS_INCX(hugepage_advised);
+	}
+
 	return p;
 }
 
@@ -4791,6 +4883,25 @@ set_vmm_debug(uint32 level)
 	vmm_debug = level;
 }
 
+/**
+ * Set whether large regions should be backed by huge pages.
+ */
+void
+set_vmm_hugepages(bool val)
+{
+	vmm_hugepages = val;
+}
+
+/**
+ * Set whether cached regions should lose their physical pages, so that they
+ * are allocated on the NUMA node of the next thread using them.
+ */
+void
+set_vmm_numa_local(bool val)
+{
+	vmm_numa_local = val;
+}
+
 /**
  * Set the VMM allocation strategy.
  *
@@ -4953,6 +5064,8 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP64(cache_splits);
 	DUMP64(cache_high_coalescing);
 	DUMP64(cache_too_large);
+	DUMP64(hugepage_advised);
+	DUMP64(numa_released);
 
 	/*
 	 * Count cached entries -- this is a transient value, so no need to
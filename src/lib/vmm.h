@@ -135,6 +135,8 @@ bool vmm_is_stack_pointer(const void *p, const void *top) G_GNUC_PURE;
 bool vmm_grows_upwards(void) G_GNUC_PURE;
 
 void set_vmm_debug(uint32 level);
+void set_vmm_hugepages(bool val);
+void set_vmm_numa_local(bool val);
 bool vmm_is_debugging(uint32 level) G_GNUC_PURE;
 void vmm_crash_mode(void);
 void vmm_init(void);
@@ -161,6 +163,7 @@ void vmm_madvise_free(void *p, size_t size);
 void vmm_madvise_normal(void *p, size_t size);
 void vmm_madvise_sequential(void *p, size_t size);
 void vmm_madvise_willneed(void *p, size_t size);
+void vmm_madvise_hugepage(void *p, size_t size, bool on);
 
 void *vmm_mmap(void *addr, size_t length,
 	int prot, int flags, int fd, fileoffset_t offset);
@@ -47,6 +47,7 @@
 #include "eslist.h"
 #include "evq.h"			/* For evq_is_inited() */
 #include "log.h"
+#include "memprof.h"
 #include "mutex.h"
 #include "once.h"
 #include "pow2.h"
@@ -371,6 +372,7 @@ G_GNUC_HOT void *
 walloc(size_t size)
 {
 	tmalloc_t *depot;
+	void *p;
 	size_t rounded = zalloc_round(size);
 
 	g_assert(size_is_positive(size));
@@ -382,10 +384,15 @@ walloc(size_t size)
 
 	depot = walloc_get_magazine(rounded);
 
-	if G_UNLIKELY(NULL == depot)
-		return walloc_raw(size);
+	if G_UNLIKELY(NULL == depot) {
+		p = walloc_raw(size);
+		memprof_malloc(p, size, MEMPROF_ZALLOC);
+	} else {
+		p = tmalloc(depot);
+		memprof_malloc(p, size, MEMPROF_TMALLOC);
+	}
 
-	return tmalloc(depot);
+	return p;
 }
 
 /**
@@ -421,6 +428,8 @@ wfree(void *ptr, size_t size)
 		return;
 	}
 
+	memprof_free(ptr);
+
 #ifdef TRACK_ZALLOC
 	wfree_raw(ptr, size);
 #else
@@ -487,6 +496,13 @@ wfree_pslist(pslist_t *pl, size_t size)
 		return;
 	}
 
+	if G_UNLIKELY(memprof_live_samples != 0) {
+		const pslist_t *l;
+
+		for (l = pl; l != NULL; l = l->next)
+			memprof_forget(l);
+	}
+
 #ifdef TRACK_ZALLOC
 	depot = NULL;
 #else
@@ -534,6 +550,13 @@ wfree_eslist(eslist_t *el, size_t size)
 		return;
 	}
 
+	if G_UNLIKELY(memprof_live_samples != 0) {
+		const void *p;
+
+		for (p = eslist_head(el); p != NULL; p = eslist_next_data(el, p))
+			memprof_forget(p);
+	}
+
 #ifdef TRACK_ZALLOC
 	depot = NULL;
 #else
@@ -561,13 +584,17 @@ void *
 wmove(void *ptr, size_t size)
 {
 	zone_t *zone = walloc_get_zone(zalloc_round(size), FALSE);
+	void *np;
 
 	if G_UNLIKELY(walloc_stopped)
 		return ptr;
 
 	g_assert(zone != NULL);
 
-	return zmove(zone, ptr);
+	np = zmove(zone, ptr);
+	memprof_move(ptr, np);
+
+	return np;
 }
 
 /**
@@ -608,8 +635,11 @@ wrealloc(void *old, size_t old_size, size_t new_size)
 	old_zone = walloc_get_zone(old_rounded, FALSE);
 	new_zone = walloc_get_zone(new_rounded, TRUE);
 
-	if (old_zone == new_zone)
-		return zmove(old_zone, old);	/* Move around if interesting */
+	if (old_zone == new_zone) {
+		new = zmove(old_zone, old);		/* Move around if interesting */
+		memprof_move(old, new);
+		return new;
+	}
 
 resize_block:
 
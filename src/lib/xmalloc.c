@@ -70,6 +70,7 @@
 #include "log.h"
 #include "mem.h"			/* For mem_is_valid_ptr() */
 #include "mempcpy.h"
+#include "memprof.h"
 #include "memusage.h"
 #include "misc.h"			/* For short_size() and clamp_strlen() */
 #include "mutex.h"
@@ -4675,7 +4676,10 @@ skip_pool:
 void *
 xmalloc(size_t size)
 {
-	return xallocate(size, TRUE);
+	void *p = xallocate(size, TRUE);
+
+	memprof_malloc(p, size, MEMPROF_XMALLOC);
+	return p;
 }
 
 /**
@@ -4697,8 +4701,13 @@ xhmalloc(size_t size)
 	 * routines being called.
 	 */
 
+	void *p;
+
 	XSTATS_INCX(allocations_heap);
-	return xallocate(size, FALSE);
+	p = xallocate(size, FALSE);
+	memprof_malloc(p, size, MEMPROF_XMALLOC);
+
+	return p;
 }
 
 /**
@@ -4711,7 +4720,8 @@ xmalloc0(size_t size)
 {
 	void *p;
 
-	p = xmalloc(size);
+	p = xallocate(size, TRUE);
+	memprof_malloc(p, size, MEMPROF_XMALLOC);
 	memset(p, 0, size);
 	XSTATS_INCX(allocations_zeroed);
 
@@ -4748,7 +4758,17 @@ xcalloc(size_t nmemb, size_t size)
 char *
 xstrdup(const char *str)
 {
-	return str ? xcopy(str, 1 + strlen(str)) : NULL;
+	size_t len;
+	char *res;
+
+	if G_UNLIKELY(NULL == str)
+		return NULL;
+
+	len = 1 + strlen(str);
+	res = xallocate(len, TRUE);
+	memprof_malloc(res, len, MEMPROF_XMALLOC);
+
+	return memcpy(res, str, len);
 }
 
 /**
@@ -4770,7 +4790,8 @@ xstrndup(const char *str, size_t n)
 		return NULL;
 
 	len = clamp_strlen(str, n);
-	res = xmalloc(len + 1);
+	res = xallocate(len + 1, TRUE);
+	memprof_malloc(res, len + 1, MEMPROF_XMALLOC);
 	p = mempcpy(res, str, len);
 	*p = '\0';
 
@@ -4834,22 +4855,12 @@ xallocated(const void *p)
 }
 
 /**
- * Free memory block allocated via xmalloc() or xrealloc().
+ * Release memory block allocated via xallocate() or xreallocate().
  */
-void
-xfree(void *p)
+static void
+xdeallocate(void *p)
 {
-	struct xheader *xh;
-
-	/*
-	 * Some parts of the libc can call free() with a NULL pointer.
-	 * So we explicitly allow this to be able to replace free() correctly.
-	 */
-
-	if G_UNLIKELY(NULL == p)
-		return;
-
-	xh = ptr_add_offset(p, -XHEADER_SIZE);
+	struct xheader *xh = ptr_add_offset(p, -XHEADER_SIZE);
 
 	/*
 	 * Handle thread-specific blocks early in the process since they do not
@@ -4912,6 +4923,24 @@ xfree(void *p)
 	xmalloc_freelist_add(xh, xh->length, XM_COALESCE_ALL | XM_COALESCE_SMART);
 }
 
+/**
+ * Free memory block allocated via xmalloc() or xrealloc().
+ */
+void
+xfree(void *p)
+{
+	/*
+	 * Some parts of the libc can call free() with a NULL pointer.
+	 * So we explicitly allow this to be able to replace free() correctly.
+	 */
+
+	if G_UNLIKELY(NULL == p)
+		return;
+
+	memprof_free(p);
+	xdeallocate(p);
+}
+
 /**
  * Reallocate a block allocated via xmalloc().
  *
@@ -4938,7 +4967,7 @@ xreallocate(void *p, size_t size)
 		return xallocate(size, TRUE);
 
 	if (0 == size) {
-		xfree(p);
+		xdeallocate(p);
 		return NULL;
 	}
 
@@ -5421,7 +5450,7 @@ relocate:
 		g_assert(size_is_positive(old_size));
 
 		memcpy(np, p, MIN(size, old_size));
-		xfree(p);
+		xdeallocate(p);
 	}
 
 	return np;
@@ -5464,12 +5493,41 @@ realloc_from_thread:
 		XSTATS_INCX(realloc_regular_strategy);
 
 		memcpy(np, p, MIN(size, old_size));
-		xfree(p);
+		xdeallocate(p);
 	}
 
 	return np;
 }
 
+/**
+ * Reallocate a block, reporting the operation to the memory profiler.
+ *
+ * A resized block keeps its profiling sample, if any, instead of being
+ * accounted for as a freeing followed by a new allocation.
+ */
+static inline void *
+xreallocate_profiled(void *p, size_t size)
+{
+	size_t old_size = 0;
+	void *np;
+
+	if G_UNLIKELY(p != NULL && memprof_is_active()) {
+		if (0 == size)
+			memprof_free(p);
+		else
+			old_size = xallocated(p);
+	}
+
+	np = xreallocate(p, size);
+
+	if (NULL == p)
+		memprof_malloc(np, size, MEMPROF_XMALLOC);
+	else if (np != NULL)
+		memprof_realloc(p, np, old_size, size, MEMPROF_XMALLOC);
+
+	return np;
+}
+
 /**
  * Reallocate a block allocated via xmalloc().
  *
@@ -5486,7 +5544,7 @@ realloc_from_thread:
 void *
 xrealloc(void *p, size_t size)
 {
-	return xreallocate(p, size);
+	return xreallocate_profiled(p, size);
 }
 
 /**
@@ -5505,7 +5563,7 @@ xrealloc(void *p, size_t size)
 void *
 xprealloc(void *p, size_t size)
 {
-	return xreallocate(p, size);
+	return xreallocate_profiled(p, size);
 }
 
 /**
@@ -116,6 +116,7 @@
 #include "lib/crc.h"
 #include "lib/dbus_util.h"
 #include "lib/debug.h"
+#include "lib/epoch.h"
 #include "lib/eval.h"
 #include "lib/evq.h"
 #include "lib/exit.h"
@@ -154,6 +155,7 @@
 #include "lib/tigertree.h"
 #include "lib/tm.h"
 #include "lib/tmalloc.h"
+#include "lib/tpool.h"
 #include "lib/utf8.h"
 #include "lib/vendors.h"
 #include "lib/vmm.h"
@@ -731,6 +733,7 @@ gtk_gnutella_exit(int exit_code)
 	thread_set_main(TRUE);				/* Main thread can now block */
 
 	DO(settings_terminate);	/* Entering the final sequence */
+	DO(epoch_shutdown);		/* Reclaim synchronously from now on */
 	DO(cq_halt);			/* No more callbacks, with everything shutdown */
 	DO(search_shutdown);	/* Disable now, since we can get queries above */
 
@@ -790,6 +793,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
+	DO(tpool_close);
 	DO(log_close);		/* Does not disable logging */
 	DO(gentime_close);
 
@@ -32,6 +32,7 @@
 
 #include "common.h"
 
+#include "lib/halloc.h"
 #include "lib/rand31.h"
 #include "lib/str.h"
 #include "lib/stringify.h"	/* For plural() */
@@ -53,12 +54,13 @@ static bool large_keys, large_values, common_head_tail;
 #define WR_VOLATILE	(1 << 1)
 #define WR_EMPTY	(1 << 2)
 #define WR_DELETING	(1 << 3)
+#define WR_BULK		(1 << 4)
 
 static void G_GNUC_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-bdeiikprstvwBDEKSTUV] [-R seed] [-c pages] dbname count\n"
+		"Usage: %s [-bdeiikprstvwBDEKLSTUV] [-R seed] [-c pages] dbname count\n"
 		"  -b : rebuild the database\n"
 		"  -c : set LRU cache size\n"
 		"  -d : perform delete test\n"
@@ -75,6 +77,7 @@ usage(void)
 		"  -D : enable LRU cache write delay\n"
 		"  -E : empty existing database on write test\n"
 		"  -K : use large keys with common head/tail parts\n"
+		"  -L : bulk-load all the items on write test\n"
 		"  -R : seed for repeatable random key sequence\n"
 		"  -S : shrink database before testing\n"
 		"  -T : make database handle thread-safe\n"
@@ -285,6 +288,45 @@ exist_db(const char *name, long count, long cache, int wflags, tm_t *done)
 	sdbm_close(db);
 }
 
+static void
+write_bulk_db(DBM *db, long count)
+{
+	datum_pair *pairs;
+	char *keys, *values;
+	size_t klen = large_keys ? 1024 : NORMAL_KEY_LEN;
+	size_t vlen = large_values ? 1024 : NORMAL_KEY_LEN;
+	long i;
+
+	HALLOC_ARRAY(pairs, count);
+	keys = halloc(count * klen);
+	values = halloc0(count * vlen);
+
+	for (i = 0; i < count; i++) {
+		char buf[1024];
+		datum_pair *p = &pairs[i];
+
+		if (progress && 0 == i % 500)
+			show_progress(i, count);
+
+		fill_key(buf, sizeof buf, i);
+
+		p->key.dptr = &keys[i * klen];
+		p->key.dsize = klen;
+		memcpy(p->key.dptr, buf, klen);
+
+		p->val.dptr = &values[i * vlen];
+		p->val.dsize = vlen;
+		memcpy(p->val.dptr, buf, MIN(vlen, large_keys ? klen : NORMAL_KEY_LEN));
+	}
+
+	if (-1 == sdbm_store_bulk(db, pairs, count, DBM_REPLACE))
+		oops("bulk write error");
+
+	HFREE_NULL(pairs);
+	HFREE_NULL(keys);
+	HFREE_NULL(values);
+}
+
 static void
 write_db(const char *name, long count, long cache, int wflags, tm_t *done)
 {
@@ -294,12 +336,18 @@ write_db(const char *name, long count, long cache, int wflags, tm_t *done)
 	char buf[1024];
 	long cpage = 0 == cache ? 64 : cache;
 
-	printf("Starting %swrite test (%ld item%s), "
+	printf("Starting %s%swrite test (%ld item%s), "
 		"cache=%ld page%s, %s write...\n",
 		(wflags & WR_VOLATILE) ? "volatile " : "",
+		(wflags & WR_BULK) ? "bulk " : "",
 		count, plural(count), cpage, plural(cpage),
 		(wflags & WR_DELAY) ? "delayed" : "immediate");
 
+	if (wflags & WR_BULK) {
+		write_bulk_db(db, count);
+		goto finished;
+	}
+
 	key.dsize = large_keys ? sizeof buf : NORMAL_KEY_LEN;
 	key.dptr = buf;
 
@@ -330,6 +378,7 @@ write_db(const char *name, long count, long cache, int wflags, tm_t *done)
 			oops("write error at item #%ld", i);
 	}
 
+finished:
 	show_done(done);
 
 	sdbm_close(db);
@@ -438,7 +487,7 @@ main(int argc, char **argv)
 	mingw_early_init();
 	progname = argv[0];
 
-	while ((c = getopt(argc, argv, "bBc:dDeEikKprR:sStTUvVw")) != EOF) {
+	while ((c = getopt(argc, argv, "bBc:dDeEikKLprR:sStTUvVw")) != EOF) {
 		switch (c) {
 		case 'B':			/* rebuild before testing */
 			rebuild++;
@@ -471,6 +520,9 @@ main(int argc, char **argv)
 			large_keys++;
 			common_head_tail++;
 			break;
+		case 'L':			/* bulk-load on write test */
+			wflags |= WR_BULK;
+			break;
 		case 'p':			/* show test progress */
 			progress++;
 			break;
@@ -524,6 +576,9 @@ main(int argc, char **argv)
 	if (wflag && (wflags & WR_VOLATILE))
 		printf("Volatile database, write test will not flush all values.\n");
 
+	if (wflag && (wflags & WR_BULK))
+		printf("Write test will bulk-load all the items.\n");
+
 	if (randomize)
 		printf("Using random keys with seed 0x%x.\n", rseed);
 
@@ -30,6 +30,7 @@
 #include "lib/stringify.h"
 #include "lib/thread.h"
 #include "lib/vmm.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/xmalloc.h"
 
@@ -43,6 +44,7 @@ const datum nullitem = {0, 0};
 static bool getdbit(DBM *, long);
 static bool setdbit(DBM *, long);
 static bool getpage(DBM *, long);
+static bool fetch_dirbuf(DBM *, long);
 static datum getnext(DBM *);
 static bool makroom(DBM *, long, size_t);
 static void validpage(DBM *, long);
@@ -1189,6 +1191,244 @@ sdbm_replace(DBM *db, datum key, datum val, bool *existed)
 	sdbm_return(db, r);
 }
 
+/**
+ * Bulk loading: an item to sort.
+ */
+struct bulk_item {
+	uint32 rhash;			/* bit-reversed hash of the key */
+	datum_pair *pair;		/* the pair to insert */
+};
+
+/**
+ * Reverse the bits of the 32 lowest bits of a hash value.
+ *
+ * Since the trie is walked from the lowest hash bit to the highest one,
+ * sorting on reversed hashes groups keys by leaf page, in trie order.
+ */
+static inline uint32
+bulk_rhash(long hash)
+{
+	uint32 h = hash;
+
+	return
+		(uint32) reverse_byte(h & 0xff) << 24 |
+		(uint32) reverse_byte((h >> 8) & 0xff) << 16 |
+		(uint32) reverse_byte((h >> 16) & 0xff) << 8 |
+		(uint32) reverse_byte(h >> 24);
+}
+
+static int
+bulk_item_cmp(const void *a, const void *b)
+{
+	const struct bulk_item *ia = a, *ib = b;
+
+	return CMP(ia->rhash, ib->rhash);
+}
+
+/**
+ * Set all the bits of the forest bitmap, from bit 0 up to ``count'' excluded,
+ * writing each directory block once.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+setdbits(DBM *db, long count)
+{
+	long dbit = 0;
+
+	assert_sdbm_locked(db);
+
+	while (dbit < count) {
+		long dirb = dbit / BYTESIZ / DBM_DBLKSIZ;
+		long end = MIN(count, OFF_DIR((dirb+1)) * BYTESIZ);
+
+		if G_UNLIKELY(!fetch_dirbuf(db, dirb))
+			return FALSE;
+
+		for (/* empty */; dbit < end; dbit++) {
+			long c = dbit / BYTESIZ;
+			db->dirbuf[c % DBM_DBLKSIZ] |= (1 << dbit % BYTESIZ);
+		}
+
+		if G_UNLIKELY(OFF_DIR((dirb+1)) * BYTESIZ > db->maxbno)
+			db->maxbno = OFF_DIR((dirb+1)) * BYTESIZ;
+
+#ifdef LRU
+		db->dirbuf_dirty = TRUE;
+		if (db->is_volatile) {
+			db->dirwdelayed++;
+		} else
+#endif
+		if G_UNLIKELY(!flush_dirbuf(db))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Pre-split an empty database so that it can hold ``total'' bytes of
+ * key/value data without having to split pages during insertions.
+ *
+ * Since the database is empty, the pages created by the split are all empty
+ * and there is nothing to move: we only need to set the bits of the internal
+ * nodes of a complete trie of the proper depth.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+presplit(DBM *db, size_t total)
+{
+	size_t pages;
+	int depth;
+
+	assert_sdbm_locked(db);
+
+	/*
+	 * Only do that on an empty database: the trie must be reduced to its
+	 * root and the first page must not hold any key.
+	 */
+
+	if (getdbit(db, 0))
+		return TRUE;
+
+	if G_UNLIKELY(!fetch_pagbuf(db, 0))
+		return FALSE;
+
+	if (0 != ((unsigned short *) db->pagbuf)[0])
+		return TRUE;
+
+	/*
+	 * Aim at filling pages at 75% on average, to leave room for the
+	 * irregularities of the hash distribution.
+	 */
+
+	pages = total / (DBM_PBLKSIZ * 3 / 4) + 1;
+	if (pages <= 1)
+		return TRUE;
+
+	depth = highest_bit_set(next_pow2(MIN(pages, 1U << 30)));
+	depth = MIN(depth, (int) G_N_ELEMENTS(masks) - 2);
+
+	return setdbits(db, (1L << depth) - 1);
+}
+
+/**
+ * Store a batch of (key, value) pairs in the database.
+ *
+ * This is meant to be used when (re)building a database: when the database
+ * is empty, the directory is pre-sized according to the amount of data
+ * about to be inserted, and the pairs are inserted in hash order so that
+ * pages are filled sequentially, with writes deferred until the end.
+ * This avoids most of the page splits and of the page reloads that would
+ * occur with individual insertions.
+ *
+ * The ``flags'' can be either DBM_INSERT (existing key left untouched) or
+ * DBM_REPLACE (replace entry if key exists).
+ *
+ * @param db		the database
+ * @param pairs		the array of pairs to store (left untouched)
+ * @param count		amount of pairs in the array
+ * @param flags		DBM_INSERT or DBM_REPLACE
+ *
+ * @return -1 on error, the amount of new keys created otherwise.  On error,
+ * some of the pairs may have been stored already.
+ */
+long
+sdbm_store_bulk(DBM *db, datum_pair *pairs, size_t count, int flags)
+{
+	struct bulk_item *items;
+	size_t i, total = 0;
+	long created = 0;
+#ifdef LRU
+	bool wdelay;
+#endif
+
+	sdbm_check(db);
+	g_assert(pairs != NULL || 0 == count);
+
+	if G_UNLIKELY(0 == count)
+		return 0;
+
+	sdbm_synchronize(db);
+
+	SDBM_WARN_ITERATING(db);
+
+	if G_UNLIKELY(db->flags & (DBM_RDONLY | DBM_IOERR_W | DBM_BROKEN)) {
+		errno = (db->flags & DBM_RDONLY) ? EPERM :
+			(db->flags & DBM_BROKEN) ? ESTALE : EIO;
+		created = -1;
+		goto done;
+	}
+
+	/*
+	 * Compute the hash of each key and the total amount of page space
+	 * we are going to need, then sort the pairs by reversed hash.
+	 */
+
+	XMALLOC_ARRAY(items, count);
+
+	for (i = 0; i < count; i++) {
+		datum_pair *p = &pairs[i];
+		size_t need;
+
+		if G_UNLIKELY(
+			bad(p->key) ||
+			!sdbm_storage_needs(p->key.dsize, p->val.dsize, &need)
+		) {
+			errno = EINVAL;
+			created = -1;
+			goto finished;
+		}
+
+		items[i].rhash = bulk_rhash(exhash(p->key));
+		items[i].pair = p;
+		total += need + 2 * sizeof(unsigned short);
+	}
+
+	vsort(items, count, sizeof items[0], bulk_item_cmp);
+
+	if G_UNLIKELY(!presplit(db, total)) {
+		created = -1;
+		goto finished;
+	}
+
+#ifdef LRU
+	wdelay = getwdelay(db);
+	if (!wdelay)
+		setwdelay(db, TRUE);
+#endif
+
+	for (i = 0; i < count; i++) {
+		datum_pair *p = items[i].pair;
+		bool existed = FALSE;
+		int r;
+
+		r = storepair(db, p->key, p->val, flags, &existed);
+
+		if G_UNLIKELY(-1 == r) {
+			created = -1;
+			break;
+		}
+		if (0 == r && !existed)
+			created++;
+	}
+
+#ifdef LRU
+	if (!wdelay) {
+		int saved_errno = errno;
+		setwdelay(db, FALSE);	/* Flushes all dirty pages */
+		errno = saved_errno;
+	}
+#endif
+
+finished:
+	XFREE_NULL(items);
+
+done:
+	sdbm_return(db, created);
+}
+
 /*
  * makroom - make room by splitting the overfull page
  * this routine will attempt to make room for DBM_SPLTMAX times before
@@ -33,6 +33,14 @@ typedef struct {
 
 extern const datum nullitem;
 
+/*
+ * for sdbm_store_bulk
+ */
+typedef struct {
+	datum key;
+	datum val;
+} datum_pair;
+
 /*
  * flags to sdbm_store
  */
@@ -83,6 +91,7 @@ void sdbm_unlink(DBM *);
 int sdbm_rename(DBM *, const char *);
 int sdbm_rename_files(DBM *, const char *, const char *, const char *);
 int sdbm_rebuild(DBM *);
+long sdbm_store_bulk(DBM *, datum_pair *, size_t, int);
 
 /*
  * only defined if compiled with THREADS set in "tune.h".
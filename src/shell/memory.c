@@ -45,6 +45,7 @@
 #include "lib/glib-missing.h"
 #include "lib/halloc.h"
 #include "lib/log.h"
+#include "lib/memprof.h"
 #include "lib/misc.h"
 #include "lib/omalloc.h"
 #include "lib/palloc.h"
@@ -663,6 +664,67 @@ failed:
 	return REPLY_ERROR;
 }
 
+static enum shell_reply
+shell_exec_memory_profile(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+	if (0 == ascii_strcasecmp(argv[1], "on")) {
+		size_t rate = MEMPROF_RATE_DEFAULT;
+
+		if (argc > 2) {
+			const char *endptr;
+			int error;
+
+			rate = parse_size(argv[2], &endptr, 10, &error);
+			if (error || '\0' != *endptr || 0 == rate) {
+				shell_set_formatted(sh, "Cannot parse sampling rate \"%s\"",
+					argv[2]);
+				return REPLY_ERROR;
+			}
+		}
+
+		memprof_set_rate(rate);
+		shell_set_formatted(sh, "Sampling allocations every %zu bytes", rate);
+	} else if (0 == ascii_strcasecmp(argv[1], "off")) {
+		memprof_set_rate(0);
+		shell_set_msg(sh, "Allocation sampling stopped");
+	} else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+		memprof_reset();
+		shell_set_msg(sh, "Allocation profile cleared");
+	} else if (0 == ascii_strcasecmp(argv[1], "show")) {
+		logagent_t *la = log_agent_string_make(0, NULL);
+
+		shell_write(sh, "100~\n");
+		memprof_dump_log(la, DUMP_OPT_PRETTY);
+		shell_write(sh, log_agent_string_get(la));
+		shell_write(sh, ".\n");
+		log_agent_free_null(&la);
+	} else if (0 == ascii_strcasecmp(argv[1], "export")) {
+		if (argc < 3)
+			return REPLY_ERROR;
+
+		if (-1 == memprof_export(argv[2])) {
+			shell_set_formatted(sh, "Cannot export profile to \"%s\": %s",
+				argv[2], g_strerror(errno));
+			return REPLY_ERROR;
+		}
+
+		shell_set_formatted(sh, "Profile exported to \"%s\"", argv[2]);
+	} else {
+		shell_set_formatted(sh, "Unknown action \"%s\" on profile", argv[1]);
+		return REPLY_ERROR;
+	}
+
+	return REPLY_READY;
+}
+
 static enum shell_reply
 shell_exec_memory_usage(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -709,6 +771,7 @@ shell_exec_memory(struct gnutella_shell *sh, int argc, const char *argv[])
 	CMD(dump);
 #endif
 	CMD(check);
+	CMD(profile);
 	CMD(show);
 	CMD(stats);
 	CMD(usage);
@@ -744,6 +807,16 @@ shell_help_memory(int argc, const char *argv[])
 				"-s : silent mode, only display summary at the end\n"
 				"-v : verbosely report for each freelist\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "profile")) {
+			return "memory profile on [RATE]|off|reset|show|export FILE\n"
+				"sample allocations every RATE bytes on average "
+					"(default is 512 KiB)\n"
+				"on     : start sampling allocations per call site\n"
+				"off    : stop sampling, keep tracking live samples\n"
+				"reset  : discard the collected profile\n"
+				"show   : display call sites by decreasing live size\n"
+				"export : write profile to FILE in pprof heap format\n";
+		}
 		else if (0 == ascii_strcasecmp(argv[1], "show")) {
 			return
 				"memory show hole      # display VMM first known hole\n"
@@ -770,6 +843,7 @@ shell_help_memory(int argc, const char *argv[])
 		"memory dump ADDRESS LENGTH\n"
 #endif
 		"memory check xmalloc\n"
+		"memory profile on [RATE]|off|reset|show|export FILE\n"
 		"memory show hole|magazines|options|pmap|pools|xmalloc|zones\n"
 		"memory stats [-pu] omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
 		"memory usage zone <size> on|off|show\n"
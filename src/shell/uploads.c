@@ -35,11 +35,14 @@
 
 #include "cmd.h"
 
+#include "core/upload_map.h"
 #include "core/uploads.h"
 
 #include "if/gnet_property_priv.h"
 
+#include "lib/dump_options.h"
 #include "lib/iso3166.h"
+#include "lib/log.h"
 #include "lib/misc.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
@@ -77,22 +80,41 @@ print_upload_info(struct gnutella_shell *sh,
 enum shell_reply
 shell_exec_uploads(struct gnutella_shell *sh, int argc, const char *argv[])
 {
-	const pslist_t *sl;
-	pslist_t *sl_info;
+	const char *pretty, *stats;
+	const option_t options[] = {
+		{ "p", &pretty },		/* pretty-print */
+		{ "s", &stats },		/* mapping cache statistics */
+	};
+	int parsed;
 
 	shell_check(sh);
 	g_assert(argv);
 	g_assert(argc > 0);
 
+	parsed = shell_options_parse(sh, argv, options, G_N_ELEMENTS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
 	shell_set_msg(sh, "");
 
 	shell_write(sh, "100~ \n");
 
-	sl_info = upload_get_info_list();
-	PSLIST_FOREACH(sl_info, sl) {
-		print_upload_info(sh, sl->data);
+	if (stats != NULL) {
+		logagent_t *la = log_agent_string_make(0, NULL);
+
+		upload_map_dump_stats_log(la, NULL == pretty ? 0 : DUMP_OPT_PRETTY);
+		shell_write(sh, log_agent_string_get(la));
+		log_agent_free_null(&la);
+	} else {
+		const pslist_t *sl;
+		pslist_t *sl_info;
+
+		sl_info = upload_get_info_list();
+		PSLIST_FOREACH(sl_info, sl) {
+			print_upload_info(sh, sl->data);
+		}
+		upload_free_info_list(&sl_info);
 	}
-	upload_free_info_list(&sl_info);
 
 	shell_write(sh, ".\n");	/* Terminate message body */
 
@@ -110,8 +132,12 @@ shell_help_uploads(int argc, const char *argv[])
 {
 	g_assert(argv);
 	g_assert(argc > 0);
-	
-	return NULL;
+
+	return
+		"uploads [-ps]\n"
+		"show active uploads\n"
+		"-p: pretty-print numbers\n"
+		"-s: show statistics of the shared upload mapping cache\n";
 }
 
 /* vi: set ts=4 sw=4 cindent: */